@@ -0,0 +1,171 @@
+// Microbenchmarks for the record batch codec: CRC-32C throughput of each
+// implementation across buffer sizes, whole-batch validation, and record
+// decoding (the varint fast path against a byte-at-a-time loop).
+//
+// usage: crc32c_bench [seconds per case = 0.2]
+
+#include "Crc32c.h"
+#include "RecordBatch.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+double seconds_per_case = 0.2;
+
+// Runs body until the time budget is used up; returns calls per second.
+template <typename F> double measure(F &&body) {
+    using Clock = std::chrono::steady_clock;
+    uint64_t calls = 0;
+    auto start = Clock::now();
+    std::chrono::duration<double> elapsed{};
+    do {
+        for (int i = 0; i < 16; ++i) {
+            body();
+        }
+        calls += 16;
+        elapsed = Clock::now() - start;
+    } while (elapsed.count() < seconds_per_case);
+    return calls / elapsed.count();
+}
+
+// Keeps results alive so the work is not optimized away.
+volatile uint64_t sink;
+
+void benchChecksums() {
+    std::mt19937_64 rng(42);
+    std::vector<std::byte> buffer(1 << 20);
+    for (auto &byte : buffer) {
+        byte = static_cast<std::byte>(rng());
+    }
+
+    struct Implementation {
+        const char *name;
+        bool supported;
+        uint32_t (*extend)(uint32_t, std::span<const std::byte>);
+    };
+    const Implementation implementations[] = {
+        {"portable", true, crc32c::extendPortable},
+        {"sse4.2", crc32c::hasSse42(), crc32c::extendSse42},
+        {"pclmul", crc32c::hasPclmul(), crc32c::extendPclmul},
+    };
+
+    std::printf("CRC-32C (dispatch: %s), MiB/s\n", crc32c::implementation());
+    std::printf("%10s", "bytes");
+    for (const auto &impl : implementations) {
+        std::printf("%12s", impl.name);
+    }
+    std::printf("\n");
+
+    for (size_t size : {64, 256, 1024, 4096, 16384, 65536, 1 << 20}) {
+        std::span<const std::byte> data(buffer.data(), size);
+        std::printf("%10zu", size);
+        for (const auto &impl : implementations) {
+            if (!impl.supported) {
+                std::printf("%12s", "-");
+                continue;
+            }
+            double rate = measure([&] { sink = impl.extend(0, data); });
+            std::printf("%12.0f", rate * size / (1 << 20));
+        }
+        std::printf("\n");
+    }
+}
+
+std::string makeBatch(int records, size_t value_size) {
+    std::string value(value_size, 'v');
+    RecordBatchBuilder builder(1700000000000);
+    for (int i = 0; i < records; ++i) {
+        std::string key = "key-" + std::to_string(i);
+        builder.append(std::as_bytes(std::span(key)),
+                       std::as_bytes(std::span(value)), 1700000000000 + i);
+    }
+    return builder.build();
+}
+
+// What readUnsignedVarlong did before the fast path.
+uint64_t readVarlongBytewise(const std::byte *&p) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        uint8_t byte = static_cast<uint8_t>(*p++);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+    }
+    return value;
+}
+
+void benchBatches() {
+    std::printf("\nrecord batches (100-byte values)\n");
+    std::printf("%10s%12s%16s%16s\n", "records", "bytes", "validate MiB/s",
+                "decode rec/s");
+
+    for (int records : {1, 10, 100, 1000}) {
+        std::string batch = makeBatch(records, 100);
+        RecordBatchView view(std::as_bytes(std::span(batch)));
+
+        double validate = measure([&] { view.ensureValid(); });
+        double decode = measure([&] {
+            uint64_t total = 0;
+            view.forEachRecord(
+                [&](const Record &record) { total += record.offset_delta; });
+            sink = total;
+        });
+
+        std::printf("%10d%12zu%16.0f%16.0f\n", records, batch.size(),
+                    validate * batch.size() / (1 << 20), decode * records);
+    }
+}
+
+void benchVarints() {
+    // Mostly small values, as in record headers, with some timestamps.
+    std::mt19937_64 rng(7);
+    std::string encoded;
+    WireWriter writer(encoded);
+    const size_t count = 1 << 16;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t value = (i % 8 == 0) ? rng() >> 20 : rng() % 300;
+        writer.writeUnsignedVarlong(value);
+    }
+    auto bytes = std::as_bytes(std::span(encoded));
+
+    double bytewise = measure([&] {
+        const std::byte *p = bytes.data();
+        uint64_t total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            total += readVarlongBytewise(p);
+        }
+        sink = total;
+    });
+    double reader = measure([&] {
+        WireReader wire_reader(bytes);
+        uint64_t total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            total += wire_reader.readUnsignedVarlong();
+        }
+        sink = total;
+    });
+
+    std::printf("\nvarint decode, millions/s\n");
+    std::printf("  byte loop:   %8.1f\n", bytewise * count / 1e6);
+    std::printf("  WireReader:  %8.1f\n", reader * count / 1e6);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        seconds_per_case = std::atof(argv[1]);
+    }
+
+    benchChecksums();
+    benchBatches();
+    benchVarints();
+    return 0;
+}
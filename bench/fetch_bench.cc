@@ -0,0 +1,156 @@
+// Compares the two ways a fetch response can reach the socket: copying the
+// record data into the serialized response (what every response did before
+// Fetch existed) and queueing it as a FileRegion that goes out via sendfile().
+//
+// usage: fetch_bench [file MiB = 256] [fetch KiB = 1024] [rounds = 5]
+//
+// A consumer thread on the other end of a loopback connection drains
+// everything, so the numbers include the kernel's TCP path on both sides.
+
+#include "FileRegion.h"
+#include "TCPManager.h"
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+Fd createDataFile(uint64_t size) {
+    char path[] = "/tmp/fetch_bench.XXXXXX";
+    Fd fd(mkstemp(path));
+    if (fd < 0) {
+        perror("mkstemp failed: ");
+        exit(1);
+    }
+    unlink(path);
+
+    std::string block(1 << 20, 'r');
+    for (uint64_t written = 0; written < size; written += block.size()) {
+        if (write(fd, block.data(), block.size()) < 0) {
+            perror("write failed: ");
+            exit(1);
+        }
+    }
+    return fd;
+}
+
+// Returns {sender, receiver} ends of a loopback TCP connection.
+std::pair<Fd, Fd> connectLoopback() {
+    Fd listener(socket(AF_INET, SOCK_STREAM, 0));
+    struct sockaddr_in addr {
+        .sin_family = AF_INET, .sin_port = 0,
+    };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(listener, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        listen(listener, 1) != 0 ||
+        getsockname(listener, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+        perror("listen failed: ");
+        exit(1);
+    }
+
+    Fd sender(socket(AF_INET, SOCK_STREAM, 0));
+    if (connect(sender, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        perror("connect failed: ");
+        exit(1);
+    }
+    Fd receiver(accept(listener, nullptr, nullptr));
+    return {std::move(sender), std::move(receiver)};
+}
+
+// Frame header of a response carrying `size` record bytes; its content does
+// not matter to the consumer.
+std::string responseHeader(uint64_t size) {
+    std::string header(64, '\0');
+    wire::store(header.data(), static_cast<uint32_t>(header.size() - 4 + size));
+    return header;
+}
+
+double run(bool zero_copy, const Fd &file, uint64_t file_size,
+           uint64_t fetch_size, int rounds) {
+    auto [sender, receiver] = connectLoopback();
+
+    uint64_t responses = (file_size + fetch_size - 1) / fetch_size;
+    uint64_t expected =
+        rounds * (file_size + responses * responseHeader(0).size());
+
+    std::thread consumer([&receiver, expected] {
+        std::vector<char> buffer(1 << 20);
+        for (uint64_t received = 0; received < expected;) {
+            ssize_t n = recv(receiver, buffer.data(), buffer.size(), 0);
+            if (n <= 0) {
+                perror("recv failed: ");
+                exit(1);
+            }
+            received += n;
+        }
+    });
+
+    TCPManager tcp_manager;
+    BufferPool buffer_pool;
+    Connection connection(0, std::move(sender), buffer_pool);
+    auto shared_file = std::make_shared<const Fd>(dup(file));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; ++round) {
+        for (uint64_t position = 0; position < file_size;
+             position += fetch_size) {
+            uint64_t size = std::min(fetch_size, file_size - position);
+
+            if (zero_copy) {
+                std::vector<OutputChunk> chunks;
+                chunks.emplace_back(responseHeader(size));
+                chunks.emplace_back(FileRegion{shared_file, position, size});
+                tcp_manager.writeChunksOnClientFd(connection, std::move(chunks));
+            } else {
+                std::string frame = responseHeader(size);
+                size_t header_size = frame.size();
+                frame.resize(header_size + size);
+                if (pread(file, frame.data() + header_size, size, position) !=
+                    static_cast<ssize_t>(size)) {
+                    perror("pread failed: ");
+                    exit(1);
+                }
+                tcp_manager.writeFrameOnClientFd(connection, std::move(frame));
+            }
+            tcp_manager.flushClient(connection);
+        }
+    }
+    consumer.join();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+    return rounds * file_size / elapsed.count() / (1 << 20);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    uint64_t file_size = (argc > 1 ? std::atoll(argv[1]) : 256) << 20;
+    uint64_t fetch_size = (argc > 2 ? std::atoll(argv[2]) : 1024) << 10;
+    int rounds = argc > 3 ? std::atoi(argv[3]) : 5;
+
+    Fd file = createDataFile(file_size);
+
+    // Warm the page cache so both modes read from memory.
+    run(false, file, file_size, fetch_size, 1);
+    double copy = run(false, file, file_size, fetch_size, rounds);
+    double zero_copy = run(true, file, file_size, fetch_size, rounds);
+
+    std::printf("file %llu MiB, fetch %llu KiB, %d rounds\n",
+                static_cast<unsigned long long>(file_size >> 20),
+                static_cast<unsigned long long>(fetch_size >> 10), rounds);
+    std::printf("copy (pread + writev): %8.1f MiB/s\n", copy);
+    std::printf("zero-copy (sendfile):  %8.1f MiB/s\n", zero_copy);
+    std::printf("speedup:               %8.2fx\n", zero_copy / copy);
+    return 0;
+}
@@ -0,0 +1,648 @@
+// Load generator for a running broker: N connections, each keeping `depth`
+// requests in flight, drawn from a weighted mix of ApiVersions, Produce and
+// Fetch. Reports throughput and latency percentiles per API, latency being
+// the time from queueing a request to having read its whole response.
+//
+// usage: kafka-bench [--host 127.0.0.1] [--port 9092] [--connections 4]
+//                    [--threads min(connections, CPUs)] [--depth 1]
+//                    [--duration 10] [--mix apiversions=1,produce=0,fetch=0]
+//                    [--topic bench] [--partitions 1] [--acks 1]
+//                    [--record-size 100] [--batch-records 10]
+//                    [--fetch-bytes 1048576]
+//
+// Produce auto-creates the topic; run a produce mix first (or alongside)
+// for fetches to have something to read. Each connection fetches one
+// partition from the start, following the offsets it gets back.
+
+#include "Crc32c.h"
+#include "Metrics.h"
+#include "RecordBatch.h"
+#include "WireCodec.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+enum Api { API_VERSIONS, PRODUCE, FETCH, API_COUNT };
+
+constexpr const char *API_NAMES[API_COUNT] = {"ApiVersions", "Produce",
+                                              "Fetch"};
+constexpr int16_t API_KEYS[API_COUNT] = {18, 0, 1};
+constexpr int16_t API_VERSIONS_VERSION = 4;
+constexpr int16_t PRODUCE_VERSION = 9;
+constexpr int16_t FETCH_VERSION = 12;
+// Offset of the correlation id in a request frame, size prefix included.
+constexpr size_t CORRELATION_ID_OFFSET = 8;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    uint16_t port = 9092;
+    int connections = 4;
+    int threads = 0;
+    int depth = 1;
+    double duration = 10;
+    double mix[API_COUNT] = {1, 0, 0};
+    std::string topic = "bench";
+    int partitions = 1;
+    int16_t acks = 1;
+    size_t record_size = 100;
+    int batch_records = 10;
+    int32_t fetch_bytes = 1024 * 1024;
+};
+
+[[noreturn]] void usage(const char *message) {
+    std::fprintf(stderr, "kafka-bench: %s\n", message);
+    std::exit(2);
+}
+
+void parseMix(const std::string &value, Options &options) {
+    std::fill(std::begin(options.mix), std::end(options.mix), 0);
+    size_t begin = 0;
+    while (begin < value.size()) {
+        size_t end = value.find(',', begin);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        std::string item = value.substr(begin, end - begin);
+        size_t separator = item.find('=');
+        std::string name = item.substr(0, separator);
+        double weight =
+            separator == std::string::npos ? 1 : std::stod(item.substr(separator + 1));
+
+        if (name == "apiversions") {
+            options.mix[API_VERSIONS] = weight;
+        } else if (name == "produce") {
+            options.mix[PRODUCE] = weight;
+        } else if (name == "fetch") {
+            options.mix[FETCH] = weight;
+        } else {
+            usage(("unknown api in --mix: " + name).c_str());
+        }
+        begin = end + 1;
+    }
+}
+
+Options parseOptions(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i += 2) {
+        std::string flag = argv[i];
+        if (i + 1 >= argc) {
+            usage(("missing value for " + flag).c_str());
+        }
+        std::string value = argv[i + 1];
+
+        if (flag == "--host") {
+            options.host = value;
+        } else if (flag == "--port") {
+            options.port = static_cast<uint16_t>(std::stoi(value));
+        } else if (flag == "--connections") {
+            options.connections = std::stoi(value);
+        } else if (flag == "--threads") {
+            options.threads = std::stoi(value);
+        } else if (flag == "--depth") {
+            options.depth = std::stoi(value);
+        } else if (flag == "--duration") {
+            options.duration = std::stod(value);
+        } else if (flag == "--mix") {
+            parseMix(value, options);
+        } else if (flag == "--topic") {
+            options.topic = value;
+        } else if (flag == "--partitions") {
+            options.partitions = std::stoi(value);
+        } else if (flag == "--acks") {
+            options.acks = static_cast<int16_t>(std::stoi(value));
+        } else if (flag == "--record-size") {
+            options.record_size = std::stoul(value);
+        } else if (flag == "--batch-records") {
+            options.batch_records = std::stoi(value);
+        } else if (flag == "--fetch-bytes") {
+            options.fetch_bytes = std::stoi(value);
+        } else {
+            usage(("unknown option " + flag).c_str());
+        }
+    }
+
+    if (options.connections < 1 || options.depth < 1 ||
+        options.partitions < 1 || options.batch_records < 1) {
+        usage("--connections, --depth, --partitions and --batch-records "
+              "must be positive");
+    }
+    if (options.acks == 0 && options.mix[PRODUCE] > 0) {
+        // Nothing comes back, so there would be nothing to time.
+        usage("--acks 0 is not supported");
+    }
+    if (options.threads <= 0) {
+        options.threads = std::min<int>(
+            options.connections,
+            std::max(1u, std::thread::hardware_concurrency()));
+    }
+    return options;
+}
+
+void writeRequestHeader(WireWriter &writer, Api api, int16_t version) {
+    writer.writeInt16(API_KEYS[api]);
+    writer.writeInt16(version);
+    writer.writeInt32(0); // correlation id, patched per request
+    writer.writeString("kafka-bench");
+    writer.writeEmptyTaggedFields();
+}
+
+std::string apiVersionsRequest() {
+    std::string buffer;
+    WireWriter writer(buffer);
+    size_t frame = writer.beginFrame();
+    writeRequestHeader(writer, API_VERSIONS, API_VERSIONS_VERSION);
+    writer.writeCompactString("kafka-bench");
+    writer.writeCompactString("1.0");
+    writer.writeEmptyTaggedFields();
+    writer.endFrame(frame);
+    return buffer;
+}
+
+// A v2 record batch of `count` records with `size` value bytes each.
+std::string recordBatch(int count, size_t size) {
+    std::string records;
+    WireWriter record_writer(records);
+    std::string value(size, 'x');
+    for (int i = 0; i < count; ++i) {
+        std::string record;
+        WireWriter writer(record);
+        writer.writeInt8(0);    // attributes
+        writer.writeVarlong(0); // timestamp delta
+        writer.writeVarint(i);  // offset delta
+        writer.writeVarint(-1); // null key
+        writer.writeVarint(static_cast<int32_t>(value.size()));
+        writer.writeRaw(value);
+        writer.writeUnsignedVarint(0); // no headers
+        record_writer.writeVarint(static_cast<int32_t>(record.size()));
+        record_writer.writeRaw(record);
+    }
+
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::system_clock::now().time_since_epoch())
+                      .count();
+    std::string batch;
+    WireWriter writer(batch);
+    writer.writeInt64(0); // base offset, assigned by the broker
+    writer.writeInt32(static_cast<int32_t>(
+        RecordBatchView::HEADER_SIZE - RecordBatchView::LOG_OVERHEAD +
+        records.size()));
+    writer.writeInt32(-1); // partition leader epoch
+    writer.writeInt8(RecordBatchView::CURRENT_MAGIC);
+    writer.writeUint32(0); // crc, filled in below
+    writer.writeInt16(0);  // attributes
+    writer.writeInt32(count - 1);
+    writer.writeInt64(now);
+    writer.writeInt64(now);
+    writer.writeInt64(-1); // producer id
+    writer.writeInt16(-1); // producer epoch
+    writer.writeInt32(-1); // base sequence
+    writer.writeInt32(count);
+    writer.writeRaw(records);
+
+    auto bytes = std::as_writable_bytes(std::span(batch));
+    wire::store(bytes.data() + RecordBatchView::CRC_OFFSET,
+                crc32c::value(bytes.subspan(RecordBatchView::ATTRIBUTES_OFFSET)));
+    return batch;
+}
+
+std::string produceRequest(const Options &options, int32_t partition,
+                           const std::string &batch) {
+    std::string buffer;
+    WireWriter writer(buffer);
+    size_t frame = writer.beginFrame();
+    writeRequestHeader(writer, PRODUCE, PRODUCE_VERSION);
+    writer.writeCompactNullableString(std::nullopt); // transactional id
+    writer.writeInt16(options.acks);
+    writer.writeInt32(30000); // timeout
+    writer.writeCompactArrayLength(1);
+    writer.writeCompactString(options.topic);
+    writer.writeCompactArrayLength(1);
+    writer.writeInt32(partition);
+    writer.writeUnsignedVarint(static_cast<uint32_t>(batch.size()) + 1);
+    writer.writeRaw(batch);
+    writer.writeEmptyTaggedFields();
+    writer.writeEmptyTaggedFields();
+    writer.writeEmptyTaggedFields();
+    writer.endFrame(frame);
+    return buffer;
+}
+
+std::string fetchRequest(const Options &options, int32_t partition,
+                         int64_t offset) {
+    std::string buffer;
+    WireWriter writer(buffer);
+    size_t frame = writer.beginFrame();
+    writeRequestHeader(writer, FETCH, FETCH_VERSION);
+    writer.writeInt32(-1); // replica id
+    writer.writeInt32(0);  // max wait: answer right away
+    writer.writeInt32(1);  // min bytes
+    writer.writeInt32(options.fetch_bytes);
+    writer.writeInt8(0);   // isolation level
+    writer.writeInt32(0);  // session id
+    writer.writeInt32(-1); // session epoch
+    writer.writeCompactArrayLength(1);
+    writer.writeCompactString(options.topic);
+    writer.writeCompactArrayLength(1);
+    writer.writeInt32(partition);
+    writer.writeInt32(-1); // current leader epoch
+    writer.writeInt64(offset);
+    writer.writeInt32(-1); // last fetched epoch
+    writer.writeInt64(-1); // log start offset
+    writer.writeInt32(options.fetch_bytes);
+    writer.writeEmptyTaggedFields();
+    writer.writeEmptyTaggedFields();
+    writer.writeCompactArrayLength(0); // forgotten topics
+    writer.writeCompactString("");     // rack id
+    writer.writeEmptyTaggedFields();
+    writer.endFrame(frame);
+    return buffer;
+}
+
+// Per API, merged across threads at the end.
+struct ApiStats {
+    LatencyHistogram latency;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    uint64_t bytes_out = 0;
+    uint64_t bytes_in = 0;
+};
+
+struct InFlight {
+    Api api;
+    size_t size;
+    int64_t queued_ns;
+};
+
+struct BenchConnection {
+    int fd = -1;
+    int32_t partition = 0;
+    int64_t fetch_offset = 0;
+    std::mt19937_64 rng;
+    std::string output;
+    size_t output_offset = 0;
+    std::vector<char> input;
+    std::deque<InFlight> in_flight;
+};
+
+int connectTo(const Options &options) {
+    struct addrinfo hints {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *address = nullptr;
+    std::string port = std::to_string(options.port);
+    if (getaddrinfo(options.host.c_str(), port.c_str(), &hints, &address) !=
+        0) {
+        usage(("cannot resolve " + options.host).c_str());
+    }
+
+    int fd = socket(address->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+        std::perror("connect failed");
+        std::exit(1);
+    }
+    freeaddrinfo(address);
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int flags = fcntl(fd, F_GETFL);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    return fd;
+}
+
+class Worker {
+  public:
+    Worker(const Options &_options, std::vector<int32_t> partitions,
+           uint64_t seed)
+        : options(_options) {
+        double total = 0;
+        for (int api = 0; api < API_COUNT; ++api) {
+            total += options.mix[api];
+            cumulative_mix[api] = total;
+        }
+
+        batch = recordBatch(options.batch_records, options.record_size);
+        api_versions_request = apiVersionsRequest();
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        for (size_t i = 0; i < partitions.size(); ++i) {
+            auto connection = std::make_unique<BenchConnection>();
+            connection->fd = connectTo(options);
+            connection->partition = partitions[i];
+            connection->rng.seed(seed + i);
+
+            struct epoll_event event {};
+            event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            event.data.ptr = connection.get();
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection->fd, &event);
+            connections.push_back(std::move(connection));
+        }
+    }
+
+    ~Worker() {
+        for (const auto &connection : connections) {
+            close(connection->fd);
+        }
+        close(epoll_fd);
+    }
+
+    void run(int64_t start_ns, int64_t end_ns) {
+        deadline_ns = end_ns;
+        for (const auto &connection : connections) {
+            for (int i = 0; i < options.depth; ++i) {
+                issue(*connection, start_ns);
+            }
+            flush(*connection);
+        }
+
+        struct epoll_event events[64];
+        while (monotonicNanos() < deadline_ns) {
+            int ready = epoll_wait(epoll_fd, events, 64, 10);
+            for (int i = 0; i < ready; ++i) {
+                auto &connection =
+                    *static_cast<BenchConnection *>(events[i].data.ptr);
+                if (events[i].events & EPOLLIN) {
+                    receive(connection);
+                }
+                flush(connection);
+            }
+        }
+    }
+
+    ApiStats stats[API_COUNT];
+
+  private:
+    Api pickApi(BenchConnection &connection) {
+        double total = cumulative_mix[API_COUNT - 1];
+        double point = std::uniform_real_distribution<double>(0, total)(
+            connection.rng);
+        for (int api = 0; api < API_COUNT; ++api) {
+            if (point < cumulative_mix[api]) {
+                return static_cast<Api>(api);
+            }
+        }
+        return static_cast<Api>(API_COUNT - 1);
+    }
+
+    void issue(BenchConnection &connection, int64_t now) {
+        Api api = pickApi(connection);
+        std::string request;
+        switch (api) {
+        case API_VERSIONS:
+            request = api_versions_request;
+            break;
+        case PRODUCE:
+            request = produceRequest(options, connection.partition, batch);
+            break;
+        case FETCH:
+            request = fetchRequest(options, connection.partition,
+                                   connection.fetch_offset);
+            break;
+        default:
+            return;
+        }
+        wire::store(request.data() + CORRELATION_ID_OFFSET,
+                    next_correlation_id++);
+
+        connection.output += request;
+        connection.in_flight.push_back({api, request.size(), now});
+    }
+
+    void flush(BenchConnection &connection) {
+        while (connection.output_offset < connection.output.size()) {
+            ssize_t sent = send(connection.fd,
+                                connection.output.data() + connection.output_offset,
+                                connection.output.size() - connection.output_offset,
+                                MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EAGAIN || errno == EINTR) {
+                    return;
+                }
+                std::perror("send failed");
+                std::exit(1);
+            }
+            connection.output_offset += sent;
+        }
+        connection.output.clear();
+        connection.output_offset = 0;
+    }
+
+    void receive(BenchConnection &connection) {
+        char buffer[64 * 1024];
+        while (true) {
+            ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+            if (received < 0) {
+                if (errno == EAGAIN || errno == EINTR) {
+                    break;
+                }
+                std::perror("recv failed");
+                std::exit(1);
+            }
+            if (received == 0) {
+                std::fprintf(stderr, "kafka-bench: broker closed a connection\n");
+                std::exit(1);
+            }
+            connection.input.insert(connection.input.end(), buffer,
+                                    buffer + received);
+        }
+
+        size_t consumed = 0;
+        while (connection.input.size() - consumed >= sizeof(uint32_t)) {
+            uint32_t size =
+                wire::load<uint32_t>(
+                reinterpret_cast<const std::byte *>(connection.input.data()) +
+                consumed);
+            if (connection.input.size() - consumed < sizeof(uint32_t) + size) {
+                break;
+            }
+            onResponse(connection,
+                       {connection.input.data() + consumed + sizeof(uint32_t),
+                        size});
+            consumed += sizeof(uint32_t) + size;
+        }
+        connection.input.erase(connection.input.begin(),
+                               connection.input.begin() + consumed);
+    }
+
+    void onResponse(BenchConnection &connection, std::span<const char> frame) {
+        int64_t now = monotonicNanos();
+        InFlight request = connection.in_flight.front();
+        connection.in_flight.pop_front();
+
+        // Requests still in flight at the deadline are not counted.
+        if (now >= deadline_ns) {
+            return;
+        }
+
+        ApiStats &api = stats[request.api];
+        api.requests += 1;
+        api.bytes_out += request.size;
+        api.bytes_in += frame.size() + sizeof(uint32_t);
+        api.latency.record((now - request.queued_ns) / 1000);
+        try {
+            if (!checkResponse(connection, request.api, frame)) {
+                api.errors += 1;
+            }
+        } catch (const WireError &) {
+            api.errors += 1;
+        }
+
+        issue(connection, now);
+    }
+
+    // Returns false if the response carries an error code.
+    static bool checkResponse(BenchConnection &connection, Api api,
+                              std::span<const char> frame) {
+        WireReader reader(frame.data(), frame.size());
+        reader.readInt32(); // correlation id
+
+        if (api == API_VERSIONS) {
+            // Always a v0 response header.
+            return reader.readInt16() == 0;
+        }
+        reader.skipTaggedFields();
+
+        if (api == PRODUCE) {
+            reader.readCompactArrayLength();
+            reader.readCompactString();
+            reader.readCompactArrayLength();
+            reader.readInt32(); // partition
+            return reader.readInt16() == 0;
+        }
+
+        reader.readInt32(); // throttle time
+        if (reader.readInt16() != 0) {
+            return false;
+        }
+        reader.readInt32(); // session id
+        reader.readCompactArrayLength();
+        reader.readCompactString();
+        reader.readCompactArrayLength();
+        reader.readInt32(); // partition
+        int16_t error = reader.readInt16();
+        if (error == 1) {
+            // OFFSET_OUT_OF_RANGE: the log was truncated or recreated.
+            connection.fetch_offset = 0;
+        }
+        reader.readInt64(); // high watermark
+        reader.readInt64(); // last stable offset
+        reader.readInt64(); // log start offset
+        reader.readCompactArrayLength(); // aborted transactions
+        reader.readInt32(); // preferred read replica
+
+        // Continue after the last batch that came back.
+        NullableBytes records = reader.readCompactNullableBytes();
+        std::span<const std::byte> rest = records.value_or(
+            std::span<const std::byte>{});
+        while (rest.size() >= RecordBatchView::HEADER_SIZE) {
+            RecordBatchView batch(rest);
+            if (batch.batchLength() <= 0 || batch.sizeInBytes() > rest.size()) {
+                break;
+            }
+            connection.fetch_offset = batch.lastOffset() + 1;
+            rest = rest.subspan(batch.sizeInBytes());
+        }
+        return error == 0;
+    }
+
+    const Options &options;
+    double cumulative_mix[API_COUNT];
+    std::string batch;
+    std::string api_versions_request;
+    int epoll_fd;
+    std::vector<std::unique_ptr<BenchConnection>> connections;
+    int64_t deadline_ns = 0;
+    int32_t next_correlation_id = 0;
+};
+
+void report(const Options &options, const ApiStats (&totals)[API_COUNT],
+            const LatencyHistogram::Snapshot (&latencies)[API_COUNT]) {
+    std::printf("%d connections on %d threads, depth %d, %.1f s\n",
+                options.connections, options.threads, options.depth,
+                options.duration);
+    std::printf("%-12s %10s %10s %8s %9s %9s %9s %9s %9s\n", "api",
+                "requests", "req/s", "errors", "MiB/s out", "MiB/s in",
+                "p50 us", "p99 us", "p999 us");
+
+    for (int api = 0; api < API_COUNT; ++api) {
+        const ApiStats &stats = totals[api];
+        if (stats.requests == 0) {
+            continue;
+        }
+        const auto &latency = latencies[api];
+        std::printf("%-12s %10llu %10.0f %8llu %9.1f %9.1f %9llu %9llu %9llu\n",
+                    API_NAMES[api],
+                    static_cast<unsigned long long>(stats.requests),
+                    stats.requests / options.duration,
+                    static_cast<unsigned long long>(stats.errors),
+                    stats.bytes_out / options.duration / (1 << 20),
+                    stats.bytes_in / options.duration / (1 << 20),
+                    static_cast<unsigned long long>(latency.quantileMicros(0.5)),
+                    static_cast<unsigned long long>(latency.quantileMicros(0.99)),
+                    static_cast<unsigned long long>(
+                        latency.quantileMicros(0.999)));
+    }
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options = parseOptions(argc, argv);
+
+    // Connections are dealt round-robin to the threads, partitions
+    // round-robin to the connections.
+    std::vector<std::vector<int32_t>> partitions(options.threads);
+    for (int i = 0; i < options.connections; ++i) {
+        partitions[i % options.threads].push_back(i % options.partitions);
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    for (int i = 0; i < options.threads; ++i) {
+        workers.push_back(std::make_unique<Worker>(
+            options, std::move(partitions[i]), 1000 * i));
+    }
+
+    int64_t start = monotonicNanos();
+    int64_t end = start + static_cast<int64_t>(options.duration * 1e9);
+    std::vector<std::thread> threads;
+    for (const auto &worker : workers) {
+        threads.emplace_back([&worker, start, end] { worker->run(start, end); });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    ApiStats totals[API_COUNT];
+    LatencyHistogram::Snapshot latencies[API_COUNT];
+    for (const auto &worker : workers) {
+        for (int api = 0; api < API_COUNT; ++api) {
+            const ApiStats &stats = worker->stats[api];
+            totals[api].requests += stats.requests;
+            totals[api].errors += stats.errors;
+            totals[api].bytes_out += stats.bytes_out;
+            totals[api].bytes_in += stats.bytes_in;
+            latencies[api].add(stats.latency);
+        }
+    }
+    report(options, totals, latencies);
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Microbenchmarks for the request path that needs no disk or network:
+// request header decoding, ApiVersions response serialization, the
+// API_REGISTRY lookup, and a whole ApiVersions request through
+// KafkaApis::classifyRequest() into a connection's output queue, then over
+// a socket pair from read to write. That the round trip makes no heap
+// allocations is checked by tests/api_versions_alloc_test.cc.
+//
+// usage: kafka-microbench [seconds per case = 0.2]
+
+#include "KafkaApis.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+
+namespace {
+
+double seconds_per_case = 0.2;
+
+// Runs body until the time budget is used up; returns calls per second.
+template <typename F> double measure(F &&body) {
+    using Clock = std::chrono::steady_clock;
+    uint64_t calls = 0;
+    auto start = Clock::now();
+    std::chrono::duration<double> elapsed{};
+    do {
+        for (int i = 0; i < 16; ++i) {
+            body();
+        }
+        calls += 16;
+        elapsed = Clock::now() - start;
+    } while (elapsed.count() < seconds_per_case);
+    return calls / elapsed.count();
+}
+
+// Keeps results alive so the work is not optimized away.
+volatile uint64_t sink;
+
+void report(const char *name, double calls_per_second) {
+    std::printf("%-36s %10.1f ns %12.0f /s\n", name, 1e9 / calls_per_second,
+                calls_per_second);
+}
+
+// An ApiVersions v4 request frame, size prefix excluded.
+std::string apiVersionsFrame() {
+    std::string buffer;
+    WireWriter writer(buffer);
+    writer.writeInt16(KafkaApis::API_VERSIONS_REQUEST);
+    writer.writeInt16(4);
+    writer.writeInt32(7);
+    writer.writeString("kafka-microbench");
+    writer.writeEmptyTaggedFields();
+    writer.writeCompactString("kafka-microbench");
+    writer.writeCompactString("1.0");
+    writer.writeEmptyTaggedFields();
+    return buffer;
+}
+
+void benchDecode(std::span<const std::byte> frame) {
+    report("RequestHeader::fromBuffer", measure([&] {
+               sink = RequestHeader::fromBuffer(frame).corellation_id;
+           }));
+    report("ApiVersionsRequestMessage::fromBuffer", measure([&] {
+               sink = ApiVersionsRequestMessage::fromBuffer(frame)
+                          .client_software_name.size();
+           }));
+}
+
+void benchEncode() {
+    ApiVersionsResponseMessage response;
+    for (const auto &api : API_REGISTRY) {
+        response.api_keys.push_back(
+            {api.api_key, api.min_version, api.max_version});
+    }
+    response.version = 4;
+
+    report("ApiVersionsResponseMessage::toBuffer",
+           measure([&] { sink = response.toBuffer().size(); }));
+    report("ApiVersionsResponseCache::response", measure([&] {
+               sink = ApiVersionsResponseCache::instance()
+                          .response(4, 7)
+                          .size();
+           }));
+}
+
+// Sends the request and reads the response over a socket pair, one at a
+// time, as a client waiting for each response would.
+struct RoundTrip {
+    TCPManager &tcp_manager;
+    KafkaApis &kafka_apis;
+    Connection &connection;
+    const Fd &client;
+    std::string request;
+    char response[64 * 1024];
+
+    void operator()() {
+        if (send(client, request.data(), request.size(), 0) !=
+            static_cast<ssize_t>(request.size())) {
+            std::perror("send failed");
+            std::exit(1);
+        }
+        tcp_manager.readBufferFromClientFd(connection, kafka_apis);
+        tcp_manager.flushClient(connection);
+        sink = recv(client, response, sizeof(response), 0);
+    }
+};
+
+void benchDispatch(std::span<const std::byte> frame) {
+    int16_t key = 0;
+    report("findApi", measure([&] {
+               sink = reinterpret_cast<uintptr_t>(findApi(key));
+               key = (key + 1) & MAX_API_KEY;
+           }));
+
+    // A broker with no reactors and an empty log dir: enough for requests
+    // that touch neither.
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+                                ("kafka-microbench." + std::to_string(getpid()));
+    BrokerConfig config;
+    config.log_dirs = {dir.string()};
+    config.io_threads = 0;
+    TCPManager tcp_manager;
+    LogManager log_manager(config);
+    LogFlusher log_flusher(config.flush);
+    MetadataCache metadata_cache;
+    OffsetManager offset_manager(config.offsets, log_manager);
+    KafkaApis kafka_apis(config, tcp_manager, log_manager, log_flusher,
+                         metadata_cache, offset_manager);
+    BufferPool buffer_pool;
+    Connection connection(0, Fd(), buffer_pool);
+
+    report("classifyRequest (ApiVersions)", measure([&] {
+               kafka_apis.classifyRequest(connection, frame);
+               sink = connection.output_queue.size();
+               connection.output_queue.clear();
+               connection.pending_sends.clear();
+               connection.arena.reset();
+           }));
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) != 0) {
+        std::perror("socketpair failed");
+        std::exit(1);
+    }
+    Fd client(fds[1]);
+    Connection server(1, Fd(fds[0]), buffer_pool);
+
+    RoundTrip round_trip{tcp_manager, kafka_apis, server, client, {}, {}};
+    round_trip.request.resize(sizeof(uint32_t));
+    wire::store(round_trip.request.data(), static_cast<uint32_t>(frame.size()));
+    round_trip.request.append(reinterpret_cast<const char *>(frame.data()),
+                              frame.size());
+
+    report("ApiVersions round trip", measure(round_trip));
+
+    std::filesystem::remove_all(dir);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        seconds_per_case = std::atof(argv[1]);
+    }
+
+    std::string frame = apiVersionsFrame();
+    auto bytes = std::as_bytes(std::span(frame));
+
+    benchDecode(bytes);
+    benchEncode();
+    benchDispatch(bytes);
+    return 0;
+}
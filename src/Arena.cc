@@ -0,0 +1,41 @@
+#include "Arena.h"
+
+#include <new>
+
+std::span<std::byte> Arena::allocate(size_t size) {
+    if (static_cast<size_t>(limit - cursor) >= size) {
+        std::byte *bytes = cursor;
+        cursor += size;
+        return {bytes, size};
+    }
+
+    if (size > BufferPool::SLAB_SIZE - sizeof(Block)) {
+        auto *block = static_cast<Block *>(::operator new(sizeof(Block) + size));
+        block->next = large_blocks;
+        large_blocks = block;
+        return {reinterpret_cast<std::byte *>(block + 1), size};
+    }
+
+    // Whatever is left of the current slab is abandoned until reset().
+    std::byte *slab = pool.acquire();
+    auto *block = reinterpret_cast<Block *>(slab);
+    block->next = slabs;
+    slabs = block;
+    cursor = slab + sizeof(Block) + size;
+    limit = slab + BufferPool::SLAB_SIZE;
+    return {slab + sizeof(Block), size};
+}
+
+void Arena::reset() {
+    while (slabs != nullptr) {
+        Block *next = slabs->next;
+        pool.release(reinterpret_cast<std::byte *>(slabs));
+        slabs = next;
+    }
+    while (large_blocks != nullptr) {
+        Block *next = large_blocks->next;
+        ::operator delete(large_blocks);
+        large_blocks = next;
+    }
+    cursor = limit = nullptr;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "BufferPool.h"
+
+#include <cstddef>
+#include <span>
+
+// Per-connection bump allocator for serialized responses. Allocation moves
+// a cursor through slabs taken from the reactor's BufferPool; nothing is
+// freed individually, reset() hands everything back at once when the last
+// queued response has been written. Holds bytes only, so there is no
+// alignment to keep. Frames larger than a slab get a heap block of their
+// own, freed on reset() as well.
+class Arena {
+  public:
+    explicit Arena(BufferPool &_pool) : pool(_pool) {}
+    ~Arena() { reset(); }
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    std::span<std::byte> allocate(size_t size);
+    void reset();
+
+  private:
+    // Links the slabs and large blocks in use, stored at their start.
+    struct Block {
+        Block *next;
+    };
+
+    BufferPool &pool;
+    Block *slabs = nullptr;
+    Block *large_blocks = nullptr;
+    std::byte *cursor = nullptr;
+    std::byte *limit = nullptr;
+};
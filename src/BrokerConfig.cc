@@ -0,0 +1,222 @@
+#include "BrokerConfig.h"
+
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+std::string trim(const std::string &value) {
+    size_t begin = value.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = value.find_last_not_of(" \t\r");
+    return value.substr(begin, end - begin + 1);
+}
+
+std::vector<std::string> splitList(const std::string &value) {
+    std::vector<std::string> items;
+    size_t begin = 0;
+    while (begin <= value.size()) {
+        size_t end = value.find(',', begin);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        std::string item = trim(value.substr(begin, end - begin));
+        if (!item.empty()) {
+            items.push_back(std::move(item));
+        }
+        begin = end + 1;
+    }
+    return items;
+}
+
+bool parseBool(const std::string &value) {
+    if (value == "true") {
+        return true;
+    }
+    if (value == "false") {
+        return false;
+    }
+    throw std::invalid_argument(value);
+}
+
+// PLAINTEXT://host:port, host:port or [v6 address]:port.
+void parseListener(const std::string &value, SocketServerConfig &config) {
+    std::string address = value;
+    size_t scheme = address.find("://");
+    if (scheme != std::string::npos) {
+        if (address.substr(0, scheme) != "PLAINTEXT") {
+            throw std::invalid_argument(value);
+        }
+        address = address.substr(scheme + 3);
+    }
+
+    size_t separator = address.rfind(':');
+    // One listener only; there is a single security protocol to serve.
+    if (separator == std::string::npos ||
+        address.find(',') != std::string::npos) {
+        throw std::invalid_argument(value);
+    }
+
+    std::string host = address.substr(0, separator);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+    int port = std::stoi(address.substr(separator + 1));
+    if (port < 1 || port > UINT16_MAX) {
+        throw std::invalid_argument(value);
+    }
+
+    config.host = host;
+    config.port = static_cast<uint16_t>(port);
+}
+
+} // namespace
+
+BrokerConfig BrokerConfig::fromArgs(int argc, char *argv[]) {
+    if (argc < 2) {
+        return BrokerConfig{};
+    }
+    return fromFile(argv[1]);
+}
+
+BrokerConfig BrokerConfig::fromFile(const std::string &path) {
+    std::ifstream input(path);
+    if (!input) {
+        throw std::runtime_error("Failed to open config file " + path);
+    }
+
+    BrokerConfig config;
+    std::string line;
+    while (std::getline(input, line)) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#' || line[0] == '!') {
+            continue;
+        }
+
+        size_t separator = line.find_first_of("=:");
+        if (separator == std::string::npos) {
+            continue;
+        }
+
+        config.set(trim(line.substr(0, separator)),
+                   trim(line.substr(separator + 1)));
+    }
+
+    return config;
+}
+
+LogConfig BrokerConfig::logConfig(std::string_view topic) const {
+    LogConfig result = log;
+    if (topic == OffsetsConfig::TOPIC) {
+        result.segment_bytes = offsets.segment_bytes;
+    }
+    return result;
+}
+
+void BrokerConfig::set(const std::string &key, const std::string &value) {
+    try {
+        if (key == "log.dirs" || key == "log.dir") {
+            log_dirs = splitList(value);
+            if (log_dirs.empty()) {
+                throw std::invalid_argument("empty list");
+            }
+        } else if (key == "auto.create.topics.enable") {
+            auto_create_topics = parseBool(value);
+        } else if (key == "max.request.partition.size.limit") {
+            max_request_partition_size_limit = std::stoi(value);
+            if (max_request_partition_size_limit < 1) {
+                throw std::invalid_argument(value);
+            }
+        } else if (key == "listeners") {
+            parseListener(value, socket_server);
+        } else if (key == "socket.listen.backlog.size") {
+            socket_server.listen_backlog = std::stoi(value);
+            if (socket_server.listen_backlog < 1) {
+                throw std::invalid_argument(value);
+            }
+        } else if (key == "num.io.threads") {
+            io_threads = std::stoul(value);
+        } else if (key == "num.recovery.threads.per.data.dir") {
+            recovery_threads_per_data_dir = std::stoul(value);
+        } else if (key == "num.network.threads") {
+            socket_server.network_threads = std::stoul(value);
+        } else if (key == "network.threads.pin.cpus") {
+            socket_server.pin_network_threads = parseBool(value);
+        } else if (key == "max.connections") {
+            socket_server.max_connections = std::stoul(value);
+        } else if (key == "queued.max.request.bytes") {
+            socket_server.queued_max_request_bytes = std::stoull(value);
+        } else if (key == "quota.producer.default") {
+            quota.producer_byte_rate = std::stoull(value);
+        } else if (key == "quota.consumer.default") {
+            quota.consumer_byte_rate = std::stoull(value);
+        } else if (key == "quota.request.default") {
+            quota.request_rate = std::stoull(value);
+        } else if (key == "quota.burst.ms") {
+            quota.burst_ms = std::stoull(value);
+        } else if (key == "logger.level") {
+            logger.level = Logger::parseLevel(value);
+        } else if (key == "logger.file") {
+            logger.file = value;
+        } else if (key == "metrics.host") {
+            metrics.host = value;
+        } else if (key == "metrics.port") {
+            int port = std::stoi(value);
+            if (port < 0 || port > UINT16_MAX) {
+                throw std::invalid_argument(value);
+            }
+            metrics.port = static_cast<uint16_t>(port);
+        } else if (key == "log.segment.bytes") {
+            log.segment_bytes = std::stoull(value);
+        } else if (key == "log.index.interval.bytes") {
+            log.index_interval_bytes = std::stoul(value);
+        } else if (key == "log.index.size.max.bytes") {
+            log.max_index_size = std::stoul(value);
+        } else if (key == "log.tail.cache.max.bytes") {
+            tail_cache.max_bytes = std::stoull(value);
+        } else if (key == "log.tail.cache.partition.max.bytes") {
+            tail_cache.partition_max_bytes = std::stoull(value);
+        } else if (key == "offsets.topic.segment.bytes") {
+            offsets.segment_bytes = std::stoull(value);
+            if (offsets.segment_bytes == 0) {
+                throw std::invalid_argument(value);
+            }
+        } else if (key == "offset.metadata.max.bytes") {
+            // Stored with an int16 length in the offsets log.
+            unsigned long size = std::stoul(value);
+            if (size > INT16_MAX) {
+                throw std::invalid_argument(value);
+            }
+            offsets.max_metadata_size = static_cast<uint32_t>(size);
+        } else if (key == "log.cleaner.backoff.ms") {
+            offsets.cleaner_backoff_ms = std::stoul(value);
+        } else if (key == "log.flush.interval.ms") {
+            flush.interval_ms = std::stoul(value);
+        } else if (key == "log.flush.interval.bytes") {
+            flush.interval_bytes = std::stoull(value);
+        } else if (key == "io.backend") {
+            if (value == "epoll") {
+                socket_server.io_backend = IoBackend::EPOLL;
+            } else if (value == "io_uring") {
+                socket_server.io_backend = IoBackend::IO_URING;
+            } else {
+                throw std::invalid_argument(value);
+            }
+            flush.io_backend = socket_server.io_backend;
+        } else if (key == "log.flush.acks") {
+            if (value == "none") {
+                flush.ack_policy = FlushConfig::AckPolicy::NONE;
+            } else if (value == "all") {
+                flush.ack_policy = FlushConfig::AckPolicy::ALL;
+            } else if (value == "any") {
+                flush.ack_policy = FlushConfig::AckPolicy::ANY;
+            } else {
+                throw std::invalid_argument(value);
+            }
+        }
+    } catch (const std::exception &e) {
+        throw std::runtime_error("Invalid value for " + key + ": " + value);
+    }
+}
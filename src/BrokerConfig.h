@@ -0,0 +1,177 @@
+#pragma once
+
+#include "Logger.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// How the broker talks to the kernel (io.backend): epoll readiness plus
+// one system call per read, write and sync, or io_uring, which batches them
+// all into one io_uring_enter() per event loop turn. io_uring falls back to
+// epoll on kernels that lack what it needs.
+enum class IoBackend { EPOLL, IO_URING };
+
+// Per-log settings, named after their Kafka server.properties keys.
+struct LogConfig {
+    // log.segment.bytes: roll to a new segment once the active one is full.
+    uint64_t segment_bytes = 1024 * 1024 * 1024;
+    // log.index.interval.bytes: bytes of log between two offset index entries.
+    uint32_t index_interval_bytes = 4096;
+    // log.index.size.max.bytes: size the index of the active segment may grow to.
+    uint32_t max_index_size = 10 * 1024 * 1024;
+};
+
+// Group commit settings of the LogFlusher.
+struct FlushConfig {
+    // Which produce acks wait for their data to be fsynced before the
+    // response goes out. Kafka itself never waits (durability comes from
+    // replication); "all" makes acks=-1 mean "on disk" on a single broker.
+    enum class AckPolicy { NONE, ALL, ANY };
+
+    // log.flush.interval.ms: how long appended data may stay unsynced. This
+    // is also the group-commit window: every append and every waiting
+    // producer that arrives within it shares one fdatasync per partition.
+    uint32_t interval_ms = 5;
+    // log.flush.interval.bytes: sync before the window ends once this many
+    // bytes are waiting.
+    uint64_t interval_bytes = 1024 * 1024;
+    // log.flush.acks: none | all (acks=-1) | any (acks=1 and acks=-1)
+    AckPolicy ack_policy = AckPolicy::ALL;
+    // io.backend: with io_uring, the syncs of all dirty segments go to the
+    // kernel together instead of one fdatasync after the other.
+    IoBackend io_backend = IoBackend::EPOLL;
+
+    bool waitsFor(int16_t acks) const {
+        switch (ack_policy) {
+        case AckPolicy::NONE:
+            return false;
+        case AckPolicy::ALL:
+            return acks == -1;
+        case AckPolicy::ANY:
+            return acks != 0;
+        }
+        return false;
+    }
+};
+
+// Listener and network thread settings of the socket server.
+struct SocketServerConfig {
+    // listeners=PLAINTEXT://[host]:port. An empty host binds every IPv4
+    // interface.
+    std::string host;
+    uint16_t port = 9092;
+    // socket.listen.backlog.size: pending connections per listener; the
+    // kernel caps it at net.core.somaxconn.
+    int listen_backlog = 1024;
+    // num.network.threads: reactor threads, each with an SO_REUSEPORT
+    // listener of its own. 0 means one per CPU the broker may run on.
+    uint32_t network_threads = 0;
+    // network.threads.pin.cpus: pin reactor i to the i-th of those CPUs.
+    bool pin_network_threads = false;
+    // max.connections: client connections open at once across all reactors;
+    // beyond that new ones are closed as soon as they are accepted. 0 means
+    // no limit.
+    uint32_t max_connections = 0;
+    // queued.max.request.bytes: request bytes read but not answered yet,
+    // across all connections. Once they reach it no connection reads until
+    // some are answered. 0 means no limit.
+    uint64_t queued_max_request_bytes = 512 * 1024 * 1024;
+    // io.backend: what the reactors run on.
+    IoBackend io_backend = IoBackend::EPOLL;
+};
+
+// Per-client_id quotas, see QuotaManager. Every client id gets its own
+// buckets at these rates; 0 leaves a quota off.
+struct QuotaConfig {
+    // quota.producer.default: bytes per second of Produce requests.
+    uint64_t producer_byte_rate = 0;
+    // quota.consumer.default: bytes per second of records sent in Fetch
+    // responses.
+    uint64_t consumer_byte_rate = 0;
+    // quota.request.default: requests per second, of any API.
+    uint64_t request_rate = 0;
+    // quota.burst.ms: how far ahead of its rates a client may get before
+    // it is throttled.
+    uint64_t burst_ms = 1000;
+};
+
+// The consumer offset store, see OffsetManager.
+struct OffsetsConfig {
+    // Where committed offsets are logged, as in Kafka (one partition here).
+    static constexpr std::string_view TOPIC = "__consumer_offsets";
+
+    // offsets.topic.segment.bytes: segment size of the offsets log. Only
+    // rolled segments are compacted, so this is far below log.segment.bytes.
+    uint64_t segment_bytes = 100 * 1024 * 1024;
+    // offset.metadata.max.bytes: longest metadata a commit may carry.
+    uint32_t max_metadata_size = 4096;
+    // log.cleaner.backoff.ms: how often the offsets log is checked for
+    // rolled segments to compact and the offset index is snapshotted.
+    uint32_t cleaner_backoff_ms = 15000;
+};
+
+// The in-memory cache of recently appended batches, see TailCache.
+struct TailCacheConfig {
+    // log.tail.cache.max.bytes: memory all partitions' cached batches may
+    // take together. 0 turns the cache off.
+    uint64_t max_bytes = 256 * 1024 * 1024;
+    // log.tail.cache.partition.max.bytes: how much of its most recent data
+    // one partition keeps cached at most.
+    uint64_t partition_max_bytes = 8 * 1024 * 1024;
+};
+
+// Settings of the broker's own (diagnostic) log, see Logger.
+struct LoggerConfig {
+    // logger.level: trace | debug | info | warn | error. Levels below the
+    // KAFKA_LOG_MIN_LEVEL the broker was built with never show up.
+    LogLevel level = LogLevel::INFO;
+    // logger.file: append to this file instead of writing to stderr.
+    std::string file;
+};
+
+// The HTTP endpoint serving metrics to Prometheus, see MetricsServer.
+struct MetricsConfig {
+    // metrics.host: loopback only unless asked otherwise.
+    std::string host = "127.0.0.1";
+    // metrics.port: 0 turns the endpoint off.
+    uint16_t port = 9404;
+};
+
+// Broker settings loaded from a Java-style properties file (the path the
+// broker is started with); anything not set keeps its default.
+struct BrokerConfig {
+    // log.dirs
+    std::vector<std::string> log_dirs{"/tmp/kraft-combined-logs"};
+    // auto.create.topics.enable: Produce to an unknown topic creates its log.
+    bool auto_create_topics = true;
+    // max.request.partition.size.limit: most partitions one
+    // DescribeTopicPartitions response may hold, whatever the client asks.
+    int32_t max_request_partition_size_limit = 2000;
+    // num.io.threads: request handler threads, which run the requests that
+    // may wait on the disk (see RequestHandlerPool). 0 runs them on the
+    // reactors.
+    uint32_t io_threads = 8;
+    // num.recovery.threads.per.data.dir: threads opening (and, after an
+    // unclean shutdown, recovering) the logs of each log dir at startup.
+    // 0 means one per CPU.
+    uint32_t recovery_threads_per_data_dir = 0;
+    SocketServerConfig socket_server{};
+    LoggerConfig logger{};
+    MetricsConfig metrics{};
+    QuotaConfig quota{};
+    LogConfig log{};
+    FlushConfig flush{};
+    OffsetsConfig offsets{};
+    TailCacheConfig tail_cache{};
+
+    // The settings of topic's logs: log.* with topic-specific overrides.
+    LogConfig logConfig(std::string_view topic) const;
+
+    static BrokerConfig fromArgs(int argc, char *argv[]);
+    static BrokerConfig fromFile(const std::string &path);
+
+  private:
+    void set(const std::string &key, const std::string &value);
+};
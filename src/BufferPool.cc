@@ -0,0 +1,69 @@
+#include "BufferPool.h"
+
+#include <utility>
+
+BufferPool::BufferPool() {
+    // Releasing a slab must not allocate.
+    free_slabs.reserve(MAX_FREE_SLABS);
+}
+
+BufferPool::~BufferPool() {
+    for (std::byte *slab : free_slabs) {
+        delete[] slab;
+    }
+}
+
+std::byte *BufferPool::acquire() {
+    if (free_slabs.empty()) {
+        return new std::byte[SLAB_SIZE];
+    }
+    std::byte *slab = free_slabs.back();
+    free_slabs.pop_back();
+    return slab;
+}
+
+void BufferPool::release(std::byte *slab) {
+    if (free_slabs.size() < MAX_FREE_SLABS) {
+        free_slabs.push_back(slab);
+    } else {
+        delete[] slab;
+    }
+}
+
+IoBuffer::IoBuffer(BufferPool &_pool, size_t _size) : pool(&_pool) {
+    if (_size <= BufferPool::SLAB_SIZE) {
+        bytes = pool->acquire();
+        capacity = BufferPool::SLAB_SIZE;
+    } else {
+        bytes = new std::byte[_size];
+        capacity = _size;
+    }
+}
+
+IoBuffer::IoBuffer(IoBuffer &&other) noexcept
+    : pool(other.pool), bytes(std::exchange(other.bytes, nullptr)),
+      capacity(std::exchange(other.capacity, 0)) {}
+
+IoBuffer &IoBuffer::operator=(IoBuffer &&other) noexcept {
+    if (this != &other) {
+        reset();
+        pool = other.pool;
+        bytes = std::exchange(other.bytes, nullptr);
+        capacity = std::exchange(other.capacity, 0);
+    }
+    return *this;
+}
+
+void IoBuffer::reset() {
+    if (bytes == nullptr) {
+        return;
+    }
+    // Only slabs are exactly SLAB_SIZE; anything bigger is a heap block.
+    if (capacity == BufferPool::SLAB_SIZE) {
+        pool->release(bytes);
+    } else {
+        delete[] bytes;
+    }
+    bytes = nullptr;
+    capacity = 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Fixed-size I/O buffers recycled across connections: input buffers and the
+// arenas responses are serialized into. Each reactor has its own and only
+// uses it from its thread, so there is no locking, just a free list. Up to
+// MAX_FREE_SLABS slabs are kept for reuse; beyond that they go back to the
+// heap.
+class BufferPool {
+  public:
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+    static constexpr size_t MAX_FREE_SLABS = 64;
+
+    BufferPool();
+    ~BufferPool();
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    // SLAB_SIZE bytes.
+    std::byte *acquire();
+    void release(std::byte *slab);
+
+    size_t freeSlabs() const { return free_slabs.size(); }
+
+  private:
+    std::vector<std::byte *> free_slabs;
+};
+
+// A buffer of at least the requested size: a slab of the pool when it fits
+// in one, otherwise a block of its own from the heap. Goes back to where it
+// came from when reset or destroyed. Empty when default-constructed.
+class IoBuffer {
+  public:
+    IoBuffer() = default;
+    IoBuffer(BufferPool &_pool, size_t _size);
+    ~IoBuffer() { reset(); }
+
+    IoBuffer(IoBuffer &&other) noexcept;
+    IoBuffer &operator=(IoBuffer &&other) noexcept;
+
+    std::byte *data() const { return bytes; }
+    size_t size() const { return capacity; }
+
+    void reset();
+
+  private:
+    BufferPool *pool = nullptr;
+    std::byte *bytes = nullptr;
+    size_t capacity = 0;
+};
@@ -0,0 +1,228 @@
+#include "Crc32c.h"
+
+#include <array>
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC32C_X86 1
+#endif
+
+namespace crc32c {
+namespace {
+
+// Bit-reflected Castagnoli polynomial.
+constexpr uint32_t POLY = 0x82f63b78;
+
+using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+constexpr Tables makeTables() {
+    Tables tables{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? POLY : 0);
+        }
+        tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (size_t t = 1; t < tables.size(); ++t) {
+            uint32_t prev = tables[t - 1][i];
+            tables[t][i] = (prev >> 8) ^ tables[0][prev & 0xff];
+        }
+    }
+    return tables;
+}
+
+constexpr Tables TABLES = makeTables();
+
+uint64_t loadLittle64(const unsigned char *p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    if constexpr (std::endian::native == std::endian::big) {
+        value = std::byteswap(value);
+    }
+    return value;
+}
+
+// Raw register update (no inversion).
+uint32_t portableRaw(uint32_t crc, const unsigned char *p, size_t n) {
+    while (n > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+        crc = (crc >> 8) ^ TABLES[0][(crc ^ *p++) & 0xff];
+        --n;
+    }
+    while (n >= 8) {
+        uint64_t word = loadLittle64(p) ^ crc;
+        crc = TABLES[7][word & 0xff] ^ TABLES[6][(word >> 8) & 0xff] ^
+              TABLES[5][(word >> 16) & 0xff] ^ TABLES[4][(word >> 24) & 0xff] ^
+              TABLES[3][(word >> 32) & 0xff] ^ TABLES[2][(word >> 40) & 0xff] ^
+              TABLES[1][(word >> 48) & 0xff] ^ TABLES[0][word >> 56];
+        p += 8;
+        n -= 8;
+    }
+    while (n-- > 0) {
+        crc = (crc >> 8) ^ TABLES[0][(crc ^ *p++) & 0xff];
+    }
+    return crc;
+}
+
+#if CRC32C_X86
+
+__attribute__((target("sse4.2"))) uint32_t
+sse42Raw(uint32_t crc, const unsigned char *p, size_t n) {
+    while (n > 0 && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+        --n;
+    }
+    uint64_t crc64 = crc;
+    while (n >= 8) {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        n -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (n-- > 0) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+// x^m mod P, bit-reflected: bit i holds the coefficient of x^(31 - i).
+uint32_t xPowMod(uint64_t m) {
+    uint32_t value = 0x80000000; // x^0
+    while (m-- > 0) {
+        value = (value >> 1) ^ ((value & 1) ? POLY : 0);
+    }
+    return value;
+}
+
+// crc32 has a latency of three cycles but a throughput of one, so three
+// independent lanes keep the unit busy. A lane's register is moved past the
+// bytes of the lanes after it by multiplying with x^(8 * bytes) mod P: the
+// carry-less product of two reflected 32-bit values is their product times
+// x^-1 in 64-bit reflected form, and crc32 of that 64-bit word multiplies by
+// x^32 and reduces. Hence the constants are x^(8 * bytes - 33) mod P.
+struct Lanes {
+    size_t lane_size;
+    uint32_t shift_one; // past one lane
+    uint32_t shift_two; // past two lanes
+};
+
+const Lanes LONG_LANES{4096, xPowMod(8 * 4096 - 33), xPowMod(8 * 2 * 4096 - 33)};
+const Lanes SHORT_LANES{256, xPowMod(8 * 256 - 33), xPowMod(8 * 2 * 256 - 33)};
+
+__attribute__((target("sse4.2,pclmul"))) uint32_t shift(uint32_t crc,
+                                                        uint32_t constant) {
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc),
+                                           _mm_cvtsi32_si128(constant), 0x00);
+    return static_cast<uint32_t>(
+        _mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(product))));
+}
+
+__attribute__((target("sse4.2,pclmul"))) uint32_t
+threeLanes(uint32_t crc, const unsigned char *&p, size_t &n, const Lanes &lanes) {
+    size_t lane = lanes.lane_size;
+    while (n >= 3 * lane) {
+        uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+        for (size_t i = 0; i < lane; i += 8) {
+            uint64_t w0, w1, w2;
+            std::memcpy(&w0, p + i, 8);
+            std::memcpy(&w1, p + lane + i, 8);
+            std::memcpy(&w2, p + 2 * lane + i, 8);
+            crc0 = _mm_crc32_u64(crc0, w0);
+            crc1 = _mm_crc32_u64(crc1, w1);
+            crc2 = _mm_crc32_u64(crc2, w2);
+        }
+        crc = shift(static_cast<uint32_t>(crc0), lanes.shift_two) ^
+              shift(static_cast<uint32_t>(crc1), lanes.shift_one) ^
+              static_cast<uint32_t>(crc2);
+        p += 3 * lane;
+        n -= 3 * lane;
+    }
+    return crc;
+}
+
+__attribute__((target("sse4.2,pclmul"))) uint32_t
+pclmulRaw(uint32_t crc, const unsigned char *p, size_t n) {
+    crc = threeLanes(crc, p, n, LONG_LANES);
+    crc = threeLanes(crc, p, n, SHORT_LANES);
+    return sse42Raw(crc, p, n);
+}
+
+#endif
+
+using RawFunction = uint32_t (*)(uint32_t, const unsigned char *, size_t);
+
+struct Dispatch {
+    RawFunction function;
+    const char *name;
+};
+
+Dispatch pick() {
+#if CRC32C_X86
+    if (hasPclmul()) {
+        return {pclmulRaw, "pclmul"};
+    }
+    if (hasSse42()) {
+        return {sse42Raw, "sse4.2"};
+    }
+#endif
+    return {portableRaw, "portable"};
+}
+
+const Dispatch DISPATCH = pick();
+
+uint32_t run(RawFunction function, uint32_t crc,
+             std::span<const std::byte> data) {
+    return ~function(~crc, reinterpret_cast<const unsigned char *>(data.data()),
+                     data.size());
+}
+
+} // namespace
+
+uint32_t extend(uint32_t crc, std::span<const std::byte> data) {
+    return run(DISPATCH.function, crc, data);
+}
+
+const char *implementation() { return DISPATCH.name; }
+
+uint32_t extendPortable(uint32_t crc, std::span<const std::byte> data) {
+    return run(portableRaw, crc, data);
+}
+
+bool hasSse42() {
+#if CRC32C_X86
+    return __builtin_cpu_supports("sse4.2");
+#else
+    return false;
+#endif
+}
+
+bool hasPclmul() {
+#if CRC32C_X86
+    return hasSse42() && __builtin_cpu_supports("pclmul");
+#else
+    return false;
+#endif
+}
+
+uint32_t extendSse42(uint32_t crc, std::span<const std::byte> data) {
+#if CRC32C_X86
+    return run(sse42Raw, crc, data);
+#else
+    return extendPortable(crc, data);
+#endif
+}
+
+uint32_t extendPclmul(uint32_t crc, std::span<const std::byte> data) {
+#if CRC32C_X86
+    return run(pclmulRaw, crc, data);
+#else
+    return extendPortable(crc, data);
+#endif
+}
+
+} // namespace crc32c
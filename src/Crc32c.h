@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// CRC-32C (Castagnoli), the checksum of v2 record batches. The
+// implementation is picked once at startup from what the CPU offers:
+//   pclmul   - SSE4.2 crc32 over three interleaved lanes, with the lanes
+//              combined by carry-less multiplication (large buffers)
+//   sse4.2   - one stream of 8-byte crc32 instructions
+//   portable - slicing-by-8 tables
+namespace crc32c {
+
+// Extends crc (0 to start a new checksum) over data. The usual pre- and
+// post-inversion is applied, so extend(extend(0, a), b) == value(a + b).
+uint32_t extend(uint32_t crc, std::span<const std::byte> data);
+inline uint32_t value(std::span<const std::byte> data) { return extend(0, data); }
+
+// Name of the implementation extend() dispatches to.
+const char *implementation();
+
+// The individual implementations, for benchmarks and cross-checks. The
+// hardware ones must only be called when supported.
+uint32_t extendPortable(uint32_t crc, std::span<const std::byte> data);
+bool hasSse42();
+uint32_t extendSse42(uint32_t crc, std::span<const std::byte> data);
+bool hasPclmul();
+uint32_t extendPclmul(uint32_t crc, std::span<const std::byte> data);
+
+} // namespace crc32c
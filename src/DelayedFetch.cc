@@ -0,0 +1,23 @@
+#include "DelayedFetch.h"
+
+DelayedFetch::DelayedFetch(int64_t max_wait_ms, uint64_t _min_bytes,
+                           uint64_t _bytes_ready, std::vector<WatchedLog> _logs,
+                           std::function<void()> _respond)
+    : DelayedOperation(max_wait_ms), min_bytes(_min_bytes),
+      bytes_ready(_bytes_ready), logs(std::move(_logs)),
+      respond(std::move(_respond)) {}
+
+bool DelayedFetch::tryComplete() {
+    // Counting appended bytes instead of re-reading keeps the check free of
+    // I/O; it may overestimate what max_bytes would let through, which only
+    // means answering a little early.
+    uint64_t available = bytes_ready;
+    for (const auto &watched : logs) {
+        available += watched.log->bytesAppended() - watched.appended_bytes;
+    }
+
+    if (available < min_bytes) {
+        return false;
+    }
+    return forceComplete();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "DelayedOperation.h"
+#include "PartitionLog.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+// A fetch parked until its partitions have min_bytes to return or
+// max_wait_ms have passed. Either way the response is built from what is in
+// the logs at that point, by the callback.
+struct DelayedFetch : DelayedOperation {
+    struct WatchedLog {
+        std::shared_ptr<PartitionLog> log;
+        // bytesAppended() when the fetch was parked.
+        uint64_t appended_bytes;
+    };
+
+    DelayedFetch(int64_t max_wait_ms, uint64_t _min_bytes,
+                 uint64_t _bytes_ready, std::vector<WatchedLog> _logs,
+                 std::function<void()> _respond);
+
+    bool tryComplete() override;
+    void onComplete() override { respond(); }
+
+  private:
+    uint64_t min_bytes;
+    // What the initial read found, short of min_bytes.
+    uint64_t bytes_ready;
+    std::vector<WatchedLog> logs;
+    std::function<void()> respond;
+};
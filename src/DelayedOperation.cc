@@ -0,0 +1,80 @@
+#include "DelayedOperation.h"
+
+#include <algorithm>
+
+bool DelayedOperation::forceComplete() {
+    if (completed) {
+        return false;
+    }
+    completed = true;
+    cancel();
+    onComplete();
+    return true;
+}
+
+void DelayedOperation::run() {
+    if (forceComplete()) {
+        onExpiration();
+    }
+}
+
+bool DelayedOperationPurgatory::tryCompleteElseWatch(
+    const std::shared_ptr<DelayedOperation> &operation,
+    const std::vector<TopicPartition> &keys) {
+    if (operation->tryComplete()) {
+        return true;
+    }
+
+    for (const auto &key : keys) {
+        auto &key_watchers = watchers[key];
+        // Consumers re-fetch the same partitions, so sweeping on insert keeps
+        // lists of idle partitions from filling up with expired fetches.
+        purgeCompleted(key_watchers);
+        key_watchers.push_back(operation);
+        ++watch_count;
+    }
+
+    timer.add(operation);
+    return false;
+}
+
+size_t DelayedOperationPurgatory::checkAndComplete(const TopicPartition &key) {
+    auto it = watchers.find(key);
+    if (it == watchers.end()) {
+        return 0;
+    }
+
+    // Work on a detached list so that completions cannot invalidate the
+    // iteration.
+    Watchers candidates = std::move(it->second);
+    watchers.erase(it);
+    watch_count -= candidates.size();
+
+    size_t completed = 0;
+    Watchers still_waiting;
+    for (auto &operation : candidates) {
+        if (operation->isCompleted()) {
+            continue;
+        }
+        if (operation->tryComplete()) {
+            ++completed;
+        } else {
+            still_waiting.push_back(std::move(operation));
+        }
+    }
+
+    if (!still_waiting.empty()) {
+        watch_count += still_waiting.size();
+        auto &key_watchers = watchers[key];
+        key_watchers.insert(key_watchers.end(),
+                            std::make_move_iterator(still_waiting.begin()),
+                            std::make_move_iterator(still_waiting.end()));
+    }
+    return completed;
+}
+
+void DelayedOperationPurgatory::purgeCompleted(Watchers &watchers) {
+    watch_count -= std::erase_if(watchers, [](const auto &operation) {
+        return operation->isCompleted();
+    });
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "PartitionLog.h"
+#include "TimingWheel.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// A request that cannot be answered yet, e.g. a fetch waiting for min_bytes.
+// It completes either when tryComplete() finds its condition met or when its
+// delay expires, whichever comes first; onComplete() runs exactly once.
+struct DelayedOperation : TimerTask {
+    explicit DelayedOperation(int64_t delay_ms)
+        : TimerTask(Timer::now() + delay_ms) {}
+
+    // Checks the completion condition and calls forceComplete() if it holds.
+    virtual bool tryComplete() = 0;
+    virtual void onComplete() = 0;
+    virtual void onExpiration() {}
+
+    // Returns false if the operation had already completed.
+    bool forceComplete();
+    bool isCompleted() const { return completed; }
+
+    // Timer expiry.
+    void run() override;
+
+  private:
+    bool completed = false;
+};
+
+// Parks delayed operations under the partitions they wait on, so that an
+// append only re-checks the operations watching that partition, and arms
+// their timeouts on the event loop's timer. Not thread-safe: everything but
+// watched() runs on the reactor that owns the timer.
+class DelayedOperationPurgatory {
+  public:
+    explicit DelayedOperationPurgatory(Timer &_timer) : timer(_timer) {}
+
+    // Completes the operation right away if it can, otherwise watches it
+    // under every key until it completes or times out. Returns true if it
+    // completed.
+    bool tryCompleteElseWatch(const std::shared_ptr<DelayedOperation> &operation,
+                              const std::vector<TopicPartition> &keys);
+    // Re-checks the operations watching key. Returns how many completed.
+    size_t checkAndComplete(const TopicPartition &key);
+
+    // Thread-safe, so that other reactors can skip notifying a purgatory
+    // that has nothing parked. Counts operations once per key, and may
+    // include completed ones until they are swept.
+    size_t watched() const {
+        return watch_count.load(std::memory_order_relaxed);
+    }
+
+  private:
+    using Watchers = std::vector<std::shared_ptr<DelayedOperation>>;
+
+    // Drops operations that completed through another key or expired.
+    void purgeCompleted(Watchers &watchers);
+
+    Timer &timer;
+    std::unordered_map<TopicPartition, Watchers, TopicPartitionHash> watchers;
+    std::atomic<size_t> watch_count{0};
+};
@@ -0,0 +1,50 @@
+#include "Fd.h"
+
+#include "Logger.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+
+Fd &Fd::operator=(Fd &&other) noexcept {
+    if (this != &other) {
+        if (fd >= 0)
+            close(fd);
+        fd = other.fd;
+        other.fd = -1;
+    }
+    return *this;
+}
+
+Fd::~Fd() {
+    if (fd != -1) {
+        LOG_TRACE("Closing file descriptor " << fd);
+        close(fd);
+    } else {
+        LOG_TRACE("File descriptor already closed" << fd);
+    }
+}
+
+void writeAll(const Fd &fd, std::string_view bytes, const std::string &path) {
+    while (!bytes.empty()) {
+        ssize_t result = write(fd, bytes.data(), bytes.size());
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to write " + path);
+        }
+        bytes.remove_prefix(result);
+    }
+}
+
+void syncDirectory(const std::string &dir) {
+    Fd fd(open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (fd < 0 || fsync(fd) != 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to sync " + dir);
+    }
+}
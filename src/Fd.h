@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+struct Fd {
+    explicit Fd(int _fd) : fd(_fd) {}
+    Fd() = default;
+    ~Fd();
+
+    // Delete copy operations
+    Fd(const Fd &) = delete;
+    Fd &operator=(const Fd &) = delete;
+
+    // Add move operations
+    Fd(Fd &&other) noexcept : fd(other.fd) { other.fd = -1; }
+    Fd &operator=(Fd &&other) noexcept;
+
+    void setFd(int _fd) { fd = _fd; }
+    int getFd() const { return fd; }
+    operator int() const { return fd; }
+
+  private:
+    int fd = -1;
+};
+
+// write()s all of bytes at the file position, retrying short writes.
+// Throws std::system_error naming path.
+void writeAll(const Fd &fd, std::string_view bytes, const std::string &path);
+// fsync() of a directory: makes the renames and unlinks in it durable.
+void syncDirectory(const std::string &dir);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Fd.h"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <variant>
+
+// A byte range of an open file, sent to the socket with sendfile() so that
+// the data never passes through user space. The file stays open for as long
+// as the region is queued, even if its segment is closed in the meantime.
+struct FileRegion {
+    std::shared_ptr<const Fd> file;
+    uint64_t position = 0;
+    uint64_t size = 0;
+};
+
+// Bytes in a buffer someone else owns and shares, e.g. batches in the tail
+// cache (see TailCache). The buffer stays alive for as long as the chunk is
+// queued, even if its owner drops it in the meantime.
+struct SharedBytes {
+    std::shared_ptr<const void> owner;
+    std::span<const std::byte> bytes;
+};
+
+// One entry of a connection's output queue: bytes serialized in user space,
+// either owned, in the connection's arena (see Arena) or shared, or a region
+// to be spliced straight from the page cache.
+using OutputChunk = std::variant<std::string, std::span<const std::byte>,
+                                 FileRegion, SharedBytes>;
+
+// The serialized bytes of a chunk; empty for a file region.
+inline std::span<const std::byte> chunkBytes(const OutputChunk &chunk) {
+    if (const auto *bytes = std::get_if<std::string>(&chunk)) {
+        return std::as_bytes(std::span(*bytes));
+    }
+    if (const auto *bytes = std::get_if<std::span<const std::byte>>(&chunk)) {
+        return *bytes;
+    }
+    if (const auto *shared = std::get_if<SharedBytes>(&chunk)) {
+        return shared->bytes;
+    }
+    return {};
+}
+
+inline size_t chunkSize(const OutputChunk &chunk) {
+    if (const auto *region = std::get_if<FileRegion>(&chunk)) {
+        return region->size;
+    }
+    return chunkBytes(chunk).size();
+}
@@ -0,0 +1,123 @@
+#include "IndexFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+IndexFile::IndexFile(std::string _path, size_t _entry_size, size_t max_size)
+    : file_path(std::move(_path)), entry_size(_entry_size) {
+    fd.setFd(open(file_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to open index " + file_path);
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to stat index " + file_path);
+    }
+    file_size = st.st_size;
+
+    size_t existing = file_size - file_size % entry_size;
+    mapping_size = std::max(max_size - max_size % entry_size, existing);
+    mapping_size = std::max(mapping_size, entry_size);
+    max_entries = mapping_size / entry_size;
+
+    void *address = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to map index " + file_path);
+    }
+    mapping = static_cast<std::byte *>(address);
+
+    // An index that was not trimmed (unclean shutdown of the active segment)
+    // ends in preallocated zeroes. Past the first slot no real entry is all
+    // zero: offset entries point past the first batch, and time entries
+    // strictly increase. The first can be, as a time entry for timestamp 0
+    // at the base offset, so it is kept if the file was trimmed to it. Only
+    // an index with room for one entry is preallocated to that size, and an
+    // untrimmed one is rebuilt by the active segment's recovery anyway.
+    size_t count = existing / entry_size;
+    std::vector<std::byte> zero_entry(entry_size);
+    auto is_zero = [&](size_t slot) {
+        return std::memcmp(entry(slot), zero_entry.data(), entry_size) == 0;
+    };
+    while (count > 1 && is_zero(count - 1)) {
+        --count;
+    }
+    if (count == 1 && is_zero(0) && file_size != entry_size) {
+        count = 0;
+    }
+    entry_count.store(count, std::memory_order_release);
+}
+
+IndexFile::~IndexFile() {
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+void IndexFile::ensureFileCapacity(size_t size) {
+    if (file_size >= size) {
+        return;
+    }
+    if (ftruncate(fd, mapping_size) != 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to grow index " + file_path);
+    }
+    file_size = mapping_size;
+}
+
+void IndexFile::append(const std::byte *entry) {
+    size_t slot = entries();
+    if (slot >= max_entries) {
+        throw std::runtime_error("Index " + file_path + " is full");
+    }
+
+    ensureFileCapacity((slot + 1) * entry_size);
+
+    std::memcpy(mapping + slot * entry_size, entry, entry_size);
+    entry_count.store(slot + 1, std::memory_order_release);
+}
+
+void IndexFile::truncateToEntries(size_t keep) {
+    size_t count = entries();
+    if (keep >= count) {
+        return;
+    }
+
+    entry_count.store(keep, std::memory_order_release);
+    // Zero the dropped slots so a crash cannot resurrect them on reload.
+    std::memset(mapping + keep * entry_size, 0, (count - keep) * entry_size);
+}
+
+void IndexFile::flush() const {
+    size_t bytes = entries() * entry_size;
+    if (bytes > 0 && msync(mapping, bytes, MS_SYNC) != 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to flush index " + file_path);
+    }
+}
+
+void IndexFile::trimToValidSize() {
+    size_t size = entries() * entry_size;
+    if (file_size == size) {
+        return;
+    }
+    // The mapping stays as is: only slots below entries() are ever touched,
+    // and those are still backed by the file.
+    if (ftruncate(fd, size) != 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to trim index " + file_path);
+    }
+    file_size = size;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Fd.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The memory-mapped file behind a segment index: fixed-size entries
+// appended one after another, read in place through the mapping. Address
+// space for the largest size the index may reach is reserved up front; the
+// file itself is only extended when an append needs it. What the entries
+// mean is up to OffsetIndex and TimeIndex.
+class IndexFile {
+  public:
+    // Maps the file at path; max_size bounds how large it may grow.
+    IndexFile(std::string _path, size_t _entry_size, size_t max_size);
+    ~IndexFile();
+
+    IndexFile(const IndexFile &) = delete;
+    IndexFile &operator=(const IndexFile &) = delete;
+
+    const std::byte *entry(size_t slot) const {
+        return mapping + slot * entry_size;
+    }
+    // Copies in entry_size bytes as the new last entry.
+    void append(const std::byte *entry);
+
+    bool isFull() const { return entries() >= max_entries; }
+    size_t maxEntries() const { return max_entries; }
+    size_t entries() const { return entry_count.load(std::memory_order_acquire); }
+    const std::string &path() const { return file_path; }
+
+    // Drops every entry from slot keep on.
+    void truncateToEntries(size_t keep);
+    void flush() const;
+    // Shrinks the file to its live entries. Done when the segment stops being
+    // the active one and on clean shutdown, like Kafka does.
+    void trimToValidSize();
+
+  private:
+    void ensureFileCapacity(size_t size);
+
+    std::string file_path;
+    size_t entry_size;
+    Fd fd;
+    std::byte *mapping = nullptr;
+    size_t mapping_size = 0;
+    size_t file_size = 0;
+    size_t max_entries = 0;
+    std::atomic<size_t> entry_count{0};
+};
@@ -0,0 +1,337 @@
+#include "IoUring.h"
+
+#include "Logger.h"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace {
+
+int ioUringSetup(unsigned entries, struct io_uring_params &params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+}
+
+int ioUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                 unsigned flags, const void *arg, size_t arg_size) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, arg, arg_size));
+}
+
+int ioUringRegister(int fd, unsigned opcode, const void *arg,
+                    unsigned nr_args) {
+    return static_cast<int>(
+        syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+template <typename T> T loadAcquire(const T *value) {
+    return std::atomic_ref<const T>(*value).load(std::memory_order_acquire);
+}
+
+template <typename T> void storeRelease(T *value, T new_value) {
+    std::atomic_ref<T>(*value).store(new_value, std::memory_order_release);
+}
+
+} // namespace
+
+IoUring::Mapping::Mapping(int fd, size_t _size, off_t offset) : size(_size) {
+    address = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, offset);
+    if (address == MAP_FAILED) {
+        address = nullptr;
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to map io_uring queue");
+    }
+}
+
+IoUring::Mapping::~Mapping() {
+    if (address != nullptr) {
+        munmap(address, size);
+    }
+}
+
+IoUring::Mapping &IoUring::Mapping::operator=(Mapping &&other) noexcept {
+    if (this != &other) {
+        if (address != nullptr) {
+            munmap(address, size);
+        }
+        address = std::exchange(other.address, nullptr);
+        size = std::exchange(other.size, 0);
+    }
+    return *this;
+}
+
+IoUring::IoUring(unsigned entries) {
+    struct io_uring_params params {};
+    // Completions are only run when the owner asks for them, on its own
+    // thread, instead of interrupting it whenever the kernel has one.
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP |
+                   IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries = entries * COMPLETION_ENTRIES_FACTOR;
+    int fd = ioUringSetup(entries, params);
+    if (fd < 0 && errno == EINVAL) {
+        // Before Linux 6.1; the ring works the same without them.
+        params = {};
+        params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP;
+        params.cq_entries = entries * COMPLETION_ENTRIES_FACTOR;
+        fd = ioUringSetup(entries, params);
+    }
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "io_uring_setup failed");
+    }
+    ring_fd.setFd(fd);
+    features = params.features;
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_size = std::max(sq_size, cq_size);
+    }
+    sq_mapping = Mapping(fd, sq_size, IORING_OFF_SQ_RING);
+    if (!single_mmap) {
+        cq_mapping = Mapping(fd, cq_size, IORING_OFF_CQ_RING);
+    }
+    sqe_mapping = Mapping(fd, params.sq_entries * sizeof(struct io_uring_sqe),
+                          IORING_OFF_SQES);
+
+    std::byte *sq = sq_mapping.bytes();
+    std::byte *cq = single_mmap ? sq : cq_mapping.bytes();
+
+    sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    sqes = reinterpret_cast<struct io_uring_sqe *>(sqe_mapping.bytes());
+    // Entry i always sits in slot i, so the indirection array is set up
+    // once and never touched again.
+    auto *sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries; ++i) {
+        sq_array[i] = i;
+    }
+
+    cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() = default;
+
+bool IoUring::submissionQueueFull() const {
+    return *sq_tail + sq_pending - loadAcquire(sq_head) >= sq_entries;
+}
+
+struct io_uring_sqe &IoUring::nextSqe() {
+    // Another round is fine after an interrupted submit, not after two.
+    bool stalled = false;
+    while (submissionQueueFull()) {
+        submit();
+        if (!submissionQueueFull()) {
+            break;
+        }
+        // Refused with EBUSY: under IORING_FEAT_NODROP the kernel holds
+        // completions back that did not fit, and takes no submissions until
+        // the queue has room for them. Nobody would reap them while this
+        // loops, so they are set aside here.
+        if (stashCompletions() > 0) {
+            stalled = false;
+        } else if (std::exchange(stalled, true)) {
+            throw std::runtime_error(
+                "io_uring submission queue full and not moving");
+        }
+    }
+    struct io_uring_sqe &sqe = sqes[(*sq_tail + sq_pending) & sq_mask];
+    std::memset(&sqe, 0, sizeof(sqe));
+    ++sq_pending;
+    return sqe;
+}
+
+void IoUring::submitAndWait(unsigned wait_for, int timeout_ms) {
+    storeRelease(sq_tail, *sq_tail + sq_pending);
+    sq_pending = 0;
+    // Everything the kernel has not consumed yet, including what an earlier
+    // call could not hand over.
+    unsigned to_submit = *sq_tail - loadAcquire(sq_head);
+
+    // Always asked for: with IORING_SETUP_DEFER_TASKRUN this is what posts
+    // the completions that are ready.
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    bool have_stashed = stashed_next < stashed_completions.size();
+    unsigned min_complete = timeout_ms == 0 || have_stashed ? 0 : wait_for;
+
+    struct __kernel_timespec timeout {};
+    struct io_uring_getevents_arg arg {};
+    const void *enter_arg = nullptr;
+    size_t enter_arg_size = 0;
+    if (min_complete > 0 && timeout_ms > 0) {
+        timeout.tv_sec = timeout_ms / 1000;
+        timeout.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<uint64_t>(&timeout);
+        flags |= IORING_ENTER_EXT_ARG;
+        enter_arg = &arg;
+        enter_arg_size = sizeof(arg);
+    }
+
+    if (ioUringEnter(ring_fd, to_submit, min_complete, flags, enter_arg,
+                     enter_arg_size) < 0) {
+        // A timeout, a signal, or a completion queue that needs draining
+        // before the kernel takes more: all for the caller to carry on from.
+        if (errno == ETIME || errno == EINTR || errno == EAGAIN ||
+            errno == EBUSY) {
+            return;
+        }
+        throw std::system_error(errno, std::generic_category(),
+                                "io_uring_enter failed");
+    }
+}
+
+const struct io_uring_cqe *IoUring::peekCompletion() const {
+    unsigned head = *cq_head;
+    if (head == loadAcquire(cq_tail)) {
+        return nullptr;
+    }
+    return &cqes[head & cq_mask];
+}
+
+void IoUring::popCompletion() { storeRelease(cq_head, *cq_head + 1); }
+
+unsigned IoUring::stashCompletions() {
+    unsigned stashed = 0;
+    while (const struct io_uring_cqe *cqe = peekCompletion()) {
+        stashed_completions.push_back(*cqe);
+        popCompletion();
+        ++stashed;
+    }
+    return stashed;
+}
+
+bool IoUring::supported() {
+    static const bool result = [] {
+        try {
+            return probe();
+        } catch (const std::exception &e) {
+            LOG_DEBUG("io_uring probe failed: " << e.what());
+            return false;
+        }
+    }();
+    return result;
+}
+
+bool IoUring::probe() {
+    auto ring = std::make_unique<IoUring>(8);
+    if (!(ring->features & IORING_FEAT_EXT_ARG) ||
+        !(ring->features & IORING_FEAT_NODROP)) {
+        return false;
+    }
+
+    constexpr unsigned MAX_OPS = 256;
+    std::vector<std::byte> probe_buffer(
+        sizeof(struct io_uring_probe) +
+        MAX_OPS * sizeof(struct io_uring_probe_op));
+    auto *ops = reinterpret_cast<struct io_uring_probe *>(probe_buffer.data());
+    if (ioUringRegister(ring->fd(), IORING_REGISTER_PROBE, ops, MAX_OPS) < 0) {
+        return false;
+    }
+    for (uint8_t op : {IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG,
+                       IORING_OP_POLL_ADD, IORING_OP_FSYNC,
+                       IORING_OP_ASYNC_CANCEL}) {
+        if (op > ops->last_op ||
+            !(ops->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+    }
+
+    // Multishot recv out of a buffer ring is the newest of them all, and
+    // there is no flag to probe for; one byte over a socket pair tells.
+    ProvidedBuffers buffers(*ring, 0, 1, 64);
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+        return false;
+    }
+    Fd receiver(pair[0]);
+    Fd sender(pair[1]);
+
+    struct io_uring_sqe &sqe = ring->nextSqe();
+    sqe.opcode = IORING_OP_RECV;
+    sqe.fd = receiver;
+    sqe.ioprio = IORING_RECV_MULTISHOT;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = buffers.group();
+    ring->submit();
+
+    char byte = 0;
+    if (write(sender, &byte, 1) != 1) {
+        return false;
+    }
+    ring->submitAndWait(1, 1000);
+
+    bool multishot = false;
+    ring->forEachCompletion([&multishot](const struct io_uring_cqe &cqe) {
+        multishot |= cqe.res == 1 && (cqe.flags & IORING_CQE_F_MORE);
+    });
+    // The recv is still armed: the ring goes before the buffers.
+    ring.reset();
+    return multishot;
+}
+
+ProvidedBuffers::ProvidedBuffers(const IoUring &uring, uint16_t _group,
+                                 uint16_t count, uint32_t _buffer_size)
+    : group_id(_group), mask(static_cast<uint16_t>(count - 1)),
+      buffer_size(_buffer_size),
+      storage(new std::byte[static_cast<size_t>(count) * _buffer_size]),
+      ring_size(count * sizeof(struct io_uring_buf)) {
+    void *memory = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to map the buffer ring");
+    }
+    ring = static_cast<struct io_uring_buf_ring *>(memory);
+
+    struct io_uring_buf_reg registration {};
+    registration.ring_addr = reinterpret_cast<uint64_t>(ring);
+    registration.ring_entries = count;
+    registration.bgid = group_id;
+    if (ioUringRegister(uring.fd(), IORING_REGISTER_PBUF_RING, &registration,
+                        1) < 0) {
+        int error = errno;
+        munmap(ring, ring_size);
+        throw std::system_error(error, std::generic_category(),
+                                "Failed to register the buffer ring");
+    }
+
+    for (uint16_t buffer = 0; buffer < count; ++buffer) {
+        recycle(buffer);
+    }
+}
+
+ProvidedBuffers::~ProvidedBuffers() { munmap(ring, ring_size); }
+
+void ProvidedBuffers::recycle(uint16_t buffer) {
+    // Not ring->bufs: the empty struct the uapi header puts in front of it
+    // takes a byte in C++, which moves it off the start of the ring.
+    struct io_uring_buf &slot =
+        reinterpret_cast<struct io_uring_buf *>(ring)[tail & mask];
+    slot.addr = reinterpret_cast<uint64_t>(storage.get() +
+                                           static_cast<size_t>(buffer) *
+                                               buffer_size);
+    slot.len = buffer_size;
+    slot.bid = buffer;
+    ++tail;
+    storeRelease(&ring->tail, tail);
+}
@@ -0,0 +1,174 @@
+#pragma once
+
+#include "Fd.h"
+
+#include <linux/io_uring.h>
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+// A submission and a completion queue shared with the kernel, driven
+// through the raw system calls (the broker does not depend on liburing).
+// Owned by one thread: entries are queued with nextSqe(), go to the kernel
+// all at once with the next submitAndWait(), and come back through
+// forEachCompletion(), so one io_uring_enter() stands in for a whole batch
+// of recv(), sendmsg() and fdatasync() calls.
+class IoUring {
+  public:
+    // Sized for a reactor's worth of in-flight operations; the completion
+    // queue is bigger since a multishot request posts many completions for
+    // one submission.
+    static constexpr unsigned DEFAULT_ENTRIES = 1024;
+    static constexpr unsigned COMPLETION_ENTRIES_FACTOR = 4;
+
+    // Must be created on the thread that submits to it. Throws
+    // std::system_error if the kernel refuses.
+    explicit IoUring(unsigned entries = DEFAULT_ENTRIES);
+    ~IoUring();
+
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    // Whether this kernel supports everything the broker submits: multishot
+    // accept, multishot recv out of a provided buffer ring, sendmsg, poll,
+    // fsync and waiting with a timeout (Linux 6.0 and later). Probed once,
+    // on a scratch ring and socket pair; false as well where io_uring is
+    // disabled or filtered out by seccomp.
+    static bool supported();
+
+    int fd() const { return ring_fd; }
+
+    // A cleared entry to fill in. When the submission queue is full what it
+    // holds goes to the kernel first. The kernel takes nothing while the
+    // completion queue is backed up, so completions are set aside then, for
+    // forEachCompletion() to hand out. Throws std::runtime_error if neither
+    // queue moves.
+    struct io_uring_sqe &nextSqe();
+    // Hands the queued entries to the kernel, then waits until at least
+    // wait_for completions are there or timeout_ms has passed (-1 waits as
+    // long as it takes, 0 not at all; completions set aside count).
+    // Interrupted waits just return.
+    void submitAndWait(unsigned wait_for, int timeout_ms);
+    void submit() { submitAndWait(0, 0); }
+
+    // Calls func(const io_uring_cqe &) for every completion there is, in
+    // the order they were posted, including the ones posted by the
+    // submissions func makes. Returns how many it saw.
+    template <typename F> unsigned forEachCompletion(F &&func);
+
+  private:
+    // One of the regions the ring is shared through.
+    struct Mapping {
+        Mapping() = default;
+        Mapping(int fd, size_t _size, off_t offset);
+        ~Mapping();
+        Mapping(const Mapping &) = delete;
+        Mapping &operator=(Mapping &&other) noexcept;
+
+        std::byte *bytes() const { return static_cast<std::byte *>(address); }
+
+        void *address = nullptr;
+        size_t size = 0;
+    };
+
+    // Scratch ring and socket pair test for supported().
+    static bool probe();
+
+    bool submissionQueueFull() const;
+    const struct io_uring_cqe *peekCompletion() const;
+    void popCompletion();
+    // Moves what the completion queue holds to stashed_completions; returns
+    // how many.
+    unsigned stashCompletions();
+
+    Fd ring_fd;
+    unsigned features = 0;
+    Mapping sq_mapping;
+    Mapping cq_mapping;
+    Mapping sqe_mapping;
+
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    struct io_uring_sqe *sqes = nullptr;
+    // Entries queued since the last io_uring_enter().
+    unsigned sq_pending = 0;
+
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    struct io_uring_cqe *cqes = nullptr;
+    // Taken off the completion queue by nextSqe() and not handed out yet;
+    // they come before anything still in the queue.
+    std::vector<struct io_uring_cqe> stashed_completions;
+    size_t stashed_next = 0;
+};
+
+// Buffers the kernel picks from to complete multishot receives, so that a
+// connection holds no read buffer of its own while it waits for data. A
+// completion names the buffer it filled (bufferOf()); it goes back to the
+// kernel with recycle() once its bytes have been consumed. The registration
+// goes away with the ring, which therefore has to be destroyed first.
+class ProvidedBuffers {
+  public:
+    // count must be a power of two.
+    ProvidedBuffers(const IoUring &uring, uint16_t _group, uint16_t count,
+                    uint32_t _buffer_size);
+    ~ProvidedBuffers();
+
+    ProvidedBuffers(const ProvidedBuffers &) = delete;
+    ProvidedBuffers &operator=(const ProvidedBuffers &) = delete;
+
+    // For IOSQE_BUFFER_SELECT submissions.
+    uint16_t group() const { return group_id; }
+
+    // The buffer a completion filled, if it used one.
+    static bool hasBuffer(const struct io_uring_cqe &cqe) {
+        return cqe.flags & IORING_CQE_F_BUFFER;
+    }
+    static uint16_t bufferOf(const struct io_uring_cqe &cqe) {
+        return static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    }
+    std::span<const std::byte> data(uint16_t buffer, size_t length) const {
+        return {storage.get() + static_cast<size_t>(buffer) * buffer_size,
+                length};
+    }
+    void recycle(uint16_t buffer);
+
+  private:
+    uint16_t group_id;
+    uint16_t mask;
+    uint32_t buffer_size;
+    std::unique_ptr<std::byte[]> storage;
+    // Page-aligned, as the kernel wants it; mmap()ed for that.
+    struct io_uring_buf_ring *ring = nullptr;
+    size_t ring_size;
+    uint16_t tail = 0;
+};
+
+template <typename F> unsigned IoUring::forEachCompletion(F &&func) {
+    unsigned seen = 0;
+    while (true) {
+        // Copied, so that the slot can be handed back before func runs and
+        // submits more (which may stash more).
+        struct io_uring_cqe completion;
+        if (stashed_next < stashed_completions.size()) {
+            completion = stashed_completions[stashed_next++];
+        } else if (const struct io_uring_cqe *cqe = peekCompletion()) {
+            completion = *cqe;
+            popCompletion();
+        } else {
+            break;
+        }
+        func(completion);
+        ++seen;
+    }
+    stashed_completions.clear();
+    stashed_next = 0;
+    return seen;
+}
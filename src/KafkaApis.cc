@@ -0,0 +1,1015 @@
+#include "KafkaApis.h"
+
+#include "DelayedFetch.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Reactor.h"
+#include "RecordBatch.h"
+
+#include <algorithm>
+#include <system_error>
+
+namespace {
+
+// Like Kafka's ErrorsPerSec, every error code in a response counts once.
+void countErrors(const ProduceResponseMessage &response) {
+    MetricsShard &metrics = Metrics::local();
+    for (const auto &topic : response.topics) {
+        for (const auto &partition : topic.partitions) {
+            metrics.countError(KafkaApis::PRODUCE_REQUEST,
+                               partition.error_code);
+        }
+    }
+}
+
+void countErrors(const FetchResponseMessage &response) {
+    MetricsShard &metrics = Metrics::local();
+    metrics.countError(KafkaApis::FETCH_REQUEST, response.error_code);
+    for (const auto &topic : response.responses) {
+        for (const auto &partition : topic.partitions) {
+            metrics.countError(KafkaApis::FETCH_REQUEST, partition.error_code);
+        }
+    }
+}
+
+void countErrors(const ListOffsetsResponseMessage &response) {
+    MetricsShard &metrics = Metrics::local();
+    for (const auto &topic : response.topics) {
+        for (const auto &partition : topic.partitions) {
+            metrics.countError(KafkaApis::LIST_OFFSETS_REQUEST,
+                               partition.error_code);
+        }
+    }
+}
+
+void countErrors(const OffsetCommitResponseMessage &response) {
+    MetricsShard &metrics = Metrics::local();
+    for (const auto &topic : response.topics) {
+        for (const auto &partition : topic.partitions) {
+            metrics.countError(KafkaApis::OFFSET_COMMIT_REQUEST,
+                               partition.error_code);
+        }
+    }
+}
+
+void countErrors(const OffsetFetchResponseMessage &response) {
+    MetricsShard &metrics = Metrics::local();
+    metrics.countError(KafkaApis::OFFSET_FETCH_REQUEST, response.error_code);
+    for (const auto &topic : response.topics) {
+        for (const auto &partition : topic.partitions) {
+            metrics.countError(KafkaApis::OFFSET_FETCH_REQUEST,
+                               partition.error_code);
+        }
+    }
+}
+
+void countErrors(const DescribeTopicPartitionsResponseMessage &response) {
+    MetricsShard &metrics = Metrics::local();
+    for (const auto &topic : response.topics) {
+        metrics.countError(KafkaApis::DESCRIBE_TOPIC_PARTITIONS_REQUEST,
+                           topic.error_code);
+        for (const auto &partition : topic.partitions) {
+            metrics.countError(KafkaApis::DESCRIBE_TOPIC_PARTITIONS_REQUEST,
+                               partition.error_code);
+        }
+    }
+}
+
+// Charges the records of a fetch response to the consumer byte quota.
+// Returns the throttle time the response carries.
+int32_t fetchThrottleTime(ClientQuota *quota, int32_t throttle_time_ms,
+                          uint64_t bytes_read) {
+    if (quota == nullptr) {
+        return throttle_time_ms;
+    }
+    int32_t fetch_throttle_ms = QuotaManager::throttleMillis(
+        quota->fetch_bytes.record(monotonicNanos(), bytes_read));
+    if (throttle_time_ms == 0 && fetch_throttle_ms > 0) {
+        Metrics::local().requests_throttled.add(1);
+    }
+    return std::max(throttle_time_ms, fetch_throttle_ms);
+}
+
+} // namespace
+
+ApiVersionsResponseCache::ApiVersionsResponseCache() {
+    ApiVersionsResponseMessage response;
+    response.api_keys.reserve(std::size(API_REGISTRY));
+    for (const auto &api : API_REGISTRY) {
+        response.api_keys.push_back(
+            {api.api_key, api.min_version, api.max_version});
+    }
+
+    for (int16_t version = 0; version <= MAX_VERSION; ++version) {
+        response.version = version;
+        images[version] = response.toBuffer();
+    }
+
+    // Clients that ask for a version we do not know cannot parse anything
+    // newer than v0, which still tells them which versions to retry with.
+    response.version = 0;
+    response.error_code = ErrorCode::UNSUPPORTED_VERSION;
+    unsupported_image = response.toBuffer();
+}
+
+const ApiVersionsResponseCache &ApiVersionsResponseCache::instance() {
+    static const ApiVersionsResponseCache cache;
+    return cache;
+}
+
+std::string_view ApiVersionsResponseCache::image(int16_t version) const {
+    if (version < 0 || version > MAX_VERSION) {
+        return unsupported_image;
+    }
+    return images[version];
+}
+
+std::string ApiVersionsResponseCache::response(int16_t version,
+                                               int32_t corellation_id) const {
+    std::string frame(image(version));
+    setCorrelationId(std::as_writable_bytes(std::span(frame)), corellation_id);
+    return frame;
+}
+
+void ApiVersionsResponseCache::setCorrelationId(std::span<std::byte> frame,
+                                                int32_t corellation_id) {
+    wire::store(frame.data() + CORRELATION_ID_OFFSET, corellation_id);
+}
+
+void ApiVersionsResponseCache::setThrottleTime(std::span<std::byte> frame,
+                                               int16_t version,
+                                               int32_t throttle_time_ms) {
+    if (version < 1 || version > MAX_VERSION) {
+        return;
+    }
+    // Last field of the body, followed only by the empty tagged fields of
+    // flexible versions.
+    size_t trailer =
+        version >= ApiVersionsResponseMessage::FIRST_FLEXIBLE_VERSION ? 1 : 0;
+    wire::store(frame.data() + frame.size() - sizeof(int32_t) - trailer,
+                throttle_time_ms);
+}
+
+KafkaApis::KafkaApis(const BrokerConfig &_config, TCPManager &_tcp_manager,
+                     LogManager &_log_manager, LogFlusher &_log_flusher,
+                     const MetadataCache &_metadata_cache,
+                     OffsetManager &_offset_manager)
+    : config(_config), tcp_manager(_tcp_manager), log_manager(_log_manager),
+      log_flusher(_log_flusher), metadata_cache(_metadata_cache),
+      offset_manager(_offset_manager), quotas(_config.quota),
+      request_handlers(_config.io_threads) {
+    for (uint32_t shard = 0; shard < tcp_manager.reactorCount(); ++shard) {
+        fetch_purgatories.push_back(std::make_unique<DelayedOperationPurgatory>(
+            tcp_manager.reactor(shard).getTimer()));
+    }
+    request_handlers.start();
+}
+
+void KafkaApis::shutdown() { request_handlers.shutdown(); }
+
+void KafkaApis::classifyRequest(Connection &connection,
+                                std::span<const std::byte> frame) const {
+    RequestHeader request_header = RequestHeader::fromBuffer(frame);
+
+    tcp_manager.startRequest(connection, request_header.request_api_key,
+                             request_header.request_api_version, frame.size());
+    int32_t throttle_time_ms =
+        recordQuota(connection, request_header, frame.size());
+    dispatch(connection, request_header, frame, throttle_time_ms);
+    // A deferred response is finished by the reactor once it is completed.
+    if (!connection.response_deferred) {
+        tcp_manager.finishRequest(connection);
+    }
+
+    // Over quota, by this request or by the fetches before it: nothing more
+    // is read from the client until it has served its back-off, rather than
+    // taking on work it is not entitled to.
+    if (connection.quota != nullptr) {
+        int64_t throttle_ns = connection.quota->throttleNanos(monotonicNanos());
+        if (throttle_ns > 0) {
+            tcp_manager.reactor(connection.shard())
+                .throttle(connection,
+                          QuotaManager::throttleMillis(throttle_ns));
+        }
+    }
+}
+
+int32_t KafkaApis::recordQuota(Connection &connection,
+                               const RequestHeader &request_header,
+                               size_t frame_size) const {
+    if (!quotas.enabled()) {
+        return 0;
+    }
+    std::string_view client_id = request_header.client_id.value_or("");
+    if (connection.quota == nullptr ||
+        connection.quota_client_id != client_id) {
+        connection.quota = quotas.quota(client_id);
+        connection.quota_client_id = client_id;
+    }
+
+    int64_t now = monotonicNanos();
+    ClientQuota &quota = *connection.quota;
+    int64_t throttle_ns = quota.requests.record(now, 1);
+    if (request_header.request_api_key == PRODUCE_REQUEST) {
+        throttle_ns =
+            std::max(throttle_ns, quota.produce_bytes.record(now, frame_size));
+    }
+    if (throttle_ns > 0) {
+        Metrics::local().requests_throttled.add(1);
+    }
+    return QuotaManager::throttleMillis(throttle_ns);
+}
+
+void KafkaApis::dispatch(Connection &connection,
+                         const RequestHeader &request_header,
+                         std::span<const std::byte> frame,
+                         int32_t throttle_time_ms) const {
+    const ApiDescriptor *api = findApi(request_header.request_api_key);
+    if (api == nullptr) {
+        LOG_WARN("Unsupported API key: " << request_header.request_api_key);
+        sendErrorResponse(connection, request_header, nullptr,
+                          ErrorCode::INVALID_REQUEST);
+        return;
+    }
+
+    // ApiVersions must answer every version, it reports the mismatch itself.
+    if (!api->supports(request_header.request_api_version) &&
+        api->api_key != API_VERSIONS_REQUEST) {
+        LOG_WARN("Unsupported version " << request_header.request_api_version
+                 << " for API key " << request_header.request_api_key);
+        sendErrorResponse(connection, request_header, api,
+                          ErrorCode::UNSUPPORTED_VERSION);
+        return;
+    }
+
+    if (api->blocking) {
+        submitRequest(connection, *api, frame, throttle_time_ms);
+        return;
+    }
+    (this->*api->handler)({&connection, request_header, frame, {},
+                           connection.quota, throttle_time_ms});
+}
+
+void KafkaApis::submitRequest(Connection &connection, const ApiDescriptor &api,
+                              std::span<const std::byte> frame,
+                              int32_t throttle_time_ms) const {
+    ResponseHandle response = tcp_manager.deferResponse(connection);
+    if (!connection.strand) {
+        connection.strand = std::make_shared<RequestHandlerPool::Strand>();
+    }
+
+    // The frame is in the input buffer, which the next read reuses.
+    std::string copy(reinterpret_cast<const char *>(frame.data()),
+                     frame.size());
+    request_handlers.submit(
+        connection.strand, [this, &api, response, quota = connection.quota,
+                            throttle_time_ms, copy = std::move(copy)] {
+            std::span<const std::byte> frame = std::as_bytes(std::span(copy));
+            try {
+                RequestHeader request_header = RequestHeader::fromBuffer(frame);
+                (this->*api.handler)({nullptr, request_header, frame, response,
+                                      quota, throttle_time_ms});
+            } catch (const std::exception &e) {
+                LOG_WARN("Error handling client: " << e.what());
+                tcp_manager.abortDeferredResponse(response);
+            }
+        });
+}
+
+void KafkaApis::sendErrorResponse(Connection &connection,
+                                  const RequestHeader &request_header,
+                                  const ApiDescriptor *api,
+                                  int16_t error) const {
+    // The body schema of an unknown key or version is unknown as well; every
+    // response leads with the header, and clients only need the correlation
+    // id to fail the matching request instead of waiting for a timeout.
+    bool flexible =
+        api != nullptr &&
+        api->responseHeaderVersion(request_header.request_api_version) >= 1;
+
+    std::string buffer;
+    WireWriter writer(buffer);
+    size_t frame = writer.beginFrame();
+
+    ResponseHeader response_header{request_header.corellation_id};
+    response_header.encode(writer, flexible);
+    writer.writeInt16(error);
+
+    writer.endFrame(frame);
+    Metrics::local().countError(request_header.request_api_key, error);
+    tcp_manager.writeFrameOnClientFd(connection, std::move(buffer));
+}
+
+void KafkaApis::checkApiVersions(const RequestContext &context) const {
+    ApiVersionsRequestMessage request_message =
+        ApiVersionsRequestMessage::fromBuffer(context.frame);
+
+    LOG_DEBUG("Received API Versions Request: " << request_message.toString());
+
+    if (!findApi(API_VERSIONS_REQUEST)
+             ->supports(request_message.request_api_version)) {
+        Metrics::local().countError(API_VERSIONS_REQUEST,
+                                    ErrorCode::UNSUPPORTED_VERSION);
+    }
+
+    // Copied straight from the cached image into the connection's arena:
+    // answering ApiVersions allocates nothing.
+    std::span<std::byte> frame = tcp_manager.copyFrameOnClientFd(
+        *context.connection, ApiVersionsResponseCache::instance().image(
+                                request_message.request_api_version));
+    ApiVersionsResponseCache::setCorrelationId(frame,
+                                               request_message.corellation_id);
+    if (context.throttle_time_ms > 0) {
+        ApiVersionsResponseCache::setThrottleTime(
+            frame, request_message.request_api_version,
+            context.throttle_time_ms);
+    }
+}
+
+void KafkaApis::handleProduce(const RequestContext &context) const {
+    ProduceRequestMessage request =
+        ProduceRequestMessage::fromBuffer(context.frame);
+
+    LOG_DEBUG("Received Produce Request: " << request.toString());
+
+    ProduceResponseMessage response;
+    response.version = request.request_api_version;
+    response.corellation_id = request.corellation_id;
+    response.throttle_time = context.throttle_time_ms;
+
+    bool valid_acks =
+        request.acks == 0 || request.acks == 1 || request.acks == -1;
+    // The partitions appended to, with their logs, to wait for. Reserved
+    // up front, so that these stay valid.
+    std::vector<std::pair<ProduceResponseMessage::PartitionResponse *,
+                          std::shared_ptr<PartitionLog>>>
+        appended;
+    response.topics.reserve(request.topics.size());
+
+    for (const auto &topic : request.topics) {
+        auto &topic_response =
+            response.topics.emplace_back(std::string(topic.name));
+        topic_response.partitions.reserve(topic.partitions.size());
+
+        for (const auto &partition : topic.partitions) {
+            auto &partition_response = topic_response.partitions.emplace_back();
+            partition_response.index = partition.index;
+
+            if (!valid_acks) {
+                partition_response.error_code = ErrorCode::INVALID_REQUIRED_ACKS;
+                continue;
+            }
+
+            if (auto log = appendToPartition(topic.name, partition,
+                                             partition_response)) {
+                appended.emplace_back(&partition_response, std::move(log));
+            }
+        }
+    }
+
+    // Kafka sends nothing back for acks=0.
+    if (request.acks == 0 && valid_acks) {
+        tcp_manager.completeDeferredResponse(context.response,
+                                             std::vector<OutputChunk>());
+        return;
+    }
+
+    if (appended.empty() || !config.flush.waitsFor(request.acks)) {
+        LOG_DEBUG("Sending msg to client: " << response.toString());
+        countErrors(response);
+        tcp_manager.completeDeferredResponse(context.response,
+                                             response.toBuffer());
+        return;
+    }
+
+    // Park the response until the group commit that covers these appends;
+    // the responses to later requests wait behind it.
+    std::vector<std::shared_ptr<PartitionLog>> logs;
+    logs.reserve(appended.size());
+    for (const auto &[partition, log] : appended) {
+        logs.push_back(log);
+    }
+    log_flusher.awaitFlush(
+        std::move(logs),
+        [this, handle = context.response, response = std::move(response),
+         appended = std::move(appended)](bool durable) mutable {
+            // Only the partitions whose own log failed to sync.
+            if (!durable) {
+                for (auto &[partition, log] : appended) {
+                    if (log->hasStorageFailure()) {
+                        partition->error_code = ErrorCode::KAFKA_STORAGE_ERROR;
+                    }
+                }
+            }
+            countErrors(response);
+            tcp_manager.completeDeferredResponse(handle, response.toBuffer());
+        });
+}
+
+std::shared_ptr<PartitionLog> KafkaApis::appendToPartition(
+    std::string_view topic,
+    const ProduceRequestMessage::PartitionData &partition,
+    ProduceResponseMessage::PartitionResponse &response) const {
+    // The offsets log only takes what OffsetCommit writes to it.
+    if (!LogManager::isValidTopicName(topic) ||
+        topic == OffsetsConfig::TOPIC) {
+        response.error_code = ErrorCode::INVALID_TOPIC_EXCEPTION;
+        return nullptr;
+    }
+
+    TopicPartition tp{std::string(topic), partition.index};
+    std::shared_ptr<PartitionLog> log;
+    if (partition.index >= 0) {
+        log = config.auto_create_topics ? log_manager.getOrCreateLog(tp)
+                                        : log_manager.getLog(tp);
+    }
+    if (!log) {
+        response.error_code = ErrorCode::UNKNOWN_TOPIC_OR_PARTITION;
+        return nullptr;
+    }
+
+    if (!partition.records || partition.records->empty()) {
+        response.error_code = ErrorCode::CORRUPT_MESSAGE;
+        return nullptr;
+    }
+
+    // Check every batch (framing, magic and CRC) before appending any of
+    // them, so a malformed request leaves the log untouched.
+    std::span<const std::byte> records = *partition.records;
+    std::vector<std::span<const std::byte>> batches;
+    try {
+        while (!records.empty()) {
+            RecordBatchView batch(records);
+            if (batch.batchLength() <= 0 ||
+                batch.sizeInBytes() > records.size()) {
+                throw WireError("Truncated record batch");
+            }
+            auto bytes = records.first(batch.sizeInBytes());
+            RecordBatchView(bytes).ensureValid();
+            batches.push_back(bytes);
+            records = records.subspan(batch.sizeInBytes());
+        }
+    } catch (const WireError &e) {
+        LOG_WARN("Rejecting records for " << tp.toString() << ": "
+                 << e.what());
+        response.error_code = ErrorCode::CORRUPT_MESSAGE;
+        return nullptr;
+    }
+
+    try {
+        for (size_t i = 0; i < batches.size(); ++i) {
+            LogAppendInfo info = log->append(batches[i]);
+            if (i == 0) {
+                response.base_offset = info.base_offset;
+            }
+        }
+    } catch (const WireError &e) {
+        LOG_WARN("Rejecting records for " << tp.toString() << ": "
+                 << e.what());
+        response.error_code = ErrorCode::CORRUPT_MESSAGE;
+        return nullptr;
+    } catch (const std::system_error &e) {
+        LOG_ERROR("Failed to append to " << tp.toString() << ": " << e.what());
+        response.error_code = ErrorCode::KAFKA_STORAGE_ERROR;
+        return nullptr;
+    }
+
+    log_flusher.markDirty(log, partition.records->size());
+    completeDelayedFetches(tp);
+    response.log_start_offset = log->logStartOffset();
+    return log;
+}
+
+void KafkaApis::completeDelayedFetches(const TopicPartition &tp) const {
+    for (uint32_t shard = 0; shard < fetch_purgatories.size(); ++shard) {
+        DelayedOperationPurgatory &purgatory = *fetch_purgatories[shard];
+        if (purgatory.watched() == 0) {
+            continue;
+        }
+        tcp_manager.post(shard, [&purgatory, tp] {
+            purgatory.checkAndComplete(tp);
+        });
+    }
+}
+
+FetchParams FetchParams::fromRequest(const FetchRequestMessage &request,
+                                     const MetadataImage &image) {
+    FetchParams params{request.request_api_version, request.corellation_id,
+                       request.max_bytes};
+    for (const auto &topic : request.topics) {
+        std::string name(topic.topic);
+        if (request.request_api_version >= 13) {
+            const TopicMetadata *metadata = image.topicById(topic.topic_id);
+            name = metadata ? metadata->name : "";
+        }
+        params.topics.push_back(
+            {std::move(name), topic.topic_id, topic.partitions});
+    }
+    return params;
+}
+
+void KafkaApis::handleFetch(const RequestContext &context) const {
+    FetchRequestMessage request = FetchRequestMessage::fromBuffer(context.frame);
+
+    LOG_DEBUG("Received Fetch Request: " << request.toString());
+
+    FetchParams params =
+        FetchParams::fromRequest(request, *metadata_cache.image());
+    uint64_t bytes_read = 0;
+    FetchResponseMessage response = readFetch(params, bytes_read);
+
+    // Like Kafka, errors are reported right away instead of after a wait.
+    bool has_error = false;
+    std::vector<TopicPartition> keys;
+    std::vector<DelayedFetch::WatchedLog> logs;
+    for (const auto &topic : params.topics) {
+        for (const auto &partition : topic.partitions) {
+            TopicPartition tp{topic.topic, partition.partition};
+            auto log = log_manager.getLog(tp);
+            if (!log) {
+                has_error = true;
+                break;
+            }
+            logs.push_back({log, log->bytesAppended()});
+            keys.push_back(std::move(tp));
+        }
+    }
+    for (const auto &topic : response.responses) {
+        for (const auto &partition : topic.partitions) {
+            has_error |= partition.error_code != ErrorCode::NONE;
+        }
+    }
+
+    uint64_t min_bytes = std::max(request.min_bytes, 0);
+    if (request.max_wait_ms <= 0 || bytes_read >= min_bytes || has_error ||
+        keys.empty()) {
+        response.throttle_time = fetchThrottleTime(
+            context.quota.get(), context.throttle_time_ms, bytes_read);
+        LOG_DEBUG("Sending msg to client: " << response.toString());
+        countErrors(response);
+        tcp_manager.completeDeferredResponse(context.response,
+                                             response.toChunks());
+        return;
+    }
+
+    // Park it: appends to any of its partitions re-check it, the timer
+    // answers it with whatever is there once max_wait_ms are up. The
+    // responses to later requests wait behind it. Completion happens on the
+    // reactor; the read goes back to the pool.
+    auto delayed_fetch = std::make_shared<DelayedFetch>(
+        request.max_wait_ms, min_bytes, bytes_read, std::move(logs),
+        [this, handle = context.response, quota = context.quota,
+         throttle_time_ms = context.throttle_time_ms,
+         params = std::move(params)]() mutable {
+            request_handlers.submit(
+                [this, handle, quota, throttle_time_ms,
+                 params = std::move(params)] {
+                    try {
+                        uint64_t bytes_read = 0;
+                        FetchResponseMessage response =
+                            readFetch(params, bytes_read);
+                        response.throttle_time = fetchThrottleTime(
+                            quota.get(), throttle_time_ms, bytes_read);
+                        LOG_DEBUG("Sending msg to client: "
+                                  << response.toString());
+                        countErrors(response);
+                        tcp_manager.completeDeferredResponse(
+                            handle, response.toChunks());
+                    } catch (const std::exception &e) {
+                        LOG_WARN("Error handling client: " << e.what());
+                        tcp_manager.abortDeferredResponse(handle);
+                    }
+                });
+        });
+
+    // The purgatory belongs to the connection's reactor.
+    uint32_t shard = Connection::shardOf(context.response.connection_id);
+    DelayedOperationPurgatory &purgatory = *fetch_purgatories[shard];
+    tcp_manager.post(shard, [&purgatory, delayed_fetch, keys = std::move(keys)] {
+        purgatory.tryCompleteElseWatch(delayed_fetch, keys);
+    });
+}
+
+FetchResponseMessage KafkaApis::readFetch(const FetchParams &params,
+                                          uint64_t &bytes_read) const {
+    FetchResponseMessage response;
+    response.version = params.version;
+    response.corellation_id = params.corellation_id;
+
+    // Only the record data counts against max_bytes; once it is used up the
+    // remaining partitions are still reported, just without records.
+    uint64_t remaining = std::max(params.max_bytes, 0);
+
+    for (const auto &topic : params.topics) {
+        auto &topic_response =
+            response.responses.emplace_back(topic.topic, topic.topic_id);
+        bool unknown_id = params.version >= 13 && topic.topic.empty();
+
+        for (const auto &partition : topic.partitions) {
+            auto &partition_response = topic_response.partitions.emplace_back();
+            partition_response.partition_index = partition.partition;
+            if (unknown_id) {
+                partition_response.error_code = ErrorCode::UNKNOWN_TOPIC_ID;
+                continue;
+            }
+
+            uint64_t limit = std::min<uint64_t>(
+                remaining, std::max(partition.partition_max_bytes, 0));
+            uint64_t read = readFromPartition(topic.topic, partition, limit,
+                                              partition_response);
+            remaining -= std::min(remaining, read);
+            bytes_read += read;
+        }
+    }
+
+    return response;
+}
+
+uint64_t KafkaApis::readFromPartition(
+    std::string_view topic, const FetchRequestMessage::PartitionData &partition,
+    uint64_t max_bytes, FetchResponseMessage::PartitionData &response) const {
+    auto log = log_manager.getLog({std::string(topic), partition.partition});
+    if (!log) {
+        response.error_code = ErrorCode::UNKNOWN_TOPIC_OR_PARTITION;
+        return 0;
+    }
+
+    response.high_watermark = log->logEndOffset();
+    response.last_stable_offset = response.high_watermark;
+    response.log_start_offset = log->logStartOffset();
+
+    if (max_bytes == 0) {
+        return 0;
+    }
+
+    try {
+        // Consumers keeping up with the log find their batches in memory;
+        // the rest are read from the segments.
+        auto cached = log->readFromCache(partition.fetch_offset, max_bytes);
+        if (cached) {
+            Metrics::local().tail_cache_hits.add(1);
+            size_t size = cached->records.bytes.size();
+            response.records = std::move(cached->records);
+            return size;
+        }
+
+        // read() hands back at least one whole batch, so a consumer is never
+        // stuck behind a batch larger than its limits.
+        auto read_info = log->read(partition.fetch_offset, max_bytes);
+        if (read_info) {
+            Metrics::local().tail_cache_misses.add(1);
+            response.records = read_info->records;
+            return read_info->records.size;
+        }
+    } catch (const OffsetOutOfRangeError &e) {
+        LOG_DEBUG(e.what());
+        response.error_code = ErrorCode::OFFSET_OUT_OF_RANGE;
+    } catch (const std::system_error &e) {
+        LOG_ERROR("Failed to read from " << topic << "-"
+                  << partition.partition << ": " << e.what());
+        response.error_code = ErrorCode::KAFKA_STORAGE_ERROR;
+    }
+    return 0;
+}
+
+void KafkaApis::handleListOffsets(const RequestContext &context) const {
+    ListOffsetsRequestMessage request =
+        ListOffsetsRequestMessage::fromBuffer(context.frame);
+
+    LOG_DEBUG("Received ListOffsets Request: " << request.toString());
+
+    ListOffsetsResponseMessage response;
+    response.version = request.request_api_version;
+    response.corellation_id = request.corellation_id;
+    response.throttle_time = context.throttle_time_ms;
+
+    for (const auto &topic : request.topics) {
+        auto &topic_response = response.topics.emplace_back();
+        topic_response.name = topic.name;
+
+        for (const auto &partition : topic.partitions) {
+            auto &partition_response = topic_response.partitions.emplace_back();
+            partition_response.partition_index = partition.partition_index;
+            auto log = log_manager.getLog(
+                {std::string(topic.name), partition.partition_index});
+            if (!log) {
+                partition_response.error_code =
+                    ErrorCode::UNKNOWN_TOPIC_OR_PARTITION;
+                continue;
+            }
+
+            // The log bounds are kept in memory; only a timestamp search
+            // reads the log, and then only around one time index entry.
+            int64_t timestamp = partition.timestamp;
+            if (timestamp == ListOffsetsRequestMessage::LATEST_TIMESTAMP) {
+                partition_response.offset = log->logEndOffset();
+                continue;
+            }
+            if (timestamp == ListOffsetsRequestMessage::EARLIEST_TIMESTAMP) {
+                partition_response.offset = log->logStartOffset();
+                continue;
+            }
+            if (timestamp == ListOffsetsRequestMessage::MAX_TIMESTAMP) {
+                timestamp = log->maxTimestamp();
+            }
+            try {
+                if (auto found = log->offsetForTimestamp(timestamp)) {
+                    partition_response.timestamp = found->timestamp;
+                    partition_response.offset = found->offset;
+                }
+            } catch (const std::system_error &e) {
+                LOG_ERROR("Failed to search " << topic.name << "-"
+                          << partition.partition_index << ": " << e.what());
+                partition_response.error_code = ErrorCode::KAFKA_STORAGE_ERROR;
+            }
+        }
+    }
+
+    LOG_DEBUG("Sending msg to client: " << response.toString());
+    countErrors(response);
+    tcp_manager.completeDeferredResponse(context.response, response.toBuffer());
+}
+
+void KafkaApis::handleOffsetCommit(const RequestContext &context) const {
+    OffsetCommitRequestMessage request =
+        OffsetCommitRequestMessage::fromBuffer(context.frame);
+
+    LOG_DEBUG("Received OffsetCommit Request: " << request.toString());
+
+    OffsetCommitResponseMessage response;
+    response.version = request.request_api_version;
+    response.corellation_id = request.corellation_id;
+    response.throttle_time = context.throttle_time_ms;
+
+    // Names in the offsets log have an int16 length.
+    bool valid_group = request.group_id.size() <= INT16_MAX;
+    std::vector<OffsetCommit> commits;
+    // Reserved up front, so that these stay valid.
+    std::vector<OffsetCommitResponseMessage::PartitionResponse *> committed;
+    response.topics.reserve(request.topics.size());
+
+    for (const auto &topic : request.topics) {
+        auto &topic_response =
+            response.topics.emplace_back(std::string(topic.name));
+        topic_response.partitions.reserve(topic.partitions.size());
+
+        for (const auto &partition : topic.partitions) {
+            auto &partition_response = topic_response.partitions.emplace_back();
+            partition_response.partition_index = partition.partition_index;
+            std::string_view metadata =
+                partition.committed_metadata.value_or("");
+
+            if (!valid_group) {
+                partition_response.error_code = ErrorCode::INVALID_GROUP_ID;
+            } else if (!log_manager.getLog({std::string(topic.name),
+                                            partition.partition_index})) {
+                partition_response.error_code =
+                    ErrorCode::UNKNOWN_TOPIC_OR_PARTITION;
+            } else if (metadata.size() > config.offsets.max_metadata_size) {
+                partition_response.error_code =
+                    ErrorCode::OFFSET_METADATA_TOO_LARGE;
+            } else {
+                commits.push_back({topic.name, partition.partition_index,
+                                   partition.committed_offset,
+                                   partition.committed_leader_epoch, metadata});
+                committed.push_back(&partition_response);
+            }
+        }
+    }
+
+    // Kafka answers a failed write to its offsets log with NOT_COORDINATOR,
+    // which clients retry.
+    auto fail = [](const auto &partitions) {
+        for (auto *partition : partitions) {
+            partition->error_code = ErrorCode::NOT_COORDINATOR;
+        }
+    };
+    CommitAppend append;
+    try {
+        append = offset_manager.commit(request.group_id, commits);
+        if (append.bytes > 0) {
+            log_flusher.markDirty(offset_manager.log(), append.bytes);
+        }
+    } catch (const std::exception &e) {
+        LOG_ERROR("Failed to commit offsets of group " << request.group_id
+                  << ": " << e.what());
+        fail(committed);
+        commits.clear();
+    }
+
+    // Commits are written the way Kafka writes them, with acks=-1. Only
+    // flushed ones are served, or replace older ones in the log.
+    if (!commits.empty() && config.flush.waitsFor(-1)) {
+        log_flusher.awaitFlush(
+            {offset_manager.log()},
+            [this, append, handle = context.response,
+             response = std::move(response),
+             committed = std::move(committed), fail](bool durable) mutable {
+                if (durable) {
+                    offset_manager.markFlushed(append.end_offset);
+                }
+                offset_manager.completeCommit(append.base_offset, durable);
+                if (!durable) {
+                    fail(committed);
+                }
+                countErrors(response);
+                tcp_manager.completeDeferredResponse(handle,
+                                                     response.toBuffer());
+            });
+        return;
+    }
+
+    if (!commits.empty()) {
+        // The flush policy does not hold the response back, so they are
+        // served right away.
+        offset_manager.completeCommit(append.base_offset, true);
+        log_flusher.awaitFlush({offset_manager.log()},
+                               [this, append](bool durable) {
+                                   if (durable) {
+                                       offset_manager.markFlushed(
+                                           append.end_offset);
+                                   }
+                               });
+    }
+    LOG_DEBUG("Sending msg to client: " << response.toString());
+    countErrors(response);
+    tcp_manager.completeDeferredResponse(context.response, response.toBuffer());
+}
+
+void KafkaApis::handleOffsetFetch(const RequestContext &context) const {
+    // Commits are only served once flushed, and flusher waiters are
+    // released in order: waiting behind the pending ones lets a client read
+    // what it committed just before.
+    if (config.flush.waitsFor(-1) && offset_manager.hasPendingCommits()) {
+        log_flusher.awaitFlush(
+            {offset_manager.log()},
+            [this, handle = context.response,
+             throttle_time_ms = context.throttle_time_ms,
+             frame = std::string(reinterpret_cast<const char *>(
+                                     context.frame.data()),
+                                 context.frame.size())](bool) {
+                try {
+                    tcp_manager.completeDeferredResponse(
+                        handle,
+                        offsetFetchResponse(std::as_bytes(std::span(frame)),
+                                            throttle_time_ms));
+                } catch (const std::exception &e) {
+                    LOG_WARN("Error handling client: " << e.what());
+                    tcp_manager.abortDeferredResponse(handle);
+                }
+            });
+        return;
+    }
+    tcp_manager.completeDeferredResponse(
+        context.response,
+        offsetFetchResponse(context.frame, context.throttle_time_ms));
+}
+
+std::string
+KafkaApis::offsetFetchResponse(std::span<const std::byte> frame,
+                               int32_t throttle_time_ms) const {
+    OffsetFetchRequestMessage request =
+        OffsetFetchRequestMessage::fromBuffer(frame);
+
+    LOG_DEBUG("Received OffsetFetch Request: " << request.toString());
+
+    OffsetFetchResponseMessage response;
+    response.version = request.request_api_version;
+    response.corellation_id = request.corellation_id;
+    response.throttle_time = throttle_time_ms;
+
+    // Partitions nothing was committed for keep the response's defaults:
+    // offset -1 and no error, as in Kafka.
+    std::vector<std::pair<TopicPartition, CommittedOffset>> group_offsets;
+    if (!request.topics) {
+        // Named after these, which outlive the response.
+        group_offsets = offset_manager.groupOffsets(request.group_id);
+        for (auto &[tp, committed] : group_offsets) {
+            if (response.topics.empty() ||
+                response.topics.back().name != tp.topic) {
+                response.topics.emplace_back().name = tp.topic;
+            }
+            response.topics.back().partitions.push_back(
+                {tp.partition, committed.offset, committed.leader_epoch,
+                 std::move(committed.metadata)});
+        }
+    } else {
+        for (const auto &topic : *request.topics) {
+            auto &topic_response = response.topics.emplace_back();
+            topic_response.name = topic.name;
+            for (int32_t partition_index : topic.partition_indexes) {
+                auto &partition_response =
+                    topic_response.partitions.emplace_back();
+                partition_response.partition_index = partition_index;
+                if (auto committed = offset_manager.committedOffset(
+                        request.group_id, topic.name, partition_index)) {
+                    partition_response.committed_offset = committed->offset;
+                    partition_response.committed_leader_epoch =
+                        committed->leader_epoch;
+                    partition_response.metadata =
+                        std::move(committed->metadata);
+                }
+            }
+        }
+    }
+
+    countErrors(response);
+    return response.toBuffer();
+}
+
+void KafkaApis::handleDescribeTopicPartitions(
+    const RequestContext &context) const {
+    auto request =
+        DescribeTopicPartitionsRequestMessage::fromBuffer(context.frame);
+
+    LOG_DEBUG("Received DescribeTopicPartitions Request: "
+              << request.toString());
+
+    // Held until the response is serialized: the response points into it.
+    std::shared_ptr<const MetadataImage> image = metadata_cache.image();
+
+    // Topics are described in name order, like Kafka does, which is what
+    // makes the cursor meaningful. No names means every topic.
+    std::vector<std::pair<std::string_view, const TopicMetadata *>> topics;
+    if (request.topics.empty()) {
+        auto all = request.cursor ? image->topicsFrom(request.cursor->topic_name)
+                                  : image->topics();
+        topics.reserve(all.size());
+        for (const auto &topic : all) {
+            topics.emplace_back(topic.name, &topic);
+        }
+    } else {
+        std::sort(request.topics.begin(), request.topics.end());
+        request.topics.erase(
+            std::unique(request.topics.begin(), request.topics.end()),
+            request.topics.end());
+        for (std::string_view name : request.topics) {
+            topics.emplace_back(name, image->topicByName(name));
+        }
+    }
+
+    DescribeTopicPartitionsResponseMessage response;
+    response.corellation_id = request.corellation_id;
+    response.throttle_time = context.throttle_time_ms;
+
+    int32_t remaining = std::clamp(request.response_partition_limit, 1,
+                                   config.max_request_partition_size_limit);
+
+    for (const auto &[name, topic] : topics) {
+        int32_t first_partition = 0;
+        if (request.cursor) {
+            if (name < request.cursor->topic_name) {
+                continue;
+            }
+            if (name == request.cursor->topic_name) {
+                first_partition = request.cursor->partition_index;
+            }
+        }
+
+        if (remaining == 0) {
+            response.next_cursor = {name, first_partition};
+            break;
+        }
+
+        auto &topic_response = response.topics.emplace_back();
+        topic_response.name = name;
+        if (topic == nullptr) {
+            topic_response.error_code = ErrorCode::UNKNOWN_TOPIC_OR_PARTITION;
+            continue;
+        }
+        topic_response.topic_id = topic->topic_id;
+        topic_response.is_internal = topic->isInternal();
+
+        for (const auto &partition : topic->partitions) {
+            if (partition.partition_index < first_partition) {
+                continue;
+            }
+            if (remaining == 0) {
+                response.next_cursor = {name, partition.partition_index};
+                break;
+            }
+            --remaining;
+
+            auto &partition_response = topic_response.partitions.emplace_back();
+            partition_response.partition_index = partition.partition_index;
+            partition_response.leader_id = partition.leader_id;
+            partition_response.leader_epoch = partition.leader_epoch;
+            partition_response.replica_nodes = partition.replicas;
+            partition_response.isr_nodes = partition.isr;
+            if (partition.eligible_leader_replicas) {
+                partition_response.eligible_leader_replicas =
+                    *partition.eligible_leader_replicas;
+            }
+            if (partition.last_known_elr) {
+                partition_response.last_known_elr = *partition.last_known_elr;
+            }
+        }
+
+        if (response.next_cursor) {
+            break;
+        }
+    }
+
+    countErrors(response);
+    tcp_manager.writeBufferOnClientFd(*context.connection, response);
+}
@@ -0,0 +1,257 @@
+#pragma once
+
+#include "BrokerConfig.h"
+#include "DelayedOperation.h"
+#include "LogFlusher.h"
+#include "LogManager.h"
+#include "Messages.h"
+#include "MetadataCache.h"
+#include "OffsetManager.h"
+#include "QuotaManager.h"
+#include "RequestHandlerPool.h"
+#include "TCPManager.h"
+
+#include <array>
+#include <memory>
+#include <span>
+#include <string_view>
+
+struct ApiDescriptor;
+
+// What a handler gets to work with. The frame is only valid for the
+// duration of the handler call. Handlers on the reactor answer on the
+// connection; the blocking ones run on the request handler pool, where the
+// connection must not be touched, and answer through response instead.
+struct RequestContext {
+    // nullptr on the request handler pool.
+    Connection *connection;
+    const RequestHeader &header;
+    std::span<const std::byte> frame;
+    // Deferred already on the request handler pool.
+    ResponseHandle response;
+    // The client's, nullptr while quotas are off.
+    std::shared_ptr<ClientQuota> quota;
+    // What the request cost the client, for the response's
+    // throttle_time_ms.
+    int32_t throttle_time_ms;
+};
+
+// A fetch detached from its request frame, so that it can still be answered
+// once it has been parked in the purgatory.
+struct FetchParams {
+    struct Topic {
+        // Resolved from topic_id for v13+; empty if the id is unknown.
+        std::string topic;
+        Uuid topic_id;
+        std::vector<FetchRequestMessage::PartitionData> partitions;
+    };
+
+    int16_t version{};
+    int32_t corellation_id{};
+    int32_t max_bytes{};
+    std::vector<Topic> topics;
+
+    static FetchParams fromRequest(const FetchRequestMessage &request,
+                                   const MetadataImage &image);
+};
+
+struct KafkaApis {
+    KafkaApis(const BrokerConfig &_config, TCPManager &_tcp_manager,
+              LogManager &_log_manager, LogFlusher &_log_flusher,
+              const MetadataCache &_metadata_cache,
+              OffsetManager &_offset_manager);
+    ~KafkaApis() = default;
+
+    // Lets the request handler pool finish what it has been given.
+    void shutdown();
+
+    static constexpr int16_t PRODUCE_REQUEST = 0;
+    static constexpr int16_t FETCH_REQUEST = 1;
+    static constexpr int16_t LIST_OFFSETS_REQUEST = 2;
+    static constexpr int16_t OFFSET_COMMIT_REQUEST = 8;
+    static constexpr int16_t OFFSET_FETCH_REQUEST = 9;
+    static constexpr int16_t API_VERSIONS_REQUEST = 18;
+    static constexpr int16_t DESCRIBE_TOPIC_PARTITIONS_REQUEST = 75;
+
+    // Routes a request frame through API_REGISTRY. Unknown keys and
+    // unsupported versions are answered with an error instead of silence.
+    // Records the request's queue and handling time.
+    void classifyRequest(Connection &connection,
+                         std::span<const std::byte> frame) const;
+    void checkApiVersions(const RequestContext &context) const;
+    void handleProduce(const RequestContext &context) const;
+    void handleFetch(const RequestContext &context) const;
+    void handleListOffsets(const RequestContext &context) const;
+    void handleOffsetCommit(const RequestContext &context) const;
+    void handleOffsetFetch(const RequestContext &context) const;
+    void handleDescribeTopicPartitions(const RequestContext &context) const;
+
+  private:
+    void dispatch(Connection &connection, const RequestHeader &request_header,
+                  std::span<const std::byte> frame,
+                  int32_t throttle_time_ms) const;
+    // Charges the request to the quotas of its client_id. Returns the
+    // throttle time its response carries.
+    int32_t recordQuota(Connection &connection,
+                        const RequestHeader &request_header,
+                        size_t frame_size) const;
+    void sendErrorResponse(Connection &connection,
+                           const RequestHeader &request_header,
+                           const ApiDescriptor *api, int16_t error) const;
+    // Hands a blocking request to the request handler pool, with a copy of
+    // its frame.
+    void submitRequest(Connection &connection, const ApiDescriptor &api,
+                       std::span<const std::byte> frame,
+                       int32_t throttle_time_ms) const;
+    // Appends the batches of one partition and fills in its response.
+    // Returns the log appended to, nullptr if nothing was.
+    std::shared_ptr<PartitionLog> appendToPartition(
+        std::string_view topic,
+        const ProduceRequestMessage::PartitionData &partition,
+        ProduceResponseMessage::PartitionResponse &response) const;
+    // Re-checks the fetches parked on tp, through the queues of the
+    // reactors that have any.
+    void completeDelayedFetches(const TopicPartition &tp) const;
+    // Reads every partition of the fetch; bytes_read is the record data in
+    // the response.
+    FetchResponseMessage readFetch(const FetchParams &params,
+                                   uint64_t &bytes_read) const;
+    // Answers the OffsetFetch request in frame.
+    std::string offsetFetchResponse(std::span<const std::byte> frame,
+                                    int32_t throttle_time_ms) const;
+    // Reads up to max_bytes from one partition and fills in its response.
+    // Returns the number of record bytes added.
+    uint64_t readFromPartition(
+        std::string_view topic,
+        const FetchRequestMessage::PartitionData &partition, uint64_t max_bytes,
+        FetchResponseMessage::PartitionData &response) const;
+
+    const BrokerConfig &config;
+    TCPManager &tcp_manager;
+    LogManager &log_manager;
+    LogFlusher &log_flusher;
+    const MetadataCache &metadata_cache;
+    OffsetManager &offset_manager;
+    // Fetches waiting for min_bytes, keyed by the partitions they read. One
+    // per reactor, on that reactor's timer, indexed by Connection::shard().
+    std::vector<std::unique_ptr<DelayedOperationPurgatory>> fetch_purgatories;
+    mutable QuotaManager quotas;
+    // Last, so that it stops before anything its handlers use goes away.
+    mutable RequestHandlerPool request_handlers;
+};
+
+// One row per API the broker serves. Dispatch, header versions and the
+// ApiVersions advertisement are all derived from this table, so adding an
+// API is a matter of adding its handler and a row here.
+struct ApiDescriptor {
+    using Handler = void (KafkaApis::*)(const RequestContext &) const;
+
+    // Versions at or above this use compact encodings and tagged fields.
+    static constexpr int16_t NEVER_FLEXIBLE = INT16_MAX;
+
+    int16_t api_key;
+    // As in Kafka's ApiKeys, used to label metrics.
+    const char *name;
+    int16_t min_version;
+    int16_t max_version;
+    int16_t first_flexible_version;
+    Handler handler;
+    // Runs on the request handler pool: it may wait on the disk, or must
+    // see what the blocking requests before it on its connection did.
+    bool blocking;
+
+    constexpr bool supports(int16_t version) const {
+        return version >= min_version && version <= max_version;
+    }
+    constexpr bool isFlexible(int16_t version) const {
+        return version >= first_flexible_version;
+    }
+    constexpr int16_t requestHeaderVersion(int16_t version) const {
+        return isFlexible(version) ? 2 : 1;
+    }
+    // ApiVersions always answers with a v0 header so that clients can parse
+    // it before they know which versions the broker speaks.
+    constexpr int16_t responseHeaderVersion(int16_t version) const {
+        if (api_key == KafkaApis::API_VERSIONS_REQUEST) {
+            return 0;
+        }
+        return isFlexible(version) ? 1 : 0;
+    }
+};
+
+inline constexpr ApiDescriptor API_REGISTRY[] = {
+    {KafkaApis::PRODUCE_REQUEST, "Produce", 3, 11,
+     ProduceRequestMessage::FIRST_FLEXIBLE_VERSION, &KafkaApis::handleProduce,
+     true},
+    {KafkaApis::FETCH_REQUEST, "Fetch", 4, 16,
+     FetchRequestMessage::FIRST_FLEXIBLE_VERSION, &KafkaApis::handleFetch,
+     true},
+    {KafkaApis::LIST_OFFSETS_REQUEST, "ListOffsets", 1, 7,
+     ListOffsetsRequestMessage::FIRST_FLEXIBLE_VERSION,
+     &KafkaApis::handleListOffsets, true},
+    {KafkaApis::OFFSET_COMMIT_REQUEST, "OffsetCommit", 2, 8,
+     OffsetCommitRequestMessage::FIRST_FLEXIBLE_VERSION,
+     &KafkaApis::handleOffsetCommit, true},
+    {KafkaApis::OFFSET_FETCH_REQUEST, "OffsetFetch", 1, 7,
+     OffsetFetchRequestMessage::FIRST_FLEXIBLE_VERSION,
+     &KafkaApis::handleOffsetFetch, true},
+    {KafkaApis::API_VERSIONS_REQUEST, "ApiVersions", 0, 4,
+     ApiVersionsRequestMessage::FIRST_FLEXIBLE_VERSION,
+     &KafkaApis::checkApiVersions, false},
+    {KafkaApis::DESCRIBE_TOPIC_PARTITIONS_REQUEST, "DescribeTopicPartitions",
+     0, 0,
+     DescribeTopicPartitionsRequestMessage::FIRST_FLEXIBLE_VERSION,
+     &KafkaApis::handleDescribeTopicPartitions, false},
+};
+
+// Flat api key -> API_REGISTRY index table, so dispatch is one load.
+inline constexpr int16_t MAX_API_KEY = 127;
+inline constexpr auto API_LOOKUP = [] {
+    std::array<int8_t, MAX_API_KEY + 1> lookup{};
+    lookup.fill(-1);
+    for (size_t i = 0; i < std::size(API_REGISTRY); ++i) {
+        lookup[API_REGISTRY[i].api_key] = static_cast<int8_t>(i);
+    }
+    return lookup;
+}();
+
+constexpr const ApiDescriptor *findApi(int16_t api_key) {
+    if (api_key < 0 || api_key > MAX_API_KEY || API_LOOKUP[api_key] < 0) {
+        return nullptr;
+    }
+    return &API_REGISTRY[API_LOOKUP[api_key]];
+}
+
+constexpr std::string_view apiName(int16_t api_key) {
+    const ApiDescriptor *api = findApi(api_key);
+    return api != nullptr ? api->name : "Unknown";
+}
+
+// ApiVersions responses only differ by correlation id and throttle time, so
+// every supported request version gets its frame serialized once and
+// requests just copy the image and patch them in.
+struct ApiVersionsResponseCache {
+    static constexpr size_t CORRELATION_ID_OFFSET = sizeof(uint32_t);
+
+    static const ApiVersionsResponseCache &instance();
+
+    // Serialized frame for the given request version. Unsupported versions
+    // get the v0-encoded UNSUPPORTED_VERSION response, as Kafka does.
+    std::string_view image(int16_t version) const;
+    std::string response(int16_t version, int32_t corellation_id) const;
+    // Turns a copy of an image into the response to the given request.
+    static void setCorrelationId(std::span<std::byte> frame,
+                                 int32_t corellation_id);
+    // v0 responses have no throttle time; they are left alone.
+    static void setThrottleTime(std::span<std::byte> frame, int16_t version,
+                                int32_t throttle_time_ms);
+
+  private:
+    ApiVersionsResponseCache();
+
+    static constexpr int16_t MAX_VERSION =
+        findApi(KafkaApis::API_VERSIONS_REQUEST)->max_version;
+
+    std::array<std::string, MAX_VERSION + 1> images;
+    std::string unsupported_image;
+};
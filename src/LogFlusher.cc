@@ -0,0 +1,164 @@
+#include "LogFlusher.h"
+
+#include "Logger.h"
+
+#include <algorithm>
+#include <system_error>
+
+
+LogFlusher::LogFlusher(const FlushConfig &_config) : config(_config) {}
+
+LogFlusher::~LogFlusher() { shutdown(); }
+
+void LogFlusher::start() { thread = std::thread(&LogFlusher::run, this); }
+
+void LogFlusher::shutdown() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wakeup.notify_all();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void LogFlusher::startWindow() {
+    if (!window_open) {
+        window_open = true;
+        window_start = std::chrono::steady_clock::now();
+        wakeup.notify_all();
+    }
+}
+
+void LogFlusher::markDirty(const std::shared_ptr<PartitionLog> &log,
+                           uint64_t bytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    dirty.try_emplace(log.get(), log);
+    dirty_bytes += bytes;
+    startWindow();
+
+    if (dirty_bytes >= config.interval_bytes) {
+        wakeup.notify_all();
+    }
+}
+
+void LogFlusher::awaitFlush(std::vector<std::shared_ptr<PartitionLog>> logs,
+                            Callback callback) {
+    std::lock_guard<std::mutex> guard(lock);
+    waiters.push_back({std::move(logs), std::move(callback)});
+    startWindow();
+}
+
+void LogFlusher::run() {
+    Logger::setThreadName("log-flusher");
+    if (config.io_backend == IoBackend::IO_URING && IoUring::supported()) {
+        ring = std::make_unique<IoUring>(IoUring::DEFAULT_ENTRIES);
+    }
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (true) {
+        wakeup.wait(guard, [this] { return stopping || window_open; });
+        if (!window_open) {
+            break;
+        }
+
+        // Let the window fill up: everything that arrives until it closes
+        // rides on the same sync.
+        auto deadline =
+            window_start + std::chrono::milliseconds(config.interval_ms);
+        wakeup.wait_until(guard, deadline, [this] {
+            return stopping || dirty_bytes >= config.interval_bytes;
+        });
+
+        auto to_flush = std::move(dirty);
+        auto to_release = std::move(waiters);
+        dirty.clear();
+        waiters.clear();
+        dirty_bytes = 0;
+        window_open = false;
+
+        guard.unlock();
+
+        if (ring) {
+            flushLogsOnRing(to_flush);
+        } else {
+            flushLogs(to_flush);
+        }
+
+        // A log fails for good once a sync of it failed, so this also
+        // covers appends a previous window synced.
+        for (const auto &waiter : to_release) {
+            bool durable = std::none_of(
+                waiter.logs.begin(), waiter.logs.end(),
+                [](const auto &log) { return log->hasStorageFailure(); });
+            waiter.callback(durable);
+        }
+
+        guard.lock();
+    }
+}
+
+void LogFlusher::flushLogs(const DirtyLogs &logs) {
+    for (const auto &[ptr, log] : logs) {
+        try {
+            log->flush();
+        } catch (const std::exception &e) {
+            LOG_ERROR("Failed to flush " << log->topicPartition().toString()
+                      << ": " << e.what());
+        }
+    }
+}
+
+void LogFlusher::flushLogsOnRing(const DirtyLogs &logs) {
+    struct Sync {
+        PartitionLog *log;
+        std::shared_ptr<LogSegment> segment;
+        int result = 1;
+    };
+    std::vector<Sync> syncs;
+    for (const auto &[ptr, log] : logs) {
+        try {
+            for (auto &segment : log->takeUnflushedSegments()) {
+                syncs.push_back({ptr, std::move(segment)});
+            }
+        } catch (const std::system_error &e) {
+            LOG_ERROR("Failed to flush " << log->topicPartition().toString()
+                      << ": " << e.what());
+        }
+    }
+
+    for (size_t i = 0; i < syncs.size(); ++i) {
+        struct io_uring_sqe &sqe = ring->nextSqe();
+        sqe.opcode = IORING_OP_FSYNC;
+        sqe.fd = *syncs[i].segment->logFile();
+        sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe.user_data = i;
+    }
+    for (size_t completed = 0; completed < syncs.size();) {
+        ring->submitAndWait(1, -1);
+        completed += ring->forEachCompletion(
+            [&syncs](const struct io_uring_cqe &cqe) {
+                syncs[cqe.user_data].result = cqe.res;
+            });
+    }
+
+    for (const auto &sync : syncs) {
+        try {
+            if (sync.result < 0) {
+                throw std::system_error(-sync.result, std::generic_category(),
+                                        "Failed to flush " +
+                                            sync.segment->logPath());
+            }
+            sync.segment->flushIndex();
+        } catch (const std::exception &e) {
+            // Like PartitionLog::flush(): the segment left the unflushed
+            // list, so nothing would ever sync it again.
+            sync.log->markStorageFailure();
+            LOG_ERROR("Failed to flush "
+                      << sync.log->topicPartition().toString() << ": "
+                      << e.what());
+        }
+    }
+}
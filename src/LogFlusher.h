@@ -0,0 +1,78 @@
+#pragma once
+
+#include "BrokerConfig.h"
+#include "IoUring.h"
+#include "PartitionLog.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Group commit for the partition logs. Appends only mark their log dirty;
+// one background thread syncs every dirty log once per flush window (or
+// earlier once enough bytes pile up) and then releases everybody who was
+// waiting for that data to be durable. Concurrent producers therefore
+// share a single fdatasync per partition instead of paying one each.
+// With the io_uring backend the syncs of all dirty partitions are submitted
+// at once, so the device sees them together rather than one after the
+// other.
+class LogFlusher {
+  public:
+    // Runs on the flusher thread; durable is false if a sync of one of the
+    // logs waited for failed.
+    using Callback = std::function<void(bool durable)>;
+
+    explicit LogFlusher(const FlushConfig &_config);
+    ~LogFlusher();
+
+    LogFlusher(const LogFlusher &) = delete;
+    LogFlusher &operator=(const LogFlusher &) = delete;
+
+    void start();
+    // Syncs whatever is still dirty, completes all waiters and stops.
+    void shutdown();
+
+    // Records bytes appended to log since it was last synced.
+    void markDirty(const std::shared_ptr<PartitionLog> &log, uint64_t bytes);
+    // Calls callback once everything appended to logs before this call is
+    // on disk. A failed sync of some other log does not fail it.
+    void awaitFlush(std::vector<std::shared_ptr<PartitionLog>> logs,
+                    Callback callback);
+
+  private:
+    using DirtyLogs =
+        std::unordered_map<PartitionLog *, std::shared_ptr<PartitionLog>>;
+
+    struct Waiter {
+        std::vector<std::shared_ptr<PartitionLog>> logs;
+        Callback callback;
+    };
+
+    void run();
+    // Caller holds lock; starts the window on the first pending item.
+    void startWindow();
+    // A log that fails to sync is marked (see
+    // PartitionLog::markStorageFailure()), which is what its waiters check.
+    void flushLogs(const DirtyLogs &logs);
+    void flushLogsOnRing(const DirtyLogs &logs);
+
+    FlushConfig config;
+
+    std::mutex lock;
+    std::condition_variable wakeup;
+    DirtyLogs dirty;
+    uint64_t dirty_bytes = 0;
+    std::vector<Waiter> waiters;
+    std::chrono::steady_clock::time_point window_start;
+    bool window_open = false;
+    bool stopping = false;
+
+    // Owned by the flusher thread, with io.backend=io_uring.
+    std::unique_ptr<IoUring> ring;
+    std::thread thread;
+};
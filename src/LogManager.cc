@@ -0,0 +1,215 @@
+#include "LogManager.h"
+
+#include "Logger.h"
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+LogManager::LogManager(const BrokerConfig &_config) : config(_config) {
+    if (config.tail_cache.max_bytes > 0 &&
+        config.tail_cache.partition_max_bytes > 0) {
+        tail_cache = std::make_unique<TailCache>(config.tail_cache);
+    }
+    for (const auto &dir : config.log_dirs) {
+        std::filesystem::create_directories(dir);
+        logs_per_dir[dir] = 0;
+    }
+}
+
+bool LogManager::isValidTopicName(std::string_view name) {
+    if (name.empty() || name.size() > 249 || name == "." || name == "..") {
+        return false;
+    }
+    for (char c : name) {
+        bool legal = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                     (c >= '0' && c <= '9') || c == '.' || c == '_' || c == '-';
+        if (!legal) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void LogManager::loadLogs() {
+    struct PendingLog {
+        TopicPartition tp;
+        std::string path;
+        std::shared_ptr<PartitionLog> log;
+    };
+    // The partitions of one log dir, claimed by its threads one at a time.
+    struct DirRecovery {
+        const std::string *dir;
+        bool clean;
+        std::vector<PendingLog> logs;
+        std::atomic<size_t> next{0};
+    };
+
+    auto started = std::chrono::steady_clock::now();
+    std::vector<std::unique_ptr<DirRecovery>> dirs;
+    for (const auto &dir : config.log_dirs) {
+        auto recovery = std::make_unique<DirRecovery>();
+        recovery->dir = &dir;
+        recovery->clean =
+            std::filesystem::exists(dir + "/" + CLEAN_SHUTDOWN_FILE);
+        for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+            if (!entry.is_directory()) {
+                continue;
+            }
+            auto tp = TopicPartition::fromDirName(
+                entry.path().filename().string());
+            if (tp) {
+                recovery->logs.push_back(
+                    {std::move(*tp), entry.path().string()});
+            }
+        }
+        if (!recovery->clean && !recovery->logs.empty()) {
+            LOG_INFO("No clean shutdown marker in " << dir << ", recovering "
+                     << recovery->logs.size() << " logs");
+        }
+        dirs.push_back(std::move(recovery));
+    }
+
+    size_t threads_per_dir = config.recovery_threads_per_data_dir;
+    if (threads_per_dir == 0) {
+        threads_per_dir = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    std::mutex failure_lock;
+    std::exception_ptr failure;
+    auto recover = [&](DirRecovery &recovery) {
+        while (true) {
+            size_t index = recovery.next.fetch_add(1);
+            if (index >= recovery.logs.size()) {
+                return;
+            }
+            PendingLog &pending = recovery.logs[index];
+            try {
+                pending.log = std::make_shared<PartitionLog>(
+                    pending.tp, pending.path,
+                    config.logConfig(pending.tp.topic), recovery.clean,
+                    tail_cache.get());
+                LOG_INFO("Loaded log " << pending.tp.toString()
+                         << " with end offset "
+                         << pending.log->logEndOffset());
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(failure_lock);
+                if (!failure) {
+                    failure = std::current_exception();
+                }
+                return;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t d = 0; d < dirs.size(); ++d) {
+        size_t count = std::min(threads_per_dir, dirs[d]->logs.size());
+        for (size_t i = 0; i < count; ++i) {
+            std::string name =
+                "log-recovery-" + std::to_string(d) + "-" + std::to_string(i);
+            threads.emplace_back([&, recovery = dirs[d].get(),
+                                  name = std::move(name)] {
+                Logger::setThreadName(name);
+                recover(*recovery);
+            });
+        }
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
+
+    std::unique_lock<std::shared_mutex> guard(lock);
+    size_t loaded = 0;
+    for (const auto &recovery : dirs) {
+        for (auto &pending : recovery->logs) {
+            logs.emplace(std::move(pending.tp), std::move(pending.log));
+            ++logs_per_dir[*recovery->dir];
+            ++loaded;
+        }
+        // From here on the logs are written to again; a crash has to be
+        // recovered from.
+        std::filesystem::remove(*recovery->dir + "/" + CLEAN_SHUTDOWN_FILE);
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started);
+    LOG_INFO("Loaded " << loaded << " logs in " << elapsed.count() << " ms");
+}
+
+std::shared_ptr<PartitionLog>
+LogManager::getLog(const TopicPartition &tp) const {
+    std::shared_lock<std::shared_mutex> guard(lock);
+    auto it = logs.find(tp);
+    return it == logs.end() ? nullptr : it->second;
+}
+
+std::shared_ptr<PartitionLog>
+LogManager::getOrCreateLog(const TopicPartition &tp) {
+    if (auto log = getLog(tp)) {
+        return log;
+    }
+
+    std::unique_lock<std::shared_mutex> guard(lock);
+    auto it = logs.find(tp);
+    if (it != logs.end()) {
+        return it->second;
+    }
+
+    const std::string &dir = nextLogDir();
+    auto log = std::make_shared<PartitionLog>(
+        tp, dir + "/" + tp.toString(), config.logConfig(tp.topic), false,
+        tail_cache.get());
+    ++logs_per_dir[dir];
+    logs.emplace(tp, log);
+    return log;
+}
+
+std::vector<std::shared_ptr<PartitionLog>> LogManager::allLogs() const {
+    std::shared_lock<std::shared_mutex> guard(lock);
+    std::vector<std::shared_ptr<PartitionLog>> result;
+    result.reserve(logs.size());
+    for (const auto &[tp, log] : logs) {
+        result.push_back(log);
+    }
+    return result;
+}
+
+const std::string &LogManager::nextLogDir() const {
+    const std::string *best = &config.log_dirs.front();
+    for (const auto &dir : config.log_dirs) {
+        if (logs_per_dir.at(dir) < logs_per_dir.at(*best)) {
+            best = &dir;
+        }
+    }
+    return *best;
+}
+
+void LogManager::shutdown() {
+    bool clean = true;
+    for (const auto &log : allLogs()) {
+        try {
+            log->close();
+        } catch (const std::exception &e) {
+            LOG_ERROR("Error closing log " << log->topicPartition().toString()
+                      << ": " << e.what());
+            clean = false;
+        }
+    }
+    if (!clean) {
+        return;
+    }
+    for (const auto &dir : config.log_dirs) {
+        std::ofstream marker(dir + "/" + CLEAN_SHUTDOWN_FILE);
+        if (!marker) {
+            LOG_WARN("Failed to write the clean shutdown marker in " << dir);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "BrokerConfig.h"
+#include "PartitionLog.h"
+#include "TailCache.h"
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Owns the partition logs found in (or created under) the configured log
+// directories. A partition lives in <log dir>/<topic>-<partition>, the same
+// layout Kafka uses, so existing data directories can be served directly.
+class LogManager {
+  public:
+    // Left in a log dir once all its logs have been closed, as Kafka does;
+    // its logs skip recovery on the next start.
+    static constexpr const char *CLEAN_SHUTDOWN_FILE = ".kafka_cleanshutdown";
+
+    explicit LogManager(const BrokerConfig &_config);
+
+    // Kafka's rules: 1-249 characters out of [a-zA-Z0-9._-], not "." or "..".
+    static bool isValidTopicName(std::string_view name);
+
+    // Opens every partition directory found in the log dirs, on
+    // num.recovery.threads.per.data.dir threads per dir, recovering them
+    // unless the dir was shut down cleanly.
+    void loadLogs();
+
+    std::shared_ptr<PartitionLog> getLog(const TopicPartition &tp) const;
+    std::shared_ptr<PartitionLog> getOrCreateLog(const TopicPartition &tp);
+    std::vector<std::shared_ptr<PartitionLog>> allLogs() const;
+
+    // Flushes and closes every log, and marks the log dirs clean if that
+    // worked for all of them.
+    void shutdown();
+
+  private:
+    // Directory with the fewest partitions, where new logs are placed.
+    const std::string &nextLogDir() const;
+
+    const BrokerConfig &config;
+    // Shared by all logs; nullptr when log.tail.cache.max.bytes is 0.
+    std::unique_ptr<TailCache> tail_cache;
+    mutable std::shared_mutex lock;
+    std::unordered_map<TopicPartition, std::shared_ptr<PartitionLog>,
+                       TopicPartitionHash>
+        logs;
+    std::unordered_map<std::string, size_t> logs_per_dir;
+};
@@ -0,0 +1,417 @@
+#include "LogSegment.h"
+
+#include "Logger.h"
+#include "RecordBatch.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+#include <vector>
+
+namespace {
+
+std::shared_ptr<const Fd> openLogFile(const std::string &path) {
+    auto fd = std::make_shared<Fd>(
+        open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644));
+    if (*fd < 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to open segment " + path);
+    }
+    return fd;
+}
+
+} // namespace
+
+std::string LogSegment::filenamePrefix(int64_t offset) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020lld",
+                  static_cast<long long>(offset));
+    return name;
+}
+
+LogSegment::LogSegment(const std::string &dir, int64_t _base_offset,
+                       const LogConfig &_config)
+    : base_offset(_base_offset), config(_config),
+      log_path(dir + "/" + filenamePrefix(_base_offset) + ".log"),
+      log_fd(openLogFile(log_path)),
+      index(dir + "/" + filenamePrefix(_base_offset) + ".index", _base_offset,
+            _config.max_index_size),
+      time_index(dir + "/" + filenamePrefix(_base_offset) + ".timeindex",
+                 _base_offset, _config.max_index_size) {
+    struct stat st {};
+    if (fstat(*log_fd, &st) != 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to stat segment " + log_path);
+    }
+    size_bytes.store(st.st_size, std::memory_order_release);
+
+    // Exact for a rolled segment, whose last entry onBecomeInactive() wrote;
+    // checkTail() and recover() bring it up to date for the others.
+    TimeIndex::Entry last = time_index.lastEntry();
+    largest_timestamp.store(last.timestamp, std::memory_order_release);
+    offset_of_largest_timestamp = last.offset;
+}
+
+void LogSegment::append(int64_t assigned_base_offset, int64_t last_offset,
+                        std::span<const std::byte> batch) {
+    uint64_t position = size();
+    int64_t max_timestamp = RecordBatchView(batch).maxTimestamp();
+    if (max_timestamp > largestTimestamp()) {
+        offset_of_largest_timestamp = last_offset;
+    }
+    int64_t largest = std::max(max_timestamp, largestTimestamp());
+
+    // Kafka indexes the batch that crosses the interval, keyed by its last
+    // offset and pointing at its first byte, and records the largest
+    // timestamp so far in the time index at the same point.
+    if (bytes_since_last_index_entry > config.index_interval_bytes &&
+        !index.isFull()) {
+        index.append(last_offset, static_cast<uint32_t>(position));
+        time_index.maybeAppend(largest, offset_of_largest_timestamp);
+        bytes_since_last_index_entry = 0;
+    }
+
+    std::byte offset_field[sizeof(int64_t)];
+    wire::store(offset_field, assigned_base_offset);
+
+    struct iovec iov[2] = {
+        {offset_field, sizeof(offset_field)},
+        {const_cast<std::byte *>(batch.data()) + sizeof(int64_t),
+         batch.size() - sizeof(int64_t)},
+    };
+
+    size_t written = 0;
+    while (written < batch.size()) {
+        ssize_t result =
+            pwritev(*log_fd, iov, 2, static_cast<off_t>(position + written));
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to append to " + log_path);
+        }
+
+        written += result;
+        // Advance the iovecs past what went out.
+        size_t consumed = result;
+        for (auto &vec : iov) {
+            size_t step = std::min(consumed, vec.iov_len);
+            vec.iov_base = static_cast<std::byte *>(vec.iov_base) + step;
+            vec.iov_len -= step;
+            consumed -= step;
+        }
+    }
+
+    bytes_since_last_index_entry += batch.size();
+    size_bytes.store(position + batch.size(), std::memory_order_release);
+    // Only now, so that a search never picks this segment for a batch it
+    // cannot read yet.
+    largest_timestamp.store(largest, std::memory_order_release);
+}
+
+std::optional<BatchPosition> LogSegment::batchAt(uint64_t position) const {
+    uint64_t end = size();
+    if (position + RecordBatchView::HEADER_SIZE > end) {
+        return std::nullopt;
+    }
+
+    std::byte header[RecordBatchView::HEADER_SIZE];
+    ssize_t result = pread(*log_fd, header, sizeof(header),
+                           static_cast<off_t>(position));
+    if (result != static_cast<ssize_t>(sizeof(header))) {
+        return std::nullopt;
+    }
+
+    RecordBatchView batch(header);
+    if (batch.batchLength() <= 0 || position + batch.sizeInBytes() > end) {
+        return std::nullopt;
+    }
+
+    // Pre-v2 message sets carry the last offset in the offset field.
+    bool v2 = batch.magic() >= RecordBatchView::CURRENT_MAGIC;
+    int64_t last_offset = v2 ? batch.lastOffset() : batch.baseOffset();
+    return BatchPosition{batch.baseOffset(), last_offset, position,
+                         batch.sizeInBytes(), v2 ? batch.maxTimestamp() : -1};
+}
+
+std::optional<BatchPosition>
+LogSegment::translateOffset(int64_t target) const {
+    uint64_t position = index.lookup(target).position;
+
+    while (auto batch = batchAt(position)) {
+        if (batch->last_offset >= target) {
+            return batch;
+        }
+        position += batch->size;
+    }
+    return std::nullopt;
+}
+
+std::optional<TimestampAndOffset>
+LogSegment::findOffsetByTimestamp(int64_t target) const {
+    if (largestTimestamp() < target) {
+        return std::nullopt;
+    }
+
+    // Every batch up to the entry's offset is older than target.
+    uint64_t position = index.lookup(time_index.lookup(target).offset).position;
+    std::optional<BatchPosition> found;
+    while ((found = batchAt(position)) && found->max_timestamp < target) {
+        position += found->size;
+    }
+    if (!found) {
+        return std::nullopt;
+    }
+
+    std::vector<std::byte> buffer(found->size);
+    ssize_t result = pread(*log_fd, buffer.data(), buffer.size(),
+                           static_cast<off_t>(found->position));
+    if (result < 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to read " + log_path);
+    }
+    if (static_cast<size_t>(result) != buffer.size()) {
+        return std::nullopt;
+    }
+
+    RecordBatchView batch(buffer);
+    // LogAppendTime batches stamp every record with the batch's timestamp;
+    // compressed ones cannot be walked in place and are answered with their
+    // first offset, which may be a few records early.
+    if (batch.hasLogAppendTime() || batch.compressionType() != 0) {
+        return TimestampAndOffset{batch.maxTimestamp(), batch.baseOffset()};
+    }
+
+    WireReader reader(std::span<const std::byte>(buffer).subspan(
+        RecordBatchView::RECORDS_OFFSET));
+    for (int32_t i = 0; i < batch.recordsCount(); ++i) {
+        Record record = Record::decode(reader);
+        int64_t timestamp = batch.baseTimestamp() + record.timestamp_delta;
+        if (timestamp >= target) {
+            return TimestampAndOffset{timestamp,
+                                      batch.baseOffset() + record.offset_delta};
+        }
+    }
+    // The header's max timestamp disagrees with the records.
+    return TimestampAndOffset{batch.maxTimestamp(), batch.baseOffset()};
+}
+
+int64_t LogSegment::recover() {
+    index.reset();
+    time_index.reset();
+    bytes_since_last_index_entry = 0;
+    int64_t largest = -1;
+    offset_of_largest_timestamp = -1;
+
+    int64_t next_offset = base_offset;
+    uint64_t position = 0;
+    uint64_t end = size();
+    std::vector<std::byte> buffer;
+    size_t needed = 0;
+    bool valid = true;
+
+    while (valid && position < end) {
+        size_t want = std::min<uint64_t>(
+            std::max(RECOVERY_READ_SIZE, needed), end - position);
+        buffer.resize(want);
+        ssize_t result = pread(*log_fd, buffer.data(), want,
+                               static_cast<off_t>(position));
+        if (result < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to read " + log_path);
+        }
+
+        std::span<const std::byte> chunk(buffer.data(), result);
+        size_t consumed = 0;
+        needed = 0;
+
+        while (chunk.size() - consumed >= RecordBatchView::HEADER_SIZE) {
+            RecordBatchView batch(chunk.subspan(consumed));
+            if (batch.batchLength() <= 0) {
+                valid = false;
+                break;
+            }
+            if (batch.sizeInBytes() > chunk.size() - consumed) {
+                // Read again from here with room for the whole batch.
+                needed = batch.sizeInBytes();
+                break;
+            }
+            try {
+                batch.ensureValid();
+            } catch (const WireError &e) {
+                LOG_WARN(log_path << ": " << e.what() << " at position "
+                         << position + consumed);
+                valid = false;
+                break;
+            }
+            if (batch.baseOffset() < next_offset) {
+                LOG_WARN(log_path << ": offset " << batch.baseOffset()
+                         << " goes backwards at position "
+                         << position + consumed);
+                valid = false;
+                break;
+            }
+
+            if (batch.maxTimestamp() > largest) {
+                largest = batch.maxTimestamp();
+                offset_of_largest_timestamp = batch.lastOffset();
+            }
+            if (bytes_since_last_index_entry > config.index_interval_bytes &&
+                !index.isFull()) {
+                index.append(batch.lastOffset(),
+                             static_cast<uint32_t>(position + consumed));
+                time_index.maybeAppend(largest, offset_of_largest_timestamp);
+                bytes_since_last_index_entry = 0;
+            }
+            bytes_since_last_index_entry += batch.sizeInBytes();
+            next_offset = batch.lastOffset() + 1;
+            consumed += batch.sizeInBytes();
+        }
+
+        // Nothing usable in this chunk: a header or batch cut short by the
+        // end of the file.
+        if (consumed == 0 && (needed == 0 || position + needed > end)) {
+            valid = false;
+        }
+        position += consumed;
+    }
+
+    if (position < end) {
+        LOG_WARN("Truncating " << log_path << " from " << end << " to "
+                 << position << " bytes");
+        if (ftruncate(*log_fd, static_cast<off_t>(position)) != 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to truncate " + log_path);
+        }
+        size_bytes.store(position, std::memory_order_release);
+    }
+    largest_timestamp.store(largest, std::memory_order_release);
+    return next_offset;
+}
+
+std::optional<int64_t> LogSegment::checkTail() {
+    uint64_t end = size();
+    bool indexed = index.entries() > 0;
+    OffsetIndex::Entry last_entry = index.lastEntry();
+    if (last_entry.position > end) {
+        return std::nullopt;
+    }
+
+    // The time index was written at the same points as the offset index,
+    // so its last entry covers everything before the last indexed batch.
+    TimeIndex::Entry last_time_entry = time_index.lastEntry();
+    int64_t largest = last_time_entry.timestamp;
+    int64_t offset_of_largest = last_time_entry.offset;
+
+    int64_t next_offset = base_offset;
+    uint64_t position = last_entry.position;
+    while (position < end) {
+        auto batch = batchAt(position);
+        if (!batch) {
+            return std::nullopt;
+        }
+        if (batch->max_timestamp > largest) {
+            largest = batch->max_timestamp;
+            offset_of_largest = batch->last_offset;
+        }
+        if (indexed && position == last_entry.position &&
+            batch->last_offset != last_entry.offset) {
+            return std::nullopt;
+        }
+        // append() would have indexed this batch: entries are missing.
+        if (position - last_entry.position > config.index_interval_bytes &&
+            !index.isFull()) {
+            return std::nullopt;
+        }
+        next_offset = batch->last_offset + 1;
+        position += batch->size;
+    }
+    // An entry for a batch that never made it to the file.
+    if (indexed && next_offset == base_offset) {
+        return std::nullopt;
+    }
+    // Likewise for the time index. One that is empty although the segment
+    // is not was lost, or predates time indexes.
+    if (time_index.entries() == 0 ? end > 0
+                                  : last_time_entry.offset >= next_offset) {
+        return std::nullopt;
+    }
+
+    bytes_since_last_index_entry = end - last_entry.position;
+    largest_timestamp.store(largest, std::memory_order_release);
+    offset_of_largest_timestamp = offset_of_largest;
+    return next_offset;
+}
+
+void LogSegment::forEachBatch(
+    const std::function<void(const RecordBatchView &)> &func) const {
+    uint64_t position = 0;
+    uint64_t end = size();
+    std::vector<std::byte> buffer;
+    size_t needed = 0;
+
+    while (position < end) {
+        size_t want = std::min<uint64_t>(
+            std::max(RECOVERY_READ_SIZE, needed), end - position);
+        buffer.resize(want);
+        ssize_t result = pread(*log_fd, buffer.data(), want,
+                               static_cast<off_t>(position));
+        if (result < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to read " + log_path);
+        }
+
+        std::span<const std::byte> chunk(buffer.data(), result);
+        size_t consumed = 0;
+        needed = 0;
+        while (chunk.size() - consumed >= RecordBatchView::HEADER_SIZE) {
+            RecordBatchView batch(chunk.subspan(consumed));
+            if (batch.batchLength() <= 0) {
+                return;
+            }
+            if (batch.sizeInBytes() > chunk.size() - consumed) {
+                needed = batch.sizeInBytes();
+                break;
+            }
+            func(batch);
+            consumed += batch.sizeInBytes();
+        }
+
+        if (consumed == 0 && (needed == 0 || position + needed > end)) {
+            return;
+        }
+        position += consumed;
+    }
+}
+
+void LogSegment::flush() const {
+    if (fdatasync(*log_fd) != 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "Failed to flush " + log_path);
+    }
+    flushIndex();
+}
+
+void LogSegment::flushIndex() const {
+    index.flush();
+    time_index.flush();
+}
+
+void LogSegment::onBecomeInactive() {
+    time_index.maybeAppend(largestTimestamp(), offset_of_largest_timestamp);
+    index.trimToValidSize();
+    time_index.trimToValidSize();
+}
+
+void LogSegment::deleteFiles() const {
+    std::filesystem::remove(log_path);
+    std::filesystem::remove(index.path());
+    std::filesystem::remove(time_index.path());
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "BrokerConfig.h"
+#include "Fd.h"
+#include "OffsetIndex.h"
+#include "TimeIndex.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+
+class RecordBatchView;
+
+// Where a batch lives inside a segment's .log file.
+struct BatchPosition {
+    int64_t base_offset;
+    int64_t last_offset;
+    uint64_t position;
+    uint64_t size;
+    // -1 for pre-v2 message sets, which have no such header field.
+    int64_t max_timestamp;
+};
+
+// A record found by timestamp: its own timestamp and offset.
+struct TimestampAndOffset {
+    int64_t timestamp;
+    int64_t offset;
+};
+
+// One <base offset>.log file of raw record batches plus its sparse
+// <base offset>.index and <base offset>.timeindex, named and laid out
+// exactly like Kafka's.
+class LogSegment {
+  public:
+    // Recovery reads the segment in chunks of this size.
+    static constexpr size_t RECOVERY_READ_SIZE = 1024 * 1024;
+
+    LogSegment(const std::string &dir, int64_t _base_offset,
+               const LogConfig &_config);
+
+    LogSegment(const LogSegment &) = delete;
+    LogSegment &operator=(const LogSegment &) = delete;
+
+    // 20-digit zero-padded base offset, Kafka's segment file naming.
+    static std::string filenamePrefix(int64_t offset);
+
+    int64_t baseOffset() const { return base_offset; }
+    uint64_t size() const { return size_bytes.load(std::memory_order_acquire); }
+    const std::string &logPath() const { return log_path; }
+    // Shared so that readers (e.g. a pending sendfile) keep the file open
+    // even if the segment is deleted in the meantime.
+    const std::shared_ptr<const Fd> &logFile() const { return log_fd; }
+    OffsetIndex &offsetIndex() { return index; }
+    const OffsetIndex &offsetIndex() const { return index; }
+    const TimeIndex &timeIndex() const { return time_index; }
+    // Largest batch timestamp in the segment, -1 while it is empty.
+    int64_t largestTimestamp() const {
+        return largest_timestamp.load(std::memory_order_acquire);
+    }
+
+    // Appends one batch whose base offset has already been assigned. The
+    // batch's first 8 bytes are replaced by base_offset on the way to disk,
+    // so the caller's buffer is never modified.
+    void append(int64_t base_offset, int64_t last_offset,
+                std::span<const std::byte> batch);
+
+    // First batch whose last offset is >= target, found by an index lookup
+    // followed by a forward scan of at most ~index_interval_bytes.
+    std::optional<BatchPosition> translateOffset(int64_t target) const;
+    // Reads the header of the batch starting at position, if a complete
+    // one is there.
+    std::optional<BatchPosition> batchAt(uint64_t position) const;
+    // First record whose timestamp is >= target, found by a time index
+    // lookup followed by a forward scan of batch headers from the position
+    // of the entry's offset. Nothing if every record is older.
+    std::optional<TimestampAndOffset>
+    findOffsetByTimestamp(int64_t target) const;
+
+    // Validates every batch (framing and CRC-32C) while rebuilding the
+    // index, and truncates the segment after the last valid one: whatever
+    // follows is a torn or corrupt write. Returns the offset after the last
+    // valid batch.
+    int64_t recover();
+    // The cheap alternative to recover() for segments whose data can be
+    // trusted: follows the batch headers from the last index entry to the
+    // end of the file, without reading record data or checking CRCs.
+    // Returns the offset after the last batch, or nothing if the index is
+    // missing or stale or the file does not end on a batch boundary; the
+    // segment then needs recover().
+    std::optional<int64_t> checkTail();
+
+    // Calls func for every complete batch in the file, reading it in chunks
+    // of RECOVERY_READ_SIZE. Nothing is validated; the walk ends at the
+    // first header that does not frame a batch.
+    void forEachBatch(
+        const std::function<void(const RecordBatchView &)> &func) const;
+
+    // fdatasync() of the log, then flushIndex().
+    void flush() const;
+    void flushIndex() const;
+    // The segment stops being written to: index its largest timestamp and
+    // shrink the indexes to their entries.
+    void onBecomeInactive();
+    // Unlinks the .log and index files. Whoever still holds the log file
+    // (see logFile()) reads on from it until they let go.
+    void deleteFiles() const;
+
+  private:
+    int64_t base_offset;
+    LogConfig config;
+    std::string log_path;
+    std::shared_ptr<const Fd> log_fd;
+    std::atomic<uint64_t> size_bytes{0};
+    OffsetIndex index;
+    TimeIndex time_index;
+    uint64_t bytes_since_last_index_entry = 0;
+    std::atomic<int64_t> largest_timestamp{-1};
+    // Writer side only.
+    int64_t offset_of_largest_timestamp = -1;
+};
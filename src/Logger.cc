@@ -0,0 +1,389 @@
+#include "Logger.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <streambuf>
+#include <string_view>
+#include <system_error>
+
+namespace {
+
+constexpr const char *LEVEL_NAMES[] = {"TRACE", "DEBUG", "INFO", "WARN",
+                                       "ERROR"};
+
+// Marks the unused end of a ring when a record did not fit before the wrap.
+constexpr uint8_t PADDING = 0xff;
+
+// One message in a ring, followed by its text. Records are padded to the
+// alignment of the header.
+struct RecordHeader {
+    // Including header and padding.
+    uint32_t size;
+    uint8_t level;
+    uint32_t text_size;
+    int32_t line;
+    int64_t timestamp_us;
+    // A __FILE_NAME__ literal, so it outlives the record.
+    const char *file;
+};
+
+constexpr size_t alignRecord(size_t size) {
+    return (size + alignof(RecordHeader) - 1) & ~(alignof(RecordHeader) - 1);
+}
+
+// Appends to a string that keeps its capacity from one message to the next.
+class MessageBuffer : public std::streambuf {
+  public:
+    void reset() { text.clear(); }
+    std::string_view view() const { return text; }
+
+  protected:
+    int_type overflow(int_type ch) override {
+        if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+            text.push_back(traits_type::to_char_type(ch));
+        }
+        return traits_type::not_eof(ch);
+    }
+    std::streamsize xsputn(const char *data, std::streamsize size) override {
+        text.append(data, size);
+        return size;
+    }
+
+  private:
+    std::string text;
+};
+
+void appendLine(std::string &out, const RecordHeader &header,
+                const std::string &thread_name, std::string_view text) {
+    time_t seconds = header.timestamp_us / 1000000;
+    struct tm time {};
+    gmtime_r(&seconds, &time);
+
+    char prefix[64];
+    int size = snprintf(prefix, sizeof(prefix),
+                        "%04d-%02d-%02dT%02d:%02d:%02d.%06dZ %-5s [",
+                        time.tm_year + 1900, time.tm_mon + 1, time.tm_mday,
+                        time.tm_hour, time.tm_min, time.tm_sec,
+                        static_cast<int>(header.timestamp_us % 1000000),
+                        LEVEL_NAMES[header.level]);
+    out.append(prefix, size);
+    out += thread_name;
+    out += "] ";
+    out += header.file;
+    out += ':';
+    out += std::to_string(header.line);
+    out += ' ';
+
+    while (!text.empty() && text.back() == '\n') {
+        text.remove_suffix(1);
+    }
+    out += text;
+    out += '\n';
+}
+
+} // namespace
+
+// Single-producer, single-consumer ring of variable-size records: the thread
+// that owns it appends at tail, the writer thread consumes from head. Both
+// only ever grow; their difference is the space in use.
+struct LogRing {
+    static constexpr size_t MASK = Logger::RING_SIZE - 1;
+    static_assert((Logger::RING_SIZE & MASK) == 0);
+
+    explicit LogRing(std::string _thread_name)
+        : buffer(std::make_unique<std::byte[]>(Logger::RING_SIZE)),
+          thread_name(std::move(_thread_name)) {}
+
+    // Returns false, leaving the ring untouched, if the record does not fit.
+    bool push(RecordHeader header, std::string_view text) {
+        text = text.substr(0, Logger::RING_SIZE / 4);
+        header.text_size = static_cast<uint32_t>(text.size());
+        header.size = static_cast<uint32_t>(
+            alignRecord(sizeof(RecordHeader) + text.size()));
+
+        uint64_t position = tail.load(std::memory_order_relaxed);
+        size_t offset = position & MASK;
+        size_t contiguous = Logger::RING_SIZE - offset;
+        size_t padding = header.size > contiguous ? contiguous : 0;
+        if (position + padding + header.size -
+                head.load(std::memory_order_acquire) >
+            Logger::RING_SIZE) {
+            return false;
+        }
+
+        if (padding > 0) {
+            // Only size and level are read back from a padding record, and
+            // there is always room for those.
+            RecordHeader marker{static_cast<uint32_t>(padding), PADDING};
+            std::memcpy(buffer.get() + offset, &marker,
+                        std::min(padding, sizeof(marker)));
+            position += padding;
+            offset = 0;
+        }
+
+        std::memcpy(buffer.get() + offset, &header, sizeof(header));
+        std::memcpy(buffer.get() + offset + sizeof(header), text.data(),
+                    text.size());
+        tail.store(position + header.size, std::memory_order_release);
+        return true;
+    }
+
+    // Calls func(header, text) for every record. Returns false if there was
+    // none.
+    template <typename F> bool drain(F &&func) {
+        uint64_t position = head.load(std::memory_order_relaxed);
+        uint64_t end = tail.load(std::memory_order_acquire);
+        if (position == end) {
+            return false;
+        }
+
+        while (position < end) {
+            const std::byte *record = buffer.get() + (position & MASK);
+            RecordHeader header{};
+            std::memcpy(&header, record, offsetof(RecordHeader, text_size));
+            if (header.level != PADDING) {
+                std::memcpy(&header, record, sizeof(header));
+                func(header, std::string_view(reinterpret_cast<const char *>(
+                                                  record + sizeof(header)),
+                                              header.text_size));
+            }
+            position += header.size;
+        }
+        head.store(position, std::memory_order_release);
+        return true;
+    }
+
+    size_t used() const {
+        return tail.load(std::memory_order_relaxed) -
+               head.load(std::memory_order_relaxed);
+    }
+
+    std::unique_ptr<std::byte[]> buffer;
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    const std::string thread_name;
+    // Set once the owning thread is done with the ring; the writer drops it
+    // after draining it.
+    std::atomic<bool> closed{false};
+};
+
+namespace {
+
+struct ThreadLog {
+    ThreadLog() : name(std::to_string(gettid())) {}
+    ~ThreadLog() {
+        if (ring) {
+            ring->closed.store(true, std::memory_order_release);
+        }
+    }
+
+    MessageBuffer buffer;
+    std::ostream stream{&buffer};
+    std::string name;
+    // Created on the first message sent while the writer runs.
+    std::shared_ptr<LogRing> ring;
+};
+
+thread_local ThreadLog thread_log;
+
+} // namespace
+
+Logger &Logger::instance() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::~Logger() {
+    shutdown();
+    if (fd != STDERR_FILENO) {
+        close(fd);
+    }
+}
+
+LogLevel Logger::parseLevel(const std::string &name) {
+    for (size_t level = 0; level < std::size(LEVEL_NAMES); ++level) {
+        if (strcasecmp(name.c_str(), LEVEL_NAMES[level]) == 0) {
+            return static_cast<LogLevel>(level);
+        }
+    }
+    throw std::invalid_argument(name);
+}
+
+void Logger::start(LogLevel level, const std::string &path) {
+    min_level = level;
+
+    if (!path.empty()) {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                  0644);
+        if (fd < 0) {
+            fd = STDERR_FILENO;
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to open log file " + path);
+        }
+    }
+
+    running = true;
+    thread = std::thread(&Logger::run, this);
+}
+
+void Logger::shutdown() {
+    // From here on messages are written synchronously; the writer picks up
+    // what is left in the rings on its way out.
+    running = false;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    wakeup.notify_all();
+
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+void Logger::setThreadName(std::string name) {
+    // The main thread's name is the process name ps and pkill go by.
+    if (gettid() != getpid()) {
+        pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+    }
+
+    // The writer reads the name of a ring without synchronization, so a
+    // renamed thread starts a new ring instead of changing it.
+    ThreadLog &local = thread_log;
+    if (local.ring) {
+        local.ring->closed.store(true, std::memory_order_release);
+        local.ring.reset();
+    }
+    local.name = std::move(name);
+}
+
+std::ostream &Logger::beginMessage() {
+    ThreadLog &local = thread_log;
+    local.buffer.reset();
+    local.stream.clear();
+    return local.stream;
+}
+
+void Logger::endMessage(LogLevel level, const char *file, int line) {
+    ThreadLog &local = thread_log;
+
+    RecordHeader header{};
+    header.level = static_cast<uint8_t>(level);
+    header.line = line;
+    header.file = file;
+    header.timestamp_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+
+    if (!running.load(std::memory_order_acquire)) {
+        std::string out;
+        appendLine(out, header, local.name, local.buffer.view());
+        write(out);
+        return;
+    }
+
+    if (!local.ring) {
+        local.ring = registerRing(local.name);
+    }
+    if (!local.ring->push(header, local.buffer.view())) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // The writer polls, but should not wait for its next round to make
+    // room in a ring that is filling up.
+    if (local.ring->used() > RING_SIZE / 2) {
+        wakeup.notify_one();
+    }
+}
+
+std::shared_ptr<LogRing> Logger::registerRing(const std::string &name) {
+    auto ring = std::make_shared<LogRing>(name);
+    std::lock_guard<std::mutex> guard(lock);
+    rings.push_back(ring);
+    return ring;
+}
+
+void Logger::run() {
+    pthread_setname_np(pthread_self(), "logger");
+
+    std::string out;
+    while (true) {
+        bool stop;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = stopping;
+        }
+
+        out.clear();
+        bool drained = drainRings(out);
+
+        uint64_t now_dropped = dropped.load(std::memory_order_relaxed);
+        if (now_dropped != reported_dropped) {
+            out += "Logger: dropped " +
+                   std::to_string(now_dropped - reported_dropped) +
+                   " messages, log rings were full\n";
+            reported_dropped = now_dropped;
+        }
+        if (!out.empty()) {
+            write(out);
+        }
+
+        // stop was read before draining, so everything logged before
+        // shutdown() is out by now.
+        if (stop) {
+            break;
+        }
+        if (!drained) {
+            std::unique_lock<std::mutex> guard(lock);
+            wakeup.wait_for(guard, std::chrono::milliseconds(IDLE_WAIT_MS),
+                            [this] { return stopping; });
+        }
+    }
+}
+
+bool Logger::drainRings(std::string &out) {
+    std::vector<std::shared_ptr<LogRing>> snapshot;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        snapshot = rings;
+    }
+
+    bool drained = false;
+    for (const auto &ring : snapshot) {
+        // Read before draining: once closed, nothing is pushed any more.
+        bool closed = ring->closed.load(std::memory_order_acquire);
+        drained |= ring->drain(
+            [&](const RecordHeader &header, std::string_view text) {
+                appendLine(out, header, ring->thread_name, text);
+            });
+        if (closed) {
+            std::lock_guard<std::mutex> guard(lock);
+            std::erase(rings, ring);
+        }
+    }
+    return drained;
+}
+
+void Logger::write(const std::string &out) const {
+    size_t written = 0;
+    while (written < out.size()) {
+        ssize_t result =
+            ::write(fd, out.data() + written, out.size() - written);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Nowhere left to report it.
+            return;
+        }
+        written += result;
+    }
+}
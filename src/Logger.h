@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class LogLevel : uint8_t { TRACE, DEBUG, INFO, WARN, ERROR };
+
+// Messages below this level are compiled out, arguments and all. Set with
+// -DKAFKA_LOG_MIN_LEVEL=<0..4> (see LogLevel); the runtime level in
+// logger.level filters what is left.
+#ifndef KAFKA_LOG_MIN_LEVEL
+#define KAFKA_LOG_MIN_LEVEL 0
+#endif
+
+// LOG_INFO("Loaded " << count << " topics"). The stream expression is only
+// evaluated when the level is enabled, so it may call toString() freely.
+#define KAFKA_LOG(level, expr)                                                 \
+    do {                                                                       \
+        if constexpr (static_cast<int>(level) >= KAFKA_LOG_MIN_LEVEL) {        \
+            if (Logger::instance().enabled(level)) {                           \
+                Logger::beginMessage() << expr;                                \
+                Logger::instance().endMessage(level, __FILE_NAME__, __LINE__); \
+            }                                                                  \
+        }                                                                      \
+    } while (0)
+
+#define LOG_TRACE(expr) KAFKA_LOG(LogLevel::TRACE, expr)
+#define LOG_DEBUG(expr) KAFKA_LOG(LogLevel::DEBUG, expr)
+#define LOG_INFO(expr) KAFKA_LOG(LogLevel::INFO, expr)
+#define LOG_WARN(expr) KAFKA_LOG(LogLevel::WARN, expr)
+#define LOG_ERROR(expr) KAFKA_LOG(LogLevel::ERROR, expr)
+
+struct LogRing;
+
+// Asynchronous logger. Every thread formats its messages into a stream of
+// its own and copies them into its own single-producer ring buffer; a
+// background thread drains the rings and writes to stderr or a file. The
+// producer side takes no locks and makes no system calls, and a full ring
+// drops the message (counted, and reported by the writer) rather than
+// blocking the caller.
+//
+// Until start() and after shutdown(), messages are written synchronously.
+class Logger {
+  public:
+    // Per-thread ring size; a larger message is cut to fit.
+    static constexpr size_t RING_SIZE = 1024 * 1024;
+    // How long the writer sleeps when there is nothing to drain.
+    static constexpr int IDLE_WAIT_MS = 10;
+
+    static Logger &instance();
+
+    static LogLevel parseLevel(const std::string &name);
+
+    // path "" means stderr.
+    void start(LogLevel level, const std::string &path);
+    // Writes out whatever is still buffered and stops the writer thread.
+    void shutdown();
+
+    bool enabled(LogLevel level) const {
+        return level >= min_level.load(std::memory_order_relaxed);
+    }
+
+    // Names the calling thread in its messages (e.g. "reactor-3").
+    static void setThreadName(std::string name);
+
+    // Used by the LOG_* macros: the calling thread's stream, emptied...
+    static std::ostream &beginMessage();
+    // ...and its contents handed to the writer.
+    void endMessage(LogLevel level, const char *file, int line);
+
+    uint64_t droppedMessages() const { return dropped; }
+
+  private:
+    Logger() = default;
+    ~Logger();
+
+    void run();
+    // Formats everything buffered in the rings into out. Returns false if
+    // there was nothing.
+    bool drainRings(std::string &out);
+    void write(const std::string &out) const;
+    std::shared_ptr<LogRing> registerRing(const std::string &name);
+
+    std::atomic<LogLevel> min_level{LogLevel::INFO};
+    int fd = 2;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> dropped{0};
+    uint64_t reported_dropped = 0;
+
+    std::mutex lock;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    std::vector<std::shared_ptr<LogRing>> rings;
+    std::thread thread;
+};
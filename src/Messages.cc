@@ -0,0 +1,1012 @@
+#include "Messages.h"
+
+#include <algorithm>
+
+RequestHeader RequestHeader::fromBuffer(std::span<const std::byte> buffer) {
+    WireReader reader(buffer);
+    RequestHeader request_header;
+    request_header.decodeLocal(reader, INT16_MAX);
+    return request_header;
+}
+
+void RequestHeader::decodeLocal(WireReader &reader,
+                                int16_t first_flexible_version) {
+    request_api_key = reader.readInt16();
+    request_api_version = reader.readInt16();
+    corellation_id = reader.readInt32();
+    // client_id keeps the classic int16 length even in v2 headers
+    client_id = reader.readNullableString();
+
+    if (request_api_version >= first_flexible_version) {
+        reader.skipTaggedFields();
+    }
+}
+
+std::string RequestHeader::toString() const {
+    return "RequestHeader{request_api_key=" + std::to_string(request_api_key) +
+           ", request_api_version=" + std::to_string(request_api_version) +
+           ", corellation_id=" + std::to_string(corellation_id) +
+           ", client_id=" + std::string(client_id.value_or("null")) + "}";
+}
+
+ApiVersionsRequestMessage
+ApiVersionsRequestMessage::fromBuffer(std::span<const std::byte> buffer) {
+    WireReader reader(buffer);
+
+    ApiVersionsRequestMessage api_versions_request_message;
+    api_versions_request_message.decodeLocal(reader, FIRST_FLEXIBLE_VERSION);
+
+    if (api_versions_request_message.request_api_version >=
+        FIRST_FLEXIBLE_VERSION) {
+        api_versions_request_message.client_software_name =
+            reader.readCompactString();
+        api_versions_request_message.client_software_version =
+            reader.readCompactString();
+        reader.skipTaggedFields();
+    }
+
+    return api_versions_request_message;
+}
+
+std::string ApiVersionsRequestMessage::toString() const {
+    return "ApiVersionsRequestMessage{" + RequestHeader::toString() +
+           ", client_software_name=" + std::string(client_software_name) +
+           ", client_software_version=" +
+           std::string(client_software_version) + "}";
+}
+
+void ResponseHeader::encode(WireWriter &writer, bool flexible) const {
+    writer.writeInt32(corellation_id);
+    if (flexible) {
+        writer.writeEmptyTaggedFields();
+    }
+}
+
+void ApiVersionsResponseMessage::encode(std::string &buffer) const {
+    bool flexible = version >= FIRST_FLEXIBLE_VERSION;
+
+    WireWriter writer(buffer);
+    size_t frame = writer.beginFrame();
+
+    ResponseHeader::encode(writer, false);
+    writer.writeInt16(error_code);
+
+    writer.writeArrayLength(api_keys.size(), flexible);
+    for (const auto &api_key : api_keys) {
+        writer.writeInt16(api_key.api_key);
+        writer.writeInt16(api_key.min_version);
+        writer.writeInt16(api_key.max_version);
+        if (flexible) {
+            writer.writeEmptyTaggedFields();
+        }
+    }
+
+    // Throttle time, added in v1
+    if (version >= 1) {
+        writer.writeInt32(throttle_time);
+    }
+
+    if (flexible) {
+        writer.writeEmptyTaggedFields();
+    }
+
+    writer.endFrame(frame);
+}
+
+std::string ApiVersionsResponseMessage::toString() const {
+    std::string result = "ApiVersionsResponseMessage{version=" +
+           std::to_string(version) +
+           ", corellation_id=" + std::to_string(corellation_id) +
+           ", error_code=" + std::to_string(error_code) +
+           ", api_keys=[";
+
+    for (size_t i = 0; i < api_keys.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += "{api_key=" + std::to_string(api_keys[i].api_key) +
+                 ", min_version=" + std::to_string(api_keys[i].min_version) +
+                 ", max_version=" + std::to_string(api_keys[i].max_version) + "}";
+    }
+
+    result += "], throttle_time=" + std::to_string(throttle_time) + "}";
+
+    return result;
+}
+
+ProduceRequestMessage
+ProduceRequestMessage::fromBuffer(std::span<const std::byte> buffer) {
+    WireReader reader(buffer);
+
+    ProduceRequestMessage request;
+    request.decodeLocal(reader, FIRST_FLEXIBLE_VERSION);
+    bool flexible = request.request_api_version >= FIRST_FLEXIBLE_VERSION;
+
+    request.transactional_id = reader.readNullableString(flexible);
+    request.acks = reader.readInt16();
+    request.timeout_ms = reader.readInt32();
+
+    request.topics.resize(std::max(reader.readArrayLength(flexible), 0));
+
+    for (auto &topic : request.topics) {
+        topic.name = reader.readString(flexible);
+        topic.partitions.resize(std::max(reader.readArrayLength(flexible), 0));
+
+        for (auto &partition : topic.partitions) {
+            partition.index = reader.readInt32();
+            partition.records = reader.readNullableBytes(flexible);
+            if (flexible) {
+                reader.skipTaggedFields();
+            }
+        }
+
+        if (flexible) {
+            reader.skipTaggedFields();
+        }
+    }
+
+    if (flexible) {
+        reader.skipTaggedFields();
+    }
+
+    return request;
+}
+
+std::string ProduceRequestMessage::toString() const {
+    std::string result = "ProduceRequestMessage{" + RequestHeader::toString() +
+                         ", acks=" + std::to_string(acks) +
+                         ", timeout_ms=" + std::to_string(timeout_ms) +
+                         ", topics=[";
+
+    for (size_t i = 0; i < topics.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += "{name=" + std::string(topics[i].name) + ", partitions=[";
+        for (size_t j = 0; j < topics[i].partitions.size(); ++j) {
+            const auto &partition = topics[i].partitions[j];
+            if (j > 0) result += ", ";
+            result += "{index=" + std::to_string(partition.index) +
+                      ", record_bytes=" +
+                      std::to_string(partition.records ? partition.records->size()
+                                                       : 0) +
+                      "}";
+        }
+        result += "]}";
+    }
+
+    return result + "]}";
+}
+
+void ProduceResponseMessage::encode(std::string &buffer) const {
+    bool flexible = version >= FIRST_FLEXIBLE_VERSION;
+
+    WireWriter writer(buffer);
+    size_t frame = writer.beginFrame();
+
+    ResponseHeader::encode(writer, flexible);
+
+    writer.writeArrayLength(topics.size(), flexible);
+    for (const auto &topic : topics) {
+        writer.writeString(topic.name, flexible);
+
+        writer.writeArrayLength(topic.partitions.size(), flexible);
+        for (const auto &partition : topic.partitions) {
+            writer.writeInt32(partition.index);
+            writer.writeInt16(partition.error_code);
+            writer.writeInt64(partition.base_offset);
+            writer.writeInt64(partition.log_append_time_ms);
+            if (version >= 5) {
+                writer.writeInt64(partition.log_start_offset);
+            }
+            if (version >= 8) {
+                // record_errors: per-batch errors are not reported separately
+                writer.writeArrayLength(0, flexible);
+                writer.writeNullableString(partition.error_message, flexible);
+            }
+            if (flexible) {
+                writer.writeEmptyTaggedFields();
+            }
+        }
+
+        if (flexible) {
+            writer.writeEmptyTaggedFields();
+        }
+    }
+
+    writer.writeInt32(throttle_time);
+
+    if (flexible) {
+        writer.writeEmptyTaggedFields();
+    }
+
+    writer.endFrame(frame);
+}
+
+std::string ProduceResponseMessage::toString() const {
+    std::string result = "ProduceResponseMessage{version=" +
+                         std::to_string(version) +
+                         ", corellation_id=" + std::to_string(corellation_id) +
+                         ", topics=[";
+
+    for (size_t i = 0; i < topics.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += "{name=" + topics[i].name + ", partitions=[";
+        for (size_t j = 0; j < topics[i].partitions.size(); ++j) {
+            const auto &partition = topics[i].partitions[j];
+            if (j > 0) result += ", ";
+            result += "{index=" + std::to_string(partition.index) +
+                      ", error_code=" + std::to_string(partition.error_code) +
+                      ", base_offset=" + std::to_string(partition.base_offset) +
+                      "}";
+        }
+        result += "]}";
+    }
+
+    return result + "], throttle_time=" + std::to_string(throttle_time) + "}";
+}
+
+FetchRequestMessage
+FetchRequestMessage::fromBuffer(std::span<const std::byte> buffer) {
+    WireReader reader(buffer);
+
+    FetchRequestMessage request;
+    request.decodeLocal(reader, FIRST_FLEXIBLE_VERSION);
+    int16_t version = request.request_api_version;
+    bool flexible = version >= FIRST_FLEXIBLE_VERSION;
+
+    if (version < 15) {
+        request.replica_id = reader.readInt32();
+    }
+    request.max_wait_ms = reader.readInt32();
+    request.min_bytes = reader.readInt32();
+    if (version >= 3) {
+        request.max_bytes = reader.readInt32();
+    }
+    if (version >= 4) {
+        request.isolation_level = reader.readInt8();
+    }
+    if (version >= 7) {
+        request.session_id = reader.readInt32();
+        request.session_epoch = reader.readInt32();
+    }
+
+    request.topics.resize(std::max(reader.readArrayLength(flexible), 0));
+
+    for (auto &topic : request.topics) {
+        if (version >= 13) {
+            topic.topic_id = reader.readUuid();
+        } else {
+            topic.topic = reader.readString(flexible);
+        }
+        topic.partitions.resize(std::max(reader.readArrayLength(flexible), 0));
+
+        for (auto &partition : topic.partitions) {
+            partition.partition = reader.readInt32();
+            if (version >= 9) {
+                partition.current_leader_epoch = reader.readInt32();
+            }
+            partition.fetch_offset = reader.readInt64();
+            if (version >= 12) {
+                partition.last_fetched_epoch = reader.readInt32();
+            }
+            if (version >= 5) {
+                partition.log_start_offset = reader.readInt64();
+            }
+            partition.partition_max_bytes = reader.readInt32();
+            if (flexible) {
+                reader.skipTaggedFields();
+            }
+        }
+
+        if (flexible) {
+            reader.skipTaggedFields();
+        }
+    }
+
+    if (version >= 7) {
+        int32_t forgotten = reader.readArrayLength(flexible);
+        for (int32_t i = 0; i < forgotten; ++i) {
+            version >= 13 ? reader.skip(sizeof(Uuid::bytes))
+                          : static_cast<void>(reader.readString(flexible));
+            int32_t partitions = reader.readArrayLength(flexible);
+            reader.skip(std::max(partitions, 0) * sizeof(int32_t));
+            if (flexible) {
+                reader.skipTaggedFields();
+            }
+        }
+    }
+
+    if (version >= 11) {
+        request.rack_id = reader.readString(flexible);
+    }
+
+    if (flexible) {
+        reader.skipTaggedFields();
+    }
+
+    return request;
+}
+
+std::string FetchRequestMessage::toString() const {
+    std::string result = "FetchRequestMessage{" + RequestHeader::toString() +
+                         ", max_wait_ms=" + std::to_string(max_wait_ms) +
+                         ", min_bytes=" + std::to_string(min_bytes) +
+                         ", max_bytes=" + std::to_string(max_bytes) +
+                         ", topics=[";
+
+    for (size_t i = 0; i < topics.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += "{topic=" +
+                  (request_api_version >= 13 ? topics[i].topic_id.toString()
+                                             : std::string(topics[i].topic)) +
+                  ", partitions=[";
+        for (size_t j = 0; j < topics[i].partitions.size(); ++j) {
+            const auto &partition = topics[i].partitions[j];
+            if (j > 0) result += ", ";
+            result += "{partition=" + std::to_string(partition.partition) +
+                      ", fetch_offset=" +
+                      std::to_string(partition.fetch_offset) +
+                      ", partition_max_bytes=" +
+                      std::to_string(partition.partition_max_bytes) + "}";
+        }
+        result += "]}";
+    }
+
+    return result + "]}";
+}
+
+std::vector<OutputChunk> FetchResponseMessage::toChunks() const {
+    bool flexible = version >= FIRST_FLEXIBLE_VERSION;
+
+    std::vector<OutputChunk> chunks;
+    std::string buffer;
+    WireWriter writer(buffer);
+    size_t frame = writer.beginFrame();
+    uint64_t region_bytes = 0;
+
+    ResponseHeader::encode(writer, flexible);
+
+    writer.writeInt32(throttle_time);
+    if (version >= 7) {
+        writer.writeInt16(error_code);
+        writer.writeInt32(session_id);
+    }
+
+    writer.writeArrayLength(responses.size(), flexible);
+    for (const auto &topic : responses) {
+        if (version >= 13) {
+            writer.writeUuid(topic.topic_id);
+        } else {
+            writer.writeString(topic.topic, flexible);
+        }
+
+        writer.writeArrayLength(topic.partitions.size(), flexible);
+        for (const auto &partition : topic.partitions) {
+            writer.writeInt32(partition.partition_index);
+            writer.writeInt16(partition.error_code);
+            writer.writeInt64(partition.high_watermark);
+            writer.writeInt64(partition.last_stable_offset);
+            if (version >= 5) {
+                writer.writeInt64(partition.log_start_offset);
+            }
+            // aborted_transactions: no transactions, so always null
+            flexible ? writer.writeCompactArrayLength(-1)
+                     : writer.writeArrayLength(-1);
+            if (version >= 11) {
+                writer.writeInt32(partition.preferred_read_replica);
+            }
+
+            uint64_t records_size =
+                partition.records ? chunkSize(*partition.records) : 0;
+            flexible ? writer.writeUnsignedVarint(records_size + 1)
+                     : writer.writeInt32(records_size);
+
+            // Cut the buffer here; the batches follow straight from the file
+            // or the cache.
+            if (records_size > 0) {
+                chunks.emplace_back(std::move(buffer));
+                buffer.clear();
+                chunks.emplace_back(*partition.records);
+                region_bytes += records_size;
+            }
+
+            if (flexible) {
+                writer.writeEmptyTaggedFields();
+            }
+        }
+
+        if (flexible) {
+            writer.writeEmptyTaggedFields();
+        }
+    }
+
+    if (flexible) {
+        writer.writeEmptyTaggedFields();
+    }
+    // Before v12 nothing follows the records of the last partition, and an
+    // empty chunk would never be written out.
+    if (!buffer.empty()) {
+        chunks.emplace_back(std::move(buffer));
+    }
+
+    // The size prefix sits at the front of the first chunk and covers every
+    // chunk after it.
+    uint64_t total = region_bytes - sizeof(uint32_t);
+    for (const auto &chunk : chunks) {
+        if (const auto *bytes = std::get_if<std::string>(&chunk)) {
+            total += bytes->size();
+        }
+    }
+    wire::store(std::get<std::string>(chunks.front()).data() + frame,
+                static_cast<uint32_t>(total));
+
+    return chunks;
+}
+
+std::string FetchResponseMessage::toString() const {
+    std::string result = "FetchResponseMessage{version=" +
+                         std::to_string(version) +
+                         ", corellation_id=" + std::to_string(corellation_id) +
+                         ", error_code=" + std::to_string(error_code) +
+                         ", responses=[";
+
+    for (size_t i = 0; i < responses.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += "{topic=" + responses[i].topic + ", partitions=[";
+        for (size_t j = 0; j < responses[i].partitions.size(); ++j) {
+            const auto &partition = responses[i].partitions[j];
+            if (j > 0) result += ", ";
+            result += "{partition_index=" +
+                      std::to_string(partition.partition_index) +
+                      ", error_code=" + std::to_string(partition.error_code) +
+                      ", high_watermark=" +
+                      std::to_string(partition.high_watermark) +
+                      ", record_bytes=" +
+                      std::to_string(partition.records
+                                         ? chunkSize(*partition.records)
+                                         : 0) +
+                      "}";
+        }
+        result += "]}";
+    }
+
+    return result + "]}";
+}
+
+DescribeTopicPartitionsRequestMessage
+DescribeTopicPartitionsRequestMessage::fromBuffer(
+    std::span<const std::byte> buffer) {
+    WireReader reader(buffer);
+
+    DescribeTopicPartitionsRequestMessage request;
+    request.decodeLocal(reader, FIRST_FLEXIBLE_VERSION);
+
+    request.topics.resize(std::max(reader.readCompactArrayLength(), 0));
+    for (auto &topic : request.topics) {
+        topic = reader.readCompactString();
+        reader.skipTaggedFields();
+    }
+
+    request.response_partition_limit = reader.readInt32();
+
+    // Nullable struct: -1 for null, 1 followed by the fields otherwise.
+    if (reader.readInt8() >= 0) {
+        Cursor cursor;
+        cursor.topic_name = reader.readCompactString();
+        cursor.partition_index = reader.readInt32();
+        reader.skipTaggedFields();
+        request.cursor = cursor;
+    }
+
+    reader.skipTaggedFields();
+    return request;
+}
+
+std::string DescribeTopicPartitionsRequestMessage::toString() const {
+    std::string result = "DescribeTopicPartitionsRequestMessage{" +
+                         RequestHeader::toString() + ", topics=[";
+    for (size_t i = 0; i < topics.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += topics[i];
+    }
+    result += "], response_partition_limit=" +
+              std::to_string(response_partition_limit);
+    if (cursor) {
+        result += ", cursor={topic_name=" + std::string(cursor->topic_name) +
+                  ", partition_index=" +
+                  std::to_string(cursor->partition_index) + "}";
+    }
+    return result + "}";
+}
+
+namespace {
+
+void writeCompactInt32Array(WireWriter &writer,
+                            std::span<const int32_t> values) {
+    writer.writeCompactArrayLength(values.size());
+    for (int32_t value : values) {
+        writer.writeInt32(value);
+    }
+}
+
+void writeCompactNullableInt32Array(
+    WireWriter &writer, const std::optional<std::span<const int32_t>> &values) {
+    if (!values) {
+        writer.writeCompactArrayLength(-1);
+        return;
+    }
+    writeCompactInt32Array(writer, *values);
+}
+
+} // namespace
+
+void DescribeTopicPartitionsResponseMessage::encode(std::string &buffer) const {
+    WireWriter writer(buffer);
+    size_t frame = writer.beginFrame();
+
+    ResponseHeader::encode(writer, true);
+
+    writer.writeInt32(throttle_time);
+
+    writer.writeCompactArrayLength(topics.size());
+    for (const auto &topic : topics) {
+        writer.writeInt16(topic.error_code);
+        writer.writeCompactNullableString(topic.name);
+        writer.writeUuid(topic.topic_id);
+        writer.writeBool(topic.is_internal);
+
+        writer.writeCompactArrayLength(topic.partitions.size());
+        for (const auto &partition : topic.partitions) {
+            writer.writeInt16(partition.error_code);
+            writer.writeInt32(partition.partition_index);
+            writer.writeInt32(partition.leader_id);
+            writer.writeInt32(partition.leader_epoch);
+            writeCompactInt32Array(writer, partition.replica_nodes);
+            writeCompactInt32Array(writer, partition.isr_nodes);
+            writeCompactNullableInt32Array(writer,
+                                           partition.eligible_leader_replicas);
+            writeCompactNullableInt32Array(writer, partition.last_known_elr);
+            writeCompactInt32Array(writer, partition.offline_replicas);
+            writer.writeEmptyTaggedFields();
+        }
+
+        writer.writeInt32(topic.topic_authorized_operations);
+        writer.writeEmptyTaggedFields();
+    }
+
+    if (next_cursor) {
+        writer.writeInt8(1);
+        writer.writeCompactString(next_cursor->topic_name);
+        writer.writeInt32(next_cursor->partition_index);
+        writer.writeEmptyTaggedFields();
+    } else {
+        writer.writeInt8(-1);
+    }
+
+    writer.writeEmptyTaggedFields();
+
+    writer.endFrame(frame);
+}
+
+std::string DescribeTopicPartitionsResponseMessage::toString() const {
+    std::string result =
+        "DescribeTopicPartitionsResponseMessage{corellation_id=" +
+        std::to_string(corellation_id) + ", topics=[";
+
+    for (size_t i = 0; i < topics.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += "{name=" + std::string(topics[i].name) +
+                  ", error_code=" + std::to_string(topics[i].error_code) +
+                  ", topic_id=" + topics[i].topic_id.toString() +
+                  ", partitions=" + std::to_string(topics[i].partitions.size()) +
+                  "}";
+    }
+    result += "]";
+    if (next_cursor) {
+        result += ", next_cursor={topic_name=" +
+                  std::string(next_cursor->topic_name) + ", partition_index=" +
+                  std::to_string(next_cursor->partition_index) + "}";
+    }
+    return result + "}";
+}
+
+OffsetCommitRequestMessage
+OffsetCommitRequestMessage::fromBuffer(std::span<const std::byte> buffer) {
+    WireReader reader(buffer);
+
+    OffsetCommitRequestMessage request;
+    request.decodeLocal(reader, FIRST_FLEXIBLE_VERSION);
+    int16_t version = request.request_api_version;
+    bool flexible = version >= FIRST_FLEXIBLE_VERSION;
+
+    request.group_id = reader.readString(flexible);
+    if (version >= 1) {
+        request.generation_id_or_member_epoch = reader.readInt32();
+        request.member_id = reader.readString(flexible);
+    }
+    if (version >= 7) {
+        request.group_instance_id = reader.readNullableString(flexible);
+    }
+    if (version >= 2 && version <= 4) {
+        request.retention_time_ms = reader.readInt64();
+    }
+
+    request.topics.resize(std::max(reader.readArrayLength(flexible), 0));
+    for (auto &topic : request.topics) {
+        topic.name = reader.readString(flexible);
+        topic.partitions.resize(std::max(reader.readArrayLength(flexible), 0));
+
+        for (auto &partition : topic.partitions) {
+            partition.partition_index = reader.readInt32();
+            partition.committed_offset = reader.readInt64();
+            if (version >= 6) {
+                partition.committed_leader_epoch = reader.readInt32();
+            }
+            if (version == 1) {
+                reader.readInt64(); // commit_timestamp
+            }
+            partition.committed_metadata = reader.readNullableString(flexible);
+            if (flexible) {
+                reader.skipTaggedFields();
+            }
+        }
+
+        if (flexible) {
+            reader.skipTaggedFields();
+        }
+    }
+
+    if (flexible) {
+        reader.skipTaggedFields();
+    }
+
+    return request;
+}
+
+std::string OffsetCommitRequestMessage::toString() const {
+    std::string result = "OffsetCommitRequestMessage{" +
+                         RequestHeader::toString() +
+                         ", group_id=" + std::string(group_id) +
+                         ", generation_id_or_member_epoch=" +
+                         std::to_string(generation_id_or_member_epoch) +
+                         ", member_id=" + std::string(member_id) +
+                         ", topics=[";
+
+    for (size_t i = 0; i < topics.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += "{name=" + std::string(topics[i].name) + ", partitions=[";
+        for (size_t j = 0; j < topics[i].partitions.size(); ++j) {
+            const auto &partition = topics[i].partitions[j];
+            if (j > 0) result += ", ";
+            result += "{partition_index=" +
+                      std::to_string(partition.partition_index) +
+                      ", committed_offset=" +
+                      std::to_string(partition.committed_offset) + "}";
+        }
+        result += "]}";
+    }
+
+    return result + "]}";
+}
+
+void OffsetCommitResponseMessage::encode(std::string &buffer) const {
+    bool flexible = version >= FIRST_FLEXIBLE_VERSION;
+
+    WireWriter writer(buffer);
+    size_t frame = writer.beginFrame();
+
+    ResponseHeader::encode(writer, flexible);
+
+    if (version >= 3) {
+        writer.writeInt32(throttle_time);
+    }
+
+    writer.writeArrayLength(topics.size(), flexible);
+    for (const auto &topic : topics) {
+        writer.writeString(topic.name, flexible);
+
+        writer.writeArrayLength(topic.partitions.size(), flexible);
+        for (const auto &partition : topic.partitions) {
+            writer.writeInt32(partition.partition_index);
+            writer.writeInt16(partition.error_code);
+            if (flexible) {
+                writer.writeEmptyTaggedFields();
+            }
+        }
+
+        if (flexible) {
+            writer.writeEmptyTaggedFields();
+        }
+    }
+
+    if (flexible) {
+        writer.writeEmptyTaggedFields();
+    }
+
+    writer.endFrame(frame);
+}
+
+std::string OffsetCommitResponseMessage::toString() const {
+    std::string result = "OffsetCommitResponseMessage{version=" +
+                         std::to_string(version) +
+                         ", corellation_id=" + std::to_string(corellation_id) +
+                         ", topics=[";
+
+    for (size_t i = 0; i < topics.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += "{name=" + topics[i].name + ", partitions=[";
+        for (size_t j = 0; j < topics[i].partitions.size(); ++j) {
+            const auto &partition = topics[i].partitions[j];
+            if (j > 0) result += ", ";
+            result += "{partition_index=" +
+                      std::to_string(partition.partition_index) +
+                      ", error_code=" + std::to_string(partition.error_code) +
+                      "}";
+        }
+        result += "]}";
+    }
+
+    return result + "], throttle_time=" + std::to_string(throttle_time) + "}";
+}
+
+OffsetFetchRequestMessage
+OffsetFetchRequestMessage::fromBuffer(std::span<const std::byte> buffer) {
+    WireReader reader(buffer);
+
+    OffsetFetchRequestMessage request;
+    request.decodeLocal(reader, FIRST_FLEXIBLE_VERSION);
+    int16_t version = request.request_api_version;
+    bool flexible = version >= FIRST_FLEXIBLE_VERSION;
+
+    request.group_id = reader.readString(flexible);
+
+    int32_t topic_count = reader.readArrayLength(flexible);
+    if (topic_count >= 0) {
+        auto &topics = request.topics.emplace(topic_count);
+        for (auto &topic : topics) {
+            topic.name = reader.readString(flexible);
+            topic.partition_indexes.resize(
+                std::max(reader.readArrayLength(flexible), 0));
+            for (auto &partition_index : topic.partition_indexes) {
+                partition_index = reader.readInt32();
+            }
+            if (flexible) {
+                reader.skipTaggedFields();
+            }
+        }
+    }
+
+    if (version >= 7) {
+        request.require_stable = reader.readBool();
+    }
+
+    if (flexible) {
+        reader.skipTaggedFields();
+    }
+
+    return request;
+}
+
+std::string OffsetFetchRequestMessage::toString() const {
+    std::string result = "OffsetFetchRequestMessage{" +
+                         RequestHeader::toString() +
+                         ", group_id=" + std::string(group_id) + ", topics=";
+    if (!topics) {
+        return result + "null}";
+    }
+
+    result += "[";
+    for (size_t i = 0; i < topics->size(); ++i) {
+        const auto &topic = (*topics)[i];
+        if (i > 0) result += ", ";
+        result += "{name=" + std::string(topic.name) + ", partition_indexes=[";
+        for (size_t j = 0; j < topic.partition_indexes.size(); ++j) {
+            if (j > 0) result += ", ";
+            result += std::to_string(topic.partition_indexes[j]);
+        }
+        result += "]}";
+    }
+
+    return result + "]}";
+}
+
+void OffsetFetchResponseMessage::encode(std::string &buffer) const {
+    bool flexible = version >= FIRST_FLEXIBLE_VERSION;
+
+    WireWriter writer(buffer);
+    size_t frame = writer.beginFrame();
+
+    ResponseHeader::encode(writer, flexible);
+
+    if (version >= 3) {
+        writer.writeInt32(throttle_time);
+    }
+
+    writer.writeArrayLength(topics.size(), flexible);
+    for (const auto &topic : topics) {
+        writer.writeString(topic.name, flexible);
+
+        writer.writeArrayLength(topic.partitions.size(), flexible);
+        for (const auto &partition : topic.partitions) {
+            writer.writeInt32(partition.partition_index);
+            writer.writeInt64(partition.committed_offset);
+            if (version >= 5) {
+                writer.writeInt32(partition.committed_leader_epoch);
+            }
+            writer.writeString(partition.metadata, flexible);
+            writer.writeInt16(partition.error_code);
+            if (flexible) {
+                writer.writeEmptyTaggedFields();
+            }
+        }
+
+        if (flexible) {
+            writer.writeEmptyTaggedFields();
+        }
+    }
+
+    if (version >= 2) {
+        writer.writeInt16(error_code);
+    }
+
+    if (flexible) {
+        writer.writeEmptyTaggedFields();
+    }
+
+    writer.endFrame(frame);
+}
+
+std::string OffsetFetchResponseMessage::toString() const {
+    std::string result = "OffsetFetchResponseMessage{version=" +
+                         std::to_string(version) +
+                         ", corellation_id=" + std::to_string(corellation_id) +
+                         ", error_code=" + std::to_string(error_code) +
+                         ", topics=[";
+
+    for (size_t i = 0; i < topics.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += "{name=" + std::string(topics[i].name) + ", partitions=[";
+        for (size_t j = 0; j < topics[i].partitions.size(); ++j) {
+            const auto &partition = topics[i].partitions[j];
+            if (j > 0) result += ", ";
+            result += "{partition_index=" +
+                      std::to_string(partition.partition_index) +
+                      ", committed_offset=" +
+                      std::to_string(partition.committed_offset) +
+                      ", error_code=" + std::to_string(partition.error_code) +
+                      "}";
+        }
+        result += "]}";
+    }
+
+    return result + "]}";
+}
+
+ListOffsetsRequestMessage
+ListOffsetsRequestMessage::fromBuffer(std::span<const std::byte> buffer) {
+    WireReader reader(buffer);
+
+    ListOffsetsRequestMessage request;
+    request.decodeLocal(reader, FIRST_FLEXIBLE_VERSION);
+    int16_t version = request.request_api_version;
+    bool flexible = version >= FIRST_FLEXIBLE_VERSION;
+
+    request.replica_id = reader.readInt32();
+    if (version >= 2) {
+        request.isolation_level = reader.readInt8();
+    }
+
+    request.topics.resize(std::max(reader.readArrayLength(flexible), 0));
+    for (auto &topic : request.topics) {
+        topic.name = reader.readString(flexible);
+        topic.partitions.resize(std::max(reader.readArrayLength(flexible), 0));
+
+        for (auto &partition : topic.partitions) {
+            partition.partition_index = reader.readInt32();
+            if (version >= 4) {
+                partition.current_leader_epoch = reader.readInt32();
+            }
+            partition.timestamp = reader.readInt64();
+            if (flexible) {
+                reader.skipTaggedFields();
+            }
+        }
+
+        if (flexible) {
+            reader.skipTaggedFields();
+        }
+    }
+
+    if (flexible) {
+        reader.skipTaggedFields();
+    }
+
+    return request;
+}
+
+std::string ListOffsetsRequestMessage::toString() const {
+    std::string result = "ListOffsetsRequestMessage{" +
+                         RequestHeader::toString() +
+                         ", replica_id=" + std::to_string(replica_id) +
+                         ", isolation_level=" +
+                         std::to_string(isolation_level) + ", topics=[";
+
+    for (size_t i = 0; i < topics.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += "{name=" + std::string(topics[i].name) + ", partitions=[";
+        for (size_t j = 0; j < topics[i].partitions.size(); ++j) {
+            const auto &partition = topics[i].partitions[j];
+            if (j > 0) result += ", ";
+            result += "{partition_index=" +
+                      std::to_string(partition.partition_index) +
+                      ", timestamp=" + std::to_string(partition.timestamp) +
+                      "}";
+        }
+        result += "]}";
+    }
+
+    return result + "]}";
+}
+
+void ListOffsetsResponseMessage::encode(std::string &buffer) const {
+    bool flexible = version >= FIRST_FLEXIBLE_VERSION;
+
+    WireWriter writer(buffer);
+    size_t frame = writer.beginFrame();
+
+    ResponseHeader::encode(writer, flexible);
+
+    if (version >= 2) {
+        writer.writeInt32(throttle_time);
+    }
+
+    writer.writeArrayLength(topics.size(), flexible);
+    for (const auto &topic : topics) {
+        writer.writeString(topic.name, flexible);
+
+        writer.writeArrayLength(topic.partitions.size(), flexible);
+        for (const auto &partition : topic.partitions) {
+            writer.writeInt32(partition.partition_index);
+            writer.writeInt16(partition.error_code);
+            writer.writeInt64(partition.timestamp);
+            writer.writeInt64(partition.offset);
+            if (version >= 4) {
+                writer.writeInt32(partition.leader_epoch);
+            }
+            if (flexible) {
+                writer.writeEmptyTaggedFields();
+            }
+        }
+
+        if (flexible) {
+            writer.writeEmptyTaggedFields();
+        }
+    }
+
+    if (flexible) {
+        writer.writeEmptyTaggedFields();
+    }
+
+    writer.endFrame(frame);
+}
+
+std::string ListOffsetsResponseMessage::toString() const {
+    std::string result = "ListOffsetsResponseMessage{version=" +
+                         std::to_string(version) +
+                         ", corellation_id=" + std::to_string(corellation_id) +
+                         ", topics=[";
+
+    for (size_t i = 0; i < topics.size(); ++i) {
+        if (i > 0) result += ", ";
+        result += "{name=" + std::string(topics[i].name) + ", partitions=[";
+        for (size_t j = 0; j < topics[i].partitions.size(); ++j) {
+            const auto &partition = topics[i].partitions[j];
+            if (j > 0) result += ", ";
+            result += "{partition_index=" +
+                      std::to_string(partition.partition_index) +
+                      ", error_code=" + std::to_string(partition.error_code) +
+                      ", timestamp=" + std::to_string(partition.timestamp) +
+                      ", offset=" + std::to_string(partition.offset) + "}";
+        }
+        result += "]}";
+    }
+
+    return result + "]}";
+}
@@ -0,0 +1,461 @@
+#pragma once
+
+#include "FileRegion.h"
+#include "WireCodec.h"
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Request and response types of the Kafka protocol. Requests are decoded in
+// place from the frame handed over by the connection (size prefix excluded),
+// so string fields are views that stay valid only while the frame does.
+
+// Error codes from the Kafka protocol (see org.apache.kafka.common.protocol.Errors).
+namespace ErrorCode {
+inline constexpr int16_t NONE = 0;
+inline constexpr int16_t OFFSET_OUT_OF_RANGE = 1;
+inline constexpr int16_t CORRUPT_MESSAGE = 2;
+inline constexpr int16_t UNKNOWN_TOPIC_OR_PARTITION = 3;
+inline constexpr int16_t OFFSET_METADATA_TOO_LARGE = 12;
+inline constexpr int16_t NOT_COORDINATOR = 16;
+inline constexpr int16_t INVALID_TOPIC_EXCEPTION = 17;
+inline constexpr int16_t INVALID_REQUIRED_ACKS = 21;
+inline constexpr int16_t INVALID_GROUP_ID = 24;
+inline constexpr int16_t UNSUPPORTED_VERSION = 35;
+inline constexpr int16_t INVALID_REQUEST = 42;
+inline constexpr int16_t KAFKA_STORAGE_ERROR = 56;
+inline constexpr int16_t UNKNOWN_TOPIC_ID = 100;
+} // namespace ErrorCode
+
+struct RequestHeader {
+    int16_t request_api_key{};
+    int16_t request_api_version{};
+    int32_t corellation_id{};
+    NullableString client_id{};
+
+    // Decodes just the v1 fields, which is enough to route a request.
+    static RequestHeader fromBuffer(std::span<const std::byte> buffer);
+    // Decodes the header and, from first_flexible_version on, the tagged
+    // fields that make it a v2 header.
+    void decodeLocal(WireReader &reader, int16_t first_flexible_version);
+    std::string toString() const;
+};
+
+struct ApiVersionsRequestMessage : RequestHeader {
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 3;
+
+    std::string_view client_software_name;
+    std::string_view client_software_version;
+
+    static ApiVersionsRequestMessage
+    fromBuffer(std::span<const std::byte> buffer);
+    std::string toString() const;
+};
+
+struct ResponseHeader {
+    int32_t corellation_id{};
+
+    // v0 is just the correlation id; v1 adds tagged fields.
+    void encode(WireWriter &writer, bool flexible) const;
+};
+
+struct ApiVersionsResponseMessage : ResponseHeader {
+    // First version that uses compact arrays and tagged fields.
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 3;
+
+    // Request version this response answers; selects the wire layout.
+    int16_t version{};
+    int16_t error_code{};
+
+    // Array of API key entries
+    struct ApiKeyEntry {
+        int16_t api_key{};
+        int16_t min_version{};
+        int16_t max_version{};
+    };
+
+    std::vector<ApiKeyEntry> api_keys;
+
+    int32_t throttle_time = 0;
+
+    // Appends the whole frame, size prefix included. The response header
+    // is always v0 for ApiVersions, even for flexible versions.
+    void encode(std::string &buffer) const;
+    std::string toBuffer() const {
+        std::string buffer;
+        encode(buffer);
+        return buffer;
+    }
+    std::string toString() const;
+};
+
+struct ProduceRequestMessage : RequestHeader {
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 9;
+
+    struct PartitionData {
+        int32_t index{};
+        // Raw record batches, still in the request frame.
+        NullableBytes records;
+    };
+
+    struct TopicData {
+        std::string_view name;
+        std::vector<PartitionData> partitions;
+    };
+
+    NullableString transactional_id;
+    int16_t acks{};
+    int32_t timeout_ms{};
+    std::vector<TopicData> topics;
+
+    static ProduceRequestMessage fromBuffer(std::span<const std::byte> buffer);
+    std::string toString() const;
+};
+
+struct ProduceResponseMessage : ResponseHeader {
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 9;
+
+    struct PartitionResponse {
+        int32_t index{};
+        int16_t error_code{};
+        int64_t base_offset = -1;
+        int64_t log_append_time_ms = -1;
+        int64_t log_start_offset = -1;
+        NullableString error_message;
+    };
+
+    struct TopicResponse {
+        // Owned: the response may be sent after the request frame is gone.
+        std::string name;
+        std::vector<PartitionResponse> partitions;
+    };
+
+    int16_t version{};
+    std::vector<TopicResponse> topics;
+    int32_t throttle_time = 0;
+
+    // Appends the whole frame, size prefix included.
+    void encode(std::string &buffer) const;
+    std::string toBuffer() const {
+        std::string buffer;
+        encode(buffer);
+        return buffer;
+    }
+    std::string toString() const;
+};
+
+struct FetchRequestMessage : RequestHeader {
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 12;
+
+    struct PartitionData {
+        int32_t partition{};
+        int32_t current_leader_epoch = -1;
+        int64_t fetch_offset{};
+        int32_t last_fetched_epoch = -1;
+        int64_t log_start_offset = -1;
+        int32_t partition_max_bytes{};
+    };
+
+    struct TopicData {
+        // Up to v12 topics are named, from v13 on they are identified by id.
+        std::string_view topic;
+        Uuid topic_id;
+        std::vector<PartitionData> partitions;
+    };
+
+    // Replaced by the replica_state tagged field in v15.
+    int32_t replica_id = -1;
+    int32_t max_wait_ms{};
+    int32_t min_bytes{};
+    int32_t max_bytes = INT32_MAX;
+    int8_t isolation_level{};
+    int32_t session_id{};
+    int32_t session_epoch = -1;
+    std::vector<TopicData> topics;
+    // Forgotten topics only matter to fetch sessions, which the broker does
+    // not keep; they are decoded and dropped.
+    std::string_view rack_id;
+
+    static FetchRequestMessage fromBuffer(std::span<const std::byte> buffer);
+    std::string toString() const;
+};
+
+struct FetchResponseMessage : ResponseHeader {
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 12;
+
+    struct PartitionData {
+        int32_t partition_index{};
+        int16_t error_code{};
+        int64_t high_watermark = -1;
+        int64_t last_stable_offset = -1;
+        int64_t log_start_offset = -1;
+        int32_t preferred_read_replica = -1;
+        // Record batches, still in the segment file or in the tail cache.
+        // Empty when nothing was read.
+        std::optional<OutputChunk> records;
+    };
+
+    struct TopicResponse {
+        std::string topic;
+        Uuid topic_id;
+        std::vector<PartitionData> partitions;
+    };
+
+    int16_t version{};
+    int32_t throttle_time = 0;
+    int16_t error_code{};
+    int32_t session_id{};
+    std::vector<TopicResponse> responses;
+
+    // Serializes the frame around the record data: the returned chunks
+    // alternate between encoded fields and file regions, and the size prefix
+    // of the first chunk already accounts for the regions.
+    std::vector<OutputChunk> toChunks() const;
+    std::string toString() const;
+};
+
+struct DescribeTopicPartitionsRequestMessage : RequestHeader {
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 0;
+
+    // Where the previous, truncated response stopped.
+    struct Cursor {
+        std::string_view topic_name;
+        int32_t partition_index{};
+    };
+
+    // Empty means every topic.
+    std::vector<std::string_view> topics;
+    int32_t response_partition_limit = 2000;
+    std::optional<Cursor> cursor;
+
+    static DescribeTopicPartitionsRequestMessage
+    fromBuffer(std::span<const std::byte> buffer);
+    std::string toString() const;
+};
+
+// Topic names and node lists are views (into the request frame or the
+// metadata image); serialize the response before either goes away.
+struct DescribeTopicPartitionsResponseMessage : ResponseHeader {
+    // Topic operations allowed without an authorizer: READ, WRITE, CREATE,
+    // DELETE, ALTER, DESCRIBE, DESCRIBE_CONFIGS and ALTER_CONFIGS.
+    static constexpr int32_t ALL_TOPIC_OPERATIONS = 0x0df8;
+
+    struct Partition {
+        int16_t error_code{};
+        int32_t partition_index{};
+        int32_t leader_id = -1;
+        int32_t leader_epoch = -1;
+        std::span<const int32_t> replica_nodes;
+        std::span<const int32_t> isr_nodes;
+        std::optional<std::span<const int32_t>> eligible_leader_replicas;
+        std::optional<std::span<const int32_t>> last_known_elr;
+        std::span<const int32_t> offline_replicas;
+    };
+
+    struct Topic {
+        int16_t error_code{};
+        std::string_view name;
+        Uuid topic_id;
+        bool is_internal = false;
+        std::vector<Partition> partitions;
+        int32_t topic_authorized_operations = ALL_TOPIC_OPERATIONS;
+    };
+
+    struct Cursor {
+        std::string_view topic_name;
+        int32_t partition_index{};
+    };
+
+    int32_t throttle_time = 0;
+    std::vector<Topic> topics;
+    std::optional<Cursor> next_cursor;
+
+    // Appends the whole frame, size prefix included.
+    void encode(std::string &buffer) const;
+    std::string toBuffer() const {
+        std::string buffer;
+        encode(buffer);
+        return buffer;
+    }
+    std::string toString() const;
+};
+
+struct OffsetCommitRequestMessage : RequestHeader {
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 8;
+
+    struct PartitionData {
+        int32_t partition_index{};
+        int64_t committed_offset{};
+        int32_t committed_leader_epoch = -1;
+        NullableString committed_metadata;
+    };
+
+    struct TopicData {
+        std::string_view name;
+        std::vector<PartitionData> partitions;
+    };
+
+    std::string_view group_id;
+    // Without a group coordinator these are not checked: every commit is
+    // taken as one from a standalone consumer.
+    int32_t generation_id_or_member_epoch = -1;
+    std::string_view member_id;
+    NullableString group_instance_id;
+    // v2-v4; offsets are kept until they are overwritten.
+    int64_t retention_time_ms = -1;
+    std::vector<TopicData> topics;
+
+    static OffsetCommitRequestMessage
+    fromBuffer(std::span<const std::byte> buffer);
+    std::string toString() const;
+};
+
+struct OffsetCommitResponseMessage : ResponseHeader {
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 8;
+
+    struct PartitionResponse {
+        int32_t partition_index{};
+        int16_t error_code{};
+    };
+
+    struct TopicResponse {
+        // Owned: the response may be sent after the request frame is gone.
+        std::string name;
+        std::vector<PartitionResponse> partitions;
+    };
+
+    int16_t version{};
+    int32_t throttle_time = 0;
+    std::vector<TopicResponse> topics;
+
+    // Appends the whole frame, size prefix included.
+    void encode(std::string &buffer) const;
+    std::string toBuffer() const {
+        std::string buffer;
+        encode(buffer);
+        return buffer;
+    }
+    std::string toString() const;
+};
+
+struct OffsetFetchRequestMessage : RequestHeader {
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 6;
+
+    struct TopicData {
+        std::string_view name;
+        std::vector<int32_t> partition_indexes;
+    };
+
+    std::string_view group_id;
+    // Null (v2+) asks for every partition the group has committed to.
+    std::optional<std::vector<TopicData>> topics;
+    // Commits are visible as soon as they are logged, so there are no
+    // unstable offsets to wait for.
+    bool require_stable = false;
+
+    static OffsetFetchRequestMessage
+    fromBuffer(std::span<const std::byte> buffer);
+    std::string toString() const;
+};
+
+// Topic names are views (into the request frame or the offsets the handler
+// looked up); serialize the response before either goes away.
+struct OffsetFetchResponseMessage : ResponseHeader {
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 6;
+
+    struct PartitionResponse {
+        int32_t partition_index{};
+        // -1 when nothing has been committed.
+        int64_t committed_offset = -1;
+        int32_t committed_leader_epoch = -1;
+        std::string metadata;
+        int16_t error_code{};
+    };
+
+    struct TopicResponse {
+        std::string_view name;
+        std::vector<PartitionResponse> partitions;
+    };
+
+    int16_t version{};
+    int32_t throttle_time = 0;
+    std::vector<TopicResponse> topics;
+    int16_t error_code{};
+
+    // Appends the whole frame, size prefix included.
+    void encode(std::string &buffer) const;
+    std::string toBuffer() const {
+        std::string buffer;
+        encode(buffer);
+        return buffer;
+    }
+    std::string toString() const;
+};
+
+struct ListOffsetsRequestMessage : RequestHeader {
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 6;
+
+    // Timestamps with a special meaning: the log end, the log start, and
+    // (v7+) the record with the largest timestamp.
+    static constexpr int64_t LATEST_TIMESTAMP = -1;
+    static constexpr int64_t EARLIEST_TIMESTAMP = -2;
+    static constexpr int64_t MAX_TIMESTAMP = -3;
+
+    struct PartitionData {
+        int32_t partition_index{};
+        int32_t current_leader_epoch = -1;
+        int64_t timestamp{};
+    };
+
+    struct TopicData {
+        std::string_view name;
+        std::vector<PartitionData> partitions;
+    };
+
+    int32_t replica_id{};
+    // There are no transactions, so the last stable offset is the log end
+    // either way.
+    int8_t isolation_level{};
+    std::vector<TopicData> topics;
+
+    static ListOffsetsRequestMessage
+    fromBuffer(std::span<const std::byte> buffer);
+    std::string toString() const;
+};
+
+// Topic names are views into the request frame; serialize the response
+// before it goes away.
+struct ListOffsetsResponseMessage : ResponseHeader {
+    static constexpr int16_t FIRST_FLEXIBLE_VERSION = 6;
+
+    struct PartitionResponse {
+        int32_t partition_index{};
+        int16_t error_code{};
+        int64_t timestamp = -1;
+        // -1 when no record is at or past the requested timestamp.
+        int64_t offset = -1;
+        int32_t leader_epoch = -1;
+    };
+
+    struct TopicResponse {
+        std::string_view name;
+        std::vector<PartitionResponse> partitions;
+    };
+
+    int16_t version{};
+    int32_t throttle_time = 0;
+    std::vector<TopicResponse> topics;
+
+    // Appends the whole frame, size prefix included.
+    void encode(std::string &buffer) const;
+    std::string toBuffer() const {
+        std::string buffer;
+        encode(buffer);
+        return buffer;
+    }
+    std::string toString() const;
+};
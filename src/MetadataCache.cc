@@ -0,0 +1,282 @@
+#include "MetadataCache.h"
+
+#include "Logger.h"
+#include "RecordBatch.h"
+
+#include <algorithm>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+
+std::vector<int32_t> readInt32Array(WireReader &reader) {
+    int32_t length = reader.readCompactArrayLength();
+    std::vector<int32_t> values(std::max(length, 0));
+    for (auto &value : values) {
+        value = reader.readInt32();
+    }
+    return values;
+}
+
+std::optional<std::vector<int32_t>> readNullableInt32Array(WireReader &reader) {
+    int32_t length = reader.readCompactArrayLength();
+    if (length < 0) {
+        return std::nullopt;
+    }
+    std::vector<int32_t> values(length);
+    for (auto &value : values) {
+        value = reader.readInt32();
+    }
+    return values;
+}
+
+// First partition whose index is >= index; partitions are kept sorted.
+template <typename Partitions>
+auto lowerBoundPartition(Partitions &partitions, int32_t index) {
+    return std::lower_bound(partitions.begin(), partitions.end(), index,
+                            [](const auto &partition, int32_t i) {
+                                return partition.partition_index < i;
+                            });
+}
+
+} // namespace
+
+const TopicPartition MetadataCache::METADATA_TOPIC_PARTITION{
+    "__cluster_metadata", 0};
+
+const PartitionMetadata *TopicMetadata::partition(int32_t partition_index) const {
+    auto it = lowerBoundPartition(partitions, partition_index);
+    if (it == partitions.end() || it->partition_index != partition_index) {
+        return nullptr;
+    }
+    return &*it;
+}
+
+const TopicMetadata *MetadataImage::topicByName(std::string_view name) const {
+    auto it = by_name.find(name);
+    return it == by_name.end() ? nullptr : it->second;
+}
+
+const TopicMetadata *MetadataImage::topicById(const Uuid &topic_id) const {
+    auto it = by_id.find(topic_id);
+    return it == by_id.end() ? nullptr : it->second;
+}
+
+std::span<const TopicMetadata>
+MetadataImage::topicsFrom(std::string_view name) const {
+    auto it = std::lower_bound(
+        sorted_topics.begin(), sorted_topics.end(), name,
+        [](const auto &topic, std::string_view n) { return topic.name < n; });
+    return {it, sorted_topics.end()};
+}
+
+void MetadataImageBuilder::apply(std::span<const std::byte> record) {
+    WireReader reader(record);
+    reader.readInt8(); // frame version
+    int8_t type = reader.readInt8();
+    int8_t version = reader.readInt8();
+
+    switch (type) {
+    case TOPIC_RECORD:
+        applyTopicRecord(reader);
+        break;
+    case PARTITION_RECORD:
+        applyPartitionRecord(reader, version);
+        break;
+    case PARTITION_CHANGE_RECORD:
+        applyPartitionChangeRecord(reader);
+        break;
+    case REMOVE_TOPIC_RECORD:
+        applyRemoveTopicRecord(reader);
+        break;
+    default:
+        break;
+    }
+}
+
+void MetadataImageBuilder::applyTopicRecord(WireReader &reader) {
+    std::string_view name = reader.readCompactString();
+    Uuid topic_id = reader.readUuid();
+
+    auto &topic = topics[topic_id];
+    topic.name = name;
+    topic.topic_id = topic_id;
+}
+
+void MetadataImageBuilder::applyPartitionRecord(WireReader &reader,
+                                                int8_t version) {
+    PartitionMetadata partition;
+    partition.partition_index = reader.readInt32();
+    Uuid topic_id = reader.readUuid();
+    partition.replicas = readInt32Array(reader);
+    partition.isr = readInt32Array(reader);
+    readInt32Array(reader); // removing replicas
+    readInt32Array(reader); // adding replicas
+    partition.leader_id = reader.readInt32();
+    partition.leader_epoch = reader.readInt32();
+    partition.partition_epoch = reader.readInt32();
+    if (version >= 1) {
+        // directories
+        int32_t directories = reader.readCompactArrayLength();
+        reader.skip(std::max(directories, 0) * sizeof(Uuid::bytes));
+    }
+    reader.readTaggedFields([&](uint32_t tag, std::span<const std::byte> data) {
+        WireReader field(data);
+        if (tag == 1) {
+            partition.eligible_leader_replicas = readNullableInt32Array(field);
+        } else if (tag == 2) {
+            partition.last_known_elr = readNullableInt32Array(field);
+        }
+    });
+
+    auto it = topics.find(topic_id);
+    if (it == topics.end()) {
+        LOG_WARN("PartitionRecord for unknown topic " << topic_id.toString());
+        return;
+    }
+
+    auto &partitions = it->second.partitions;
+    auto pos = lowerBoundPartition(partitions, partition.partition_index);
+    if (pos != partitions.end() &&
+        pos->partition_index == partition.partition_index) {
+        *pos = std::move(partition);
+    } else {
+        partitions.insert(pos, std::move(partition));
+    }
+}
+
+void MetadataImageBuilder::applyPartitionChangeRecord(WireReader &reader) {
+    int32_t partition_index = reader.readInt32();
+    Uuid topic_id = reader.readUuid();
+
+    PartitionMetadata *partition = nullptr;
+    if (auto it = topics.find(topic_id); it != topics.end()) {
+        auto pos = lowerBoundPartition(it->second.partitions, partition_index);
+        if (pos != it->second.partitions.end() &&
+            pos->partition_index == partition_index) {
+            partition = &*pos;
+        }
+    }
+
+    // Every field of a change record is tagged and only present if changed.
+    std::optional<int32_t> leader;
+    reader.readTaggedFields([&](uint32_t tag, std::span<const std::byte> data) {
+        if (partition == nullptr) {
+            return;
+        }
+        WireReader field(data);
+        switch (tag) {
+        case 0:
+            partition->isr = readInt32Array(field);
+            break;
+        case 1:
+            leader = field.readInt32();
+            break;
+        case 2:
+            partition->replicas = readInt32Array(field);
+            break;
+        case 7:
+            partition->eligible_leader_replicas = readNullableInt32Array(field);
+            break;
+        case 8:
+            partition->last_known_elr = readNullableInt32Array(field);
+            break;
+        default:
+            break;
+        }
+    });
+
+    if (partition == nullptr) {
+        LOG_WARN("PartitionChangeRecord for unknown partition "
+                 << topic_id.toString() << "-" << partition_index);
+        return;
+    }
+
+    // -2 means "no change"; a new leader starts a new leader epoch.
+    if (leader && *leader != -2 && *leader != partition->leader_id) {
+        partition->leader_id = *leader;
+        ++partition->leader_epoch;
+    }
+    ++partition->partition_epoch;
+}
+
+void MetadataImageBuilder::applyRemoveTopicRecord(WireReader &reader) {
+    topics.erase(reader.readUuid());
+}
+
+void MetadataImageBuilder::replay(const PartitionLog &log) {
+    std::vector<std::byte> buffer;
+    int64_t offset = log.logStartOffset();
+
+    while (offset < log.logEndOffset()) {
+        auto read_info = log.read(offset, 1024 * 1024);
+        if (!read_info) {
+            break;
+        }
+
+        const FileRegion &region = read_info->records;
+        buffer.resize(region.size);
+        ssize_t bytes_read =
+            pread(*region.file, buffer.data(), region.size, region.position);
+        if (bytes_read < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to read metadata log");
+        }
+
+        // Only whole batches; a trailing partial one is read again from its
+        // start on the next round.
+        std::span<const std::byte> bytes(buffer.data(), bytes_read);
+        int64_t next_offset = offset;
+        while (bytes.size() >= RecordBatchView::HEADER_SIZE) {
+            RecordBatchView batch(bytes);
+            if (batch.sizeInBytes() > bytes.size()) {
+                break;
+            }
+            if (!batch.isControlBatch() && batch.lastOffset() >= offset) {
+                batch.forEachRecord([this](const Record &record) {
+                    if (record.value) {
+                        apply(*record.value);
+                    }
+                });
+            }
+            next_offset = batch.lastOffset() + 1;
+            bytes = bytes.subspan(batch.sizeInBytes());
+        }
+
+        if (next_offset == offset) {
+            throw WireError("Metadata log batch at offset " +
+                            std::to_string(offset) + " cannot be read");
+        }
+        offset = next_offset;
+    }
+}
+
+std::shared_ptr<const MetadataImage> MetadataImageBuilder::build() const {
+    auto image = std::make_shared<MetadataImage>();
+
+    image->sorted_topics.reserve(topics.size());
+    for (const auto &[topic_id, topic] : topics) {
+        image->sorted_topics.push_back(topic);
+    }
+    std::sort(image->sorted_topics.begin(), image->sorted_topics.end(),
+              [](const auto &a, const auto &b) { return a.name < b.name; });
+
+    for (const auto &topic : image->sorted_topics) {
+        image->by_name.emplace(topic.name, &topic);
+        image->by_id.emplace(topic.topic_id, &topic);
+    }
+    return image;
+}
+
+MetadataCache::MetadataCache()
+    : current(MetadataImageBuilder().build()) {}
+
+void MetadataCache::loadFromLog(const PartitionLog &log) {
+    MetadataImageBuilder builder;
+    builder.replay(log);
+
+    auto image = builder.build();
+    LOG_INFO("Loaded cluster metadata: " << image->topics().size()
+             << " topics");
+    publish(std::move(image));
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include "PartitionLog.h"
+#include "WireCodec.h"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct PartitionMetadata {
+    int32_t partition_index{};
+    int32_t leader_id = -1;
+    int32_t leader_epoch = -1;
+    int32_t partition_epoch{};
+    std::vector<int32_t> replicas;
+    std::vector<int32_t> isr;
+    std::optional<std::vector<int32_t>> eligible_leader_replicas;
+    std::optional<std::vector<int32_t>> last_known_elr;
+};
+
+struct TopicMetadata {
+    std::string name;
+    Uuid topic_id;
+    // Sorted by partition index.
+    std::vector<PartitionMetadata> partitions;
+
+    // Kafka's internal topics (__consumer_offsets, ...) start with "__".
+    bool isInternal() const { return name.starts_with("__"); }
+    const PartitionMetadata *partition(int32_t partition_index) const;
+};
+
+// Immutable view of the cluster metadata at one point of the metadata log.
+// Readers share it through a shared_ptr; changes produce a new image.
+class MetadataImage {
+  public:
+    MetadataImage() = default;
+    // The indexes point into the image itself.
+    MetadataImage(const MetadataImage &) = delete;
+    MetadataImage &operator=(const MetadataImage &) = delete;
+
+    const TopicMetadata *topicByName(std::string_view name) const;
+    const TopicMetadata *topicById(const Uuid &topic_id) const;
+
+    // All topics, sorted by name.
+    std::span<const TopicMetadata> topics() const { return sorted_topics; }
+    // Topics from the first one whose name is >= name on, for pagination.
+    std::span<const TopicMetadata> topicsFrom(std::string_view name) const;
+
+  private:
+    friend class MetadataImageBuilder;
+
+    std::vector<TopicMetadata> sorted_topics;
+    // Both point into sorted_topics, which never changes after build().
+    std::unordered_map<std::string_view, const TopicMetadata *> by_name;
+    std::unordered_map<Uuid, const TopicMetadata *, UuidHash> by_id;
+};
+
+// Replays metadata records (the values in the KRaft __cluster_metadata log)
+// into the next image.
+class MetadataImageBuilder {
+  public:
+    // Record types we apply; everything else (features, brokers, configs,
+    // ...) does not affect topic metadata and is skipped.
+    static constexpr int8_t TOPIC_RECORD = 2;
+    static constexpr int8_t PARTITION_RECORD = 3;
+    static constexpr int8_t PARTITION_CHANGE_RECORD = 5;
+    static constexpr int8_t REMOVE_TOPIC_RECORD = 9;
+
+    // Applies one record value: frameVersion int8, type int8, version int8,
+    // then the record's (flexible) fields.
+    void apply(std::span<const std::byte> record);
+    // Applies every record in the log, start to end.
+    void replay(const PartitionLog &log);
+
+    std::shared_ptr<const MetadataImage> build() const;
+
+  private:
+    void applyTopicRecord(WireReader &reader);
+    void applyPartitionRecord(WireReader &reader, int8_t version);
+    void applyPartitionChangeRecord(WireReader &reader);
+    void applyRemoveTopicRecord(WireReader &reader);
+
+    std::map<Uuid, TopicMetadata> topics;
+};
+
+// Publishes the current MetadataImage. Readers grab the image with one
+// atomic load and keep it alive for as long as they use it; a writer swaps
+// in a complete new image, so readers never see a partial update and never
+// wait on each other (read-copy-update).
+class MetadataCache {
+  public:
+    // The partition holding the KRaft metadata log.
+    static const TopicPartition METADATA_TOPIC_PARTITION;
+
+    MetadataCache();
+
+    std::shared_ptr<const MetadataImage> image() const {
+        return current.load(std::memory_order_acquire);
+    }
+    void publish(std::shared_ptr<const MetadataImage> image) {
+        current.store(std::move(image), std::memory_order_release);
+    }
+
+    // Builds the image from the metadata log, if there is one.
+    void loadFromLog(const PartitionLog &log);
+
+  private:
+    std::atomic<std::shared_ptr<const MetadataImage>> current;
+};
@@ -0,0 +1,341 @@
+#include "Metrics.h"
+
+#include "Logger.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+
+namespace {
+
+constexpr double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+struct PhaseMetric {
+    const char *name;
+    const char *help;
+};
+
+constexpr PhaseMetric PHASE_METRICS[REQUEST_PHASES] = {
+    {"kafka_network_request_queue_time_seconds",
+     "Time from reading a request off the socket to handling it."},
+    {"kafka_network_request_handle_time_seconds",
+     "Time from handling a request to queueing its response, including "
+     "delayed operations."},
+    {"kafka_network_request_send_time_seconds",
+     "Time from queueing a response to writing its last byte."},
+};
+
+void appendHeader(std::string &out, const char *name, const char *type,
+                  const char *help) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+void appendSample(std::string &out, std::string_view name,
+                  std::string_view labels, std::string_view value) {
+    out += name;
+    if (!labels.empty()) {
+        out += '{';
+        out += labels;
+        out += '}';
+    }
+    out += ' ';
+    out += value;
+    out += '\n';
+}
+
+// Counters are written out in full; a double would round them past 2^53.
+void appendSample(std::string &out, std::string_view name,
+                  std::string_view labels, uint64_t value) {
+    appendSample(out, name, labels, std::string_view(std::to_string(value)));
+}
+
+void appendSample(std::string &out, std::string_view name,
+                  std::string_view labels, double value) {
+    char number[32];
+    std::snprintf(number, sizeof(number), "%.9g", value);
+    appendSample(out, name, labels, std::string_view(number));
+}
+
+} // namespace
+
+size_t LatencyHistogram::bucketOf(uint64_t micros) {
+    if (micros < SUB_BUCKETS) {
+        return micros;
+    }
+    int msb = std::bit_width(micros) - 1;
+    if (msb >= MAX_VALUE_BITS) {
+        return BUCKETS - 1;
+    }
+    int octave = msb - SUB_BUCKET_BITS + 1;
+    return octave * SUB_BUCKETS +
+           ((micros >> (msb - SUB_BUCKET_BITS)) - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::bucketMaxValue(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    size_t octave = bucket / SUB_BUCKETS;
+    uint64_t sub_bucket = bucket % SUB_BUCKETS;
+    uint64_t width = uint64_t{1} << (octave - 1);
+    return (SUB_BUCKETS + sub_bucket) * width + width - 1;
+}
+
+void LatencyHistogram::Snapshot::add(const LatencyHistogram &histogram) {
+    // The total is taken from the buckets rather than kept separately, so
+    // it matches them even while the owner keeps recording.
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        uint64_t value = histogram.buckets[i].value();
+        counts[i] += value;
+        count += value;
+    }
+    sum_micros += histogram.sum_micros.value();
+}
+
+uint64_t LatencyHistogram::Snapshot::quantileMicros(double quantile) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = std::max<uint64_t>(1, quantile * count + 0.5);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) {
+            return bucketMaxValue(i);
+        }
+    }
+    return bucketMaxValue(BUCKETS - 1);
+}
+
+MetricsShard::ApiMetrics::~ApiMetrics() {
+    for (auto &histogram : latencies) {
+        delete histogram.load(std::memory_order_relaxed);
+    }
+}
+
+MetricsShard::~MetricsShard() {
+    for (auto &api : apis) {
+        delete api.load(std::memory_order_relaxed);
+    }
+}
+
+MetricsShard::ApiMetrics *MetricsShard::apiForUpdate(int16_t api_key) {
+    if (api_key < 0 || static_cast<size_t>(api_key) >= API_KEYS) {
+        return nullptr;
+    }
+    // Only the owner allocates; release publishes the zeroed counters to
+    // render().
+    ApiMetrics *api = apis[api_key].load(std::memory_order_relaxed);
+    if (api == nullptr) {
+        api = new ApiMetrics();
+        apis[api_key].store(api, std::memory_order_release);
+    }
+    return api;
+}
+
+void MetricsShard::countRequest(int16_t api_key, int16_t api_version) {
+    ApiMetrics *api = apiForUpdate(api_key);
+    if (api != nullptr && api_version >= 0 &&
+        static_cast<size_t>(api_version) < API_VERSIONS) {
+        api->requests[api_version].add(1);
+    }
+}
+
+void MetricsShard::countError(int16_t api_key, int16_t error_code) {
+    if (error_code <= 0 || static_cast<size_t>(error_code) >= ERROR_CODES) {
+        return;
+    }
+    if (ApiMetrics *api = apiForUpdate(api_key)) {
+        api->errors[error_code].add(1);
+    }
+}
+
+void MetricsShard::recordLatency(int16_t api_key, int16_t api_version,
+                                 RequestPhase phase, int64_t nanos) {
+    ApiMetrics *api = apiForUpdate(api_key);
+    if (api == nullptr || api_version < 0 ||
+        static_cast<size_t>(api_version) >= API_VERSIONS) {
+        return;
+    }
+
+    auto &slot = api->latencies[api_version * REQUEST_PHASES +
+                                static_cast<size_t>(phase)];
+    LatencyHistogram *histogram = slot.load(std::memory_order_relaxed);
+    if (histogram == nullptr) {
+        histogram = new LatencyHistogram();
+        slot.store(histogram, std::memory_order_release);
+    }
+    histogram->record(nanos > 0 ? nanos / 1000 : 0);
+}
+
+Metrics &Metrics::instance() {
+    static Metrics metrics;
+    return metrics;
+}
+
+MetricsShard &Metrics::local() {
+    thread_local MetricsShard *shard = instance().registerShard();
+    return *shard;
+}
+
+MetricsShard *Metrics::registerShard() {
+    std::lock_guard<std::mutex> guard(lock);
+    shards.push_back(std::make_unique<MetricsShard>());
+    return shards.back().get();
+}
+
+std::string Metrics::render(
+    const std::function<std::string_view(int16_t)> &api_name) const {
+    std::lock_guard<std::mutex> guard(lock);
+
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t accepted = 0;
+    uint64_t closed = 0;
+    uint64_t rejected = 0;
+    uint64_t throttled = 0;
+    uint64_t cache_hits = 0;
+    uint64_t cache_misses = 0;
+    for (const auto &shard : shards) {
+        bytes_in += shard->bytes_in.value();
+        bytes_out += shard->bytes_out.value();
+        accepted += shard->connections_accepted.value();
+        closed += shard->connections_closed.value();
+        rejected += shard->connections_rejected.value();
+        throttled += shard->requests_throttled.value();
+        cache_hits += shard->tail_cache_hits.value();
+        cache_misses += shard->tail_cache_misses.value();
+    }
+
+    std::string out;
+    appendHeader(out, "kafka_network_bytes_in_total", "counter",
+                 "Bytes read from client connections.");
+    appendSample(out, "kafka_network_bytes_in_total", "", bytes_in);
+    appendHeader(out, "kafka_network_bytes_out_total", "counter",
+                 "Bytes written to client connections.");
+    appendSample(out, "kafka_network_bytes_out_total", "", bytes_out);
+    appendHeader(out, "kafka_network_connections_accepted_total", "counter",
+                 "Client connections accepted.");
+    appendSample(out, "kafka_network_connections_accepted_total", "",
+                 accepted);
+    appendHeader(out, "kafka_network_connections_active", "gauge",
+                 "Client connections currently open.");
+    appendSample(out, "kafka_network_connections_active", "",
+                 accepted - std::min(closed, accepted));
+    appendHeader(out, "kafka_network_connections_rejected_total", "counter",
+                 "Client connections closed right away by max.connections.");
+    appendSample(out, "kafka_network_connections_rejected_total", "",
+                 rejected);
+    appendHeader(out, "kafka_server_throttled_requests_total", "counter",
+                 "Requests answered with a throttle time, their client "
+                 "being over a quota.");
+    appendSample(out, "kafka_server_throttled_requests_total", "", throttled);
+    appendHeader(out, "kafka_log_tail_cache_hits_total", "counter",
+                 "Fetch reads served from the in-memory tail cache.");
+    appendSample(out, "kafka_log_tail_cache_hits_total", "", cache_hits);
+    appendHeader(out, "kafka_log_tail_cache_misses_total", "counter",
+                 "Fetch reads that had to go to the segment files.");
+    appendSample(out, "kafka_log_tail_cache_misses_total", "", cache_misses);
+    appendHeader(out, "kafka_logger_dropped_messages_total", "counter",
+                 "Log messages dropped because a log ring was full.");
+    appendSample(out, "kafka_logger_dropped_messages_total", "",
+                 Logger::instance().droppedMessages());
+
+    std::string requests;
+    std::string errors;
+    std::string latencies[REQUEST_PHASES];
+
+    for (size_t api_key = 0; api_key < MetricsShard::API_KEYS; ++api_key) {
+        std::vector<const MetricsShard::ApiMetrics *> apis;
+        for (const auto &shard : shards) {
+            if (const auto *api = shard->api(api_key)) {
+                apis.push_back(api);
+            }
+        }
+        if (apis.empty()) {
+            continue;
+        }
+
+        std::string api_label = "api=\"";
+        api_label += api_name(static_cast<int16_t>(api_key));
+        api_label += '"';
+
+        for (size_t version = 0; version < MetricsShard::API_VERSIONS;
+             ++version) {
+            std::string labels =
+                api_label + ",version=\"" + std::to_string(version) + '"';
+
+            uint64_t count = 0;
+            for (const auto *api : apis) {
+                count += api->requests[version].value();
+            }
+            if (count > 0) {
+                appendSample(requests, "kafka_network_requests_total", labels,
+                             count);
+            }
+
+            for (size_t phase = 0; phase < REQUEST_PHASES; ++phase) {
+                LatencyHistogram::Snapshot snapshot;
+                for (const auto *api : apis) {
+                    const LatencyHistogram *histogram =
+                        api->latencies[version * REQUEST_PHASES + phase].load(
+                            std::memory_order_acquire);
+                    if (histogram != nullptr) {
+                        snapshot.add(*histogram);
+                    }
+                }
+                if (snapshot.count == 0) {
+                    continue;
+                }
+
+                std::string &section = latencies[phase];
+                std::string_view name = PHASE_METRICS[phase].name;
+                for (double quantile : QUANTILES) {
+                    char label[48];
+                    std::snprintf(label, sizeof(label), ",quantile=\"%g\"",
+                                  quantile);
+                    appendSample(section, name, labels + label,
+                                 snapshot.quantileMicros(quantile) / 1e6);
+                }
+                appendSample(section, std::string(name) + "_sum", labels,
+                             snapshot.sum_micros / 1e6);
+                appendSample(section, std::string(name) + "_count", labels,
+                             snapshot.count);
+            }
+        }
+
+        for (size_t code = 0; code < MetricsShard::ERROR_CODES; ++code) {
+            uint64_t count = 0;
+            for (const auto *api : apis) {
+                count += api->errors[code].value();
+            }
+            if (count > 0) {
+                appendSample(errors, "kafka_network_request_errors_total",
+                             api_label + ",error_code=\"" +
+                                 std::to_string(code) + '"',
+                             count);
+            }
+        }
+    }
+
+    appendHeader(out, "kafka_network_requests_total", "counter",
+                 "Requests received, by API and version.");
+    out += requests;
+    appendHeader(out, "kafka_network_request_errors_total", "counter",
+                 "Error codes in responses, by API and code.");
+    out += errors;
+    for (size_t phase = 0; phase < REQUEST_PHASES; ++phase) {
+        appendHeader(out, PHASE_METRICS[phase].name, "summary",
+                     PHASE_METRICS[phase].help);
+        out += latencies[phase];
+    }
+    return out;
+}
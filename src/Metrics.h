@@ -0,0 +1,160 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Time base of every latency the broker records.
+inline int64_t monotonicNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// A counter written by one thread only, the owner of its shard: increments
+// are a plain load and store instead of a locked read-modify-write. Other
+// threads may read it at any time.
+class ShardCounter {
+  public:
+    void add(uint64_t n) {
+        count.store(count.load(std::memory_order_relaxed) + n,
+                    std::memory_order_relaxed);
+    }
+    uint64_t value() const { return count.load(std::memory_order_relaxed); }
+
+  private:
+    std::atomic<uint64_t> count{0};
+};
+
+// Latency histogram with log-linear buckets, as in HdrHistogram: values
+// below SUB_BUCKETS get a bucket each, above that every power of two is
+// split into SUB_BUCKETS buckets, so a bucket is never wider than 1/8 of
+// the values in it. Microseconds, up to 2^36 (about 19 hours); anything
+// longer lands in the last bucket. Single writer, like ShardCounter.
+class LatencyHistogram {
+  public:
+    static constexpr int SUB_BUCKET_BITS = 3;
+    static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr int MAX_VALUE_BITS = 36;
+    static constexpr size_t BUCKETS =
+        (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    // Merged counts of any number of histograms, for reporting.
+    struct Snapshot {
+        std::array<uint64_t, BUCKETS> counts{};
+        uint64_t count = 0;
+        uint64_t sum_micros = 0;
+
+        void add(const LatencyHistogram &histogram);
+        // Highest value of the bucket holding the given quantile (0..1).
+        uint64_t quantileMicros(double quantile) const;
+    };
+
+    static size_t bucketOf(uint64_t micros);
+    static uint64_t bucketMaxValue(size_t bucket);
+
+    void record(uint64_t micros) {
+        buckets[bucketOf(micros)].add(1);
+        sum_micros.add(micros);
+    }
+
+  private:
+    std::array<ShardCounter, BUCKETS> buckets;
+    ShardCounter sum_micros;
+};
+
+// The stages a request goes through, each with a histogram of its own.
+enum class RequestPhase : uint8_t {
+    // From the read that completed the request to its handler starting.
+    QUEUE,
+    // From the handler starting to its response being queued, including any
+    // time spent waiting for a request handler thread, in a purgatory or for
+    // a flush.
+    HANDLE,
+    // From the response being queued to its last byte being written.
+    SEND,
+};
+inline constexpr size_t REQUEST_PHASES = 3;
+
+// Everything one thread records. Only the owning thread writes to it, and
+// the alignment keeps the shards of two threads off the same cache line.
+struct alignas(64) MetricsShard {
+    static constexpr size_t API_KEYS = 128;
+    static constexpr size_t API_VERSIONS = 32;
+    static constexpr size_t ERROR_CODES = 128;
+
+    // Per api key, allocated when the first request with that key comes in.
+    struct ApiMetrics {
+        ~ApiMetrics();
+
+        std::array<ShardCounter, API_VERSIONS> requests;
+        std::array<ShardCounter, ERROR_CODES> errors;
+        // Indexed by version * REQUEST_PHASES + phase, allocated on first use.
+        std::array<std::atomic<LatencyHistogram *>,
+                   API_VERSIONS * REQUEST_PHASES>
+            latencies{};
+    };
+
+    ~MetricsShard();
+
+    // Keys, versions and error codes out of range are not counted.
+    void countRequest(int16_t api_key, int16_t api_version);
+    // NONE is not an error and is not counted either.
+    void countError(int16_t api_key, int16_t error_code);
+    void recordLatency(int16_t api_key, int16_t api_version,
+                       RequestPhase phase, int64_t nanos);
+
+    // nullptr if no request with this key was seen.
+    const ApiMetrics *api(size_t api_key) const {
+        return apis[api_key].load(std::memory_order_acquire);
+    }
+
+    ShardCounter bytes_in;
+    ShardCounter bytes_out;
+    ShardCounter connections_accepted;
+    ShardCounter connections_closed;
+    // Turned away by max.connections.
+    ShardCounter connections_rejected;
+    // Answered with a nonzero throttle_time_ms.
+    ShardCounter requests_throttled;
+    // Fetch reads served from the tail cache, and those that went to the
+    // segments instead.
+    ShardCounter tail_cache_hits;
+    ShardCounter tail_cache_misses;
+
+  private:
+    ApiMetrics *apiForUpdate(int16_t api_key);
+
+    std::array<std::atomic<ApiMetrics *>, API_KEYS> apis{};
+};
+
+// Broker-wide registry of the per-thread shards. Recording only ever
+// touches the calling thread's shard; render() sums them all up.
+class Metrics {
+  public:
+    static Metrics &instance();
+
+    // The calling thread's shard, created on first use. Shards outlive
+    // their threads so that nothing counted is lost.
+    static MetricsShard &local();
+
+    // Every metric in the Prometheus text exposition format. api_name
+    // labels the api keys.
+    std::string
+    render(const std::function<std::string_view(int16_t)> &api_name) const;
+
+  private:
+    Metrics() = default;
+
+    MetricsShard *registerShard();
+
+    mutable std::mutex lock;
+    std::vector<std::unique_ptr<MetricsShard>> shards;
+};
@@ -0,0 +1,168 @@
+#include "MetricsServer.h"
+
+#include "Logger.h"
+
+#include <netdb.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+
+void setTimeout(const Fd &fd, int option, int timeout_ms) {
+    struct timeval timeout {};
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, option, &timeout, sizeof(timeout));
+}
+
+bool sendAll(const Fd &fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data.remove_prefix(sent);
+    }
+    return true;
+}
+
+} // namespace
+
+MetricsServer::MetricsServer(MetricsConfig _config,
+                             std::function<std::string()> _render)
+    : config(std::move(_config)), render(std::move(_render)) {}
+
+MetricsServer::~MetricsServer() { shutdown(); }
+
+void MetricsServer::start() {
+    struct addrinfo hints {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    std::string port = std::to_string(config.port);
+    struct addrinfo *addresses = nullptr;
+    int result =
+        getaddrinfo(config.host.empty() ? nullptr : config.host.c_str(),
+                    port.c_str(), &hints, &addresses);
+    if (result != 0) {
+        throw std::runtime_error("Failed to resolve metrics address " +
+                                 config.host + ": " + gai_strerror(result));
+    }
+    std::unique_ptr<struct addrinfo, decltype(&freeaddrinfo)> address(
+        addresses, freeaddrinfo);
+
+    server_fd.setFd(
+        socket(address->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (server_fd < 0) {
+        throw std::runtime_error(std::string("Failed to create metrics socket: ") +
+                                 std::strerror(errno));
+    }
+
+    int reuse = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if (bind(server_fd, address->ai_addr, address->ai_addrlen) != 0 ||
+        listen(server_fd, SOMAXCONN) != 0) {
+        throw std::runtime_error("Failed to listen for metrics on " +
+                                 config.host + ":" + port + ": " +
+                                 std::strerror(errno));
+    }
+
+    wakeup_fd.setFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if (wakeup_fd < 0) {
+        throw std::runtime_error(std::string("Failed to create eventfd: ") +
+                                 std::strerror(errno));
+    }
+
+    thread = std::thread(&MetricsServer::run, this);
+    LOG_INFO("Serving metrics on " << config.host << ":" << port);
+}
+
+void MetricsServer::shutdown() {
+    if (!thread.joinable()) {
+        return;
+    }
+    uint64_t one = 1;
+    [[maybe_unused]] ssize_t written = write(wakeup_fd, &one, sizeof(one));
+    thread.join();
+}
+
+void MetricsServer::run() {
+    Logger::setThreadName("metrics");
+
+    struct pollfd fds[2] = {{server_fd, POLLIN, 0}, {wakeup_fd, POLLIN, 0}};
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("poll failed: " << std::strerror(errno));
+            return;
+        }
+        if (fds[1].revents != 0) {
+            return;
+        }
+        if (fds[0].revents == 0) {
+            continue;
+        }
+
+        Fd client(accept4(server_fd, nullptr, nullptr, SOCK_CLOEXEC));
+        if (client < 0) {
+            LOG_WARN("Metrics accept failed: " << std::strerror(errno));
+            continue;
+        }
+        serve(client);
+    }
+}
+
+void MetricsServer::serve(const Fd &client) const {
+    setTimeout(client, SO_RCVTIMEO, CLIENT_TIMEOUT_MS);
+    setTimeout(client, SO_SNDTIMEO, CLIENT_TIMEOUT_MS);
+
+    // Only the request line matters; read up to the end of the headers so
+    // the client is not reset while still sending them.
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos &&
+           request.size() < MAX_REQUEST_SIZE) {
+        ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return;
+        }
+        request.append(buffer, received);
+    }
+
+    std::string_view line(request);
+    line = line.substr(0, line.find("\r\n"));
+
+    std::string status = "200 OK";
+    std::string body;
+    if (line.starts_with("GET /metrics ") || line.starts_with("GET / ")) {
+        body = render();
+    } else {
+        status = "404 Not Found";
+        body = "Metrics are served at /metrics\n";
+    }
+
+    std::string response = "HTTP/1.1 " + status +
+                           "\r\nContent-Type: text/plain; version=0.0.4"
+                           "\r\nContent-Length: " +
+                           std::to_string(body.size()) +
+                           "\r\nConnection: close\r\n\r\n";
+    if (sendAll(client, response)) {
+        sendAll(client, body);
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "BrokerConfig.h"
+#include "Fd.h"
+
+#include <functional>
+#include <string>
+#include <thread>
+
+// Serves the broker's metrics in the Prometheus text format over HTTP
+// (GET /metrics) from a thread of its own. Scrapes are rare and small, so
+// it keeps to blocking sockets and one request per connection, and shares
+// nothing with the reactors.
+class MetricsServer {
+  public:
+    // A scraper gets this long to send its request and read the response.
+    static constexpr int CLIENT_TIMEOUT_MS = 1000;
+    static constexpr size_t MAX_REQUEST_SIZE = 8192;
+
+    MetricsServer(MetricsConfig _config, std::function<std::string()> _render);
+    ~MetricsServer();
+
+    // Binds the listener and starts serving. Throws if it cannot bind.
+    void start();
+    void shutdown();
+
+  private:
+    void run();
+    void serve(const Fd &client) const;
+
+    MetricsConfig config;
+    std::function<std::string()> render;
+    Fd server_fd;
+    Fd wakeup_fd;
+    std::thread thread;
+};
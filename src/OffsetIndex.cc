@@ -0,0 +1,64 @@
+#include "OffsetIndex.h"
+
+#include "WireCodec.h"
+
+#include <stdexcept>
+
+OffsetIndex::OffsetIndex(std::string _path, int64_t _base_offset,
+                         size_t max_size)
+    : base_offset(_base_offset), file(std::move(_path), ENTRY_SIZE, max_size) {
+}
+
+OffsetIndex::Entry OffsetIndex::entryAt(size_t slot) const {
+    const std::byte *entry = file.entry(slot);
+    return {base_offset + wire::load<int32_t>(entry),
+            wire::load<uint32_t>(entry + sizeof(int32_t))};
+}
+
+OffsetIndex::Entry OffsetIndex::lookup(int64_t target) const {
+    size_t count = entries();
+    if (count == 0 || target < entryAt(0).offset) {
+        return {base_offset, 0};
+    }
+
+    // Last slot whose offset is <= target.
+    size_t low = 0;
+    size_t high = count - 1;
+    while (low < high) {
+        size_t mid = low + (high - low + 1) / 2;
+        if (entryAt(mid).offset <= target) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return entryAt(low);
+}
+
+OffsetIndex::Entry OffsetIndex::lastEntry() const {
+    size_t count = entries();
+    if (count == 0) {
+        return {base_offset, 0};
+    }
+    return entryAt(count - 1);
+}
+
+void OffsetIndex::append(int64_t offset, uint32_t position) {
+    size_t slot = entries();
+    if (slot > 0 && offset <= entryAt(slot - 1).offset) {
+        throw std::runtime_error("Out of order append to index " + path());
+    }
+
+    std::byte entry[ENTRY_SIZE];
+    wire::store(entry, static_cast<int32_t>(offset - base_offset));
+    wire::store(entry + sizeof(int32_t), position);
+    file.append(entry);
+}
+
+void OffsetIndex::truncateTo(int64_t offset) {
+    size_t keep = entries();
+    while (keep > 0 && entryAt(keep - 1).offset >= offset) {
+        --keep;
+    }
+    file.truncateToEntries(keep);
+}
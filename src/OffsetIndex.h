@@ -0,0 +1,48 @@
+#pragma once
+
+#include "IndexFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Sparse offset -> file position index of one log segment, in Kafka's
+// .index format: 8-byte entries holding the offset relative to the segment
+// base and the byte position of the batch in the .log file, both big-endian
+// int32. The file is memory-mapped, so lookups are a binary search over the
+// mapping without any syscall.
+class OffsetIndex {
+  public:
+    static constexpr size_t ENTRY_SIZE = 8;
+
+    struct Entry {
+        int64_t offset;
+        uint32_t position;
+    };
+
+    // Maps the index at path; max_size bounds how large it may grow.
+    OffsetIndex(std::string _path, int64_t _base_offset, size_t max_size);
+
+    // Largest entry whose offset is <= target, or {base_offset, 0} when the
+    // target precedes the first entry.
+    Entry lookup(int64_t target) const;
+    // Entries must be appended in increasing offset order.
+    void append(int64_t offset, uint32_t position);
+
+    bool isFull() const { return file.isFull(); }
+    size_t entries() const { return file.entries(); }
+    Entry lastEntry() const;
+    const std::string &path() const { return file.path(); }
+
+    // Drops every entry at or beyond offset (log truncation).
+    void truncateTo(int64_t offset);
+    void reset() { truncateTo(base_offset); }
+    void flush() const { file.flush(); }
+    void trimToValidSize() { file.trimToValidSize(); }
+
+  private:
+    Entry entryAt(size_t slot) const;
+
+    int64_t base_offset;
+    IndexFile file;
+};
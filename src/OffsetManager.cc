@@ -0,0 +1,508 @@
+#include "OffsetManager.h"
+
+#include "Crc32c.h"
+#include "Logger.h"
+#include "RecordBatch.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+#include <tuple>
+
+namespace {
+
+// Kafka's OffsetCommitKey and OffsetCommitValue versions: key 0 and 1 are
+// offset commits (2 is group metadata), value 3 is the newest without
+// tagged fields.
+constexpr int16_t MAX_KEY_VERSION = 1;
+constexpr int16_t MAX_VALUE_VERSION = 3;
+constexpr int16_t SNAPSHOT_VERSION = 0;
+
+struct CommitKey {
+    std::string_view group;
+    std::string_view topic;
+    int32_t partition{};
+};
+
+struct CommitValue {
+    int64_t offset{};
+    int32_t leader_epoch = -1;
+    std::string_view metadata;
+    int64_t commit_timestamp{};
+};
+
+std::optional<CommitKey> decodeKey(const NullableBytes &bytes) {
+    if (!bytes) {
+        return std::nullopt;
+    }
+    WireReader reader(*bytes);
+    int16_t version = reader.readInt16();
+    if (version < 0 || version > MAX_KEY_VERSION) {
+        return std::nullopt;
+    }
+    CommitKey key;
+    key.group = reader.readString();
+    key.topic = reader.readString();
+    key.partition = reader.readInt32();
+    return key;
+}
+
+std::optional<CommitValue> decodeValue(const NullableBytes &bytes) {
+    if (!bytes) {
+        return std::nullopt;
+    }
+    WireReader reader(*bytes);
+    int16_t version = reader.readInt16();
+    if (version < 0 || version > MAX_VALUE_VERSION) {
+        return std::nullopt;
+    }
+    CommitValue value;
+    value.offset = reader.readInt64();
+    if (version >= 3) {
+        value.leader_epoch = reader.readInt32();
+    }
+    value.metadata = reader.readString();
+    // v1 follows it with an expire timestamp, which nothing uses anymore.
+    value.commit_timestamp = reader.readInt64();
+    return value;
+}
+
+int64_t nowMillis() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+} // namespace
+
+OffsetManager::OffsetManager(const OffsetsConfig &_config,
+                             LogManager &_log_manager)
+    : config(_config), log_manager(_log_manager) {}
+
+OffsetManager::~OffsetManager() { shutdown(); }
+
+void OffsetManager::load() {
+    auto started = std::chrono::steady_clock::now();
+    offsets_log = log_manager.getOrCreateLog(
+        {std::string(OffsetsConfig::TOPIC), 0});
+    snapshot_path = offsets_log->dir() + "/" + SNAPSHOT_FILE;
+
+    std::optional<int64_t> snapshot_end = loadSnapshot();
+    if (snapshot_end && *snapshot_end > offsets_log->logEndOffset()) {
+        // The log lost its tail in a crash, and commits the snapshot holds
+        // with it: only the log can say which ones are left.
+        LOG_WARN("Offset snapshot " << snapshot_path << " is ahead of the log"
+                 << ", replaying all of it");
+        std::unique_lock<std::shared_mutex> guard(lock);
+        groups = StringInterner();
+        topics = StringInterner();
+        table = OffsetTable();
+        snapshot_end.reset();
+    }
+    snapshot_offset = snapshot_end.value_or(-1);
+
+    int64_t replay_from =
+        std::max(snapshot_end.value_or(0), offsets_log->logStartOffset());
+    replayFrom(replay_from);
+    flushed_offset = offsets_log->logEndOffset();
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started);
+    LOG_INFO("Loaded " << table.size() << " committed offsets, replaying "
+             << offsets_log->logEndOffset() - replay_from
+             << " log offsets after the snapshot, in " << elapsed.count()
+             << " ms");
+}
+
+void OffsetManager::start() {
+    cleaner = std::thread(&OffsetManager::run, this);
+}
+
+void OffsetManager::shutdown() {
+    {
+        std::lock_guard<std::mutex> guard(cleaner_lock);
+        stopping = true;
+    }
+    cleaner_wakeup.notify_all();
+    if (cleaner.joinable()) {
+        cleaner.join();
+    }
+
+    if (!offsets_log) {
+        return;
+    }
+    try {
+        writeSnapshot();
+    } catch (const std::exception &e) {
+        LOG_ERROR("Failed to snapshot committed offsets: " << e.what());
+    }
+}
+
+CommitAppend OffsetManager::commit(std::string_view group,
+                                   std::span<const OffsetCommit> commits) {
+    if (commits.empty()) {
+        return {};
+    }
+
+    int64_t now = nowMillis();
+    RecordBatchBuilder builder(now);
+    std::string key;
+    std::string value;
+    for (const auto &commit : commits) {
+        key.clear();
+        WireWriter key_writer(key);
+        key_writer.writeInt16(MAX_KEY_VERSION);
+        key_writer.writeString(group);
+        key_writer.writeString(commit.topic);
+        key_writer.writeInt32(commit.partition);
+
+        value.clear();
+        WireWriter value_writer(value);
+        value_writer.writeInt16(MAX_VALUE_VERSION);
+        value_writer.writeInt64(commit.offset);
+        value_writer.writeInt32(commit.leader_epoch);
+        value_writer.writeString(commit.metadata);
+        value_writer.writeInt64(now);
+
+        builder.append(std::as_bytes(std::span(key)),
+                       std::as_bytes(std::span(value)));
+    }
+    std::string batch = builder.build();
+
+    std::unique_lock<std::shared_mutex> guard(lock);
+    LogAppendInfo info = offsets_log->append(std::as_bytes(std::span(batch)));
+    uint32_t group_id = groups.intern(group);
+    auto &slots = pending[info.base_offset];
+    slots.reserve(commits.size());
+    for (size_t i = 0; i < commits.size(); ++i) {
+        const OffsetCommit &commit = commits[i];
+        slots.push_back(
+            {{{group_id, topics.intern(commit.topic), commit.partition},
+              commit.leader_epoch,
+              commit.offset,
+              now,
+              info.base_offset + static_cast<int64_t>(i)},
+             std::string(commit.metadata)});
+    }
+    return {batch.size(), info.base_offset,
+            info.base_offset + static_cast<int64_t>(commits.size())};
+}
+
+void OffsetManager::completeCommit(int64_t base_offset, bool apply) {
+    std::unique_lock<std::shared_mutex> guard(lock);
+    auto batch = pending.find(base_offset);
+    if (batch == pending.end()) {
+        return;
+    }
+    if (apply) {
+        for (const auto &[slot, metadata] : batch->second) {
+            table.put(slot, metadata);
+        }
+    }
+    pending.erase(batch);
+}
+
+void OffsetManager::markFlushed(int64_t end_offset) {
+    std::unique_lock<std::shared_mutex> guard(lock);
+    flushed_offset = std::max(flushed_offset, end_offset);
+}
+
+bool OffsetManager::hasPendingCommits() const {
+    std::shared_lock<std::shared_mutex> guard(lock);
+    return !pending.empty();
+}
+
+std::optional<CommittedOffset>
+OffsetManager::committedOffset(std::string_view group, std::string_view topic,
+                               int32_t partition) const {
+    std::shared_lock<std::shared_mutex> guard(lock);
+    uint32_t group_id = groups.find(group);
+    uint32_t topic_id = topics.find(topic);
+    if (group_id == StringInterner::NOT_FOUND ||
+        topic_id == StringInterner::NOT_FOUND) {
+        return std::nullopt;
+    }
+    const OffsetTable::Slot *slot = table.find({group_id, topic_id, partition});
+    if (slot == nullptr) {
+        return std::nullopt;
+    }
+    return CommittedOffset{slot->offset, slot->leader_epoch,
+                           std::string(table.metadata(*slot))};
+}
+
+std::vector<std::pair<TopicPartition, CommittedOffset>>
+OffsetManager::groupOffsets(std::string_view group) const {
+    std::vector<std::pair<TopicPartition, CommittedOffset>> result;
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        uint32_t group_id = groups.find(group);
+        if (group_id == StringInterner::NOT_FOUND) {
+            return result;
+        }
+        table.forEach([&](const OffsetTable::Slot &slot) {
+            if (slot.key.group != group_id) {
+                return;
+            }
+            result.push_back(
+                {{std::string(topics.name(slot.key.topic)), slot.key.partition},
+                 {slot.offset, slot.leader_epoch,
+                  std::string(table.metadata(slot))}});
+        });
+    }
+
+    std::sort(result.begin(), result.end(),
+              [](const auto &a, const auto &b) {
+                  return std::tie(a.first.topic, a.first.partition) <
+                         std::tie(b.first.topic, b.first.partition);
+              });
+    return result;
+}
+
+void OffsetManager::applyRecord(int64_t offset, const Record &record) {
+    std::optional<CommitKey> key = decodeKey(record.key);
+    std::optional<CommitValue> value = decodeValue(record.value);
+    if (!key || !value) {
+        return;
+    }
+    table.put({{groups.intern(key->group), topics.intern(key->topic),
+                key->partition},
+               value->leader_epoch,
+               value->offset,
+               value->commit_timestamp,
+               offset},
+              value->metadata);
+}
+
+bool OffsetManager::isRetained(int64_t offset, const Record &record) const {
+    std::optional<CommitKey> key;
+    try {
+        key = decodeKey(record.key);
+        if (!key || !decodeValue(record.value)) {
+            return true;
+        }
+    } catch (const WireError &) {
+        return true;
+    }
+
+    std::shared_lock<std::shared_mutex> guard(lock);
+    const OffsetTable::Slot *slot = table.find(
+        {groups.find(key->group), topics.find(key->topic), key->partition});
+    return slot == nullptr || slot->log_offset <= offset ||
+           slot->log_offset >= flushed_offset;
+}
+
+void OffsetManager::replayFrom(int64_t offset) {
+    std::unique_lock<std::shared_mutex> guard(lock);
+    std::vector<std::byte> buffer;
+
+    while (auto read =
+               offsets_log->read(offset, LogSegment::RECOVERY_READ_SIZE)) {
+        const FileRegion &region = read->records;
+        buffer.resize(region.size);
+        ssize_t result = pread(*region.file, buffer.data(), region.size,
+                               static_cast<off_t>(region.position));
+        if (result < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to read " + offsets_log->dir());
+        }
+
+        // read() returns the first batch whole, so every round gets on.
+        std::span<const std::byte> chunk(buffer.data(), result);
+        int64_t next_offset = offset;
+        while (chunk.size() >= RecordBatchView::HEADER_SIZE) {
+            RecordBatchView batch(chunk);
+            if (batch.batchLength() <= 0 ||
+                batch.sizeInBytes() > chunk.size()) {
+                break;
+            }
+            try {
+                if (!batch.isControlBatch()) {
+                    batch.forEachRecord([&](const Record &record) {
+                        applyRecord(batch.baseOffset() + record.offset_delta,
+                                    record);
+                    });
+                }
+            } catch (const WireError &e) {
+                LOG_WARN("Skipping offsets at " << batch.baseOffset() << " of "
+                         << offsets_log->topicPartition().toString() << ": "
+                         << e.what());
+            }
+            next_offset = batch.lastOffset() + 1;
+            chunk = chunk.subspan(batch.sizeInBytes());
+        }
+        if (next_offset == offset) {
+            break;
+        }
+        offset = next_offset;
+    }
+}
+
+std::optional<int64_t> OffsetManager::loadSnapshot() {
+    std::ifstream file(snapshot_path, std::ios::binary);
+    if (!file) {
+        return std::nullopt;
+    }
+    std::string contents((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+
+    try {
+        // Everything is followed by its CRC-32C.
+        if (contents.size() < sizeof(uint32_t)) {
+            throw WireError("Truncated snapshot");
+        }
+        auto bytes = std::as_bytes(std::span(contents));
+        auto body = bytes.first(bytes.size() - sizeof(uint32_t));
+        if (crc32c::value(body) !=
+            wire::load<uint32_t>(bytes.data() + body.size())) {
+            throw WireError("Snapshot checksum mismatch");
+        }
+
+        WireReader reader(body);
+        if (reader.readInt16() != SNAPSHOT_VERSION) {
+            throw WireError("Unknown snapshot version");
+        }
+        int64_t end_offset = reader.readInt64();
+
+        // Names in id order, so interning them again gives the same ids.
+        StringInterner loaded_groups;
+        StringInterner loaded_topics;
+        for (StringInterner *names : {&loaded_groups, &loaded_topics}) {
+            int32_t count = reader.readArrayLength();
+            for (int32_t i = 0; i < count; ++i) {
+                if (names->intern(reader.readString()) !=
+                    static_cast<uint32_t>(i)) {
+                    throw WireError("Duplicate name in snapshot");
+                }
+            }
+        }
+
+        OffsetTable loaded_table;
+        int32_t count = reader.readArrayLength();
+        for (int32_t i = 0; i < count; ++i) {
+            OffsetTable::Slot slot;
+            slot.key.group = reader.readUint32();
+            slot.key.topic = reader.readUint32();
+            slot.key.partition = reader.readInt32();
+            slot.leader_epoch = reader.readInt32();
+            slot.offset = reader.readInt64();
+            slot.commit_timestamp = reader.readInt64();
+            slot.log_offset = reader.readInt64();
+            std::string_view metadata = reader.readString();
+            if (slot.key.group >= loaded_groups.size() ||
+                slot.key.topic >= loaded_topics.size()) {
+                throw WireError("Unknown name id in snapshot");
+            }
+            loaded_table.put(slot, metadata);
+        }
+
+        std::unique_lock<std::shared_mutex> guard(lock);
+        groups = std::move(loaded_groups);
+        topics = std::move(loaded_topics);
+        table = std::move(loaded_table);
+        return end_offset;
+    } catch (const WireError &e) {
+        LOG_WARN("Ignoring offset snapshot " << snapshot_path << ": "
+                 << e.what());
+        return std::nullopt;
+    }
+}
+
+void OffsetManager::writeSnapshot() {
+    std::string contents;
+    WireWriter writer(contents);
+    int64_t end_offset;
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        end_offset = pending.empty() ? offsets_log->logEndOffset()
+                                     : pending.begin()->first;
+        if (end_offset == snapshot_offset) {
+            return;
+        }
+
+        writer.writeInt16(SNAPSHOT_VERSION);
+        writer.writeInt64(end_offset);
+        for (const StringInterner *names : {&groups, &topics}) {
+            writer.writeArrayLength(static_cast<int32_t>(names->size()));
+            for (uint32_t id = 0; id < names->size(); ++id) {
+                writer.writeString(names->name(id));
+            }
+        }
+        writer.writeArrayLength(static_cast<int32_t>(table.size()));
+        table.forEach([&](const OffsetTable::Slot &slot) {
+            writer.writeUint32(slot.key.group);
+            writer.writeUint32(slot.key.topic);
+            writer.writeInt32(slot.key.partition);
+            writer.writeInt32(slot.leader_epoch);
+            writer.writeInt64(slot.offset);
+            writer.writeInt64(slot.commit_timestamp);
+            writer.writeInt64(slot.log_offset);
+            writer.writeString(table.metadata(slot));
+        });
+    }
+    writer.writeUint32(crc32c::value(std::as_bytes(std::span(contents))));
+
+    // Written aside and renamed over the old one: a crash leaves one or the
+    // other, never half of one.
+    std::string temporary = snapshot_path + ".tmp";
+    {
+        Fd fd(open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644));
+        if (fd < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to create " + temporary);
+        }
+        writeAll(fd, contents, temporary);
+        if (fdatasync(fd) != 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to flush " + temporary);
+        }
+    }
+    std::filesystem::rename(temporary, snapshot_path);
+    snapshot_offset = end_offset;
+}
+
+void OffsetManager::clean() {
+    try {
+        auto started = std::chrono::steady_clock::now();
+        auto info = offsets_log->compact(
+            [this](int64_t offset, const Record &record) {
+                return isRetained(offset, record);
+            });
+        if (info) {
+            auto elapsed =
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - started);
+            LOG_INFO("Compacted " << info->segments << " segments of "
+                     << offsets_log->topicPartition().toString() << " from "
+                     << info->bytes_before << " to " << info->bytes_after
+                     << " bytes in " << elapsed.count() << " ms");
+        }
+        writeSnapshot();
+    } catch (const std::exception &e) {
+        LOG_ERROR("Failed to clean "
+                  << offsets_log->topicPartition().toString() << ": "
+                  << e.what());
+    }
+}
+
+void OffsetManager::run() {
+    Logger::setThreadName("offsets-cleaner");
+    std::unique_lock<std::mutex> guard(cleaner_lock);
+    while (!stopping) {
+        cleaner_wakeup.wait_for(
+            guard, std::chrono::milliseconds(config.cleaner_backoff_ms),
+            [this] { return stopping; });
+        if (stopping) {
+            break;
+        }
+        guard.unlock();
+        clean();
+        guard.lock();
+    }
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "BrokerConfig.h"
+#include "LogManager.h"
+#include "OffsetTable.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+struct Record;
+
+// What a group has committed for one partition.
+struct CommittedOffset {
+    int64_t offset = -1;
+    int32_t leader_epoch = -1;
+    std::string metadata;
+};
+
+// One partition of an OffsetCommit request.
+struct OffsetCommit {
+    std::string_view topic;
+    int32_t partition;
+    int64_t offset;
+    int32_t leader_epoch;
+    std::string_view metadata;
+};
+
+// Where commit() put one request's commits.
+struct CommitAppend {
+    size_t bytes = 0;
+    int64_t base_offset = -1;
+    int64_t end_offset = -1;
+};
+
+// Committed consumer group offsets, kept the way Kafka keeps them: every
+// commit is appended to the __consumer_offsets log as a keyed record (in
+// Kafka's record format), and the latest value per (group, topic,
+// partition) is served from an OffsetTable. A cleaner thread compacts the
+// rolled segments of the log down to those latest values and snapshots the
+// table next to the log, so that a restart only replays the commits made
+// after the last snapshot. Commits are only served, and only let older
+// ones be compacted away, once they are on disk.
+class OffsetManager {
+  public:
+    // In the directory of the offsets log.
+    static constexpr const char *SNAPSHOT_FILE = "offsets.snapshot";
+
+    OffsetManager(const OffsetsConfig &_config, LogManager &_log_manager);
+    ~OffsetManager();
+
+    OffsetManager(const OffsetManager &) = delete;
+    OffsetManager &operator=(const OffsetManager &) = delete;
+
+    // Opens the offsets log, creating it if needed, and rebuilds the table
+    // from the snapshot and the part of the log after it. Without a usable
+    // snapshot the whole log is replayed.
+    void load();
+    void start();
+    // Stops the cleaner and snapshots the table one last time, so that the
+    // next start has nothing to replay.
+    void shutdown();
+
+    // What commits are appended to, for the flusher. nullptr before load().
+    const std::shared_ptr<PartitionLog> &log() const { return offsets_log; }
+
+    // Appends the commits of one request as one batch, which stays pending
+    // until completeCommit(). Throws what PartitionLog::append() does.
+    CommitAppend commit(std::string_view group,
+                        std::span<const OffsetCommit> commits);
+    // Applies the pending batch at base_offset to the table, or drops it
+    // if it is not to be served (its flush failed).
+    void completeCommit(int64_t base_offset, bool apply);
+    // Everything before end_offset is on disk.
+    void markFlushed(int64_t end_offset);
+    bool hasPendingCommits() const;
+    std::optional<CommittedOffset> committedOffset(std::string_view group,
+                                                   std::string_view topic,
+                                                   int32_t partition) const;
+    // Everything group has committed, by topic and partition.
+    std::vector<std::pair<TopicPartition, CommittedOffset>>
+    groupOffsets(std::string_view group) const;
+
+    // One cleaner pass, what the cleaner thread runs every
+    // log.cleaner.backoff.ms: compacts the log, then snapshots the table if
+    // it moved on since the last snapshot. Not while that thread runs.
+    void clean();
+
+  private:
+    void run();
+
+    // Applies one record of the log; anything but an offset commit (group
+    // metadata, tombstones) is skipped. Caller holds lock exclusively.
+    void applyRecord(int64_t offset, const Record &record);
+    // Whether compaction keeps the record at offset: anything but a commit
+    // that a later, flushed one for the same key replaced.
+    bool isRetained(int64_t offset, const Record &record) const;
+    void replayFrom(int64_t offset);
+    // The log end offset the snapshot was taken at, if there is a snapshot
+    // that could be read.
+    std::optional<int64_t> loadSnapshot();
+    void writeSnapshot();
+
+    OffsetsConfig config;
+    LogManager &log_manager;
+    std::shared_ptr<PartitionLog> offsets_log;
+    std::string snapshot_path;
+
+    // Commits hold it exclusively from their append until they are
+    // pending, so that whatever is logged is in the table or pending for
+    // anyone who takes it shared (a snapshot in particular).
+    mutable std::shared_mutex lock;
+    StringInterner groups;
+    StringInterner topics;
+    OffsetTable table;
+    // Batches appended but not completed yet, by base offset. A snapshot
+    // stops before the first, so that a restart replays them.
+    std::map<int64_t, std::vector<std::pair<OffsetTable::Slot, std::string>>>
+        pending;
+    // The log end offset known to be on disk. A commit past it does not
+    // replace older ones in compaction: a crash may still lose it.
+    int64_t flushed_offset = 0;
+
+    // Cleaner thread only.
+    int64_t snapshot_offset = -1;
+
+    std::mutex cleaner_lock;
+    std::condition_variable cleaner_wakeup;
+    bool stopping = false;
+    std::thread cleaner;
+};
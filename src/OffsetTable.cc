@@ -0,0 +1,87 @@
+#include "OffsetTable.h"
+
+#include <utility>
+
+uint32_t StringInterner::intern(std::string_view name) {
+    auto it = ids.find(name);
+    if (it != ids.end()) {
+        return it->second;
+    }
+    uint32_t id = static_cast<uint32_t>(names.size());
+    const std::string &stored = names.emplace_back(name);
+    ids.emplace(stored, id);
+    return id;
+}
+
+uint32_t StringInterner::find(std::string_view name) const {
+    auto it = ids.find(name);
+    return it == ids.end() ? NOT_FOUND : it->second;
+}
+
+OffsetTable::OffsetTable()
+    : slots(new Slot[INITIAL_CAPACITY]),
+      metadata_values(new std::string[INITIAL_CAPACITY]),
+      capacity(INITIAL_CAPACITY) {
+    for (size_t i = 0; i < capacity; ++i) {
+        slots[i].key.group = EMPTY;
+    }
+}
+
+size_t OffsetTable::hash(const Key &key) {
+    // Multiply-xorshift over the three ids; consecutive partitions of one
+    // topic land far apart.
+    uint64_t h = (static_cast<uint64_t>(key.group) << 32 | key.topic) *
+                 0x9e3779b97f4a7c15ULL;
+    h ^= static_cast<uint32_t>(key.partition) * 0xc2b2ae3d27d4eb4fULL;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return static_cast<size_t>(h ^ (h >> 32));
+}
+
+size_t OffsetTable::probe(const Key &key) const {
+    size_t mask = capacity - 1;
+    for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+        if (slots[i].key.group == EMPTY || slots[i].key == key) {
+            return i;
+        }
+    }
+}
+
+const OffsetTable::Slot *OffsetTable::find(const Key &key) const {
+    const Slot &slot = slots[probe(key)];
+    return slot.key.group == EMPTY ? nullptr : &slot;
+}
+
+void OffsetTable::put(const Slot &slot, std::string_view metadata) {
+    // At most half full, which keeps probe sequences short.
+    if ((count + 1) * 2 > capacity) {
+        grow();
+    }
+    size_t i = probe(slot.key);
+    if (slots[i].key.group == EMPTY) {
+        ++count;
+    } else if (slots[i].log_offset > slot.log_offset) {
+        return;
+    }
+    slots[i] = slot;
+    metadata_values[i].assign(metadata);
+}
+
+void OffsetTable::grow() {
+    size_t old_capacity = std::exchange(capacity, capacity * 2);
+    auto old_slots = std::exchange(slots, std::make_unique<Slot[]>(capacity));
+    auto old_metadata = std::exchange(
+        metadata_values, std::make_unique<std::string[]>(capacity));
+    for (size_t i = 0; i < capacity; ++i) {
+        slots[i].key.group = EMPTY;
+    }
+
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_slots[i].key.group == EMPTY) {
+            continue;
+        }
+        size_t target = probe(old_slots[i].key);
+        slots[target] = old_slots[i];
+        metadata_values[target] = std::move(old_metadata[i]);
+    }
+}
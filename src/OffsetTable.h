@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Hands out a small, dense id per distinct string, so that keys built from
+// group and topic names are a few integers instead of heap strings. Names
+// are never forgotten; their views stay valid for the interner's lifetime.
+class StringInterner {
+  public:
+    static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+    uint32_t intern(std::string_view name);
+    // NOT_FOUND for a name that was never interned.
+    uint32_t find(std::string_view name) const;
+    std::string_view name(uint32_t id) const { return names[id]; }
+    size_t size() const { return names.size(); }
+
+  private:
+    // A deque, so that the views the map is keyed by never move.
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, uint32_t> ids;
+};
+
+// The latest committed offset per (group, topic, partition), in one flat
+// array probed linearly: a lookup hashes three integers and usually reads a
+// single cache line. Metadata strings live in an array of their own, so
+// that the probed slots stay small. There is no erase; offsets are only
+// ever overwritten.
+class OffsetTable {
+  public:
+    struct Key {
+        // Ids from the group and topic interners.
+        uint32_t group;
+        uint32_t topic;
+        int32_t partition;
+
+        bool operator==(const Key &) const = default;
+    };
+
+    struct Slot {
+        Key key;
+        int32_t leader_epoch;
+        int64_t offset;
+        int64_t commit_timestamp;
+        // Where the commit is in the offsets log: later commits win, and
+        // compaction keeps exactly the records a slot points at.
+        int64_t log_offset;
+    };
+
+    OffsetTable();
+
+    // Stores the commit unless the key already holds a later one (by
+    // log_offset), which makes replaying the log over a snapshot harmless.
+    void put(const Slot &slot, std::string_view metadata);
+    const Slot *find(const Key &key) const;
+    std::string_view metadata(const Slot &slot) const {
+        return metadata_values[&slot - slots.get()];
+    }
+    size_t size() const { return count; }
+
+    // Calls func(const Slot &) for every entry, in no particular order.
+    template <typename F> void forEach(F &&func) const {
+        for (size_t i = 0; i < capacity; ++i) {
+            if (slots[i].key.group != EMPTY) {
+                func(slots[i]);
+            }
+        }
+    }
+
+  private:
+    // Marks an unused slot; interned ids never get that high.
+    static constexpr uint32_t EMPTY = UINT32_MAX;
+    static constexpr size_t INITIAL_CAPACITY = 1024;
+
+    static size_t hash(const Key &key);
+    // The slot holding key, or the free slot where it would go.
+    size_t probe(const Key &key) const;
+    void grow();
+
+    std::unique_ptr<Slot[]> slots;
+    std::unique_ptr<std::string[]> metadata_values;
+    size_t capacity = 0;
+    size_t count = 0;
+};
@@ -0,0 +1,425 @@
+#include "PartitionLog.h"
+
+#include "Logger.h"
+#include "RecordBatch.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+namespace {
+
+// Appends batch to out without the records retain() drops. Like Kafka's
+// cleaner, a filtered batch keeps its base offset and last offset delta, so
+// the offsets of what is left do not change. Compressed batches cannot be
+// filtered in place and control batches carry no keys: both stay whole.
+void appendRetained(const RecordBatchView &batch,
+                    const PartitionLog::RetainFunction &retain,
+                    std::string &out) {
+    std::span<const std::byte> bytes = batch.data().first(batch.sizeInBytes());
+    WireWriter writer(out);
+    if (batch.compressionType() != 0 || batch.isControlBatch()) {
+        writer.writeRaw(bytes);
+        return;
+    }
+
+    std::span<const std::byte> records =
+        bytes.subspan(RecordBatchView::RECORDS_OFFSET);
+    std::string retained;
+    int32_t kept = 0;
+    WireReader reader(records);
+    for (int32_t i = 0; i < batch.recordsCount(); ++i) {
+        size_t start = reader.position();
+        Record record = Record::decode(reader);
+        if (retain(batch.baseOffset() + record.offset_delta, record)) {
+            WireWriter(retained).writeRaw(
+                records.subspan(start, reader.position() - start));
+            ++kept;
+        }
+    }
+
+    if (kept == 0) {
+        return;
+    }
+    if (kept == batch.recordsCount()) {
+        writer.writeRaw(bytes);
+        return;
+    }
+
+    size_t begin = out.size();
+    writer.writeRaw(bytes.first(RecordBatchView::HEADER_SIZE));
+    writer.writeRaw(retained);
+    char *header = out.data() + begin;
+    wire::store(header + RecordBatchView::LENGTH_OFFSET,
+                static_cast<int32_t>(out.size() - begin -
+                                     RecordBatchView::LOG_OVERHEAD));
+    wire::store(header + RecordBatchView::RECORDS_COUNT_OFFSET, kept);
+    RecordBatchView filtered(std::as_bytes(std::span(out).subspan(begin)));
+    wire::store(header + RecordBatchView::CRC_OFFSET,
+                filtered.computeChecksum());
+}
+
+} // namespace
+
+std::optional<TopicPartition>
+TopicPartition::fromDirName(const std::string &name) {
+    size_t separator = name.rfind('-');
+    if (separator == std::string::npos || separator == 0 ||
+        separator + 1 == name.size()) {
+        return std::nullopt;
+    }
+
+    std::string partition = name.substr(separator + 1);
+    // Also rules out Kafka's "<tp>.<uuid>-delete" / "-future" directories.
+    if (!std::all_of(partition.begin(), partition.end(),
+                     [](unsigned char c) { return std::isdigit(c); }) ||
+        partition.size() > 9) {
+        return std::nullopt;
+    }
+
+    return TopicPartition{name.substr(0, separator), std::stoi(partition)};
+}
+
+PartitionLog::PartitionLog(TopicPartition _topic_partition, std::string _dir,
+                           const LogConfig &_config, bool had_clean_shutdown,
+                           TailCache *_tail_cache)
+    : topic_partition(std::move(_topic_partition)), log_dir(std::move(_dir)),
+      config(_config) {
+    std::filesystem::create_directories(log_dir);
+    loadSegments(had_clean_shutdown);
+    if (_tail_cache != nullptr) {
+        tail_cache = std::make_unique<PartitionTailCache>(*_tail_cache);
+    }
+}
+
+void PartitionLog::loadSegments(bool had_clean_shutdown) {
+    for (const auto &entry : std::filesystem::directory_iterator(log_dir)) {
+        const auto &path = entry.path();
+        // Left behind by a compaction that was interrupted.
+        if (path.extension() == ".cleaned") {
+            std::filesystem::remove(path);
+            continue;
+        }
+        std::string stem = path.stem().string();
+        if (path.extension() != ".log" || stem.size() != 20 ||
+            !std::all_of(stem.begin(), stem.end(),
+                         [](unsigned char c) { return std::isdigit(c); })) {
+            continue;
+        }
+
+        int64_t base_offset = std::stoll(stem);
+        segments.emplace(base_offset, std::make_shared<LogSegment>(
+                                          log_dir, base_offset, config));
+    }
+
+    if (segments.empty()) {
+        segments.emplace(0, std::make_shared<LogSegment>(log_dir, 0, config));
+    }
+
+    for (auto it = segments.begin(); std::next(it) != segments.end(); ++it) {
+        LogSegment &segment = *it->second;
+        // Rolled segments were complete when the next one started; only a
+        // lost index or one that fell behind the log has to be rebuilt. So
+        // does a missing time index, e.g. of a segment from before they
+        // were kept.
+        bool time_indexed =
+            segment.size() == 0 || segment.timeIndex().entries() > 0;
+        if ((!had_clean_shutdown || !time_indexed) && !segment.checkTail()) {
+            LOG_WARN("Rebuilding index of " << segment.logPath());
+            segment.recover();
+        }
+        segment.onBecomeInactive();
+    }
+
+    // Only the active segment can end in a torn write.
+    LogSegment &active = *activeSegment();
+    std::optional<int64_t> end_offset;
+    if (had_clean_shutdown) {
+        end_offset = active.checkTail();
+    }
+    next_offset = end_offset ? *end_offset : active.recover();
+    rebuildTimestampBounds();
+}
+
+void PartitionLog::rebuildTimestampBounds() {
+    timestamp_bounds.clear();
+    max_timestamp = -1;
+    for (const auto &[base_offset, segment] : segments) {
+        max_timestamp = std::max(max_timestamp, segment->largestTimestamp());
+        if (segment != activeSegment()) {
+            timestamp_bounds.push_back({base_offset, max_timestamp});
+        }
+    }
+}
+
+std::shared_ptr<LogSegment> PartitionLog::activeSegment() const {
+    return segments.rbegin()->second;
+}
+
+void PartitionLog::roll(int64_t new_base_offset) {
+    auto previous = activeSegment();
+    previous->onBecomeInactive();
+    timestamp_bounds.push_back({previous->baseOffset(), max_timestamp});
+    unflushed_segments.push_back(std::move(previous));
+
+    segments.emplace(new_base_offset, std::make_shared<LogSegment>(
+                                          log_dir, new_base_offset, config));
+}
+
+LogAppendInfo PartitionLog::append(std::span<const std::byte> bytes) {
+    RecordBatchView batch(bytes);
+    batch.ensureValid();
+    if (batch.sizeInBytes() != bytes.size()) {
+        throw WireError("Malformed record batch");
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    checkStorage();
+
+    LogAppendInfo info{next_offset, next_offset + batch.lastOffsetDelta()};
+
+    auto active = activeSegment();
+    bool segment_full =
+        active->size() > 0 &&
+        active->size() + bytes.size() > config.segment_bytes;
+    if (segment_full || active->offsetIndex().isFull() ||
+        active->timeIndex().isFull()) {
+        roll(info.base_offset);
+        active = activeSegment();
+    }
+
+    active->append(info.base_offset, info.last_offset, bytes);
+    if (tail_cache) {
+        tail_cache->append(info.base_offset, info.last_offset, bytes);
+    }
+    next_offset = info.last_offset + 1;
+    max_timestamp = std::max(max_timestamp, batch.maxTimestamp());
+    appended_bytes += bytes.size();
+    return info;
+}
+
+std::optional<LogReadInfo> PartitionLog::read(int64_t offset,
+                                              uint64_t max_bytes) const {
+    std::shared_ptr<LogSegment> candidates[2];
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (offset < segments.begin()->first || offset > next_offset) {
+            throw OffsetOutOfRangeError(
+                "Offset " + std::to_string(offset) + " is out of range for " +
+                topic_partition.toString());
+        }
+        if (offset == next_offset) {
+            return std::nullopt;
+        }
+
+        // The floor segment holds the offset unless it ends just before it,
+        // in which case the first batch of the next segment does.
+        auto it = std::prev(segments.upper_bound(offset));
+        candidates[0] = it->second;
+        if (++it != segments.end()) {
+            candidates[1] = it->second;
+        }
+    }
+
+    for (const auto &segment : candidates) {
+        if (!segment) {
+            break;
+        }
+        auto batch = segment->translateOffset(offset);
+        if (!batch) {
+            continue;
+        }
+
+        uint64_t available = segment->size() - batch->position;
+        uint64_t size = std::min(available, std::max(max_bytes, batch->size));
+        return LogReadInfo{{segment->logFile(), batch->position, size},
+                           batch->base_offset};
+    }
+
+    return std::nullopt;
+}
+
+std::optional<CachedReadInfo>
+PartitionLog::readFromCache(int64_t offset, uint64_t max_bytes) const {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!tail_cache || offset < segments.begin()->first ||
+        offset >= next_offset) {
+        return std::nullopt;
+    }
+    return tail_cache->read(offset, max_bytes);
+}
+
+int64_t PartitionLog::logStartOffset() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return segments.begin()->first;
+}
+
+int64_t PartitionLog::logEndOffset() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return next_offset;
+}
+
+int64_t PartitionLog::maxTimestamp() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return max_timestamp;
+}
+
+std::optional<TimestampAndOffset>
+PartitionLog::offsetForTimestamp(int64_t target) const {
+    std::shared_ptr<LogSegment> segment;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (max_timestamp < target) {
+            return std::nullopt;
+        }
+        auto bound = std::lower_bound(
+            timestamp_bounds.begin(), timestamp_bounds.end(), target,
+            [](const TimestampBound &bound, int64_t timestamp) {
+                return bound.max_timestamp < timestamp;
+            });
+        segment = bound == timestamp_bounds.end()
+                      ? activeSegment()
+                      : segments.at(bound->base_offset);
+    }
+    return segment->findOffsetByTimestamp(target);
+}
+
+std::optional<CompactionInfo>
+PartitionLog::compact(const RetainFunction &retain) {
+    std::vector<std::shared_ptr<LogSegment>> rolled;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (auto it = segments.begin(); std::next(it) != segments.end();
+             ++it) {
+            rolled.push_back(it->second);
+        }
+    }
+    if (rolled.empty() ||
+        (rolled.size() == 1 && rolled.front() == compacted_segment)) {
+        return std::nullopt;
+    }
+
+    // Rolled segments are never written again, so they are read without
+    // the lock while appends go on.
+    CompactionInfo info{rolled.size(), 0, 0};
+    const LogSegment &first = *rolled.front();
+    std::string cleaned_path = first.logPath() + ".cleaned";
+    {
+        Fd cleaned(open(cleaned_path.c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+        if (cleaned < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to create " + cleaned_path);
+        }
+        std::string buffer;
+        for (const auto &segment : rolled) {
+            info.bytes_before += segment->size();
+            segment->forEachBatch([&](const RecordBatchView &batch) {
+                appendRetained(batch, retain, buffer);
+                if (buffer.size() >= LogSegment::RECOVERY_READ_SIZE) {
+                    info.bytes_after += buffer.size();
+                    writeAll(cleaned, buffer, cleaned_path);
+                    buffer.clear();
+                }
+            });
+        }
+        info.bytes_after += buffer.size();
+        writeAll(cleaned, buffer, cleaned_path);
+        if (fdatasync(cleaned) != 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to flush " + cleaned_path);
+        }
+    }
+    // Typically the segment an earlier run of the broker compacted already.
+    if (rolled.size() == 1 && info.bytes_after == info.bytes_before) {
+        std::filesystem::remove(cleaned_path);
+        compacted_segment = rolled.front();
+        return std::nullopt;
+    }
+
+    // The old indexes go first, so that the new segment builds fresh ones
+    // instead of mapping (and truncating) the file the old segment still
+    // reads through. A crash in between leaves the old segment without an
+    // index, which recovery rebuilds; one after the rename leaves the new
+    // segment next to rolled segments holding the same records at the same
+    // offsets again, which the next pass merges.
+    std::filesystem::remove(first.offsetIndex().path());
+    std::filesystem::remove(first.timeIndex().path());
+    std::filesystem::rename(cleaned_path, first.logPath());
+    syncDirectory(log_dir);
+
+    auto replacement =
+        std::make_shared<LogSegment>(log_dir, first.baseOffset(), config);
+    replacement->recover();
+    replacement->onBecomeInactive();
+    replacement->flushIndex();
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        for (const auto &segment : rolled) {
+            segments.erase(segment->baseOffset());
+        }
+        segments.emplace(replacement->baseOffset(), replacement);
+        rebuildTimestampBounds();
+        // Cached batches of the rolled segments still hold what was dropped.
+        if (tail_cache) {
+            tail_cache->clear();
+        }
+    }
+    for (size_t i = 1; i < rolled.size(); ++i) {
+        rolled[i]->deleteFiles();
+    }
+    compacted_segment = std::move(replacement);
+    return info;
+}
+
+std::vector<std::shared_ptr<LogSegment>>
+PartitionLog::takeUnflushedSegments() const {
+    std::vector<std::shared_ptr<LogSegment>> to_flush;
+    std::lock_guard<std::mutex> guard(lock);
+    checkStorage();
+    to_flush.swap(unflushed_segments);
+    to_flush.push_back(activeSegment());
+    return to_flush;
+}
+
+void PartitionLog::flush() const {
+    try {
+        for (const auto &segment : takeUnflushedSegments()) {
+            segment->flush();
+        }
+    } catch (const std::system_error &) {
+        markStorageFailure();
+        throw;
+    }
+}
+
+void PartitionLog::markStorageFailure() const {
+    if (!storage_failed.exchange(true)) {
+        LOG_ERROR("Marking " << topic_partition.toString()
+                  << " as failed: a sync of its log did not complete");
+    }
+}
+
+void PartitionLog::checkStorage() const {
+    if (storage_failed) {
+        throw std::system_error(EIO, std::generic_category(),
+                                topic_partition.toString() +
+                                    " failed to sync earlier");
+    }
+}
+
+void PartitionLog::close() {
+    flush();
+
+    std::lock_guard<std::mutex> guard(lock);
+    activeSegment()->onBecomeInactive();
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "BrokerConfig.h"
+#include "FileRegion.h"
+#include "LogSegment.h"
+#include "TailCache.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct TopicPartition {
+    std::string topic;
+    int32_t partition{};
+
+    bool operator==(const TopicPartition &) const = default;
+    // <topic>-<partition>, the name of the partition's log directory.
+    std::string toString() const {
+        return topic + "-" + std::to_string(partition);
+    }
+    static std::optional<TopicPartition> fromDirName(const std::string &name);
+};
+
+struct TopicPartitionHash {
+    size_t operator()(const TopicPartition &tp) const noexcept {
+        return std::hash<std::string>{}(tp.topic) * 31 +
+               std::hash<int32_t>{}(tp.partition);
+    }
+};
+
+struct Record;
+
+struct OffsetOutOfRangeError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+struct LogAppendInfo {
+    int64_t base_offset;
+    int64_t last_offset;
+};
+
+// A contiguous slice of one segment file, e.g. what a fetch sends out.
+struct LogReadInfo {
+    FileRegion records;
+    int64_t first_offset = 0;
+};
+
+// What a PartitionLog::compact() pass did.
+struct CompactionInfo {
+    size_t segments;
+    uint64_t bytes_before;
+    uint64_t bytes_after;
+};
+
+// The log of one partition: an ordered set of segments where only the last
+// (active) one is appended to. Offsets are assigned under a short critical
+// section; reads only take the lock to pick the segment and then work on
+// their own reference to it.
+class PartitionLog {
+  public:
+    // Whether compaction keeps the record at offset.
+    using RetainFunction =
+        std::function<bool(int64_t offset, const Record &record)>;
+
+    // Opens the segments found in dir. After a clean shutdown they are
+    // trusted as they are; otherwise the active segment is validated batch
+    // by batch and truncated after the last good one, and the others get
+    // their index checked against the log (see LogSegment::checkTail()).
+    // Appends are also copied into tail_cache, if there is one.
+    PartitionLog(TopicPartition _topic_partition, std::string _dir,
+                 const LogConfig &_config, bool had_clean_shutdown = false,
+                 TailCache *_tail_cache = nullptr);
+
+    const TopicPartition &topicPartition() const { return topic_partition; }
+    const std::string &dir() const { return log_dir; }
+
+    // Assigns offsets to one record batch and appends it to the active
+    // segment, rolling to a new one when it is full.
+    LogAppendInfo append(std::span<const std::byte> batch);
+
+    // Up to max_bytes of whole-or-trailing-partial batches starting with the
+    // one that contains offset. The first batch is always returned whole,
+    // even if it is larger than max_bytes, so consumers always make
+    // progress. Empty when offset is at the log end; throws
+    // OffsetOutOfRangeError outside [log start, log end].
+    std::optional<LogReadInfo> read(int64_t offset, uint64_t max_bytes) const;
+    // The same from the tail cache, for consumers at or near the log end.
+    // Nothing if the batch with offset is not cached (or offset is the log
+    // end); read() is the fallback.
+    std::optional<CachedReadInfo> readFromCache(int64_t offset,
+                                                uint64_t max_bytes) const;
+
+    int64_t logStartOffset() const;
+    int64_t logEndOffset() const;
+    // Largest batch timestamp in the log, -1 while it is empty.
+    int64_t maxTimestamp() const;
+    // First record whose timestamp is >= target, or nothing if every record
+    // is older. The segment is found by a binary search over the rolled
+    // segments' timestamp bounds, the record by that segment's time index
+    // (see LogSegment::findOffsetByTimestamp()).
+    std::optional<TimestampAndOffset> offsetForTimestamp(int64_t target) const;
+    // Total bytes appended since the log was opened. Parked fetches compare
+    // it against the value they saw to tell whether min_bytes is met.
+    uint64_t bytesAppended() const { return appended_bytes; }
+
+    // Rewrites the rolled segments into one holding only the records
+    // retain() keeps, at their original offsets, the way Kafka's cleaner
+    // compacts a keyed log. The active segment is left alone and appends
+    // carry on meanwhile. Returns nothing if there is nothing new to
+    // compact: the only rolled segment is what the last pass wrote. One
+    // caller at a time.
+    std::optional<CompactionInfo> compact(const RetainFunction &retain);
+
+    // Throws a std::system_error if a sync fails, and from then on for good
+    // (see markStorageFailure()).
+    void flush() const;
+    // What flush() syncs, for callers that sync it themselves: the segments
+    // rolled since the last flush and the active one. Callers report a
+    // failed sync through markStorageFailure().
+    std::vector<std::shared_ptr<LogSegment>> takeUnflushedSegments() const;
+    // Once a sync failed, whatever it covered may never reach the disk, and
+    // a retried fsync would not tell (the error is reported only once). So
+    // the log fails every later append and flush instead, the way Kafka
+    // takes the log dir offline.
+    void markStorageFailure() const;
+    bool hasStorageFailure() const { return storage_failed; }
+    void close();
+
+  private:
+    // For each rolled segment in offset order: the largest timestamp in the
+    // log up to its end. Unlike the segments' own largest timestamps these
+    // never decrease, so the first segment holding a record at or past some
+    // timestamp is the first one whose bound reaches it.
+    struct TimestampBound {
+        int64_t base_offset;
+        int64_t max_timestamp;
+    };
+
+    void loadSegments(bool had_clean_shutdown);
+    // Caller holds lock.
+    void rebuildTimestampBounds();
+    std::shared_ptr<LogSegment> activeSegment() const;
+    void roll(int64_t new_base_offset);
+    void checkStorage() const;
+
+    TopicPartition topic_partition;
+    std::string log_dir;
+    LogConfig config;
+
+    mutable std::mutex lock;
+    std::map<int64_t, std::shared_ptr<LogSegment>> segments;
+    // Segments rolled since the last flush(); they still need an fsync.
+    mutable std::vector<std::shared_ptr<LogSegment>> unflushed_segments;
+    // Written by the last compact(), owned by its caller.
+    std::shared_ptr<LogSegment> compacted_segment;
+    std::vector<TimestampBound> timestamp_bounds;
+    std::unique_ptr<PartitionTailCache> tail_cache;
+    int64_t max_timestamp = -1;
+    int64_t next_offset = 0;
+    std::atomic<uint64_t> appended_bytes{0};
+    mutable std::atomic<bool> storage_failed{false};
+};
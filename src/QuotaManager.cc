@@ -0,0 +1,101 @@
+#include "QuotaManager.h"
+
+#include "Logger.h"
+#include "Metrics.h"
+
+#include <algorithm>
+#include <climits>
+#include <mutex>
+
+TokenBucket::TokenBucket(uint64_t rate, uint64_t burst_ms)
+    : burst_ns(static_cast<int64_t>(burst_ms) * 1000000) {
+    if (rate > 0) {
+        nanos_per_token = 1e9 / static_cast<double>(rate);
+    }
+}
+
+int64_t TokenBucket::record(int64_t now_ns, uint64_t cost) {
+    if (!enabled()) {
+        return 0;
+    }
+    auto cost_ns = static_cast<int64_t>(static_cast<double>(cost) *
+                                        nanos_per_token);
+    int64_t full_at = full_at_ns.load(std::memory_order_relaxed);
+    int64_t next;
+    do {
+        // A bucket that filled up meanwhile starts from now, not from when
+        // it was last used: unused tokens do not pile up beyond the burst.
+        next = std::max(full_at, now_ns) + cost_ns;
+    } while (!full_at_ns.compare_exchange_weak(full_at, next,
+                                               std::memory_order_relaxed));
+    return std::max<int64_t>(0, next - now_ns - burst_ns);
+}
+
+int64_t TokenBucket::throttleNanos(int64_t now_ns) const {
+    if (!enabled()) {
+        return 0;
+    }
+    return std::max<int64_t>(
+        0, full_at_ns.load(std::memory_order_relaxed) - now_ns - burst_ns);
+}
+
+bool TokenBucket::full(int64_t now_ns) const {
+    return full_at_ns.load(std::memory_order_relaxed) <= now_ns;
+}
+
+ClientQuota::ClientQuota(const QuotaConfig &config)
+    : requests(config.request_rate, config.burst_ms),
+      produce_bytes(config.producer_byte_rate, config.burst_ms),
+      fetch_bytes(config.consumer_byte_rate, config.burst_ms) {}
+
+int64_t ClientQuota::throttleNanos(int64_t now_ns) const {
+    return std::max({requests.throttleNanos(now_ns),
+                     produce_bytes.throttleNanos(now_ns),
+                     fetch_bytes.throttleNanos(now_ns)});
+}
+
+bool ClientQuota::idle(int64_t now_ns) const {
+    return requests.full(now_ns) && produce_bytes.full(now_ns) &&
+           fetch_bytes.full(now_ns);
+}
+
+QuotaManager::QuotaManager(const QuotaConfig &_config)
+    : config(_config),
+      active(_config.request_rate > 0 || _config.producer_byte_rate > 0 ||
+             _config.consumer_byte_rate > 0) {}
+
+std::shared_ptr<ClientQuota>
+QuotaManager::quota(std::string_view client_id) {
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        auto it = quotas.find(client_id);
+        if (it != quotas.end()) {
+            return it->second;
+        }
+    }
+    std::unique_lock<std::shared_mutex> guard(lock);
+    if (quotas.size() >= next_sweep_size) {
+        expireIdle(monotonicNanos());
+        next_sweep_size = std::max(MIN_SWEEP_SIZE, 2 * quotas.size());
+    }
+    auto &quota = quotas[std::string(client_id)];
+    if (!quota) {
+        quota = std::make_shared<ClientQuota>(config);
+    }
+    return quota;
+}
+
+void QuotaManager::expireIdle(int64_t now_ns) {
+    // References are only handed out under the lock, so one the map alone
+    // holds stays unused until it is erased.
+    size_t dropped = std::erase_if(quotas, [now_ns](const auto &entry) {
+        return entry.second.use_count() == 1 && entry.second->idle(now_ns);
+    });
+    LOG_DEBUG("Dropped " << dropped << " idle client quotas, "
+              << quotas.size() << " left");
+}
+
+int32_t QuotaManager::throttleMillis(int64_t throttle_ns) {
+    int64_t millis = (throttle_ns + 999999) / 1000000;
+    return static_cast<int32_t>(std::min<int64_t>(millis, INT32_MAX));
+}
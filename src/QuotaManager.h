@@ -0,0 +1,96 @@
+#pragma once
+
+#include "BrokerConfig.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Token bucket kept in a single atomic word, as in GCRA: instead of a token
+// count it stores the time at which the bucket will be full again. Taking
+// tokens pushes that time forward by cost / rate; a client is over quota
+// once it lies more than the burst ahead of now. Any thread may record
+// against it with one compare-and-swap, no lock.
+class TokenBucket {
+  public:
+    // rate is in tokens per second; 0 turns the bucket off.
+    TokenBucket(uint64_t rate, uint64_t burst_ms);
+
+    bool enabled() const { return nanos_per_token > 0; }
+
+    // Takes cost tokens, going into debt if there are not enough: the work
+    // has been done already. Returns how long the client has to back off
+    // for the bucket to be within its burst again, 0 if it is.
+    int64_t record(int64_t now_ns, uint64_t cost);
+    // The back-off record() returned last, less the time since.
+    int64_t throttleNanos(int64_t now_ns) const;
+    // Whether it has filled up again, i.e. is as good as a new bucket.
+    bool full(int64_t now_ns) const;
+
+  private:
+    double nanos_per_token = 0;
+    int64_t burst_ns;
+    std::atomic<int64_t> full_at_ns{0};
+};
+
+// The buckets of one client_id.
+struct ClientQuota {
+    explicit ClientQuota(const QuotaConfig &config);
+
+    // Longest back-off any of the buckets asks for.
+    int64_t throttleNanos(int64_t now_ns) const;
+    // Every bucket is full: forgetting the client loses nothing.
+    bool idle(int64_t now_ns) const;
+
+    TokenBucket requests;
+    TokenBucket produce_bytes;
+    TokenBucket fetch_bytes;
+};
+
+// Per-client_id quotas, in the spirit of Kafka's ClientQuotaManager. Every
+// client id gets buckets of its own at the configured default rates. Going
+// over a quota does not fail anything: responses carry the back-off in
+// throttle_time_ms, and the broker stops reading from the connection until
+// it is over (see Reactor::throttle()).
+class QuotaManager {
+  public:
+    explicit QuotaManager(const QuotaConfig &_config);
+
+    // False while no quota is configured, so that nothing is looked up.
+    bool enabled() const { return active; }
+
+    // Thread-safe. Clients may make up any number of ids, so entries only
+    // last while they matter: one that nobody else holds on to and whose
+    // buckets have filled up again is dropped by the next sweep, which
+    // runs whenever the map has doubled since the last one.
+    std::shared_ptr<ClientQuota> quota(std::string_view client_id);
+
+    // Milliseconds, rounded up, for a throttle_time_ms field.
+    static int32_t throttleMillis(int64_t throttle_ns);
+
+  private:
+    // Map size below which no sweep is done.
+    static constexpr size_t MIN_SWEEP_SIZE = 1024;
+
+    // Caller holds lock exclusively.
+    void expireIdle(int64_t now_ns);
+
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view value) const {
+            return std::hash<std::string_view>{}(value);
+        }
+    };
+
+    QuotaConfig config;
+    bool active;
+    std::shared_mutex lock;
+    std::unordered_map<std::string, std::shared_ptr<ClientQuota>, StringHash,
+                       std::equal_to<>>
+        quotas;
+    size_t next_sweep_size = MIN_SWEEP_SIZE;
+};
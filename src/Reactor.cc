@@ -0,0 +1,692 @@
+#include "Reactor.h"
+#include "KafkaApis.h"
+#include "Logger.h"
+#include "Metrics.h"
+
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cstring>
+
+namespace {
+
+// The part of a connection id below its reactor index.
+constexpr uint64_t LOCAL_ID_MASK =
+    (uint64_t{1} << Connection::SHARD_SHIFT) - 1;
+
+// Ends the back-off of a throttled connection.
+struct ThrottleTimeout : TimerTask {
+    ThrottleTimeout(int64_t deadline_ms, std::function<void()> _expire)
+        : TimerTask(deadline_ms), expire(std::move(_expire)) {}
+
+    void run() override { expire(); }
+
+    std::function<void()> expire;
+};
+
+} // namespace
+
+Reactor::Reactor(TCPManager &_tcp_manager, uint32_t _shard)
+    : tcp_manager(_tcp_manager), shard_index(_shard),
+      next_connection_id((static_cast<uint64_t>(_shard)
+                          << Connection::SHARD_SHIFT) +
+                         WAKEUP_ID + 1) {
+    // shutdown() and the queues poke this eventfd so the loop wakes up
+    // without having to wait for client traffic.
+    wakeup_fd.setFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if (wakeup_fd < 0) {
+        LOG_ERROR("eventfd failed: " << std::strerror(errno));
+        throw std::runtime_error("Failed to create wakeup eventfd");
+    }
+
+    // The ring is set up by run(), on the thread that submits to it.
+    if (tcp_manager.ioBackend() == IoBackend::IO_URING) {
+        return;
+    }
+
+    epoll_fd.setFd(epoll_create1(EPOLL_CLOEXEC));
+    if (epoll_fd < 0) {
+        LOG_ERROR("epoll_create1 failed: " << std::strerror(errno));
+        throw std::runtime_error("Failed to create epoll instance");
+    }
+
+    registerFd(wakeup_fd, WAKEUP_ID, EPOLLIN);
+}
+
+void Reactor::listen(const struct addrinfo &address, int backlog) {
+    server_fd.setFd(socket(address.ai_family,
+                           SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    if (server_fd < 0) {
+        LOG_ERROR("socket failed: " << std::strerror(errno));
+        throw std::runtime_error("Failed to create server socket: ");
+    }
+
+    // Since the tester restarts your program quite often, setting SO_REUSEADDR
+    // ensures that we don't run into 'Address already in use' errors.
+    // SO_REUSEPORT lets every reactor bind the same port.
+    int reuse = 1;
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse,
+                   sizeof(reuse)) < 0 ||
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &reuse,
+                   sizeof(reuse)) < 0) {
+        LOG_ERROR("setsockopt failed: " << std::strerror(errno));
+        throw std::runtime_error("setsockopt failed: ");
+    }
+
+    if (bind(server_fd, address.ai_addr, address.ai_addrlen) != 0) {
+        LOG_ERROR("bind failed: " << std::strerror(errno));
+        throw std::runtime_error("Failed to bind the listener");
+    }
+
+    if (::listen(server_fd, backlog) != 0) {
+        LOG_ERROR("listen failed: " << std::strerror(errno));
+        throw std::runtime_error("listen failed");
+    }
+
+    if (epoll_fd >= 0) {
+        registerFd(server_fd, SERVER_ID, EPOLLIN | EPOLLET);
+    }
+}
+
+void Reactor::registerFd(int fd, uint64_t id, uint32_t events) const {
+    struct epoll_event event {};
+    event.events = events;
+    event.data.u64 = id;
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        LOG_ERROR("epoll_ctl failed: " << std::strerror(errno));
+        throw std::runtime_error("Failed to register fd with epoll");
+    }
+}
+
+Fd Reactor::acceptConnection() const {
+    struct sockaddr_storage client_addr {};
+    socklen_t client_addr_len = sizeof(client_addr);
+
+    struct sockaddr *addr = reinterpret_cast<struct sockaddr *>(&client_addr);
+    Fd client_fd(accept4(server_fd, addr, &client_addr_len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC));
+
+    if (client_fd < 0) {
+        // The listening socket is non-blocking: an empty backlog is not an
+        // error, and neither is a client that went away before we got to it.
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED ||
+            errno == EINTR) {
+            return Fd();
+        }
+        LOG_ERROR("accept failed: " << std::strerror(errno));
+        throw std::runtime_error("Failed to accept connection: ");
+    }
+
+    LOG_DEBUG("Client connected on reactor " << shard_index);
+    return client_fd;
+}
+
+void Reactor::acceptPendingConnections() {
+    // Edge-triggered: keep accepting until the backlog is empty, otherwise
+    // the remaining connections would not be reported again.
+    while (!shutdown_flag) {
+        Fd client_fd = acceptConnection();
+        if (client_fd < 0) {
+            return;
+        }
+
+        if (!tcp_manager.admitConnection()) {
+            LOG_DEBUG("Closing connection beyond max.connections");
+            Metrics::local().connections_rejected.add(1);
+            continue;
+        }
+
+        configureClientSocket(client_fd);
+
+        uint64_t id = next_connection_id++;
+        registerFd(client_fd, id, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        connections.emplace(
+            id, std::make_unique<Connection>(id, std::move(client_fd),
+                                             buffer_pool));
+        Metrics::local().connections_accepted.add(1);
+    }
+}
+
+void Reactor::configureClientSocket(const Fd &client_fd) {
+    // Responses are coalesced in user space, so Nagle only adds latency.
+    // Set once here rather than after every message.
+    int optval = 1;
+    if (setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &optval,
+                   sizeof(optval)) != 0) {
+        LOG_ERROR("setsockopt TCP_NODELAY failed: " << std::strerror(errno));
+    }
+}
+
+void Reactor::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        tasks.push_back(std::move(task));
+    }
+    wakeup();
+}
+
+void Reactor::completeDeferredResponse(ResponseHandle response,
+                                       std::vector<OutputChunk> chunks) {
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        deferred_responses.push_back({response, std::move(chunks)});
+    }
+    wakeup();
+}
+
+void Reactor::closeConnection(uint64_t connection_id) {
+    post([this, connection_id] { cleanupClient(connection_id); });
+}
+
+void Reactor::throttle(Connection &connection, int64_t throttle_ms) {
+    int64_t until = Timer::now() + throttle_ms;
+    if (until <= connection.throttled_until_ms) {
+        return;
+    }
+    connection.throttled_until_ms = until;
+    // A timer is pending already; it finds the new deadline when it fires.
+    if (connection.mute_reasons & Connection::THROTTLED) {
+        return;
+    }
+    connection.mute(Connection::THROTTLED);
+    uint64_t id = connection.id;
+    timer.add(std::make_shared<ThrottleTimeout>(
+        until, [this, id] { liftThrottle(id); }));
+}
+
+void Reactor::liftThrottle(uint64_t connection_id) {
+    auto it = connections.find(connection_id);
+    if (it == connections.end()) {
+        return;
+    }
+    Connection &connection = *it->second;
+    if (connection.throttled_until_ms > Timer::now()) {
+        uint64_t id = connection.id;
+        timer.add(std::make_shared<ThrottleTimeout>(
+            connection.throttled_until_ms, [this, id] { liftThrottle(id); }));
+        return;
+    }
+    unmuteClient(connection, Connection::THROTTLED);
+}
+
+void Reactor::awaitRequestMemory(uint64_t connection_id) {
+    memory_waiters.push_back(connection_id);
+}
+
+void Reactor::resumeRequestMemory() {
+    post([this] {
+        std::vector<uint64_t> waiters;
+        waiters.swap(memory_waiters);
+        for (uint64_t id : waiters) {
+            auto it = connections.find(id);
+            if (it != connections.end()) {
+                unmuteClient(*it->second, Connection::REQUEST_MEMORY);
+            }
+        }
+    });
+}
+
+void Reactor::unmuteClient(Connection &connection,
+                           Connection::MuteReason reason) {
+    if (!(connection.mute_reasons & reason)) {
+        return;
+    }
+    connection.unmute(reason);
+    // The socket may have data the edge-triggered loop will not report
+    // again.
+    if (!connection.muted()) {
+        handleClient(connection, EPOLLIN);
+    }
+}
+
+void Reactor::drainQueues() {
+    std::vector<DeferredResponse> ready;
+    std::vector<std::function<void()>> ready_tasks;
+    {
+        std::lock_guard<std::mutex> guard(queue_lock);
+        ready.swap(deferred_responses);
+        ready_tasks.swap(tasks);
+    }
+
+    for (const auto &task : ready_tasks) {
+        task();
+    }
+
+    for (auto &response : ready) {
+        auto it = connections.find(response.response.connection_id);
+        if (it == connections.end()) {
+            continue;
+        }
+
+        Connection &connection = *it->second;
+        bool was_muted = connection.muted();
+        tcp_manager.completeResponse(connection, response.response.sequence,
+                                     std::move(response.chunks));
+
+        // Send whatever is ready now. A connection that got unmuted also has
+        // to pick up what was pipelined behind: the socket may have data the
+        // edge-triggered loop will not report again.
+        handleClient(connection,
+                     was_muted && !connection.muted() ? EPOLLIN : EPOLLOUT);
+    }
+}
+
+void Reactor::drainWakeups() const {
+    uint64_t counter;
+    while (read(wakeup_fd, &counter, sizeof(counter)) > 0) {
+    }
+}
+
+void Reactor::run(KafkaApis &_kafka_apis) {
+    kafka_apis = &_kafka_apis;
+    Logger::setThreadName("reactor-" + std::to_string(shard_index));
+
+    if (tcp_manager.ioBackend() == IoBackend::IO_URING) {
+        runRing();
+    } else {
+        runEpoll();
+    }
+
+    connections.clear();
+}
+
+void Reactor::runEpoll() {
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+
+    while (!shutdown_flag) {
+        int ready = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS,
+                               timer.pollTimeout(Timer::now()));
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("epoll_wait failed: " << std::strerror(errno));
+            throw std::runtime_error("epoll_wait failed");
+        }
+
+        for (int i = 0; i < ready && !shutdown_flag; ++i) {
+            uint64_t id = events[i].data.u64;
+
+            if (id == WAKEUP_ID) {
+                drainWakeups();
+                drainQueues();
+                continue;
+            }
+
+            if (id == SERVER_ID) {
+                try {
+                    acceptPendingConnections();
+                } catch (const std::exception &e) {
+                    LOG_WARN("Error accepting connection: " << e.what());
+                }
+                continue;
+            }
+
+            auto it = connections.find(id);
+            if (it == connections.end()) {
+                continue;
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                cleanupClient(id);
+                continue;
+            }
+
+            handleClient(*it->second, events[i].events);
+        }
+
+        timer.advanceClock(Timer::now());
+    }
+}
+
+uint64_t Reactor::ringData(RingOp op, uint64_t connection_id) {
+    return (static_cast<uint64_t>(op) << RING_OP_SHIFT) |
+           (connection_id & LOCAL_ID_MASK);
+}
+
+uint64_t Reactor::ringConnectionId(uint64_t user_data) const {
+    return (static_cast<uint64_t>(shard_index) << Connection::SHARD_SHIFT) |
+           (user_data & LOCAL_ID_MASK);
+}
+
+void Reactor::runRing() {
+    ring = std::make_unique<IoUring>();
+    receive_buffers = std::make_unique<ProvidedBuffers>(
+        *ring, 0, RECEIVE_BUFFERS, RECEIVE_BUFFER_SIZE);
+    armAccept();
+    armWakeup();
+
+    while (!shutdown_flag) {
+        // Whatever the last batch of completions queued (sends, re-armed
+        // receives) goes to the kernel with this one call.
+        ring->submitAndWait(1, timer.pollTimeout(Timer::now()));
+        ring->forEachCompletion([this](const struct io_uring_cqe &cqe) {
+            if (!shutdown_flag) {
+                handleCompletion(cqe);
+            }
+        });
+        timer.advanceClock(Timer::now());
+    }
+
+    // Closing the ring cancels what is still in flight.
+    ring.reset();
+    closing_connections.clear();
+}
+
+void Reactor::armAccept() {
+    struct io_uring_sqe &sqe = ring->nextSqe();
+    sqe.opcode = IORING_OP_ACCEPT;
+    sqe.fd = server_fd;
+    sqe.ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe.accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe.user_data = ringData(RING_ACCEPT, 0);
+}
+
+void Reactor::armWakeup() {
+    struct io_uring_sqe &sqe = ring->nextSqe();
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = wakeup_fd;
+    sqe.len = IORING_POLL_ADD_MULTI;
+    sqe.poll32_events = POLLIN;
+    sqe.user_data = ringData(RING_WAKEUP, 0);
+}
+
+void Reactor::handleCompletion(const struct io_uring_cqe &cqe) {
+    auto op = static_cast<RingOp>(cqe.user_data >> RING_OP_SHIFT);
+    // Multishot requests stay armed for as long as this is set.
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+
+    if (op == RING_ACCEPT) {
+        if (cqe.res >= 0) {
+            acceptRingConnection(cqe.res);
+        } else if (cqe.res != -ECONNABORTED && cqe.res != -EINTR) {
+            LOG_WARN("Error accepting connection: " << std::strerror(-cqe.res));
+        }
+        if (!more) {
+            armAccept();
+        }
+        return;
+    }
+
+    if (op == RING_WAKEUP) {
+        drainWakeups();
+        drainQueues();
+        if (!more) {
+            armWakeup();
+        }
+        return;
+    }
+
+    uint64_t id = ringConnectionId(cqe.user_data);
+    auto it = connections.find(id);
+    if (it == connections.end()) {
+        // Closed already: only the buffer and the bookkeeping are left.
+        if (ProvidedBuffers::hasBuffer(cqe)) {
+            receive_buffers->recycle(ProvidedBuffers::bufferOf(cqe));
+        }
+        auto closing = closing_connections.find(id);
+        if (closing != closing_connections.end() && !more &&
+            --closing->second->ring_ops == 0) {
+            closing_connections.erase(closing);
+        }
+        return;
+    }
+
+    Connection &connection = *it->second;
+    if (!more) {
+        --connection.ring_ops;
+    }
+
+    bool open = true;
+    try {
+        switch (op) {
+        case RING_RECV:
+            open = completeReceive(connection, cqe);
+            break;
+        case RING_SEND:
+            open = completeSend(connection, cqe.res);
+            break;
+        case RING_POLL_OUT:
+            connection.sending = false;
+            break;
+        default:
+            break;
+        }
+    } catch (const std::exception &e) {
+        LOG_WARN("Error handling client: " << e.what());
+        open = false;
+    }
+
+    if (!open) {
+        cleanupClient(id);
+        return;
+    }
+    serviceRingClient(connection, false);
+}
+
+void Reactor::acceptRingConnection(int fd) {
+    Fd client_fd(fd);
+    LOG_DEBUG("Client connected on reactor " << shard_index);
+
+    if (!tcp_manager.admitConnection()) {
+        LOG_DEBUG("Closing connection beyond max.connections");
+        Metrics::local().connections_rejected.add(1);
+        return;
+    }
+
+    configureClientSocket(client_fd);
+
+    uint64_t id = next_connection_id++;
+    Connection &connection =
+        *connections
+             .emplace(id, std::make_unique<Connection>(
+                              id, std::move(client_fd), buffer_pool))
+             .first->second;
+    Metrics::local().connections_accepted.add(1);
+    updateReceive(connection);
+}
+
+bool Reactor::completeReceive(Connection &connection,
+                              const struct io_uring_cqe &cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        connection.receiving = false;
+        connection.cancelling_receive = false;
+    }
+
+    if (cqe.res > 0 && ProvidedBuffers::hasBuffer(cqe)) {
+        uint16_t buffer = ProvidedBuffers::bufferOf(cqe);
+        try {
+            tcp_manager.receiveBytes(connection, *kafka_apis,
+                                     receive_buffers->data(buffer, cqe.res));
+        } catch (...) {
+            receive_buffers->recycle(buffer);
+            throw;
+        }
+        receive_buffers->recycle(buffer);
+        return true;
+    }
+
+    if (cqe.res == 0) {
+        LOG_DEBUG("Client shut down its side of the connection");
+        connection.input_closed = true;
+        return true;
+    }
+
+    // Out of buffers for now, or cancelled because the connection was
+    // muted: it is re-armed as soon as it may read again.
+    if (cqe.res == -ENOBUFS || cqe.res == -ECANCELED) {
+        return true;
+    }
+
+    LOG_ERROR("recv failed: " << std::strerror(-cqe.res));
+    throw std::runtime_error("Failed to read from client: ");
+}
+
+bool Reactor::completeSend(Connection &connection, int result) {
+    connection.sending = false;
+
+    if (result >= 0) {
+        tcp_manager.completeRingSend(connection, result);
+        return true;
+    }
+    if (result == -EAGAIN || result == -EWOULDBLOCK) {
+        pollWritable(connection);
+        return true;
+    }
+    if (result == -EINTR) {
+        return true;
+    }
+
+    LOG_ERROR("sendmsg failed: " << std::strerror(-result));
+    throw std::runtime_error("Failed to send response to client: ");
+}
+
+void Reactor::serviceRingClient(Connection &connection, bool read_buffered) {
+    bool open = true;
+
+    try {
+        if (read_buffered) {
+            tcp_manager.receiveBytes(connection, *kafka_apis, {});
+        }
+        updateReceive(connection);
+        submitSend(connection);
+        open = !connection.drained();
+    } catch (const std::exception &e) {
+        LOG_WARN("Error handling client: " << e.what());
+        open = false;
+    }
+
+    if (!open) {
+        cleanupClient(connection.id);
+    }
+}
+
+void Reactor::updateReceive(Connection &connection) {
+    if (connection.input_closed) {
+        return;
+    }
+    if (connection.muted()) {
+        if (connection.receiving && !connection.cancelling_receive) {
+            struct io_uring_sqe &sqe = ring->nextSqe();
+            sqe.opcode = IORING_OP_ASYNC_CANCEL;
+            sqe.addr = ringData(RING_RECV, connection.id);
+            sqe.user_data = ringData(RING_CANCEL, connection.id);
+            ++connection.ring_ops;
+            connection.cancelling_receive = true;
+        }
+        return;
+    }
+
+    if (!connection.receiving) {
+        struct io_uring_sqe &sqe = ring->nextSqe();
+        sqe.opcode = IORING_OP_RECV;
+        sqe.fd = connection.fd;
+        sqe.ioprio = IORING_RECV_MULTISHOT;
+        sqe.flags = IOSQE_BUFFER_SELECT;
+        sqe.buf_group = receive_buffers->group();
+        sqe.user_data = ringData(RING_RECV, connection.id);
+        ++connection.ring_ops;
+        connection.receiving = true;
+    }
+}
+
+void Reactor::submitSend(Connection &connection) {
+    if (connection.sending) {
+        return;
+    }
+
+    bool would_block = false;
+    RingSend *send = tcp_manager.prepareRingSend(connection, would_block);
+    if (send == nullptr) {
+        if (would_block) {
+            pollWritable(connection);
+        }
+        return;
+    }
+
+    struct io_uring_sqe &sqe = ring->nextSqe();
+    sqe.opcode = IORING_OP_SENDMSG;
+    sqe.fd = connection.fd;
+    sqe.addr = reinterpret_cast<uint64_t>(&send->msg);
+    sqe.msg_flags = send->flags;
+    sqe.user_data = ringData(RING_SEND, connection.id);
+    ++connection.ring_ops;
+    connection.sending = true;
+}
+
+void Reactor::pollWritable(Connection &connection) {
+    struct io_uring_sqe &sqe = ring->nextSqe();
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = connection.fd;
+    sqe.poll32_events = POLLOUT;
+    sqe.user_data = ringData(RING_POLL_OUT, connection.id);
+    ++connection.ring_ops;
+    connection.sending = true;
+}
+
+void Reactor::handleClient(Connection &connection, uint32_t events) {
+    if (ring) {
+        serviceRingClient(connection, events & EPOLLIN);
+        return;
+    }
+
+    bool open = true;
+
+    try {
+        // A muted connection does not read, and sees the end of the stream
+        // only once it reads again; its requests are answered all the same.
+        if (events & (EPOLLIN | EPOLLRDHUP)) {
+            tcp_manager.readBufferFromClientFd(connection, *kafka_apis);
+        }
+        // Everything answered in this batch goes out together, and EPOLLOUT
+        // lands here as well to resume a partial write.
+        tcp_manager.flushClient(connection);
+        open = !connection.drained();
+    } catch (const std::exception &e) {
+        LOG_WARN("Error handling client: " << e.what());
+        open = false;
+    }
+
+    if (!open) {
+        cleanupClient(connection.id);
+    }
+}
+
+void Reactor::cleanupClient(uint64_t connection_id) {
+    LOG_DEBUG("Client disconnected, cleaning up...");
+    // Closing the descriptor also removes it from the epoll interest list;
+    // the Fd destructor takes care of that when the connection is erased.
+    auto it = connections.find(connection_id);
+    if (it == connections.end()) {
+        return;
+    }
+    tcp_manager.connectionClosed(*it->second);
+    if (it->second->ring_ops > 0) {
+        // Ends the receive, send or poll the kernel still has for it, so
+        // that the last completion comes soon and frees the connection.
+        ::shutdown(it->second->fd, SHUT_RDWR);
+        closing_connections.emplace(connection_id, std::move(it->second));
+    }
+    connections.erase(it);
+    Metrics::local().connections_closed.add(1);
+}
+
+void Reactor::wakeup() const {
+    // write(2) on an eventfd is async-signal-safe, so this is fine to call
+    // from a signal handler.
+    if (wakeup_fd.getFd() >= 0) {
+        uint64_t one = 1;
+        [[maybe_unused]] ssize_t written =
+            write(wakeup_fd, &one, sizeof(one));
+    }
+}
+
+void Reactor::shutdown() {
+    shutdown_flag = true;
+
+    // Wake the event loop so it notices the flag.
+    wakeup();
+}
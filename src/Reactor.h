@@ -0,0 +1,155 @@
+#pragma once
+
+#include "BrokerConfig.h"
+#include "BufferPool.h"
+#include "IoUring.h"
+#include "TCPManager.h"
+#include "TimingWheel.h"
+
+#include <netdb.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// One event loop thread with its own SO_REUSEPORT listener, epoll instance
+// (or io_uring), connections and timer. Reactors share nothing: a
+// connection is served from accept to close by the reactor the kernel
+// handed it to, and other threads only reach a reactor through its queue
+// (post(), completeDeferredResponse()), which wakes it up via an eventfd.
+//
+// With the io_uring backend the loop waits for completions instead of
+// readiness: one multishot accept stands in for the accept loop, each
+// connection has a multishot recv that fills buffers out of a ring shared
+// by all of them (so an idle connection holds no read buffer at all), and
+// the sends of every connection that has something to write are submitted
+// together, with the next wait.
+class Reactor {
+  public:
+    static constexpr int MAX_EPOLL_EVENTS = 256;
+    // epoll user data of the two non-client descriptors; client connection
+    // ids start after them.
+    static constexpr uint64_t SERVER_ID = 0;
+    static constexpr uint64_t WAKEUP_ID = 1;
+    // The receive buffer ring: enough for a burst from a few hundred
+    // connections at once. A connection that finds it empty is re-armed
+    // once buffers have been handed back.
+    static constexpr uint16_t RECEIVE_BUFFERS = 256;
+    static constexpr uint32_t RECEIVE_BUFFER_SIZE = Connection::MIN_READ_SIZE;
+
+    Reactor(TCPManager &_tcp_manager, uint32_t _shard);
+
+    uint32_t shard() const { return shard_index; }
+
+    // Opens this reactor's listener on address. Every reactor binds the
+    // same address; SO_REUSEPORT makes the kernel balance between them.
+    void listen(const struct addrinfo &address, int backlog);
+    void run(KafkaApis &_kafka_apis);
+    // Async-signal-safe.
+    void shutdown();
+
+    // Thread-safe: queues the task and wakes the loop up to run it.
+    void post(std::function<void()> task);
+    // Thread-safe, see TCPManager::completeDeferredResponse().
+    void completeDeferredResponse(ResponseHandle response,
+                                  std::vector<OutputChunk> chunks);
+    // Thread-safe: closes the connection if it is still open.
+    void closeConnection(uint64_t connection_id);
+
+    // Stops reading from the connection for throttle_ms, on top of any
+    // back-off it is serving already.
+    void throttle(Connection &connection, int64_t throttle_ms);
+    // The connection was muted because queued.max.request.bytes is used up;
+    // it is read from again on the next resumeRequestMemory().
+    void awaitRequestMemory(uint64_t connection_id);
+    // Thread-safe: requests have been answered and there is room again.
+    void resumeRequestMemory();
+
+    // Timeouts of delayed operations. Driven by the loop, which sleeps in
+    // epoll_wait() (or io_uring_enter()) until the next one is due; only
+    // use it from this reactor's thread.
+    Timer &getTimer() { return timer; }
+
+  private:
+    struct DeferredResponse {
+        ResponseHandle response;
+        std::vector<OutputChunk> chunks;
+    };
+
+    // What a submission to the ring was for, in the top byte of its user
+    // data; the rest is the connection id without its shard.
+    enum RingOp : uint8_t {
+        RING_ACCEPT,
+        RING_WAKEUP,
+        RING_RECV,
+        RING_SEND,
+        RING_POLL_OUT,
+        RING_CANCEL,
+    };
+    static constexpr int RING_OP_SHIFT = 56;
+    static uint64_t ringData(RingOp op, uint64_t connection_id);
+    uint64_t ringConnectionId(uint64_t user_data) const;
+
+    void registerFd(int fd, uint64_t id, uint32_t events) const;
+    Fd acceptConnection() const;
+    static void configureClientSocket(const Fd &client_fd);
+    void acceptPendingConnections();
+    void handleClient(Connection &connection, uint32_t events);
+    void cleanupClient(uint64_t connection_id);
+    // Lifts a mute reason; a connection that is no longer muted at all
+    // picks up the requests that were waiting.
+    void unmuteClient(Connection &connection, Connection::MuteReason reason);
+    void liftThrottle(uint64_t connection_id);
+    void wakeup() const;
+    void drainQueues();
+    void drainWakeups() const;
+
+    void runEpoll();
+    void runRing();
+    void armAccept();
+    void armWakeup();
+    void handleCompletion(const struct io_uring_cqe &cqe);
+    void acceptRingConnection(int client_fd);
+    // Returns false once the connection has to be closed.
+    bool completeReceive(Connection &connection,
+                         const struct io_uring_cqe &cqe);
+    bool completeSend(Connection &connection, int result);
+    // Waits for room in the socket buffer, then sends again.
+    void pollWritable(Connection &connection);
+    // Reads what is buffered, then brings the connection's submissions in
+    // line with its state: a recv armed unless muted, a send if there is
+    // anything to write.
+    void serviceRingClient(Connection &connection, bool read_buffered);
+    void updateReceive(Connection &connection);
+    void submitSend(Connection &connection);
+
+    TCPManager &tcp_manager;
+    uint32_t shard_index;
+    Fd server_fd;
+    Fd epoll_fd;
+    Fd wakeup_fd;
+    KafkaApis *kafka_apis = nullptr;
+    uint64_t next_connection_id;
+    // Declared before the connections, which give their buffers back to it.
+    BufferPool buffer_pool;
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> connections;
+    // io_uring backend only. Connections closed while the kernel still had
+    // operations of theirs in flight wait here until the last one
+    // completes. The ring is created on the reactor's thread, and goes
+    // before the buffers registered with it and the connections it may
+    // still be reading from.
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>>
+        closing_connections;
+    std::unique_ptr<ProvidedBuffers> receive_buffers;
+    std::unique_ptr<IoUring> ring;
+    std::atomic<bool> shutdown_flag{false};
+    Timer timer;
+    // Muted for REQUEST_MEMORY, possibly closed since.
+    std::vector<uint64_t> memory_waiters;
+
+    std::mutex queue_lock;
+    std::vector<DeferredResponse> deferred_responses;
+    std::vector<std::function<void()>> tasks;
+};
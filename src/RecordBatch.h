@@ -0,0 +1,256 @@
+#pragma once
+
+#include "Crc32c.h"
+#include "WireCodec.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <string>
+
+// One record of a v2 batch, decoded in place: key and value point into the
+// batch. Headers are skipped.
+//
+// Layout (varints are zigzag-encoded):
+//   length varint, attributes int8, timestampDelta varlong,
+//   offsetDelta varint, keyLength varint, key, valueLength varint, value,
+//   headerCount varint, headers...
+struct Record {
+    int8_t attributes{};
+    int64_t timestamp_delta{};
+    int32_t offset_delta{};
+    NullableBytes key;
+    NullableBytes value;
+
+    // Reads one record, length prefix included.
+    static Record decode(WireReader &reader) {
+        int32_t length = reader.readVarint();
+        if (length < 0) {
+            throw WireError("Negative record length");
+        }
+        WireReader body(reader.readBytes(length));
+
+        Record record;
+        record.attributes = body.readInt8();
+        record.timestamp_delta = body.readVarlong();
+        record.offset_delta = body.readVarint();
+        record.key = readVarintBytes(body);
+        record.value = readVarintBytes(body);
+
+        int32_t headers = body.readVarint();
+        for (int32_t i = 0; i < headers; ++i) {
+            int32_t key_length = body.readVarint();
+            body.skip(std::max(key_length, 0));
+            readVarintBytes(body);
+        }
+        return record;
+    }
+
+  private:
+    static NullableBytes readVarintBytes(WireReader &reader) {
+        int32_t length = reader.readVarint();
+        if (length < 0) {
+            return std::nullopt;
+        }
+        return reader.readBytes(length);
+    }
+};
+
+// In-place view of a v2 (magic 2) record batch, the unit Kafka stores in
+// .log files and ships in Produce/Fetch. Nothing is copied: accessors read
+// the big-endian header fields straight out of the underlying bytes.
+//
+// Layout:
+//   baseOffset int64, batchLength int32, partitionLeaderEpoch int32,
+//   magic int8, crc uint32, attributes int16, lastOffsetDelta int32,
+//   baseTimestamp int64, maxTimestamp int64, producerId int64,
+//   producerEpoch int16, baseSequence int32, recordsCount int32, records...
+class RecordBatchView {
+  public:
+    static constexpr size_t BASE_OFFSET_OFFSET = 0;
+    static constexpr size_t LENGTH_OFFSET = 8;
+    static constexpr size_t PARTITION_LEADER_EPOCH_OFFSET = 12;
+    static constexpr size_t MAGIC_OFFSET = 16;
+    static constexpr size_t CRC_OFFSET = 17;
+    static constexpr size_t ATTRIBUTES_OFFSET = 21;
+    static constexpr size_t LAST_OFFSET_DELTA_OFFSET = 23;
+    static constexpr size_t BASE_TIMESTAMP_OFFSET = 27;
+    static constexpr size_t MAX_TIMESTAMP_OFFSET = 35;
+    static constexpr size_t PRODUCER_ID_OFFSET = 43;
+    static constexpr size_t PRODUCER_EPOCH_OFFSET = 51;
+    static constexpr size_t BASE_SEQUENCE_OFFSET = 53;
+    static constexpr size_t RECORDS_COUNT_OFFSET = 57;
+    static constexpr size_t RECORDS_OFFSET = 61;
+
+    // baseOffset + batchLength: the part of a batch not counted in its length.
+    static constexpr size_t LOG_OVERHEAD = LENGTH_OFFSET + sizeof(int32_t);
+    static constexpr size_t HEADER_SIZE = RECORDS_OFFSET;
+    static constexpr int8_t CURRENT_MAGIC = 2;
+
+    static constexpr int16_t COMPRESSION_CODEC_MASK = 0x07;
+    static constexpr int16_t TIMESTAMP_TYPE_MASK = 0x08;
+    static constexpr int16_t CONTROL_FLAG_MASK = 0x20;
+
+    explicit RecordBatchView(std::span<const std::byte> _bytes)
+        : bytes(_bytes) {
+        if (bytes.size() < HEADER_SIZE) {
+            throw WireError("Record batch is shorter than its header");
+        }
+    }
+
+    int64_t baseOffset() const { return load<int64_t>(BASE_OFFSET_OFFSET); }
+    int32_t batchLength() const { return load<int32_t>(LENGTH_OFFSET); }
+    int32_t partitionLeaderEpoch() const {
+        return load<int32_t>(PARTITION_LEADER_EPOCH_OFFSET);
+    }
+    int8_t magic() const { return load<int8_t>(MAGIC_OFFSET); }
+    uint32_t crc() const { return load<uint32_t>(CRC_OFFSET); }
+    int16_t attributes() const { return load<int16_t>(ATTRIBUTES_OFFSET); }
+    int32_t lastOffsetDelta() const {
+        return load<int32_t>(LAST_OFFSET_DELTA_OFFSET);
+    }
+    int64_t baseTimestamp() const {
+        return load<int64_t>(BASE_TIMESTAMP_OFFSET);
+    }
+    int64_t maxTimestamp() const { return load<int64_t>(MAX_TIMESTAMP_OFFSET); }
+    int64_t producerId() const { return load<int64_t>(PRODUCER_ID_OFFSET); }
+    int16_t producerEpoch() const {
+        return load<int16_t>(PRODUCER_EPOCH_OFFSET);
+    }
+    int32_t baseSequence() const { return load<int32_t>(BASE_SEQUENCE_OFFSET); }
+    int32_t recordsCount() const { return load<int32_t>(RECORDS_COUNT_OFFSET); }
+
+    int64_t lastOffset() const { return baseOffset() + lastOffsetDelta(); }
+    // Bytes the whole batch occupies in a log file.
+    size_t sizeInBytes() const { return LOG_OVERHEAD + batchLength(); }
+
+    std::span<const std::byte> data() const { return bytes; }
+
+    // CRC-32C of everything after the crc field, which is what crc() must
+    // match.
+    uint32_t computeChecksum() const {
+        return crc32c::value(
+            bytes.subspan(ATTRIBUTES_OFFSET, sizeInBytes() - ATTRIBUTES_OFFSET));
+    }
+
+    // Checks magic, framing and checksum; throws WireError on the first
+    // problem found.
+    void ensureValid() const {
+        if (magic() != CURRENT_MAGIC) {
+            throw WireError("Unsupported record batch magic " +
+                            std::to_string(magic()));
+        }
+        if (batchLength() < static_cast<int32_t>(HEADER_SIZE - LOG_OVERHEAD) ||
+            sizeInBytes() > bytes.size() || lastOffsetDelta() < 0) {
+            throw WireError("Malformed record batch");
+        }
+        if (computeChecksum() != crc()) {
+            throw WireError("Record batch checksum mismatch");
+        }
+    }
+
+    int16_t compressionType() const {
+        return attributes() & COMPRESSION_CODEC_MASK;
+    }
+    // The broker stamped the batch on append; every record then has
+    // maxTimestamp() as its timestamp.
+    bool hasLogAppendTime() const { return attributes() & TIMESTAMP_TYPE_MASK; }
+    // Transaction markers; they carry no user records.
+    bool isControlBatch() const { return attributes() & CONTROL_FLAG_MASK; }
+
+    // Calls func(record) for every record. Only uncompressed batches can be
+    // walked in place.
+    template <typename F> void forEachRecord(F &&func) const {
+        if (compressionType() != 0) {
+            throw WireError("Compressed record batches are not supported (codec " +
+                            std::to_string(compressionType()) + ")");
+        }
+        if (sizeInBytes() > bytes.size()) {
+            throw WireError("Record batch is truncated");
+        }
+
+        WireReader reader(bytes.subspan(RECORDS_OFFSET,
+                                        sizeInBytes() - RECORDS_OFFSET));
+        for (int32_t i = 0; i < recordsCount(); ++i) {
+            func(Record::decode(reader));
+        }
+    }
+
+  private:
+    template <typename T> T load(size_t offset) const {
+        return wire::load<T>(bytes.data() + offset);
+    }
+
+    std::span<const std::byte> bytes;
+};
+
+// Builds an uncompressed v2 batch with base offset 0 (the log assigns the
+// real one), e.g. for internal topics and benchmarks. Needs at least one
+// record.
+class RecordBatchBuilder {
+  public:
+    explicit RecordBatchBuilder(int64_t _base_timestamp = 0)
+        : base_timestamp(_base_timestamp), max_timestamp(_base_timestamp) {}
+
+    void append(NullableBytes key, NullableBytes value,
+                int64_t timestamp = -1) {
+        if (timestamp < 0) {
+            timestamp = base_timestamp;
+        }
+        max_timestamp = std::max(max_timestamp, timestamp);
+
+        std::string body;
+        WireWriter writer(body);
+        writer.writeInt8(0); // attributes
+        writer.writeVarlong(timestamp - base_timestamp);
+        writer.writeVarint(count);
+        writeVarintBytes(writer, key);
+        writeVarintBytes(writer, value);
+        writer.writeVarint(0); // headers
+
+        WireWriter(records).writeVarint(static_cast<int32_t>(body.size()));
+        records += body;
+        ++count;
+    }
+
+    std::string build() const {
+        std::string batch(RecordBatchView::HEADER_SIZE, '\0');
+        batch += records;
+
+        char *p = batch.data();
+        using View = RecordBatchView;
+        wire::store(p + View::BASE_OFFSET_OFFSET, int64_t{0});
+        wire::store(p + View::LENGTH_OFFSET,
+                    static_cast<int32_t>(batch.size() - View::LOG_OVERHEAD));
+        wire::store(p + View::PARTITION_LEADER_EPOCH_OFFSET, int32_t{-1});
+        wire::store(p + View::MAGIC_OFFSET, View::CURRENT_MAGIC);
+        wire::store(p + View::ATTRIBUTES_OFFSET, int16_t{0});
+        wire::store(p + View::LAST_OFFSET_DELTA_OFFSET, count - 1);
+        wire::store(p + View::BASE_TIMESTAMP_OFFSET, base_timestamp);
+        wire::store(p + View::MAX_TIMESTAMP_OFFSET, max_timestamp);
+        wire::store(p + View::PRODUCER_ID_OFFSET, int64_t{-1});
+        wire::store(p + View::PRODUCER_EPOCH_OFFSET, int16_t{-1});
+        wire::store(p + View::BASE_SEQUENCE_OFFSET, int32_t{-1});
+        wire::store(p + View::RECORDS_COUNT_OFFSET, count);
+
+        auto bytes = std::as_bytes(std::span(batch));
+        wire::store(p + View::CRC_OFFSET,
+                    View(bytes).computeChecksum());
+        return batch;
+    }
+
+  private:
+    static void writeVarintBytes(WireWriter &writer, NullableBytes bytes) {
+        if (!bytes) {
+            writer.writeVarint(-1);
+            return;
+        }
+        writer.writeVarint(static_cast<int32_t>(bytes->size()));
+        writer.writeRaw(*bytes);
+    }
+
+    int64_t base_timestamp;
+    int64_t max_timestamp;
+    int32_t count = 0;
+    std::string records;
+};
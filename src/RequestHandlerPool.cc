@@ -0,0 +1,121 @@
+#include "RequestHandlerPool.h"
+
+#include "Logger.h"
+
+#include <string>
+
+RequestHandlerPool::RequestHandlerPool(size_t _threads)
+    : thread_count(_threads) {
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+}
+
+RequestHandlerPool::~RequestHandlerPool() { shutdown(); }
+
+void RequestHandlerPool::start() {
+    for (size_t i = 0; i < thread_count; ++i) {
+        threads.emplace_back(&RequestHandlerPool::run, this, i);
+    }
+}
+
+void RequestHandlerPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        stopping = true;
+    }
+    idle.notify_all();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+}
+
+void RequestHandlerPool::submit(std::function<void()> task) {
+    if (workers.empty()) {
+        task();
+        return;
+    }
+
+    size_t index = next_worker.fetch_add(1, std::memory_order_relaxed) %
+                   workers.size();
+    {
+        std::lock_guard<std::mutex> guard(workers[index]->lock);
+        workers[index]->tasks.push_back(std::move(task));
+        queued.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Workers check queued under idle_lock before they sleep: one that is
+    // about to has either seen the task or is waiting for this notification.
+    std::lock_guard<std::mutex> guard(idle_lock);
+    idle.notify_one();
+}
+
+void RequestHandlerPool::submit(const std::shared_ptr<Strand> &strand,
+                                std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> guard(strand->lock);
+        strand->tasks.push_back(std::move(task));
+        if (strand->scheduled) {
+            return;
+        }
+        strand->scheduled = true;
+    }
+    submit([this, strand] { runStrand(strand); });
+}
+
+void RequestHandlerPool::runStrand(const std::shared_ptr<Strand> &strand) {
+    // Drains the strand; whatever is submitted meanwhile is picked up here
+    // instead of being scheduled again.
+    while (true) {
+        std::function<void()> task;
+        {
+            std::lock_guard<std::mutex> guard(strand->lock);
+            if (strand->tasks.empty()) {
+                strand->scheduled = false;
+                return;
+            }
+            task = std::move(strand->tasks.front());
+            strand->tasks.pop_front();
+        }
+        task();
+    }
+}
+
+bool RequestHandlerPool::takeTask(size_t index,
+                                  std::function<void()> &task) {
+    // Own queue first, then the others'. Always from the front, so that
+    // requests are served in about the order they came in.
+    for (size_t i = 0; i < workers.size(); ++i) {
+        Worker &worker = *workers[(index + i) % workers.size()];
+        std::lock_guard<std::mutex> guard(worker.lock);
+        if (worker.tasks.empty()) {
+            continue;
+        }
+        task = std::move(worker.tasks.front());
+        worker.tasks.pop_front();
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    return false;
+}
+
+void RequestHandlerPool::run(size_t index) {
+    Logger::setThreadName("request-handler-" + std::to_string(index));
+
+    std::function<void()> task;
+    while (true) {
+        if (takeTask(index, task)) {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(idle_lock);
+        idle.wait(guard, [this] {
+            return stopping || queued.load(std::memory_order_relaxed) > 0;
+        });
+        if (stopping && queued.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+    }
+}
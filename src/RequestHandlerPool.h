@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs the request handlers that may wait on the disk (Produce, Fetch) off
+// the reactors, like Kafka's request handler threads (num.io.threads), so
+// that a slow partition holds up its own requests and not every connection
+// of the reactor that read them.
+//
+// Every worker has a queue of its own and submissions go round-robin; a
+// worker that runs dry steals from the others' queues before it goes to
+// sleep. With no threads at all, tasks run right away on the
+// submitting thread.
+class RequestHandlerPool {
+  public:
+    // Tasks submitted to the same strand run one at a time, in submission
+    // order, on whichever worker picks them up: the requests of a connection
+    // are executed in the order they were sent, as Kafka's ordering
+    // guarantees require, while different connections run in parallel.
+    class Strand {
+      private:
+        friend class RequestHandlerPool;
+
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+        bool scheduled = false;
+    };
+
+    explicit RequestHandlerPool(size_t _threads);
+    ~RequestHandlerPool();
+
+    void start();
+    // Runs whatever was submitted before returning.
+    void shutdown();
+
+    // Thread-safe. Tasks must not throw.
+    void submit(std::function<void()> task);
+    void submit(const std::shared_ptr<Strand> &strand,
+                std::function<void()> task);
+
+  private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void run(size_t index);
+    bool takeTask(size_t index, std::function<void()> &task);
+    void runStrand(const std::shared_ptr<Strand> &strand);
+
+    size_t thread_count;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next_worker{0};
+
+    // Sleeping workers wait here for queued to become nonzero.
+    std::mutex idle_lock;
+    std::condition_variable idle;
+    std::atomic<size_t> queued{0};
+    bool stopping = false;
+};
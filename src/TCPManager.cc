@@ -1,27 +1,19 @@
 #include "TCPManager.h"
-
-#include <netinet/tcp.h>
+#include "IoUring.h"
+#include "KafkaApis.h"
+#include "Logger.h"
+#include "Metrics.h"
+#include "Reactor.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <algorithm>
-
-Fd &Fd::operator=(Fd &&other) noexcept {
-    if (this != &other) {
-        if (fd >= 0)
-            close(fd);
-        fd = other.fd;
-        other.fd = -1;
-    }
-    return *this;
-}
-
-Fd::~Fd() {
-    if (fd != -1) {
-        std::cout << "Closing file descriptor " << fd << "\n";
-        close(fd);
-    } else {
-        std::cout << "File descriptor already closed" << fd << "\n ";
-    }
-}
+#include <cstring>
+#include <exception>
+#include <thread>
 
 void hexdump(const void *data, size_t size) {
     const unsigned char *bytes = static_cast<const unsigned char *>(data);
@@ -38,402 +30,762 @@ void hexdump(const void *data, size_t size) {
     std::cout << std::endl;
 }
 
-NullableString NullableString::fromBuffer(const char *buffer,
-                                          size_t buffer_size) {
-    if (buffer_size < sizeof(uint16_t)) [[unlikely]] {
-        throw std::runtime_error("Buffer size is too small");
+namespace {
+
+// CPUs the broker may run on, which taskset and cgroup cpusets narrow down.
+std::vector<int> usableCpus() {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    std::vector<int> cpus;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+    if (cpus.empty()) {
+        cpus.push_back(0);
     }
+    return cpus;
+}
 
-    NullableString nullable_string;
-    uint16_t length = ntohs(*reinterpret_cast<const uint16_t *>(buffer));
+void pinCurrentThread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (result != 0) {
+        LOG_WARN("Failed to pin reactor thread to CPU " << cpu << ": "
+                 << strerror(result));
+    }
+}
 
-    if (length == -1) {
-        return nullable_string;
+// SO_REUSEPORT would let a second broker run by the same user bind the port
+// as well and quietly take a share of the connections. A bind without it
+// fails while anything listens there, so try one first.
+void checkAddressAvailable(const struct addrinfo &address) {
+    Fd probe(socket(address.ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (probe < 0) {
+        LOG_ERROR("socket failed: " << std::strerror(errno));
+        throw std::runtime_error("Failed to create server socket: ");
     }
 
-    nullable_string.value = std::string(buffer + sizeof(uint16_t), length);
-    return nullable_string;
-}
+    int reuse = 1;
+    if (setsockopt(probe, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) <
+        0) {
+        LOG_ERROR("setsockopt failed: " << std::strerror(errno));
+        throw std::runtime_error("setsockopt failed: ");
+    }
 
-std::string_view NullableString::toString() const { return value; }
+    if (bind(probe, address.ai_addr, address.ai_addrlen) != 0) {
+        LOG_ERROR("bind failed: " << std::strerror(errno));
+        throw std::runtime_error("Failed to bind the listener");
+    }
+}
 
-std::string TaggedFields::toString() const {
-    return "TaggedFields{fieldCount=" + std::to_string(fieldCount) + "}";
+// Gives the request being handled a place in line behind the responses
+// still outstanding.
+void openSlot(Connection &connection) {
+    connection.response_slots.push_back({connection.current_request});
+    // The request's bytes move to the slot only if it is deferred.
+    connection.response_slots.back().request.request_bytes = 0;
+    if (connection.response_slots.size() >= Connection::MAX_IN_FLIGHT_REQUESTS) {
+        connection.mute(Connection::IN_FLIGHT_LIMIT);
+    }
 }
 
-void RequestHeader::fromBufferLocal(const char *buffer, size_t buffer_size) {
-    if (buffer_size < RequestHeader::MIN_HEADER_SIZE) {
-        throw std::runtime_error("Buffer size is too small");
+} // namespace
+
+TCPManager::TCPManager(SocketServerConfig _config)
+    : config(std::move(_config)) {}
+
+void TCPManager::createSocketAndListen() {
+    struct addrinfo hints {};
+    // An empty host keeps the wildcard IPv4 bind the broker always had.
+    hints.ai_family = config.host.empty() ? AF_INET : AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    std::string port = std::to_string(config.port);
+    struct addrinfo *addresses = nullptr;
+    int result =
+        getaddrinfo(config.host.empty() ? nullptr : config.host.c_str(),
+                    port.c_str(), &hints, &addresses);
+    if (result != 0) {
+        throw std::runtime_error("Failed to resolve listener address " +
+                                 config.host + ": " + gai_strerror(result));
     }
+    std::unique_ptr<struct addrinfo, decltype(&freeaddrinfo)> address(
+        addresses, freeaddrinfo);
 
-#pragma GCC diagnostic ignored "-Winvalid-offsetof"
+    checkAddressAvailable(*address);
 
-#define READL(field)                                                           \
-    field = ntohl(*reinterpret_cast<const decltype(RequestHeader::field) *>(   \
-        buffer + offsetof(RequestHeader, field)));
-#define READS(field)                                                           \
-    field = ntohs(*reinterpret_cast<const decltype(RequestHeader::field) *>(   \
-        buffer + offsetof(RequestHeader, field)));
+    if (config.io_backend == IoBackend::IO_URING && !IoUring::supported()) {
+        LOG_WARN("io_uring is not available on this kernel, using epoll");
+        config.io_backend = IoBackend::EPOLL;
+    }
 
-    READL(message_size);
-    READS(request_api_key);
-    READS(request_api_version);
-    READL(corellation_id);
+    size_t count = config.network_threads > 0 ? config.network_threads
+                                              : usableCpus().size();
+    for (uint32_t shard = 0; shard < count; ++shard) {
+        auto reactor = std::make_unique<Reactor>(*this, shard);
+        reactor->listen(*address, config.listen_backlog);
+        reactors.push_back(std::move(reactor));
+    }
 
-    client_id = NullableString::fromBuffer(
-        buffer + offsetof(RequestHeader, client_id),
-        buffer_size - offsetof(RequestHeader, client_id));
+    LOG_INFO("Waiting for a client to connect...");
 
-#undef READL
-#undef READS
+    // You can use print statements as follows for debugging, they'll be visible
+    // when running tests.
+    LOG_INFO("Logs from your program will appear here!");
+}
 
-#pragma diagnostic(pop)
+void TCPManager::writeFrameOnClientFd(Connection &connection,
+                                      std::string frame) const {
+    queueChunk(connection, std::move(frame));
 }
 
-RequestHeader RequestHeader::fromBuffer(const char *buffer,
-                                        size_t buffer_size) {
-    RequestHeader request_header;
-    request_header.fromBufferLocal(buffer, buffer_size);
-    return request_header;
+std::span<std::byte>
+TCPManager::copyFrameOnClientFd(Connection &connection,
+                                std::string_view frame) const {
+    std::span<std::byte> copy = connection.arena.allocate(frame.size());
+    std::memcpy(copy.data(), frame.data(), frame.size());
+    queueChunk(connection, std::span<const std::byte>(copy));
+    return copy;
 }
 
-ApiVersionsRequestMessage
-ApiVersionsRequestMessage::fromBuffer(const char *buffer, size_t buffer_size) {
-    if (buffer_size < ApiVersionsRequestMessage::MIN_HEADER_SIZE) {
-        throw std::runtime_error("Buffer size is too small");
+std::string &TCPManager::encodeBuffer() {
+    thread_local std::string buffer;
+    buffer.clear();
+    return buffer;
+}
+
+void TCPManager::writeChunksOnClientFd(Connection &connection,
+                                       std::vector<OutputChunk> chunks) const {
+    for (auto &chunk : chunks) {
+        queueChunk(connection, std::move(chunk));
     }
+}
 
-    ApiVersionsRequestMessage api_versions_request_message;
-    api_versions_request_message.fromBufferLocal(buffer, buffer_size);
-    return api_versions_request_message;
+void TCPManager::queueChunk(Connection &connection, OutputChunk chunk) {
+    if (!connection.response_slots.empty()) {
+        connection.response_slots.back().chunks.push_back(std::move(chunk));
+        return;
+    }
+    connection.bytes_queued += chunkSize(chunk);
+    connection.output_queue.push_back(std::move(chunk));
 }
 
-std::string RequestHeader::toString() const {
-    return "RequestHeader{message_size=" + std::to_string(message_size) +
-           ", request_api_key=" + std::to_string(request_api_key) +
-           ", request_api_version=" + std::to_string(request_api_version) +
-           ", corellation_id=" + std::to_string(corellation_id) +
-           ", client_id=" + std::string(client_id.toString()) + "}";
+ResponseHandle TCPManager::deferResponse(Connection &connection) const {
+    connection.response_deferred = true;
+    // Requests get a slot as they start only if one is outstanding already.
+    if (connection.response_slots.empty()) {
+        openSlot(connection);
+    }
+    connection.response_slots.back().request.request_bytes =
+        std::exchange(connection.current_request.request_bytes, 0);
+    return {connection.id, connection.current_request.sequence};
 }
 
-std::string ApiVersionsRequestMessage::toString() const {
-    return "ApiVersionsRequestMessage{" + RequestHeader::toString() + "}";
+void TCPManager::completeDeferredResponse(ResponseHandle response,
+                                          std::string frame) {
+    std::vector<OutputChunk> chunks;
+    chunks.emplace_back(std::move(frame));
+    completeDeferredResponse(response, std::move(chunks));
 }
 
-std::string ApiVersionsResponseMessage::toBuffer() const {
-    // Calculate total size: header + api_keys_count + api_keys array + tagged_fields + throttle_time + tagged_fields2
-    size_t total_size = sizeof(ResponseHeader) + sizeof(int16_t) + sizeof(uint8_t) + 
-                       (api_keys.size() * sizeof(ApiKeyEntry)) + 
-                       sizeof(TaggedFields) + sizeof(int32_t) + sizeof(TaggedFields);
-    
-    std::string buffer;
-    buffer.reserve(total_size);
-    
-    // Response header
-    uint32_t message_size_network = htonl(message_size - sizeof(message_size));
-    buffer.append(reinterpret_cast<const char*>(&message_size_network), sizeof(message_size_network));
-    
-    uint32_t correlation_id_network = htonl(corellation_id);
-    buffer.append(reinterpret_cast<const char*>(&correlation_id_network), sizeof(correlation_id_network));
-    
-    // Error code
-    uint16_t error_code_network = htons(error_code);
-    buffer.append(reinterpret_cast<const char*>(&error_code_network), sizeof(error_code_network));
-    
-    // API keys count
-    buffer.append(reinterpret_cast<const char*>(&api_keys_count), sizeof(api_keys_count));
-    
-    // API keys array
-    for (const auto& api_key : api_keys) {
-        uint16_t api_key_network = htons(api_key.api_key);
-        buffer.append(reinterpret_cast<const char*>(&api_key_network), sizeof(api_key_network));
-        
-        uint16_t min_version_network = htons(api_key.min_version);
-        buffer.append(reinterpret_cast<const char*>(&min_version_network), sizeof(min_version_network));
-        
-        uint16_t max_version_network = htons(api_key.max_version);
-        buffer.append(reinterpret_cast<const char*>(&max_version_network), sizeof(max_version_network));
-    }
-    
-    // Tagged fields
-    buffer.append(reinterpret_cast<const char*>(&tagged_fields.fieldCount), sizeof(tagged_fields.fieldCount));
-    
-    // Throttle time
-    uint32_t throttle_time_network = htonl(throttle_time);
-    buffer.append(reinterpret_cast<const char*>(&throttle_time_network), sizeof(throttle_time_network));
-    
-    // Tagged fields 2
-    buffer.append(reinterpret_cast<const char*>(&tagged_fields2.fieldCount), sizeof(tagged_fields2.fieldCount));
-    
-    return buffer;
+void TCPManager::completeDeferredResponse(ResponseHandle response,
+                                          std::vector<OutputChunk> chunks) {
+    uint32_t shard = Connection::shardOf(response.connection_id);
+    if (shard < reactors.size()) {
+        reactors[shard]->completeDeferredResponse(response, std::move(chunks));
+    }
 }
 
-std::string ApiVersionsResponseMessage::toString() const {
-    std::string result = "ApiVersionsResponseMessage{message_size=" +
-           std::to_string(message_size) +
-           ", corellation_id=" + std::to_string(corellation_id) +
-           ", error_code=" + std::to_string(error_code) +
-           ", api_keys_count=" + std::to_string(api_keys_count) +
-           ", api_keys=[";
-    
-    for (size_t i = 0; i < api_keys.size(); ++i) {
-        if (i > 0) result += ", ";
-        result += "{api_key=" + std::to_string(api_keys[i].api_key) +
-                 ", min_version=" + std::to_string(api_keys[i].min_version) +
-                 ", max_version=" + std::to_string(api_keys[i].max_version) + "}";
-    }
-    
-    result += "], throttle_time=" + std::to_string(throttle_time) +
-              ", tagged_fields=" + tagged_fields.toString() +
-              ", tagged_fields2=" + tagged_fields2.toString() + "}";
-    
-    return result;
+void TCPManager::abortDeferredResponse(ResponseHandle response) {
+    uint32_t shard = Connection::shardOf(response.connection_id);
+    if (shard < reactors.size()) {
+        reactors[shard]->closeConnection(response.connection_id);
+    }
 }
 
-void TCPManager::createSocketAndListen() {
-    server_fd.setFd(socket(AF_INET, SOCK_STREAM, 0));
-    if (server_fd < 0) {
-        perror("socket failed: ");
-        throw std::runtime_error("Failed to create server socket: ");
+void TCPManager::completeResponse(Connection &connection, uint64_t sequence,
+                                  std::vector<OutputChunk> chunks) {
+    auto &slots = connection.response_slots;
+    ResponseSlot &slot = slots[sequence - slots.front().request.sequence];
+
+    int64_t now = monotonicNanos();
+    Metrics::local().recordLatency(slot.request.api_key,
+                                   slot.request.api_version,
+                                   RequestPhase::HANDLE,
+                                   now - slot.request.started_ns);
+    slot.chunks = std::move(chunks);
+    slot.ready = true;
+    slot.completed_ns = now;
+    releaseRequestBytes(std::exchange(slot.request.request_bytes, 0));
+
+    releaseResponses(connection);
+    if (slots.size() < Connection::MAX_IN_FLIGHT_REQUESTS) {
+        connection.unmute(Connection::IN_FLIGHT_LIMIT);
     }
+}
 
-    // Since the tester restarts your program quite often, setting SO_REUSEADDR
-    // ensures that we don't run into 'Address already in use' errors
-    int reuse = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) <
-        0) {
-        perror("setsockopt failed: ");
-        close(server_fd);
-        throw std::runtime_error("setsockopt failed: ");
+bool TCPManager::admitConnection() {
+    uint32_t open = open_connections.fetch_add(1) + 1;
+    if (config.max_connections > 0 && open > config.max_connections) {
+        open_connections.fetch_sub(1);
+        return false;
     }
+    return true;
+}
 
-    struct sockaddr_in server_addr = getSocketAddr();
+void TCPManager::connectionClosed(Connection &connection) {
+    open_connections.fetch_sub(1);
+    // Responses still being produced elsewhere are dropped when they come
+    // back, so their requests count as answered now, as does one whose
+    // handler failed.
+    uint64_t bytes = std::exchange(connection.current_request.request_bytes, 0);
+    for (auto &slot : connection.response_slots) {
+        bytes += std::exchange(slot.request.request_bytes, 0);
+    }
+    releaseRequestBytes(bytes);
+}
 
-    if (bind(server_fd, reinterpret_cast<struct sockaddr *>(&server_addr),
-             sizeof(server_addr)) != 0) {
-        perror("bind failed: ");
-        close(server_fd);
-        throw std::runtime_error("Failed to bind to port 9092");
+void TCPManager::releaseRequestBytes(uint64_t bytes) {
+    if (bytes == 0) {
+        return;
+    }
+    uint64_t before = queued_request_bytes.fetch_sub(bytes);
+    uint64_t limit = config.queued_max_request_bytes;
+    // Only the release that crosses back under the limit wakes anyone:
+    // connections that find it used up after that see the room themselves
+    // (see readBufferFromClientFd()).
+    if (limit > 0 && before >= limit && before - bytes < limit) {
+        for (const auto &reactor : reactors) {
+            reactor->resumeRequestMemory();
+        }
     }
+}
 
-    std::cout << "Waiting for a client to connect...\n";
+bool TCPManager::requestMemoryExhausted() const {
+    return config.queued_max_request_bytes > 0 &&
+           queued_request_bytes.load() >= config.queued_max_request_bytes;
+}
 
-    int connection_backlog = 5;
-    if (listen(server_fd, connection_backlog) != 0) {
-        perror("listen failed: ");
-        close(server_fd);
-        throw std::runtime_error("listen failed");
+void TCPManager::releaseResponses(Connection &connection) {
+    auto &slots = connection.response_slots;
+    while (!slots.empty() && slots.front().ready) {
+        ResponseSlot &slot = slots.front();
+        uint64_t start = connection.bytes_queued;
+        for (auto &chunk : slot.chunks) {
+            connection.bytes_queued += chunkSize(chunk);
+            connection.output_queue.push_back(std::move(chunk));
+        }
+        // Nothing to send for acks=0 produces.
+        if (connection.bytes_queued > start) {
+            connection.pending_sends.push_back(
+                {connection.bytes_queued, slot.request.api_key,
+                 slot.request.api_version, slot.completed_ns});
+        }
+        slots.pop_front();
     }
+}
 
-    // You can use print statements as follows for debugging, they'll be visible
-    // when running tests.
-    std::cerr << "Logs from your program will appear here!\n";
+void TCPManager::startRequest(Connection &connection, int16_t api_key,
+                              int16_t api_version, size_t frame_size) {
+    int64_t now = monotonicNanos();
+    MetricsShard &metrics = Metrics::local();
+    metrics.countRequest(api_key, api_version);
+    metrics.recordLatency(api_key, api_version, RequestPhase::QUEUE,
+                          now - connection.last_read_ns);
+    connection.current_request = {api_key, api_version, now,
+                                  connection.bytes_queued,
+                                  connection.next_sequence++, frame_size};
+    queued_request_bytes.fetch_add(frame_size);
+    connection.response_deferred = false;
+    if (!connection.response_slots.empty()) {
+        openSlot(connection);
+    }
 }
 
-Fd TCPManager::acceptConnections() const {
-    struct sockaddr_in client_addr {};
-    socklen_t client_addr_len = sizeof(client_addr);
+void TCPManager::finishRequest(Connection &connection) {
+    const RequestTiming &request = connection.current_request;
+    int64_t now = monotonicNanos();
+    Metrics::local().recordLatency(request.api_key, request.api_version,
+                                   RequestPhase::HANDLE,
+                                   now - request.started_ns);
+    releaseRequestBytes(
+        std::exchange(connection.current_request.request_bytes, 0));
+    if (!connection.response_slots.empty()) {
+        // Goes out once the responses before it have.
+        ResponseSlot &slot = connection.response_slots.back();
+        slot.ready = true;
+        slot.completed_ns = now;
+        return;
+    }
+    // Nothing to send for acks=0 produces.
+    if (connection.bytes_queued > request.bytes_queued) {
+        connection.pending_sends.push_back({connection.bytes_queued,
+                                            request.api_key,
+                                            request.api_version, now});
+    }
+}
 
-    struct sockaddr *addr = reinterpret_cast<struct sockaddr *>(&client_addr);
-    Fd client_fd(accept(server_fd, addr, &client_addr_len));
+void TCPManager::recordSent(Connection &connection, size_t bytes) {
+    MetricsShard &metrics = Metrics::local();
+    metrics.bytes_out.add(bytes);
+    connection.bytes_sent += bytes;
 
-    if (client_fd < 0) {
-        perror("accept failed: ");
-        throw std::runtime_error("Failed to accept connection: ");
+    auto &pending = connection.pending_sends;
+    if (pending.empty() || pending.front().end > connection.bytes_sent) {
+        return;
     }
+    int64_t now = monotonicNanos();
+    while (!pending.empty() && pending.front().end <= connection.bytes_sent) {
+        const PendingSend &send = pending.front();
+        metrics.recordLatency(send.api_key, send.api_version,
+                              RequestPhase::SEND, now - send.queued_ns);
+        pending.pop_front();
+    }
+}
 
-    std::cout << "Client connected\n";
-    return client_fd;
+void TCPManager::post(uint32_t shard, std::function<void()> task) {
+    reactors.at(shard)->post(std::move(task));
+}
+
+void TCPManager::flushClient(Connection &connection) const {
+    while (!connection.output_queue.empty()) {
+        bool progress =
+            std::holds_alternative<FileRegion>(connection.output_queue.front())
+                ? sendFileRegion(connection)
+                : sendBytes(connection);
+        if (!progress) {
+            // Socket buffer is full; EPOLLOUT resumes from output_offset.
+            return;
+        }
+    }
+    // Nothing queued refers to the arena any more.
+    if (connection.response_slots.empty()) {
+        connection.arena.reset();
+    }
 }
 
-void TCPManager::writeBufferOnClientFd(const Fd &client_fd,
-                                       const auto &response_message) const {
+bool TCPManager::sendBytes(Connection &connection) const {
+    auto &queue = connection.output_queue;
 
-    std::cout << "Sending msg to client: " << response_message.toString()
-              << "\n";
+    struct iovec iov[Connection::MAX_WRITE_IOVECS];
+    int iov_count = 0;
+    bool file_follows = false;
 
-    std::string buffer = response_message.toBuffer();
+    for (auto it = queue.begin();
+         it != queue.end() && iov_count < Connection::MAX_WRITE_IOVECS; ++it) {
+        if (std::holds_alternative<FileRegion>(*it)) {
+            file_follows = true;
+            break;
+        }
+        std::span<const std::byte> bytes = chunkBytes(*it);
+        size_t skip = iov_count == 0 ? connection.output_offset : 0;
+        iov[iov_count].iov_base = const_cast<std::byte *>(bytes.data()) + skip;
+        iov[iov_count].iov_len = bytes.size() - skip;
+        ++iov_count;
+    }
+
+    struct msghdr msg {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov_count;
+
+    // With file data next, hold the header back so it shares a segment with
+    // the start of the records instead of going out as a tiny packet.
+    ssize_t bytes_sent =
+        sendmsg(connection.fd, &msg, MSG_NOSIGNAL | (file_follows ? MSG_MORE : 0));
+    if (bytes_sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        }
+        if (errno == EINTR) {
+            return true;
+        }
+        LOG_ERROR("sendmsg failed: " << std::strerror(errno));
+        throw std::runtime_error("Failed to send response to client: ");
+    }
+
+    LOG_TRACE("Message sent to client: " << bytes_sent << " bytes");
+    recordSent(connection, bytes_sent);
 
-    // Write message Length
-    if (send(client_fd, buffer.data(), sizeof(uint32_t), 0) !=
-        sizeof(uint32_t)) {
-        perror("send failed: ");
-        throw std::runtime_error("Failed to send msgLen to client: ");
+    size_t remaining = bytes_sent;
+    while (remaining > 0) {
+        size_t front_left =
+            chunkSize(queue.front()) - connection.output_offset;
+        if (remaining < front_left) {
+            connection.output_offset += remaining;
+            break;
+        }
+        remaining -= front_left;
+        connection.output_offset = 0;
+        queue.pop_front();
     }
+    return true;
+}
+
+bool TCPManager::sendFileRegion(Connection &connection) const {
+    const auto &region = std::get<FileRegion>(connection.output_queue.front());
+
+    off_t position = region.position + connection.output_offset;
+    size_t left = region.size - connection.output_offset;
 
-    if (send(client_fd, buffer.data() + 4, buffer.size() - 4, 0) !=
-        buffer.size() - 4) {
-        perror("send failed: ");
-        throw std::runtime_error("Failed to send msgLen to client: ");
+    ssize_t bytes_sent = sendfile(connection.fd, *region.file, &position, left);
+    if (bytes_sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        }
+        if (errno == EINTR) {
+            return true;
+        }
+        LOG_ERROR("sendfile failed: " << std::strerror(errno));
+        throw std::runtime_error("Failed to send file region to client: ");
+    }
+    if (bytes_sent == 0) {
+        // The frame size already promised these bytes; the stream cannot be
+        // resynchronized, so the connection has to go.
+        throw std::runtime_error("Log file ended before the fetched region");
     }
 
-    std::cout << "Message sent to client: " << buffer.size() << " bytes\n";
+    LOG_TRACE("File data sent to client: " << bytes_sent << " bytes");
+    recordSent(connection, bytes_sent);
 
-    // Just flush the write buffer
-    int optval = 1;
-    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
+    if (static_cast<size_t>(bytes_sent) < left) {
+        connection.output_offset += bytes_sent;
+    } else {
+        connection.output_offset = 0;
+        connection.output_queue.pop_front();
+    }
+    return true;
 }
 
-void TCPManager::readBufferFromClientFd(
-    const Fd &client_fd,
-    const std::function<void(const char *, const size_t)> &func) const {
-    char buffer[MAX_BUFFER_SIZE];
-    size_t bytes_received = recv(client_fd, buffer, MAX_BUFFER_SIZE, 0);
+void Connection::reserveInput(size_t size) {
+    size_t needed = size;
 
-    if (bytes_received < 0) {
-        perror("recv failed: ");
-        throw std::runtime_error("Failed to read from client: ");
+    size_t pending = input_end - input_begin;
+    if (pending >= sizeof(uint32_t)) {
+        size_t frame_size =
+            wire::load<uint32_t>(input_buffer.data() + input_begin) +
+            sizeof(uint32_t);
+        if (frame_size > pending) {
+            needed = std::max<size_t>(needed, frame_size - pending);
+        }
     }
 
-    if (bytes_received == 0) {
-        std::cout << "Client disconnected\n";
+    if (input_buffer.size() - input_end >= needed) {
         return;
     }
 
-    std::cout << "Received " << bytes_received << " bytes from client\n";
-    func(buffer, bytes_received);
+    // Slide the partial frame to the front if that makes enough room.
+    if (input_buffer.size() - pending >= needed) {
+        std::memmove(input_buffer.data(), input_buffer.data() + input_begin,
+                     pending);
+        input_begin = 0;
+        input_end = pending;
+        return;
+    }
+
+    // Otherwise move it to a bigger buffer: a slab while frames fit in one,
+    // a heap block for the large ones.
+    IoBuffer larger(buffer_pool, pending + needed);
+    if (pending > 0) {
+        std::memcpy(larger.data(), input_buffer.data() + input_begin, pending);
+    }
+    input_buffer = std::move(larger);
+    input_begin = 0;
+    input_end = pending;
+}
+
+void Connection::appendInput(std::span<const std::byte> bytes) {
+    if (bytes.empty()) {
+        return;
+    }
+    reserveInput(bytes.size());
+    std::memcpy(input_buffer.data() + input_end, bytes.data(), bytes.size());
+    input_end += bytes.size();
 }
 
-KafkaApis::KafkaApis(const Fd &_client_fd, const TCPManager &_tcp_manager)
-    : client_fd(_client_fd), tcp_manager(_tcp_manager) {}
+void Connection::releaseIdleInput() {
+    if (input_begin == input_end) {
+        input_buffer.reset();
+        input_begin = input_end = 0;
+    }
+}
+
+namespace {
+
+// Size of the frame at the front of bytes, prefix included, once all of it
+// is there; 0 until then.
+size_t completeFrameSize(std::span<const std::byte> bytes) {
+    if (bytes.size() < sizeof(uint32_t)) {
+        return 0;
+    }
 
-void KafkaApis::classifyRequest(const char *buf, const size_t buf_size) const {
-    RequestHeader request_header = RequestHeader::fromBuffer(buf, buf_size);
+    uint32_t message_size = wire::load<uint32_t>(bytes.data());
 
-    switch (request_header.request_api_key) {
-    case API_VERSIONS_REQUEST:
-        checkApiVersions(buf, buf_size);
-        break;
-    default:
-        std::cout << "Unsupported API key: " << request_header.request_api_key
-                  << "\n";
+    if (message_size > Connection::MAX_REQUEST_SIZE) {
+        throw std::runtime_error("Request of " + std::to_string(message_size) +
+                                 " bytes exceeds the maximum size");
     }
+
+    size_t frame_size = sizeof(uint32_t) + message_size;
+    return bytes.size() >= frame_size ? frame_size : 0;
 }
 
-void KafkaApis::checkApiVersions(const char *buf, const size_t buf_size) const {
-    ApiVersionsRequestMessage request_message =
-        ApiVersionsRequestMessage::fromBuffer(buf, buf_size);
+} // namespace
 
-    std::cout << "Received API Versions Request: " << request_message.toString()
-              << "\n";
+template <typename F> void Connection::consumeFrames(F &&func) {
+    while (!muted()) {
+        const std::byte *frame = input_buffer.data() + input_begin;
+        size_t frame_size =
+            completeFrameSize({frame, input_end - input_begin});
+        if (frame_size == 0) {
+            break;
+        }
 
-    ApiVersionsResponseMessage api_versions_response_message;
-    api_versions_response_message.corellation_id =
-        request_message.corellation_id;
+        input_begin += frame_size;
+        func({frame + sizeof(uint32_t), frame_size - sizeof(uint32_t)});
+    }
 
-    if (request_message.request_api_version < 0 ||
-        request_message.request_api_version > 4) {
-        api_versions_response_message.error_code = UNSUPPORTED_VERSION;
-        std::cout << "Unsupported version: "
-                  << request_message.request_api_version << "\n";
-    } else {
-        std::cout << "Supported version: "
-                  << request_message.request_api_version << "\n";
-        
-        // Add API_VERSIONS entry
-        ApiVersionsResponseMessage::ApiKeyEntry api_versions_entry;
-        api_versions_entry.api_key = API_VERSIONS_REQUEST;
-        api_versions_entry.min_version = 0;
-        api_versions_entry.max_version = 4;
-        api_versions_response_message.api_keys.push_back(api_versions_entry);
-        
-        // Add DESCRIBE_TOPIC_PARTITIONS entry
-        ApiVersionsResponseMessage::ApiKeyEntry describe_topic_partitions_entry;
-        describe_topic_partitions_entry.api_key = DESCRIBE_TOPIC_PARTITIONS_REQUEST;
-        describe_topic_partitions_entry.min_version = 0;
-        describe_topic_partitions_entry.max_version = 0;
-        api_versions_response_message.api_keys.push_back(describe_topic_partitions_entry);
-        
-        api_versions_response_message.api_keys_count = api_versions_response_message.api_keys.size();
-    }
-    
-    // Calculate message size dynamically
-    api_versions_response_message.message_size = sizeof(ResponseHeader) + sizeof(int16_t) + sizeof(uint8_t) + 
-                                               (api_versions_response_message.api_keys.size() * sizeof(ApiVersionsResponseMessage::ApiKeyEntry)) + 
-                                               sizeof(TaggedFields) + sizeof(int32_t) + sizeof(TaggedFields);
-
-    tcp_manager.writeBufferOnClientFd(client_fd, api_versions_response_message);
+    if (input_begin == input_end) {
+        input_begin = input_end = 0;
+    }
 }
 
-TCPManager::~TCPManager() {
-    shutdown();
+template <typename F>
+size_t Connection::consumeFrames(std::span<const std::byte> bytes, F &&func) {
+    size_t consumed = 0;
+    while (!muted()) {
+        size_t frame_size = completeFrameSize(bytes.subspan(consumed));
+        if (frame_size == 0) {
+            break;
+        }
+
+        const std::byte *frame = bytes.data() + consumed;
+        consumed += frame_size;
+        func({frame + sizeof(uint32_t), frame_size - sizeof(uint32_t)});
+    }
+    return consumed;
+}
+
+bool TCPManager::muteForRequestMemory(Connection &connection) {
+    if (!requestMemoryExhausted()) {
+        return false;
+    }
+    connection.mute(Connection::REQUEST_MEMORY);
+    reactors[connection.shard()]->awaitRequestMemory(connection.id);
+    // The release that made room may have come before the reactor knew
+    // about this connection; then nobody is going to wake it.
+    if (requestMemoryExhausted()) {
+        return true;
+    }
+    connection.unmute(Connection::REQUEST_MEMORY);
+    return false;
 }
 
-void TCPManager::runServer() {
-    std::cout << "Server started, accepting multiple clients...\n";
-    
-    while (!shutdown_flag) {
-        try {
-            Fd client_fd = acceptConnections();
-            
-            // Create a new thread to handle this client
-            std::lock_guard<std::mutex> lock(threads_mutex);
-            client_threads.emplace_back(&TCPManager::handleClient, this, std::move(client_fd));
-            
-            // Clean up finished threads
-            client_threads.erase(
-                std::remove_if(client_threads.begin(), client_threads.end(),
-                    [](std::thread& t) {
-                        if (t.joinable()) {
-                            return false;
-                        }
-                        t.join();
-                        return true;
-                    }),
-                client_threads.end()
-            );
-            
-        } catch (const std::exception& e) {
-            if (!shutdown_flag) {
-                std::cerr << "Error accepting connection: " << e.what() << '\n';
+void TCPManager::readBufferFromClientFd(Connection &connection,
+                                        const KafkaApis &kafka_apis) {
+    auto handle = [&](std::span<const std::byte> frame) {
+        kafka_apis.classifyRequest(connection, frame);
+    };
+    while (true) {
+        // Requests that arrived with the previous read (or while muted) go
+        // first; a muted connection leaves the rest in the socket buffer.
+        connection.consumeFrames(handle);
+        if (connection.muted()) {
+            return;
+        }
+        if (connection.input_closed) {
+            connection.releaseIdleInput();
+            return;
+        }
+
+        if (muteForRequestMemory(connection)) {
+            return;
+        }
+
+        connection.reserveInput();
+
+        std::byte *read_ptr =
+            connection.input_buffer.data() + connection.input_end;
+        size_t read_size =
+            connection.input_buffer.size() - connection.input_end;
+
+        ssize_t bytes_received = recv(connection.fd, read_ptr, read_size, 0);
+
+        if (bytes_received < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                connection.releaseIdleInput();
+                return;
+            }
+            if (errno == EINTR) {
+                continue;
             }
+            LOG_ERROR("recv failed: " << std::strerror(errno));
+            throw std::runtime_error("Failed to read from client: ");
+        }
+
+        if (bytes_received == 0) {
+            LOG_DEBUG("Client shut down its side of the connection");
+            connection.input_closed = true;
+            continue;
+        }
+
+        LOG_TRACE("Received " << bytes_received << " bytes from client");
+        connection.input_end += bytes_received;
+        connection.last_read_ns = monotonicNanos();
+        Metrics::local().bytes_in.add(bytes_received);
+    }
+}
+
+void TCPManager::receiveBytes(Connection &connection,
+                              const KafkaApis &kafka_apis,
+                              std::span<const std::byte> bytes) {
+    auto handle = [&](std::span<const std::byte> frame) {
+        kafka_apis.classifyRequest(connection, frame);
+    };
+
+    if (!bytes.empty()) {
+        LOG_TRACE("Received " << bytes.size() << " bytes from client");
+        connection.last_read_ns = monotonicNanos();
+        Metrics::local().bytes_in.add(bytes.size());
+
+        // Frames are only valid for the handler call anyway, so complete
+        // ones need not be copied out of the kernel's buffer first.
+        if (connection.input_begin == connection.input_end) {
+            bytes = bytes.subspan(connection.consumeFrames(bytes, handle));
+        }
+        connection.appendInput(bytes);
+    }
+
+    connection.consumeFrames(handle);
+    if (!connection.muted()) {
+        muteForRequestMemory(connection);
+    }
+    connection.releaseIdleInput();
+}
+
+RingSend *TCPManager::prepareRingSend(Connection &connection,
+                                      bool &would_block) const {
+    would_block = false;
+    if (!connection.ring_send) {
+        connection.ring_send = std::make_unique<RingSend>();
+    }
+    RingSend &send = *connection.ring_send;
+    auto &queue = connection.output_queue;
+    auto file_at_front = [&queue] {
+        return !queue.empty() &&
+               std::holds_alternative<FileRegion>(queue.front());
+    };
+
+    // sendfile() has no io_uring counterpart, and copies nothing either;
+    // regions go out from here once the bytes before them have.
+    while (send.chunks.empty() && file_at_front()) {
+        if (!sendFileRegion(connection)) {
+            would_block = true;
+            return nullptr;
+        }
+    }
+
+    while (send.chunks.size() < Connection::MAX_WRITE_IOVECS &&
+           !queue.empty() && !file_at_front()) {
+        send.chunks.push_back(std::move(queue.front()));
+        queue.pop_front();
+    }
+
+    if (send.chunks.empty()) {
+        // Nothing queued refers to the arena any more.
+        if (connection.response_slots.empty()) {
+            connection.arena.reset();
+        }
+        return nullptr;
+    }
+
+    for (size_t i = 0; i < send.chunks.size(); ++i) {
+        std::span<const std::byte> bytes = chunkBytes(send.chunks[i]);
+        size_t skip = i == 0 ? connection.output_offset : 0;
+        send.iov[i].iov_base = const_cast<std::byte *>(bytes.data()) + skip;
+        send.iov[i].iov_len = bytes.size() - skip;
+    }
+    send.msg = {};
+    send.msg.msg_iov = send.iov;
+    send.msg.msg_iovlen = send.chunks.size();
+    // As in sendBytes(): the header shares a segment with the records.
+    send.flags = MSG_NOSIGNAL | (file_at_front() ? MSG_MORE : 0);
+    return &send;
+}
+
+void TCPManager::completeRingSend(Connection &connection,
+                                  size_t bytes_sent) const {
+    LOG_TRACE("Message sent to client: " << bytes_sent << " bytes");
+    recordSent(connection, bytes_sent);
+
+    auto &chunks = connection.ring_send->chunks;
+    size_t remaining = bytes_sent;
+    size_t done = 0;
+    while (done < chunks.size()) {
+        size_t front_left = chunkSize(chunks[done]) - connection.output_offset;
+        if (remaining < front_left) {
+            connection.output_offset += remaining;
             break;
         }
+        remaining -= front_left;
+        connection.output_offset = 0;
+        ++done;
     }
+    chunks.erase(chunks.begin(), chunks.begin() + done);
+}
+
+TCPManager::~TCPManager() {
+    shutdown();
 }
 
-void TCPManager::handleClient(Fd client_fd) {
-    try {
-        while (!shutdown_flag) {
+void TCPManager::runServer(KafkaApis &_kafka_apis) {
+    LOG_INFO("Server started with " << reactors.size()
+             << " reactors, accepting multiple clients...");
+
+    std::vector<int> cpus = usableCpus();
+    std::mutex failure_lock;
+    std::exception_ptr failure;
+
+    std::vector<std::thread> threads;
+    threads.reserve(reactors.size());
+    for (const auto &reactor : reactors) {
+        int cpu = cpus[reactor->shard() % cpus.size()];
+        threads.emplace_back([&, reactor = reactor.get(), cpu] {
+            if (config.pin_network_threads) {
+                pinCurrentThread(cpu);
+            }
             try {
-                KafkaApis kafka_apis(client_fd, *this);
-
-                readBufferFromClientFd(
-                    client_fd,
-                    [&kafka_apis](const char *buf, const size_t buf_size) {
-                        kafka_apis.classifyRequest(buf, buf_size);
-                    });
-            } catch (const std::exception &e) {
-                std::cerr << "Error handling client: " << e.what() << '\n';
-                break;
+                reactor->run(_kafka_apis);
+            } catch (...) {
+                {
+                    std::lock_guard<std::mutex> guard(failure_lock);
+                    if (!failure) {
+                        failure = std::current_exception();
+                    }
+                }
+                // A broken loop takes the whole server down, as it did when
+                // there was only one.
+                shutdown();
             }
-        }
-    } catch (const std::exception &e) {
-        std::cerr << "Client thread error: " << e.what() << '\n';
+        });
     }
-    
-    cleanupClient(std::move(client_fd));
-}
 
-void TCPManager::cleanupClient(Fd client_fd) {
-    std::cout << "Client disconnected, cleaning up...\n";
-    // The Fd destructor will automatically close the file descriptor
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    if (failure) {
+        std::rethrow_exception(failure);
+    }
 }
 
 void TCPManager::shutdown() {
-    shutdown_flag = true;
-    
-    // Close the server socket to stop accepting new connections
-    if (server_fd.getFd() >= 0) {
-        close(server_fd.getFd());
-    }
-    
-    // Wait for all client threads to finish
-    std::lock_guard<std::mutex> lock(threads_mutex);
-    for (auto& thread : client_threads) {
-        if (thread.joinable()) {
-            thread.join();
-        }
+    for (const auto &reactor : reactors) {
+        reactor->shutdown();
     }
-    client_threads.clear();
-}
\ No newline at end of file
+}
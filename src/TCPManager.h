@@ -1,146 +1,351 @@
+#pragma once
+
+#include "Arena.h"
+#include "BrokerConfig.h"
+#include "BufferPool.h"
+#include "Fd.h"
+#include "FileRegion.h"
+#include "Logger.h"
+#include "Messages.h"
+#include "RequestHandlerPool.h"
+#include "VectorQueue.h"
+
 #include <arpa/inet.h>
 #include <bits/stdc++.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <thread>
+#include <sys/uio.h>
+#include <unordered_map>
+#include <memory>
 #include <mutex>
 #include <vector>
 #include <atomic>
 
-struct Fd {
-    explicit Fd(int _fd) : fd(_fd) {}
-    Fd() = default;
-    ~Fd();
+struct KafkaApis;
+struct ClientQuota;
+struct RingSend;
+class Reactor;
 
-    // Delete copy operations
-    Fd(const Fd &) = delete;
-    Fd &operator=(const Fd &) = delete;
-
-    // Add move operations
-    Fd(Fd &&other) noexcept : fd(other.fd) { other.fd = -1; }
-    Fd &operator=(Fd &&other) noexcept;
+// The request a connection is handling, for the latency metrics.
+struct RequestTiming {
+    int16_t api_key = -1;
+    int16_t api_version = -1;
+    int64_t started_ns = 0;
+    // Connection::bytes_queued when it started; anything beyond is its
+    // response.
+    uint64_t bytes_queued = 0;
+    // Position of the request on its connection, counting from 0.
+    uint64_t sequence = 0;
+    // Size of its frame, counted against queued.max.request.bytes until
+    // it has been answered.
+    uint64_t request_bytes = 0;
+};
 
-    void setFd(int _fd) { fd = _fd; }
-    int getFd() const { return fd; }
-    operator int() const { return fd; }
+// Where the response to a deferred request goes, from whichever thread
+// completes it.
+struct ResponseHandle {
+    uint64_t connection_id = 0;
+    uint64_t sequence = 0;
+};
 
-  private:
-    int fd = -1;
+// The response to a request that may not be sent yet: it was deferred, or
+// an earlier one on the connection was and has not been answered.
+struct ResponseSlot {
+    RequestTiming request;
+    bool ready = false;
+    int64_t completed_ns = 0;
+    std::vector<OutputChunk> chunks;
 };
 
-#pragma pack(push, 1)
-struct Header {
-    uint32_t message_size{};
+// A response whose last byte has not been written yet.
+struct PendingSend {
+    // Connection::bytes_queued once it was queued.
+    uint64_t end;
+    int16_t api_key;
+    int16_t api_version;
+    int64_t queued_ns;
 };
 
-struct NullableString {
-    std::string value = "";
+// Per-connection state owned by the event loop. Everything a client needs
+// between two readiness notifications lives here instead of on a thread stack.
+struct Connection {
+    // Upper bound on the iovecs handed to a single writev().
+    static constexpr int MAX_WRITE_IOVECS = 64;
+    // Smallest amount of free space we hand to recv(); the input buffer grows
+    // beyond a pool slab only when a single frame needs more room.
+    static constexpr size_t MIN_READ_SIZE = 16 * 1024;
+    // Same default as Kafka's socket.request.max.bytes.
+    static constexpr uint32_t MAX_REQUEST_SIZE = 100 * 1024 * 1024;
+    // Requests that may wait for an answer at once; beyond that the
+    // connection is muted until the oldest ones are answered.
+    static constexpr size_t MAX_IN_FLIGHT_REQUESTS = 32;
+    // Connection ids carry the index of their reactor in the top bits.
+    static constexpr int SHARD_SHIFT = 48;
 
-    static NullableString fromBuffer(const char *buffer, size_t buffer_size);
-    std::string_view toString() const;
-};
+    // Why a connection is not being read from. Any one of them stops
+    // reading and handling requests until it is lifted.
+    enum MuteReason : uint8_t {
+        // MAX_IN_FLIGHT_REQUESTS responses are outstanding.
+        IN_FLIGHT_LIMIT = 1,
+        // The client went over a quota; lifted by a timer.
+        THROTTLED = 2,
+        // queued.max.request.bytes is used up, by any connection.
+        REQUEST_MEMORY = 4,
+    };
 
-struct TaggedFields {
-    uint8_t fieldCount = 0;
+    Connection(uint64_t _id, Fd _fd, BufferPool &_buffer_pool)
+        : id(_id), fd(std::move(_fd)), buffer_pool(_buffer_pool),
+          arena(_buffer_pool) {}
 
-    std::string toString() const;
-};
+    static uint32_t shardOf(uint64_t connection_id) {
+        return static_cast<uint32_t>(connection_id >> SHARD_SHIFT);
+    }
+    // The reactor that accepted the connection and serves all its requests.
+    uint32_t shard() const { return shardOf(id); }
 
-struct RequestHeader : Header {
-    constexpr static uint32_t MIN_HEADER_SIZE = 14;
+    // Calls func once for every complete size-prefixed frame sitting in the
+    // input buffer (prefix stripped) and keeps any trailing partial frame.
+    // Stops early when a handler mutes the connection.
+    template <typename F> void consumeFrames(F &&func);
+    // Same, for the frames at the front of bytes, which are not in the input
+    // buffer. Returns how many bytes they took up.
+    template <typename F>
+    size_t consumeFrames(std::span<const std::byte> bytes, F &&func);
+    // Makes room for at least size bytes (or the rest of the frame currently
+    // being reassembled) after input_end.
+    void reserveInput(size_t size = MIN_READ_SIZE);
+    // Copies bytes to the end of the input buffer.
+    void appendInput(std::span<const std::byte> bytes);
+    // Hands the input buffer back to the pool if it holds no partial frame,
+    // so that idle connections keep no buffer at all.
+    void releaseIdleInput();
 
-    int16_t request_api_key{};
-    int16_t request_api_version{};
-    int32_t corellation_id{};
-    NullableString client_id{};
+    // Stable handle for completions coming from other threads; unlike the
+    // fd it is never reused.
+    uint64_t id;
+    Fd fd;
+    bool muted() const { return mute_reasons != 0; }
+    void mute(MuteReason reason) { mute_reasons |= reason; }
+    void unmute(MuteReason reason) { mute_reasons &= ~reason; }
+    // MuteReason bits.
+    uint8_t mute_reasons = 0;
 
-    static RequestHeader fromBuffer(const char *buffer, size_t buffer_size);
-    void fromBufferLocal(const char *buffer, size_t buffer_size);
-    std::string toString() const;
-};
+    // The peer shut down its side of the connection. Clients may do that
+    // right after pipelining their last requests, so nothing more is read,
+    // but those are still answered: the connection is closed once it is
+    // drained.
+    bool input_closed = false;
+    // Everything read before the input closed has been answered and sent.
+    // A muted connection may still hold requests in its input buffer.
+    bool drained() const {
+        return input_closed && !muted() && response_slots.empty() &&
+               output_queue.empty() && !sending;
+    }
 
-struct ApiVersionsRequestMessage : RequestHeader {
-    static ApiVersionsRequestMessage fromBuffer(const char *buffer,
-                                                size_t buffer_size);
-    std::string toString() const;
-};
+    // The reactor's, shared by all its connections.
+    BufferPool &buffer_pool;
+    IoBuffer input_buffer;
+    size_t input_begin = 0;
+    size_t input_end = 0;
 
-constexpr size_t MAX_BUFFER_SIZE = 1024;
+    // Responses waiting to be written, in request order. output_offset is
+    // how much of the front entry already went out.
+    VectorQueue<OutputChunk> output_queue;
+    size_t output_offset = 0;
+    // Backs the responses serialized on the reactor thread; reset whenever
+    // the output queue has been written out.
+    Arena arena;
 
-struct ResponseHeader : Header {
-    int32_t corellation_id{};
-};
+    // Latency bookkeeping. Queue time starts at the last read; the request
+    // being handled stays current while the connection is muted; responses
+    // are tracked by where they end in the output stream, which bytes_sent
+    // has to pass for them to count as sent.
+    int64_t last_read_ns = 0;
+    RequestTiming current_request;
+    uint64_t bytes_queued = 0;
+    uint64_t bytes_sent = 0;
+    VectorQueue<PendingSend> pending_sends;
 
-struct ApiVersionsResponseMessage : ResponseHeader {
-    int16_t error_code{};
-    uint8_t api_keys_count{};
-    
-    // Array of API key entries
-    struct ApiKeyEntry {
-        int16_t api_key{};
-        int16_t min_version{};
-        int16_t max_version{};
-    };
-    
-    std::vector<ApiKeyEntry> api_keys;
+    // Requests are answered in the order they came in, however they are
+    // handled. Once one is deferred (handed to the request handler pool,
+    // parked in a purgatory or waiting for a flush), it and every request
+    // after it get a slot, and responses only move on to the output queue
+    // once everything before them has.
+    uint64_t next_sequence = 0;
+    bool response_deferred = false;
+    VectorQueue<ResponseSlot> response_slots;
+    // Runs the connection's requests on the pool one at a time, in order;
+    // created with the first one.
+    std::shared_ptr<RequestHandlerPool::Strand> strand;
 
-    TaggedFields tagged_fields{};
-    int32_t throttle_time = 0;
-    TaggedFields tagged_fields2{};
+    // Quota of the client_id of the last request, while quotas are on.
+    std::shared_ptr<ClientQuota> quota;
+    std::string quota_client_id;
+    // Timer::now() at which the THROTTLED mute is lifted.
+    int64_t throttled_until_ms = 0;
 
-    std::string toBuffer() const;
-    std::string toString() const;
+    // io_uring backend only (see Reactor). Operations submitted for the
+    // connection that have not completed; it is only freed once there are
+    // none left, as the kernel may still be reading its buffers.
+    uint32_t ring_ops = 0;
+    // A multishot recv is armed. It is cancelled while the connection is
+    // muted, which leaves the rest of the data in the socket buffer.
+    bool receiving = false;
+    bool cancelling_receive = false;
+    // A send, or a poll for room to send more, is in flight.
+    bool sending = false;
+    // Created with the first send.
+    std::unique_ptr<RingSend> ring_send;
 };
 
-#pragma pack(pop)
+// A sendmsg() submitted to the io_uring backend. Its chunks are moved out of
+// the output queue, which may grow and move its entries around, so that
+// they stay where the kernel expects them until it completes. The first of
+// them starts at Connection::output_offset.
+struct RingSend {
+    RingSend() { chunks.reserve(Connection::MAX_WRITE_IOVECS); }
+
+    std::vector<OutputChunk> chunks;
+    struct iovec iov[Connection::MAX_WRITE_IOVECS];
+    struct msghdr msg {};
+    int flags = 0;
+};
 
+// Owns the reactors and holds the connection I/O they share. Requests are
+// served by whichever reactor accepted the connection; other threads reach
+// a connection through completeDeferredResponse(), which routes on the
+// reactor index carried by the connection id.
 struct TCPManager {
-    TCPManager() = default;
+    explicit TCPManager(SocketServerConfig _config = {});
     ~TCPManager();
 
-    static struct sockaddr_in getSocketAddr() {
-        struct sockaddr_in server_addr {
-            .sin_family = AF_INET, .sin_port = htons(9092),
-        };
-        server_addr.sin_addr.s_addr = INADDR_ANY;
-        return server_addr;
-    }
-
+    // Creates the reactors, each with its own SO_REUSEPORT listener on the
+    // configured address, so the kernel spreads connections across them.
     void createSocketAndListen();
-    void runServer();
+    // Runs every reactor on a thread of its own until shutdown().
+    void runServer(KafkaApis &_kafka_apis);
+    // Async-signal-safe.
     void shutdown();
-    Fd acceptConnections() const;
-
-    void writeBufferOnClientFd(const Fd &client_fd,
-                               const auto &response_message) const;
 
-    void readBufferFromClientFd(
-        const Fd &client_fd,
-        const std::function<void(const char *, const size_t)> &func) const;
+    // Valid once createSocketAndListen() has run.
+    size_t reactorCount() const { return reactors.size(); }
+    // The one configured, or epoll once createSocketAndListen() found that
+    // the kernel cannot run io_uring.
+    IoBackend ioBackend() const { return config.io_backend; }
+    Reactor &reactor(uint32_t shard) const { return *reactors[shard]; }
 
-    void handleClient(Fd client_fd);
-    void cleanupClient(Fd client_fd);
-
-  private:
-    Fd server_fd;
-    std::vector<std::thread> client_threads;
-    std::mutex threads_mutex;
-    std::atomic<bool> shutdown_flag{false};
-};
+    // Queues the serialized response on the connection; nothing is written
+    // until flushClient() runs at the end of the read batch. It is encoded
+    // into a buffer of the thread's that keeps its capacity, then copied
+    // into the connection's arena, so this does not allocate once warm.
+    void writeBufferOnClientFd(Connection &connection,
+                               const auto &response_message) const {
+        LOG_DEBUG("Sending msg to client: " << response_message.toString());
+        std::string &buffer = encodeBuffer();
+        response_message.encode(buffer);
+        copyFrameOnClientFd(connection, buffer);
+    }
+    // Same, for responses that are already serialized (size prefix included).
+    void writeFrameOnClientFd(Connection &connection, std::string frame) const;
+    // Same, copying the frame into the connection's arena. Returns the copy,
+    // which may still be patched until the connection is flushed.
+    std::span<std::byte> copyFrameOnClientFd(Connection &connection,
+                                             std::string_view frame) const;
+    // Same, for responses whose record data is sent from files (see
+    // FetchResponseMessage::toChunks()).
+    void writeChunksOnClientFd(Connection &connection,
+                               std::vector<OutputChunk> chunks) const;
+    // The response to the request being handled comes later, through
+    // completeDeferredResponse() with the handle returned. Reading goes on
+    // meanwhile; later responses wait behind this one.
+    ResponseHandle deferResponse(Connection &connection) const;
+    // Thread-safe: hands a deferred response back to the reactor of the
+    // connection, which queues it with any responses that were waiting for
+    // it. Dropped if the connection has gone away in the meantime. An empty
+    // response (acks=0) just lets the next ones through.
+    void completeDeferredResponse(ResponseHandle response, std::string frame);
+    void completeDeferredResponse(ResponseHandle response,
+                                  std::vector<OutputChunk> chunks);
+    // Thread-safe: for a deferred response that cannot be produced. Closes
+    // the connection, as a handler failing on the reactor does.
+    void abortDeferredResponse(ResponseHandle response);
+    // On the connection's reactor: the deferred response has arrived.
+    void completeResponse(Connection &connection, uint64_t sequence,
+                          std::vector<OutputChunk> chunks);
+    // max.connections: false if a newly accepted connection has to be
+    // turned away. Every admitted one is handed back to connectionClosed().
+    bool admitConnection();
+    // Releases what the connection still holds of the global limits.
+    void connectionClosed(Connection &connection);
+    // Metrics around a handler: startRequest() as it begins, finishRequest()
+    // once it returns without deferring its response. Handling time of a
+    // deferred response is recorded in completeResponse(), send time as the
+    // response goes out.
+    // They also account the frame against queued.max.request.bytes.
+    void startRequest(Connection &connection, int16_t api_key,
+                      int16_t api_version, size_t frame_size);
+    void finishRequest(Connection &connection);
+    // Thread-safe: runs task on the thread of the given reactor.
+    void post(uint32_t shard, std::function<void()> task);
 
-struct KafkaApis {
-    KafkaApis(const Fd &_client_fd, const TCPManager &_tcp_manager);
-    ~KafkaApis() = default;
+    // Writes as much of the output queue as the socket accepts: runs of
+    // serialized bytes with one writev() per IOV batch, file regions with
+    // sendfile(). Whatever is left goes out on the next EPOLLOUT.
+    void flushClient(Connection &connection) const;
 
-    static constexpr uint32_t UNSUPPORTED_VERSION = 35;
-    static constexpr uint16_t API_VERSIONS_REQUEST = 18;
-    static constexpr uint16_t DESCRIBE_TOPIC_PARTITIONS_REQUEST = 75;
+    // Drains the socket until it would block (required with EPOLLET) and
+    // hands every complete request frame to kafka_apis. Once the peer has
+    // shut down its side, marks the connection's input closed and reads no
+    // more (see Connection::drained()).
+    // Mutes the connection instead while queued.max.request.bytes is used
+    // up; its reactor reads again once enough requests have been answered.
+    void readBufferFromClientFd(Connection &connection,
+                                const KafkaApis &kafka_apis);
 
-    void classifyRequest(const char *buf, const size_t buf_size) const;
-    void checkApiVersions(const char *buf, const size_t buf_size) const;
+    // The io_uring backend's halves of the two above, with the system calls
+    // left to the reactor's ring.
+    //
+    // Takes bytes a receive completed with, handling whole frames straight
+    // out of them and keeping only a trailing partial frame, then the frames
+    // a mute left in the input buffer (bytes may be empty for just those).
+    // Mutes the connection while queued.max.request.bytes is used up.
+    void receiveBytes(Connection &connection, const KafkaApis &kafka_apis,
+                      std::span<const std::byte> bytes);
+    // The send to submit next, or nullptr if nothing but file regions is
+    // left: those go out with sendfile() right here, and would_block is set
+    // once the socket is full.
+    RingSend *prepareRingSend(Connection &connection, bool &would_block) const;
+    // The send prepareRingSend() returned wrote bytes_sent bytes.
+    void completeRingSend(Connection &connection, size_t bytes_sent) const;
 
   private:
-    const Fd &client_fd;
-    const TCPManager &tcp_manager;
-};
\ No newline at end of file
+    // Cleared, for writeBufferOnClientFd().
+    static std::string &encodeBuffer();
+    // Queues a chunk of the response being handled: on the output queue, or
+    // in its slot if an earlier response is outstanding.
+    static void queueChunk(Connection &connection, OutputChunk chunk);
+    // Moves the responses at the front of the slots that are ready to the
+    // output queue.
+    static void releaseResponses(Connection &connection);
+    // Both return false when the socket would block.
+    bool sendBytes(Connection &connection) const;
+    bool sendFileRegion(Connection &connection) const;
+    // Counts bytes that went out and records the send time of every
+    // response they completed.
+    static void recordSent(Connection &connection, size_t bytes);
+    // Hands the bytes of an answered request back to
+    // queued.max.request.bytes, waking the reactors up if that makes room.
+    void releaseRequestBytes(uint64_t bytes);
+    bool requestMemoryExhausted() const;
+    // Mutes the connection if queued.max.request.bytes is used up. Returns
+    // whether it did.
+    bool muteForRequestMemory(Connection &connection);
+
+    SocketServerConfig config;
+    std::vector<std::unique_ptr<Reactor>> reactors;
+    // Shared by the reactors, for max.connections and
+    // queued.max.request.bytes.
+    std::atomic<uint32_t> open_connections{0};
+    std::atomic<uint64_t> queued_request_bytes{0};
+};
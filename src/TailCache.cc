@@ -0,0 +1,170 @@
+#include "TailCache.h"
+
+#include "WireCodec.h"
+
+#include <algorithm>
+#include <cstring>
+
+std::shared_ptr<CacheBlock> TailCache::allocate(size_t size) {
+    if (size > config.max_bytes) {
+        return nullptr;
+    }
+
+    auto block = std::make_shared<CacheBlock>(size);
+
+    std::lock_guard<std::mutex> guard(lock);
+    while (bytes_used + size > config.max_bytes) {
+        evictOne();
+    }
+    // Right behind the hand, so a new block gets a full sweep before it is
+    // looked at.
+    block->clock_position = ring.insert(hand, block);
+    block->cached = true;
+    bytes_used += size;
+    return block;
+}
+
+void TailCache::release(const std::shared_ptr<CacheBlock> &block) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (block->cached) {
+        remove(block);
+    }
+}
+
+uint64_t TailCache::bytesUsed() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return bytes_used;
+}
+
+void TailCache::evictOne() {
+    // Every block gets cleared within one lap, so the second lap at the
+    // latest finds one.
+    while (true) {
+        if (hand == ring.end()) {
+            hand = ring.begin();
+        }
+        if (!(*hand)->referenced.exchange(false, std::memory_order_relaxed)) {
+            remove(*hand);
+            return;
+        }
+        ++hand;
+    }
+}
+
+void TailCache::remove(const std::shared_ptr<CacheBlock> &block) {
+    // block may be the ring's own reference, which erase() destroys.
+    auto position = block->clock_position;
+    block->cached = false;
+    bytes_used -= block->capacity;
+    if (hand == position) {
+        ++hand;
+    }
+    ring.erase(position);
+}
+
+std::shared_ptr<CacheBlock> PartitionTailCache::tailBlock(size_t size) const {
+    if (!tail_open || blocks.empty()) {
+        return nullptr;
+    }
+    auto block = blocks.back().block.lock();
+    if (!block || block->capacity - block->size < size) {
+        return nullptr;
+    }
+    return block;
+}
+
+void PartitionTailCache::append(int64_t base_offset, int64_t last_offset,
+                                std::span<const std::byte> batch) {
+    uint64_t bound = cache.settings().partition_max_bytes;
+    auto block = tailBlock(batch.size());
+    if (!block) {
+        tail_open = false;
+        if (batch.size() > bound) {
+            return;
+        }
+        // Several blocks per partition, so dropping the oldest one only
+        // gives up part of the cached tail.
+        size_t capacity = std::max<size_t>(
+            std::min<uint64_t>(BLOCK_BYTES, bound / 4), batch.size());
+        // Make room first, so that the partition's own oldest blocks go
+        // before anyone else's.
+        bytes += capacity;
+        trim();
+        bytes -= capacity;
+        block = cache.allocate(capacity);
+        if (!block) {
+            return;
+        }
+        blocks.push_back({base_offset, capacity, block});
+        bytes += capacity;
+        tail_open = true;
+    }
+
+    std::byte *position = block->data.get() + block->size;
+    std::memcpy(position, batch.data(), batch.size());
+    wire::store(position, base_offset);
+    block->batches.push_back(
+        {base_offset, last_offset, static_cast<uint32_t>(block->size)});
+    block->size += batch.size();
+}
+
+std::optional<CachedReadInfo>
+PartitionTailCache::read(int64_t offset, uint64_t max_bytes) const {
+    auto slot = std::upper_bound(
+        blocks.begin(), blocks.end(), offset,
+        [](int64_t value, const Slot &s) { return value < s.base_offset; });
+    if (slot == blocks.begin()) {
+        return std::nullopt;
+    }
+    auto block = std::prev(slot)->block.lock();
+    if (!block) {
+        return std::nullopt;
+    }
+
+    auto batch = std::lower_bound(
+        block->batches.begin(), block->batches.end(), offset,
+        [](const CacheBlock::Batch &b, int64_t value) {
+            return b.last_offset < value;
+        });
+    if (batch == block->batches.end() || batch->base_offset > offset) {
+        return std::nullopt;
+    }
+
+    block->referenced.store(true, std::memory_order_relaxed);
+
+    uint64_t first_size = (std::next(batch) != block->batches.end()
+                               ? std::next(batch)->position
+                               : block->size) -
+                          batch->position;
+    uint64_t available = block->size - batch->position;
+    uint64_t size = std::min(available, std::max(max_bytes, first_size));
+    std::span<const std::byte> bytes(block->data.get() + batch->position, size);
+    int64_t first_offset = batch->base_offset;
+    return CachedReadInfo{{std::move(block), bytes}, first_offset};
+}
+
+void PartitionTailCache::clear() {
+    for (const auto &slot : blocks) {
+        if (auto block = slot.block.lock()) {
+            cache.release(block);
+        }
+    }
+    blocks.clear();
+    bytes = 0;
+    tail_open = false;
+}
+
+void PartitionTailCache::trim() {
+    uint64_t bound = cache.settings().partition_max_bytes;
+    while (!blocks.empty() &&
+           (bytes > bound || blocks.front().block.expired())) {
+        if (auto block = blocks.front().block.lock()) {
+            cache.release(block);
+        }
+        bytes -= blocks.front().capacity;
+        blocks.pop_front();
+    }
+    if (blocks.empty()) {
+        tail_open = false;
+    }
+}
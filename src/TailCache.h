@@ -0,0 +1,135 @@
+#pragma once
+
+#include "BrokerConfig.h"
+#include "FileRegion.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <vector>
+
+// A buffer of consecutive record batches of one partition, copied in as
+// they were appended. Only ever written past size, so bytes below it can be
+// read without a lock once handed out.
+struct CacheBlock {
+    struct Batch {
+        int64_t base_offset;
+        int64_t last_offset;
+        uint32_t position;
+    };
+
+    // Left uninitialized: appends overwrite it before anything reads it.
+    explicit CacheBlock(size_t _capacity)
+        : data(std::make_unique_for_overwrite<std::byte[]>(_capacity)),
+          capacity(_capacity) {}
+
+    std::unique_ptr<std::byte[]> data;
+    size_t capacity;
+    size_t size = 0;
+    std::vector<Batch> batches;
+
+    // Set by reads, cleared by the clock hand passing over the block.
+    std::atomic<bool> referenced{true};
+
+    // TailCache only, under its lock.
+    std::list<std::shared_ptr<CacheBlock>>::iterator clock_position;
+    bool cached = false;
+};
+
+// Broker-wide memory budget for the partitions' tail caches. The blocks of
+// all partitions share one CLOCK ring: when a new block does not fit, the
+// hand sweeps the ring, giving blocks read since its last pass another
+// round and evicting the first one that was not. Eviction only drops the
+// ring's reference, so it never needs a partition's lock; partitions notice
+// on their next use of the block, and responses still queued keep it alive
+// until they are sent.
+class TailCache {
+  public:
+    explicit TailCache(const TailCacheConfig &_config) : config(_config) {}
+
+    TailCache(const TailCache &) = delete;
+    TailCache &operator=(const TailCache &) = delete;
+
+    const TailCacheConfig &settings() const { return config; }
+
+    // A new block of at least size bytes, evicting others as needed.
+    // nullptr if size alone is over the budget.
+    std::shared_ptr<CacheBlock> allocate(size_t size);
+    // Gives the memory of a block its partition no longer wants back.
+    void release(const std::shared_ptr<CacheBlock> &block);
+
+    uint64_t bytesUsed() const;
+
+  private:
+    // Caller holds lock.
+    void evictOne();
+    void remove(const std::shared_ptr<CacheBlock> &block);
+
+    TailCacheConfig config;
+    mutable std::mutex lock;
+    std::list<std::shared_ptr<CacheBlock>> ring;
+    std::list<std::shared_ptr<CacheBlock>>::iterator hand = ring.end();
+    uint64_t bytes_used = 0;
+};
+
+// What a fetch served from the cache sends out.
+struct CachedReadInfo {
+    SharedBytes records;
+    int64_t first_offset = 0;
+};
+
+// The most recently appended batches of one partition, up to
+// log.tail.cache.partition.max.bytes, so that consumers keeping up with the
+// log are served from memory instead of the segment files. Oldest blocks
+// make room for new ones, and the TailCache may take any of them away.
+// Used under the PartitionLog's lock.
+class PartitionTailCache {
+  public:
+    explicit PartitionTailCache(TailCache &_cache) : cache(_cache) {}
+    ~PartitionTailCache() { clear(); }
+
+    PartitionTailCache(const PartitionTailCache &) = delete;
+    PartitionTailCache &operator=(const PartitionTailCache &) = delete;
+
+    // Copies in a batch just appended at base_offset; its base offset field
+    // is patched the way the segment's copy was.
+    void append(int64_t base_offset, int64_t last_offset,
+                std::span<const std::byte> batch);
+    // Like PartitionLog::read(), but only from one cached block: nothing if
+    // the batch with offset is not cached.
+    std::optional<CachedReadInfo> read(int64_t offset,
+                                       uint64_t max_bytes) const;
+    void clear();
+
+  private:
+    struct Slot {
+        int64_t base_offset;
+        size_t capacity;
+        std::weak_ptr<CacheBlock> block;
+    };
+
+    // Block size for ordinary batches (at most a quarter of the partition
+    // bound); larger ones get a block of their own.
+    static constexpr size_t BLOCK_BYTES = 1024 * 1024;
+
+    // The block appended to, if it is still cached and has room for size
+    // more bytes.
+    std::shared_ptr<CacheBlock> tailBlock(size_t size) const;
+    // Drops the oldest blocks while over the partition's bound, and those
+    // the TailCache evicted from the front.
+    void trim();
+
+    TailCache &cache;
+    std::deque<Slot> blocks;
+    // Whether the next batch may go into the last block. Not after a batch
+    // that could not be cached: a block never spans an offset gap.
+    bool tail_open = false;
+    // Capacity of the blocks in the deque.
+    uint64_t bytes = 0;
+};
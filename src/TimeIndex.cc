@@ -0,0 +1,61 @@
+#include "TimeIndex.h"
+
+#include "WireCodec.h"
+
+TimeIndex::TimeIndex(std::string _path, int64_t _base_offset, size_t max_size)
+    : base_offset(_base_offset), file(std::move(_path), ENTRY_SIZE, max_size) {
+}
+
+TimeIndex::Entry TimeIndex::entryAt(size_t slot) const {
+    const std::byte *entry = file.entry(slot);
+    return {wire::load<int64_t>(entry),
+            base_offset + wire::load<int32_t>(entry + sizeof(int64_t))};
+}
+
+TimeIndex::Entry TimeIndex::lookup(int64_t target) const {
+    size_t count = entries();
+    if (count == 0 || entryAt(0).timestamp >= target) {
+        return {-1, base_offset};
+    }
+
+    // Last slot whose timestamp is < target.
+    size_t low = 0;
+    size_t high = count - 1;
+    while (low < high) {
+        size_t mid = low + (high - low + 1) / 2;
+        if (entryAt(mid).timestamp < target) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return entryAt(low);
+}
+
+TimeIndex::Entry TimeIndex::lastEntry() const {
+    size_t count = entries();
+    if (count == 0) {
+        return {-1, base_offset};
+    }
+    return entryAt(count - 1);
+}
+
+void TimeIndex::maybeAppend(int64_t timestamp, int64_t offset) {
+    if (timestamp <= lastEntry().timestamp || file.isFull()) {
+        return;
+    }
+
+    std::byte entry[ENTRY_SIZE];
+    wire::store(entry, timestamp);
+    wire::store(entry + sizeof(int64_t),
+                static_cast<int32_t>(offset - base_offset));
+    file.append(entry);
+}
+
+void TimeIndex::truncateTo(int64_t offset) {
+    size_t keep = entries();
+    while (keep > 0 && entryAt(keep - 1).offset >= offset) {
+        --keep;
+    }
+    file.truncateToEntries(keep);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "IndexFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Sparse timestamp -> offset index of one log segment, in Kafka's .timeindex
+// format: 12-byte entries holding a big-endian int64 timestamp and the int32
+// offset relative to the segment base. An entry (t, o) says that t is the
+// largest timestamp in the segment up to and including offset o, so
+// timestamps increase strictly from one entry to the next and a lookup is
+// a binary search over the mapping.
+class TimeIndex {
+  public:
+    static constexpr size_t ENTRY_SIZE = 12;
+
+    struct Entry {
+        int64_t timestamp;
+        int64_t offset;
+    };
+
+    // Maps the index at path; max_size bounds how large it may grow.
+    TimeIndex(std::string _path, int64_t _base_offset, size_t max_size);
+
+    // Last entry whose timestamp is < target, or {-1, base_offset} when
+    // there is none. Every record up to its offset is older than target.
+    Entry lookup(int64_t target) const;
+    // Appends unless timestamp is not past the last entry's.
+    void maybeAppend(int64_t timestamp, int64_t offset);
+
+    // Full one entry early: the last slot is kept for the entry a segment
+    // adds when it is rolled, which makes its largest timestamp the index's.
+    bool isFull() const { return entries() + 1 >= file.maxEntries(); }
+    size_t entries() const { return file.entries(); }
+    Entry lastEntry() const;
+    const std::string &path() const { return file.path(); }
+
+    // Drops every entry at or beyond offset (log truncation).
+    void truncateTo(int64_t offset);
+    void reset() { truncateTo(base_offset); }
+    void flush() const { file.flush(); }
+    void trimToValidSize() { file.trimToValidSize(); }
+
+  private:
+    Entry entryAt(size_t slot) const;
+
+    int64_t base_offset;
+    IndexFile file;
+};
@@ -0,0 +1,131 @@
+#include "TimingWheel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <utility>
+
+void TimerTask::cancel() {
+    if (list != nullptr) {
+        list->remove(*this);
+    }
+}
+
+void TimerTaskList::add(const std::shared_ptr<TimerTask> &task) {
+    task->cancel();
+    tasks.push_back(task);
+    task->list = this;
+    task->position = std::prev(tasks.end());
+}
+
+void TimerTaskList::remove(TimerTask &task) {
+    if (task.list != this) {
+        return;
+    }
+    task.list = nullptr;
+    // Last use of the iterator: this may drop the final reference to task.
+    tasks.erase(task.position);
+}
+
+void TimerTaskList::flush(
+    const std::function<void(std::shared_ptr<TimerTask>)> &func) {
+    auto detached = std::move(tasks);
+    tasks.clear();
+    expiration = -1;
+
+    for (auto &task : detached) {
+        task->list = nullptr;
+    }
+    for (auto &task : detached) {
+        func(std::move(task));
+    }
+}
+
+bool TimerTaskList::setExpiration(int64_t expiration_ms) {
+    return std::exchange(expiration, expiration_ms) != expiration_ms;
+}
+
+TimingWheel::TimingWheel(int64_t _tick_ms, int _wheel_size, int64_t start_ms,
+                         BucketQueue &_queue)
+    : tick_ms(_tick_ms), wheel_size(_wheel_size),
+      interval(_tick_ms * _wheel_size),
+      current_time(start_ms - start_ms % _tick_ms), queue(_queue),
+      buckets(_wheel_size) {}
+
+bool TimingWheel::add(const std::shared_ptr<TimerTask> &task) {
+    int64_t deadline = task->deadline_ms;
+
+    if (deadline < current_time + tick_ms) {
+        return false;
+    }
+
+    if (deadline < current_time + interval) {
+        int64_t virtual_id = deadline / tick_ms;
+        TimerTaskList &bucket = buckets[virtual_id % wheel_size];
+        bucket.add(task);
+
+        // A slot is queued once per round; later tasks in the same round
+        // ride along.
+        if (bucket.setExpiration(virtual_id * tick_ms)) {
+            queue.emplace(bucket.expiration, &bucket);
+        }
+        return true;
+    }
+
+    if (!overflow_wheel) {
+        overflow_wheel = std::make_unique<TimingWheel>(interval, wheel_size,
+                                                       current_time, queue);
+    }
+    return overflow_wheel->add(task);
+}
+
+void TimingWheel::advanceClock(int64_t time_ms) {
+    if (time_ms < current_time + tick_ms) {
+        return;
+    }
+    current_time = time_ms - time_ms % tick_ms;
+    if (overflow_wheel) {
+        overflow_wheel->advanceClock(current_time);
+    }
+}
+
+Timer::Timer() : wheel(TICK_MS, WHEEL_SIZE, now(), queue) {}
+
+int64_t Timer::now() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void Timer::add(const std::shared_ptr<TimerTask> &task) {
+    if (!wheel.add(task)) {
+        task->run();
+    }
+}
+
+void Timer::advanceClock(int64_t now_ms) {
+    while (!queue.empty() && queue.top().first <= now_ms) {
+        auto [expiration, bucket] = queue.top();
+        queue.pop();
+        if (bucket->expiration != expiration) {
+            continue;
+        }
+
+        // Tasks from higher levels move down to finer wheels; the ones that
+        // are due run.
+        wheel.advanceClock(expiration);
+        bucket->flush([this](std::shared_ptr<TimerTask> task) { add(task); });
+    }
+}
+
+int Timer::pollTimeout(int64_t now_ms) {
+    while (!queue.empty() &&
+           queue.top().second->expiration != queue.top().first) {
+        queue.pop();
+    }
+    if (queue.empty()) {
+        return -1;
+    }
+    return static_cast<int>(
+        std::clamp<int64_t>(queue.top().first - now_ms, 0, INT32_MAX));
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <queue>
+#include <vector>
+
+// Hierarchical timing wheels in the style of Kafka's SystemTimer: O(1) to
+// add or cancel a task, and the owner only has to wake up when a bucket
+// expires, not on every tick. All methods must be called from one thread
+// (the event loop).
+
+struct TimerTaskList;
+
+struct TimerTask {
+    explicit TimerTask(int64_t _deadline_ms) : deadline_ms(_deadline_ms) {}
+    virtual ~TimerTask() = default;
+
+    virtual void run() = 0;
+    // Takes the task off the wheel; a no-op if it already ran.
+    void cancel();
+
+    const int64_t deadline_ms;
+
+  private:
+    friend struct TimerTaskList;
+
+    TimerTaskList *list = nullptr;
+    std::list<std::shared_ptr<TimerTask>>::iterator position;
+};
+
+// The tasks of one wheel slot. expiration is the start of the time range the
+// slot currently covers, or -1 while it is empty.
+struct TimerTaskList {
+    void add(const std::shared_ptr<TimerTask> &task);
+    void remove(TimerTask &task);
+    // Detaches every task and hands it to func.
+    void flush(const std::function<void(std::shared_ptr<TimerTask>)> &func);
+    // Returns true if the expiration changed, i.e. the slot has to be queued.
+    bool setExpiration(int64_t expiration_ms);
+
+    int64_t expiration = -1;
+    std::list<std::shared_ptr<TimerTask>> tasks;
+};
+
+// Slots ordered by expiration; stale entries (slots flushed or reused since
+// they were queued) are skipped when they come up.
+using BucketQueue =
+    std::priority_queue<std::pair<int64_t, TimerTaskList *>,
+                        std::vector<std::pair<int64_t, TimerTaskList *>>,
+                        std::greater<>>;
+
+class TimingWheel {
+  public:
+    TimingWheel(int64_t _tick_ms, int _wheel_size, int64_t start_ms,
+                BucketQueue &_queue);
+
+    // False if the task is already due and should run right away.
+    bool add(const std::shared_ptr<TimerTask> &task);
+    void advanceClock(int64_t time_ms);
+
+  private:
+    int64_t tick_ms;
+    int wheel_size;
+    int64_t interval;
+    int64_t current_time;
+    BucketQueue &queue;
+    std::vector<TimerTaskList> buckets;
+    // Next level with tick = interval, created on first use.
+    std::unique_ptr<TimingWheel> overflow_wheel;
+};
+
+class Timer {
+  public:
+    static constexpr int64_t TICK_MS = 1;
+    static constexpr int WHEEL_SIZE = 20;
+
+    Timer();
+
+    static int64_t now();
+
+    // Runs the task at its deadline, or right away if that has passed.
+    void add(const std::shared_ptr<TimerTask> &task);
+    // Runs every task whose slot has expired by now_ms.
+    void advanceClock(int64_t now_ms);
+    // Milliseconds until the earliest non-empty slot expires, -1 if there is
+    // none: the epoll_wait timeout of the event loop.
+    int pollTimeout(int64_t now_ms);
+
+  private:
+    BucketQueue queue;
+    TimingWheel wheel;
+};
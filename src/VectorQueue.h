@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// FIFO over a vector that keeps its capacity. std::deque frees a node once
+// it has been popped past and allocates a new one as the back crosses into
+// the next, so a queue that only ever holds a few entries still allocates
+// every few hundred bytes pushed. This one rewinds to the front whenever it
+// runs empty, and compacts when it would otherwise have to grow.
+template <typename T> class VectorQueue {
+  public:
+    bool empty() const { return head == items.size(); }
+    size_t size() const { return items.size() - head; }
+
+    T &front() { return items[head]; }
+    const T &front() const { return items[head]; }
+    T &operator[](size_t index) { return items[head + index]; }
+    T &back() { return items.back(); }
+
+    auto begin() { return items.begin() + head; }
+    auto end() { return items.end(); }
+
+    template <typename... Args> T &emplace_back(Args &&...args) {
+        if (head > 0 && items.size() == items.capacity()) {
+            items.erase(items.begin(), items.begin() + head);
+            head = 0;
+        }
+        return items.emplace_back(std::forward<Args>(args)...);
+    }
+    void push_back(T item) { emplace_back(std::move(item)); }
+
+    void pop_front() {
+        // Drop what the entry holds now rather than at the next rewind.
+        items[head] = T();
+        if (++head == items.size()) {
+            clear();
+        }
+    }
+
+    void clear() {
+        items.clear();
+        head = 0;
+    }
+
+  private:
+    std::vector<T> items;
+    size_t head = 0;
+};
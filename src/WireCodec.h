@@ -0,0 +1,439 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Primitive encoders/decoders for the Kafka wire protocol.
+//
+// WireReader walks a frame in place: strings and byte fields come back as
+// views into the frame, so decoding never copies or allocates. Every read is
+// bounds-checked and throws WireError on malformed input.
+//
+// WireWriter appends to a std::string and knows how to back-patch the 4-byte
+// size prefix of a frame once the body has been written.
+
+struct WireError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+struct Uuid {
+    std::array<uint8_t, 16> bytes{};
+
+    bool isZero() const { return *this == Uuid{}; }
+    auto operator<=>(const Uuid &) const = default;
+
+    // Canonical 8-4-4-4-12 hex form, as printed by Kafka's admin tools.
+    std::string toString() const {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string result;
+        result.reserve(36);
+        for (size_t i = 0; i < bytes.size(); ++i) {
+            if (i == 4 || i == 6 || i == 8 || i == 10) {
+                result.push_back('-');
+            }
+            result.push_back(digits[bytes[i] >> 4]);
+            result.push_back(digits[bytes[i] & 0x0f]);
+        }
+        return result;
+    }
+};
+
+struct UuidHash {
+    size_t operator()(const Uuid &uuid) const noexcept {
+        uint64_t high, low;
+        std::memcpy(&high, uuid.bytes.data(), sizeof(high));
+        std::memcpy(&low, uuid.bytes.data() + sizeof(high), sizeof(low));
+        return high ^ (low * 0x9e3779b97f4a7c15ULL);
+    }
+};
+
+using NullableString = std::optional<std::string_view>;
+using NullableBytes = std::optional<std::span<const std::byte>>;
+
+namespace wire {
+
+template <typename T> inline T fromBigEndian(T value) {
+    if constexpr (std::endian::native == std::endian::little &&
+                  sizeof(T) > 1) {
+        return std::byteswap(value);
+    } else {
+        return value;
+    }
+}
+
+template <typename T> inline T load(const std::byte *data) {
+    T value;
+    std::memcpy(&value, data, sizeof(T));
+    return fromBigEndian(value);
+}
+
+template <typename T> inline void store(std::byte *data, T value) {
+    value = fromBigEndian(value);
+    std::memcpy(data, &value, sizeof(T));
+}
+
+template <typename T> inline void store(char *data, T value) {
+    store(reinterpret_cast<std::byte *>(data), value);
+}
+
+// Length of the unsigned varint encoding of value.
+constexpr size_t unsignedVarintSize(uint64_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++size;
+    }
+    return size;
+}
+
+constexpr uint32_t zigzagEncode(int32_t value) {
+    return (static_cast<uint32_t>(value) << 1) ^
+           static_cast<uint32_t>(value >> 31);
+}
+
+constexpr uint64_t zigzagEncode(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^
+           static_cast<uint64_t>(value >> 63);
+}
+
+constexpr int64_t zigzagDecode(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+} // namespace wire
+
+class WireReader {
+  public:
+    explicit WireReader(std::span<const std::byte> buffer)
+        : begin(buffer.data()), cur(buffer.data()),
+          end(buffer.data() + buffer.size()) {}
+    WireReader(const char *data, size_t size)
+        : WireReader(std::as_bytes(std::span(data, size))) {}
+
+    size_t position() const { return cur - begin; }
+    size_t remaining() const { return end - cur; }
+    bool empty() const { return cur == end; }
+    std::span<const std::byte> rest() const { return {cur, end}; }
+
+    int8_t readInt8() { return static_cast<int8_t>(readFixed<uint8_t>()); }
+    int16_t readInt16() { return static_cast<int16_t>(readFixed<uint16_t>()); }
+    int32_t readInt32() { return static_cast<int32_t>(readFixed<uint32_t>()); }
+    int64_t readInt64() { return static_cast<int64_t>(readFixed<uint64_t>()); }
+    uint32_t readUint32() { return readFixed<uint32_t>(); }
+    bool readBool() { return readFixed<uint8_t>() != 0; }
+
+    Uuid readUuid() {
+        require(sizeof(Uuid::bytes));
+        Uuid uuid;
+        std::memcpy(uuid.bytes.data(), cur, uuid.bytes.size());
+        cur += uuid.bytes.size();
+        return uuid;
+    }
+
+    uint64_t readUnsignedVarlong() {
+        // Fast path for varints of up to 8 bytes (56 bits) when 8 bytes can
+        // be loaded: one mask finds the terminating byte, three shift/mask
+        // steps squeeze out the continuation bits, no per-byte branches.
+        if constexpr (std::endian::native == std::endian::little) {
+            if (remaining() >= sizeof(uint64_t)) {
+                uint64_t word;
+                std::memcpy(&word, cur, sizeof(word));
+                uint64_t stops = ~word & 0x8080808080808080ULL;
+                if (stops != 0) {
+                    // Keeps the bytes up to and including the first stop.
+                    uint64_t value =
+                        word & (stops ^ (stops - 1)) & 0x7f7f7f7f7f7f7f7fULL;
+                    value = ((value & 0x7f007f007f007f00ULL) >> 1) |
+                            (value & 0x007f007f007f007fULL);
+                    value = ((value & 0x3fff00003fff0000ULL) >> 2) |
+                            (value & 0x00003fff00003fffULL);
+                    value = ((value & 0x0fffffff00000000ULL) >> 4) |
+                            (value & 0x000000000fffffffULL);
+                    cur += (std::countr_zero(stops) >> 3) + 1;
+                    return value;
+                }
+            }
+        }
+
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            require(1);
+            uint8_t byte = static_cast<uint8_t>(*cur++);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw WireError("Varint is too long");
+    }
+
+    uint32_t readUnsignedVarint() {
+        uint64_t value = readUnsignedVarlong();
+        if (value > UINT32_MAX) {
+            throw WireError("Unsigned varint does not fit in 32 bits");
+        }
+        return static_cast<uint32_t>(value);
+    }
+
+    int32_t readVarint() {
+        int64_t value = wire::zigzagDecode(readUnsignedVarlong());
+        if (value < INT32_MIN || value > INT32_MAX) {
+            throw WireError("Varint does not fit in 32 bits");
+        }
+        return static_cast<int32_t>(value);
+    }
+
+    int64_t readVarlong() { return wire::zigzagDecode(readUnsignedVarlong()); }
+
+    std::span<const std::byte> readBytes(size_t size) {
+        require(size);
+        std::span<const std::byte> bytes(cur, size);
+        cur += size;
+        return bytes;
+    }
+
+    void skip(size_t size) { readBytes(size); }
+
+    std::string_view readString() {
+        NullableString value = readNullableString();
+        if (!value) {
+            throw WireError("Unexpected null string");
+        }
+        return *value;
+    }
+
+    NullableString readNullableString() {
+        int16_t length = readInt16();
+        if (length < 0) {
+            return std::nullopt;
+        }
+        return asString(readBytes(length));
+    }
+
+    std::string_view readCompactString() {
+        NullableString value = readCompactNullableString();
+        if (!value) {
+            throw WireError("Unexpected null compact string");
+        }
+        return *value;
+    }
+
+    NullableString readCompactNullableString() {
+        uint32_t length = readUnsignedVarint();
+        if (length == 0) {
+            return std::nullopt;
+        }
+        return asString(readBytes(length - 1));
+    }
+
+    NullableBytes readNullableBytes() {
+        int32_t length = readInt32();
+        if (length < 0) {
+            return std::nullopt;
+        }
+        return readBytes(length);
+    }
+
+    NullableBytes readCompactNullableBytes() {
+        uint32_t length = readUnsignedVarint();
+        if (length == 0) {
+            return std::nullopt;
+        }
+        return readBytes(length - 1);
+    }
+
+    // Array lengths come back as -1 for null arrays.
+    int32_t readArrayLength() {
+        int32_t length = readInt32();
+        if (length < -1) {
+            throw WireError("Negative array length");
+        }
+        checkArrayLength(length);
+        return length;
+    }
+
+    int32_t readCompactArrayLength() {
+        uint32_t length = readUnsignedVarint();
+        if (length > static_cast<uint32_t>(INT32_MAX)) {
+            throw WireError("Compact array length out of range");
+        }
+        int32_t count = static_cast<int32_t>(length) - 1;
+        checkArrayLength(count);
+        return count;
+    }
+
+    // Either flavour depending on whether the message version is flexible.
+    int32_t readArrayLength(bool flexible) {
+        return flexible ? readCompactArrayLength() : readArrayLength();
+    }
+    std::string_view readString(bool flexible) {
+        return flexible ? readCompactString() : readString();
+    }
+    NullableString readNullableString(bool flexible) {
+        return flexible ? readCompactNullableString() : readNullableString();
+    }
+    NullableBytes readNullableBytes(bool flexible) {
+        return flexible ? readCompactNullableBytes() : readNullableBytes();
+    }
+
+    // Reads a tagged field section and calls on_field(tag, data) for each
+    // entry. Unknown tags are skipped by simply ignoring them.
+    template <typename F> void readTaggedFields(F &&on_field) {
+        uint32_t count = readUnsignedVarint();
+        for (uint32_t i = 0; i < count; ++i) {
+            uint32_t tag = readUnsignedVarint();
+            uint32_t size = readUnsignedVarint();
+            on_field(tag, readBytes(size));
+        }
+    }
+
+    void skipTaggedFields() {
+        readTaggedFields([](uint32_t, std::span<const std::byte>) {});
+    }
+
+  private:
+    static std::string_view asString(std::span<const std::byte> bytes) {
+        return {reinterpret_cast<const char *>(bytes.data()), bytes.size()};
+    }
+
+    void require(size_t size) const {
+        if (static_cast<size_t>(end - cur) < size) [[unlikely]] {
+            throw WireError("Buffer size is too small");
+        }
+    }
+
+    // Every element takes at least one byte, which rejects absurd lengths
+    // before a decoder tries to reserve memory for them.
+    void checkArrayLength(int32_t length) const {
+        if (length > 0 && static_cast<size_t>(length) > remaining()) {
+            throw WireError("Array length exceeds remaining bytes");
+        }
+    }
+
+    template <typename T> T readFixed() {
+        require(sizeof(T));
+        T value = wire::load<T>(cur);
+        cur += sizeof(T);
+        return value;
+    }
+
+    const std::byte *begin;
+    const std::byte *cur;
+    const std::byte *end;
+};
+
+class WireWriter {
+  public:
+    explicit WireWriter(std::string &_buffer) : buffer(_buffer) {}
+
+    size_t size() const { return buffer.size(); }
+
+    void writeInt8(int8_t value) { buffer.push_back(static_cast<char>(value)); }
+    void writeInt16(int16_t value) { writeFixed(static_cast<uint16_t>(value)); }
+    void writeInt32(int32_t value) { writeFixed(static_cast<uint32_t>(value)); }
+    void writeInt64(int64_t value) { writeFixed(static_cast<uint64_t>(value)); }
+    void writeUint32(uint32_t value) { writeFixed(value); }
+    void writeBool(bool value) { writeInt8(value ? 1 : 0); }
+
+    void writeUuid(const Uuid &uuid) {
+        buffer.append(reinterpret_cast<const char *>(uuid.bytes.data()),
+                      uuid.bytes.size());
+    }
+
+    void writeUnsignedVarlong(uint64_t value) {
+        while (value >= 0x80) {
+            buffer.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back(static_cast<char>(value));
+    }
+
+    void writeUnsignedVarint(uint32_t value) { writeUnsignedVarlong(value); }
+    void writeVarint(int32_t value) {
+        writeUnsignedVarlong(wire::zigzagEncode(value));
+    }
+    void writeVarlong(int64_t value) {
+        writeUnsignedVarlong(wire::zigzagEncode(value));
+    }
+
+    void writeRaw(std::string_view bytes) { buffer.append(bytes); }
+    void writeRaw(std::span<const std::byte> bytes) {
+        buffer.append(reinterpret_cast<const char *>(bytes.data()),
+                      bytes.size());
+    }
+
+    void writeString(std::string_view value) {
+        writeInt16(static_cast<int16_t>(value.size()));
+        writeRaw(value);
+    }
+
+    void writeNullableString(NullableString value) {
+        if (!value) {
+            writeInt16(-1);
+            return;
+        }
+        writeString(*value);
+    }
+
+    void writeCompactString(std::string_view value) {
+        writeUnsignedVarint(static_cast<uint32_t>(value.size()) + 1);
+        writeRaw(value);
+    }
+
+    void writeCompactNullableString(NullableString value) {
+        if (!value) {
+            writeUnsignedVarint(0);
+            return;
+        }
+        writeCompactString(*value);
+    }
+
+    void writeArrayLength(int32_t length) { writeInt32(length); }
+    void writeCompactArrayLength(int32_t length) {
+        writeUnsignedVarint(static_cast<uint32_t>(length + 1));
+    }
+
+    // Either flavour depending on whether the message version is flexible.
+    void writeArrayLength(int32_t length, bool flexible) {
+        flexible ? writeCompactArrayLength(length) : writeArrayLength(length);
+    }
+    void writeString(std::string_view value, bool flexible) {
+        flexible ? writeCompactString(value) : writeString(value);
+    }
+    void writeNullableString(NullableString value, bool flexible) {
+        flexible ? writeCompactNullableString(value)
+                 : writeNullableString(value);
+    }
+
+    void writeEmptyTaggedFields() { writeUnsignedVarint(0); }
+
+    // Reserves the 4-byte size prefix; endFrame() fills it in.
+    size_t beginFrame() {
+        size_t start = buffer.size();
+        writeInt32(0);
+        return start;
+    }
+
+    void endFrame(size_t start) {
+        uint32_t size = buffer.size() - start - sizeof(uint32_t);
+        wire::store(buffer.data() + start, size);
+    }
+
+  private:
+    template <typename T> void writeFixed(T value) {
+        char bytes[sizeof(T)];
+        wire::store(bytes, value);
+        buffer.append(bytes, sizeof(T));
+    }
+
+    std::string &buffer;
+};
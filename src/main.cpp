@@ -1,3 +1,12 @@
+#include "BrokerConfig.h"
+#include "KafkaApis.h"
+#include "LogFlusher.h"
+#include "LogManager.h"
+#include "Logger.h"
+#include "MetadataCache.h"
+#include "Metrics.h"
+#include "MetricsServer.h"
+#include "OffsetManager.h"
 #include "TCPManager.h"
 
 namespace { 
@@ -6,29 +15,77 @@ void signal_handler(int signal) { shutdown_handler(signal); }
 } // namespace
 
 int main(int argc, char *argv[]) {
-    // Disable output buffering
-    std::cout << std::unitbuf;
-    std::cerr << std::unitbuf;
+    // Anything logged before the config is read, or after main() returns,
+    // is written synchronously; the logger drains in the background in
+    // between.
+    Logger::setThreadName("main");
 
     try {
-        TCPManager tcp_manager;
+        BrokerConfig config = BrokerConfig::fromArgs(argc, argv);
+        Logger::instance().start(config.logger.level, config.logger.file);
+
+        LogManager log_manager(config);
+        log_manager.loadLogs();
+
+        MetadataCache metadata_cache;
+        if (auto metadata_log =
+                log_manager.getLog(MetadataCache::METADATA_TOPIC_PARTITION)) {
+            metadata_cache.loadFromLog(*metadata_log);
+        }
+
+        OffsetManager offset_manager(config.offsets, log_manager);
+        offset_manager.load();
+
+        TCPManager tcp_manager(config.socket_server);
         tcp_manager.createSocketAndListen();
 
-        shutdown_handler = [&tcp_manager](int signal) {
-            std::cout << "Caught signal " << signal << '\n';
+        // Metrics are diagnostics: a taken port is no reason not to serve.
+        MetricsServer metrics_server(config.metrics, [] {
+            return Metrics::instance().render(apiName);
+        });
+        if (config.metrics.port != 0) {
+            try {
+                metrics_server.start();
+            } catch (const std::exception &e) {
+                LOG_WARN(e.what() << ", metrics are not exposed");
+            }
+        }
+
+        LogFlusher log_flusher(config.flush);
+        log_flusher.start();
+        offset_manager.start();
+
+        KafkaApis kafka_apis(config, tcp_manager, log_manager, log_flusher,
+                             metadata_cache, offset_manager);
+
+        // Only async-signal-safe work in the handler; the signal is logged
+        // once the event loops have stopped.
+        std::atomic<int> caught_signal{0};
+        shutdown_handler = [&tcp_manager, &caught_signal](int signal) {
+            caught_signal = signal;
             tcp_manager.shutdown();
-            exit(0);
         };
 
         signal(SIGINT, signal_handler);
-        
-        // Run the multi-threaded server
-        tcp_manager.runServer();
-        
+        signal(SIGTERM, signal_handler);
+        // sendfile() has no MSG_NOSIGNAL: a consumer that resets its
+        // connection in the middle of a fetch must only fail that send.
+        signal(SIGPIPE, SIG_IGN);
+
+        // Run the event loop until shutdown() wakes it up
+        tcp_manager.runServer(kafka_apis);
+        LOG_INFO("Caught signal " << caught_signal << ", shutting down");
+
+        // Requests still on the handler pool finish before their logs close.
+        kafka_apis.shutdown();
+        metrics_server.shutdown();
+        offset_manager.shutdown();
+        log_flusher.shutdown();
+        log_manager.shutdown();
     } catch (const std::exception &e) {
-        std::cerr << "Error: " << e.what() << '\n';
+        LOG_ERROR("Error: " << e.what());
         return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
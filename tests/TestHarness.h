@@ -0,0 +1,153 @@
+#pragma once
+
+#include "RecordBatch.h"
+
+#include <stdlib.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <span>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// A minimal harness for the test executables ctest runs, so that they need
+// nothing beyond kafka_core. TEST(name) registers a case; CHECK() reports a
+// failed condition and carries on, REQUIRE() also ends the case. main()
+// returns runTests(), which is nonzero if anything failed.
+namespace test {
+
+// Thrown by REQUIRE() to leave the case.
+struct Abort {};
+
+struct Case {
+    const char *name;
+    void (*body)();
+};
+
+inline std::vector<Case> &cases() {
+    static std::vector<Case> all;
+    return all;
+}
+
+inline int failures = 0;
+
+struct Registrar {
+    Registrar(const char *name, void (*body)()) {
+        cases().push_back({name, body});
+    }
+};
+
+inline bool check(bool ok, const char *expression, const char *file,
+                  int line) {
+    if (!ok) {
+        std::cerr << file << ":" << line << ": CHECK(" << expression
+                  << ") failed\n";
+        ++failures;
+    }
+    return ok;
+}
+
+template <typename A, typename B>
+bool checkEqual(const A &a, const B &b, const char *expression_a,
+                const char *expression_b, const char *file, int line) {
+    if (!(a == b)) {
+        std::cerr << file << ":" << line << ": CHECK_EQ(" << expression_a
+                  << ", " << expression_b << ") failed: " << a
+                  << " != " << b << "\n";
+        ++failures;
+        return false;
+    }
+    return true;
+}
+
+inline int runTests() {
+    for (const auto &test_case : cases()) {
+        int before = failures;
+        try {
+            test_case.body();
+        } catch (const Abort &) {
+        } catch (const std::exception &e) {
+            std::cerr << test_case.name << ": unexpected exception: "
+                      << e.what() << "\n";
+            ++failures;
+        }
+        std::printf("%-52s %s\n", test_case.name,
+                    failures == before ? "ok" : "FAILED");
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// A fresh directory under the system temp dir, removed with its contents.
+class TempDir {
+  public:
+    TempDir() {
+        std::string pattern =
+            (std::filesystem::temp_directory_path() / "kafka-test.XXXXXX")
+                .string();
+        if (mkdtemp(pattern.data()) == nullptr) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to create " + pattern);
+        }
+        dir = pattern;
+    }
+    ~TempDir() {
+        std::error_code ignored;
+        std::filesystem::remove_all(dir, ignored);
+    }
+
+    TempDir(const TempDir &) = delete;
+    TempDir &operator=(const TempDir &) = delete;
+
+    const std::string &path() const { return dir; }
+
+  private:
+    std::string dir;
+};
+
+// A v2 batch of count records stamped timestamp, each with a value of
+// value_size bytes. Its base offset is 0; appends assign the real one.
+inline std::string recordBatch(int count, int64_t timestamp,
+                               size_t value_size = 16) {
+    RecordBatchBuilder builder(timestamp);
+    std::string value(value_size, 'v');
+    for (int i = 0; i < count; ++i) {
+        builder.append(std::nullopt, std::as_bytes(std::span(value)));
+    }
+    return builder.build();
+}
+
+inline std::span<const std::byte> bytesOf(const std::string &buffer) {
+    return std::as_bytes(std::span(buffer));
+}
+
+} // namespace test
+
+#define TEST(name)                                                             \
+    static void name();                                                        \
+    static test::Registrar name##_registrar(#name, name);                     \
+    static void name()
+
+#define CHECK(condition)                                                       \
+    test::check(static_cast<bool>(condition), #condition, __FILE__, __LINE__)
+#define CHECK_EQ(a, b) test::checkEqual((a), (b), #a, #b, __FILE__, __LINE__)
+#define CHECK_THROWS(expression, type)                                         \
+    do {                                                                       \
+        bool thrown = false;                                                   \
+        try {                                                                  \
+            (void)(expression);                                                \
+        } catch (const type &) {                                               \
+            thrown = true;                                                     \
+        }                                                                      \
+        CHECK(thrown && #expression " throws " #type);                         \
+    } while (0)
+#define REQUIRE(condition)                                                     \
+    do {                                                                       \
+        if (!CHECK(condition)) {                                               \
+            throw test::Abort();                                               \
+        }                                                                      \
+    } while (0)
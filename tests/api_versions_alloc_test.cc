@@ -0,0 +1,113 @@
+// The ApiVersions request path makes no heap allocations once warmed up:
+// from reading the request off the socket, through
+// KafkaApis::classifyRequest(), to writing the response back.
+
+#include "TestHarness.h"
+
+#include "KafkaApis.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+// Heap allocations made by this thread, counted by the replacements of the
+// global allocation functions below (the array and nothrow forms call them).
+thread_local uint64_t allocations = 0;
+
+void *operator new(size_t size) {
+    ++allocations;
+    if (void *block = std::malloc(size > 0 ? size : 1)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    ++allocations;
+    size_t align = static_cast<size_t>(alignment);
+    size_t rounded = (std::max<size_t>(size, 1) + align - 1) / align * align;
+    if (void *block = std::aligned_alloc(align, rounded)) {
+        return block;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *block) noexcept { std::free(block); }
+void operator delete(void *block, size_t) noexcept { std::free(block); }
+void operator delete(void *block, std::align_val_t) noexcept {
+    std::free(block);
+}
+void operator delete(void *block, size_t, std::align_val_t) noexcept {
+    std::free(block);
+}
+
+namespace {
+
+// An ApiVersions v4 request frame, size prefix included.
+std::string apiVersionsRequest() {
+    std::string frame;
+    WireWriter writer(frame);
+    writer.writeInt16(KafkaApis::API_VERSIONS_REQUEST);
+    writer.writeInt16(4);
+    writer.writeInt32(7);
+    writer.writeString("api-versions-test");
+    writer.writeEmptyTaggedFields();
+    writer.writeCompactString("api-versions-test");
+    writer.writeCompactString("1.0");
+    writer.writeEmptyTaggedFields();
+
+    std::string request(sizeof(uint32_t), '\0');
+    wire::store(request.data(), static_cast<uint32_t>(frame.size()));
+    return request + frame;
+}
+
+} // namespace
+
+TEST(api_versions_round_trip_does_not_allocate) {
+    // A broker with no reactors and an empty log dir: enough for requests
+    // that touch neither.
+    test::TempDir dir;
+    BrokerConfig config;
+    config.log_dirs = {dir.path()};
+    config.io_threads = 0;
+    TCPManager tcp_manager;
+    LogManager log_manager(config);
+    LogFlusher log_flusher(config.flush);
+    MetadataCache metadata_cache;
+    OffsetManager offset_manager(config.offsets, log_manager);
+    KafkaApis kafka_apis(config, tcp_manager, log_manager, log_flusher,
+                         metadata_cache, offset_manager);
+    BufferPool buffer_pool;
+
+    int fds[2];
+    REQUIRE(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+    Fd client(fds[1]);
+    Connection server(1, Fd(fds[0]), buffer_pool);
+
+    std::string request = apiVersionsRequest();
+    std::vector<char> response(64 * 1024);
+    // Sends the request and reads the response, one at a time, as a
+    // client waiting for each response would.
+    auto round_trip = [&] {
+        REQUIRE(send(client, request.data(), request.size(), 0) ==
+                static_cast<ssize_t>(request.size()));
+        tcp_manager.readBufferFromClientFd(server, kafka_apis);
+        tcp_manager.flushClient(server);
+        REQUIRE(recv(client, response.data(), response.size(), 0) > 0);
+    };
+
+    // Warm up metrics, pool slabs and queues.
+    for (int i = 0; i < 1000; ++i) {
+        round_trip();
+    }
+    uint64_t before = allocations;
+    for (int i = 0; i < 10000; ++i) {
+        round_trip();
+    }
+    CHECK_EQ(allocations - before, 0u);
+}
+
+int main() { return test::runTests(); }
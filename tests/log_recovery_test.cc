@@ -0,0 +1,225 @@
+// Loading log dirs after a crash: torn and corrupt tails are truncated, lost
+// or damaged indexes are rebuilt, and a clean shutdown skips all of it.
+
+#include "TestHarness.h"
+
+#include "LogManager.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+const TopicPartition TP{"t", 0};
+constexpr int BATCHES = 40;
+constexpr int RECORDS_PER_BATCH = 2;
+constexpr int64_t END_OFFSET = BATCHES * RECORDS_PER_BATCH;
+
+BrokerConfig brokerConfig(const test::TempDir &dir) {
+    BrokerConfig config;
+    config.log_dirs = {dir.path()};
+    config.recovery_threads_per_data_dir = 1;
+    config.log.segment_bytes = 4096;
+    config.log.index_interval_bytes = 256;
+    return config;
+}
+
+// Writes the test log and leaves it the way a crash would: flushed, but
+// without the clean shutdown marker. Returns the size of each batch.
+size_t writeLog(const BrokerConfig &config) {
+    LogManager log_manager(config);
+    log_manager.loadLogs();
+    auto log = log_manager.getOrCreateLog(TP);
+    std::string batch;
+    for (int i = 0; i < BATCHES; ++i) {
+        batch = test::recordBatch(RECORDS_PER_BATCH, 1000 + i, 100);
+        log->append(test::bytesOf(batch));
+    }
+    log->flush();
+    return batch.size();
+}
+
+std::string logDir(const test::TempDir &dir) {
+    return dir.path() + "/" + TP.toString();
+}
+
+// The segment files with extension, in offset order.
+std::vector<std::string> segmentFiles(const test::TempDir &dir,
+                                      const std::string &extension) {
+    std::vector<std::string> files;
+    for (const auto &entry :
+         std::filesystem::directory_iterator(logDir(dir))) {
+        if (entry.path().extension() == extension) {
+            files.push_back(entry.path().string());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+std::string readFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(file),
+            std::istreambuf_iterator<char>()};
+}
+
+void writeFile(const std::string &path, const std::string &contents) {
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << contents;
+}
+
+// Flips one byte of the record data of the last batch in the active
+// segment, leaving its framing intact.
+void corruptLastBatch(const test::TempDir &dir, size_t batch_size) {
+    std::string active = segmentFiles(dir, ".log").back();
+    std::string contents = readFile(active);
+    REQUIRE(contents.size() >= batch_size);
+    contents[contents.size() - batch_size / 2] ^= 0x5a;
+    writeFile(active, contents);
+}
+
+} // namespace
+
+TEST(recovery_truncates_a_torn_tail) {
+    test::TempDir dir;
+    BrokerConfig config = brokerConfig(dir);
+    size_t batch_size = writeLog(config);
+
+    std::string active = segmentFiles(dir, ".log").back();
+    uint64_t size = std::filesystem::file_size(active);
+    std::filesystem::resize_file(active, size - batch_size / 3);
+
+    LogManager log_manager(config);
+    log_manager.loadLogs();
+    auto log = log_manager.getLog(TP);
+    REQUIRE(log);
+    CHECK_EQ(log->logEndOffset(), END_OFFSET - RECORDS_PER_BATCH);
+    CHECK_EQ(std::filesystem::file_size(active), size - batch_size);
+    CHECK_EQ(log->maxTimestamp(), 1000 + BATCHES - 2);
+
+    std::string batch = test::recordBatch(1, 5000);
+    CHECK_EQ(log->append(test::bytesOf(batch)).base_offset,
+             END_OFFSET - RECORDS_PER_BATCH);
+}
+
+TEST(recovery_truncates_a_corrupt_tail) {
+    test::TempDir dir;
+    BrokerConfig config = brokerConfig(dir);
+    size_t batch_size = writeLog(config);
+    corruptLastBatch(dir, batch_size);
+
+    LogManager log_manager(config);
+    log_manager.loadLogs();
+    auto log = log_manager.getLog(TP);
+    REQUIRE(log);
+    CHECK_EQ(log->logEndOffset(), END_OFFSET - RECORDS_PER_BATCH);
+    CHECK(log->read(END_OFFSET - RECORDS_PER_BATCH - 1, 1));
+}
+
+TEST(recovery_rebuilds_deleted_indexes) {
+    test::TempDir dir;
+    BrokerConfig config = brokerConfig(dir);
+    writeLog(config);
+    {
+        // Close the log cleanly, so that every index is trimmed and final.
+        LogManager log_manager(config);
+        log_manager.loadLogs();
+        log_manager.shutdown();
+    }
+    std::vector<std::string> indexes = segmentFiles(dir, ".index");
+    std::vector<std::string> time_indexes = segmentFiles(dir, ".timeindex");
+    REQUIRE(indexes.size() > 1);
+    std::vector<std::string> originals;
+    for (const auto &files : {indexes, time_indexes}) {
+        for (const auto &path : files) {
+            originals.push_back(readFile(path));
+            std::filesystem::remove(path);
+        }
+    }
+
+    // Even after a clean shutdown: the marker does not vouch for files
+    // that are gone.
+    LogManager log_manager(config);
+    log_manager.loadLogs();
+    auto log = log_manager.getLog(TP);
+    REQUIRE(log);
+    CHECK_EQ(log->logEndOffset(), END_OFFSET);
+    log_manager.shutdown();
+
+    size_t i = 0;
+    for (const auto &files : {indexes, time_indexes}) {
+        for (const auto &path : files) {
+            REQUIRE(std::filesystem::exists(path));
+            CHECK(readFile(path) == originals[i++]);
+        }
+    }
+}
+
+TEST(recovery_rebuilds_corrupt_indexes) {
+    test::TempDir dir;
+    BrokerConfig config = brokerConfig(dir);
+    writeLog(config);
+
+    // The first segment is rolled, so its indexes were final; point their
+    // last entries past the end of the log.
+    std::string index = segmentFiles(dir, ".index").front();
+    std::string time_index = segmentFiles(dir, ".timeindex").front();
+    std::string original_index = readFile(index);
+    std::string original_time_index = readFile(time_index);
+    REQUIRE(original_index.size() >= OffsetIndex::ENTRY_SIZE);
+    REQUIRE(original_time_index.size() >= TimeIndex::ENTRY_SIZE);
+    std::string garbage_index = original_index;
+    std::fill(garbage_index.end() - OffsetIndex::ENTRY_SIZE,
+              garbage_index.end(), '\x7f');
+    writeFile(index, garbage_index);
+    std::string garbage_time_index = original_time_index;
+    std::fill(garbage_time_index.end() - TimeIndex::ENTRY_SIZE,
+              garbage_time_index.end(), '\x7f');
+    writeFile(time_index, garbage_time_index);
+
+    LogManager log_manager(config);
+    log_manager.loadLogs();
+    auto log = log_manager.getLog(TP);
+    REQUIRE(log);
+    CHECK_EQ(log->logEndOffset(), END_OFFSET);
+    CHECK(readFile(index) == original_index);
+    CHECK(readFile(time_index) == original_time_index);
+    for (int64_t offset = 0; offset < END_OFFSET; offset += 3) {
+        auto read = log->read(offset, 1);
+        REQUIRE(read);
+        CHECK(read->first_offset <= offset);
+    }
+    CHECK_EQ(log->offsetForTimestamp(1010)->offset, 20);
+}
+
+TEST(clean_shutdown_marker_skips_recovery) {
+    test::TempDir dir;
+    BrokerConfig config = brokerConfig(dir);
+    size_t batch_size = writeLog(config);
+    std::string marker = dir.path() + "/" + LogManager::CLEAN_SHUTDOWN_FILE;
+    {
+        LogManager log_manager(config);
+        log_manager.loadLogs();
+        log_manager.shutdown();
+    }
+    CHECK(std::filesystem::exists(marker));
+
+    // Damage recovery would notice, but the trusted path does not look at
+    // record data.
+    corruptLastBatch(dir, batch_size);
+    {
+        LogManager log_manager(config);
+        log_manager.loadLogs();
+        CHECK(!std::filesystem::exists(marker));
+        CHECK_EQ(log_manager.getLog(TP)->logEndOffset(), END_OFFSET);
+    }
+
+    // The marker is gone, so the next load recovers and drops the batch.
+    LogManager log_manager(config);
+    log_manager.loadLogs();
+    CHECK_EQ(log_manager.getLog(TP)->logEndOffset(),
+             END_OFFSET - RECORDS_PER_BATCH);
+}
+
+int main() { return test::runTests(); }
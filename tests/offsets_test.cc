@@ -0,0 +1,308 @@
+// Committed offsets: the open-addressing OffsetTable, commits that are only
+// served once flushed, the snapshot next to the offsets log, and what
+// compaction of that log may drop.
+
+#include "TestHarness.h"
+
+#include "LogManager.h"
+#include "OffsetManager.h"
+#include "OffsetTable.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+BrokerConfig brokerConfig(const test::TempDir &dir) {
+    BrokerConfig config;
+    config.log_dirs = {dir.path()};
+    config.recovery_threads_per_data_dir = 1;
+    config.offsets.segment_bytes = 1024;
+    return config;
+}
+
+// A LogManager and an OffsetManager on it, loaded from the log dir.
+struct Broker {
+    explicit Broker(const BrokerConfig &config)
+        : log_manager(config), offset_manager(config.offsets, log_manager) {
+        log_manager.loadLogs();
+        offset_manager.load();
+    }
+
+    // Snapshots the offsets and marks the log dir clean.
+    void shutdown() {
+        offset_manager.shutdown();
+        log_manager.shutdown();
+    }
+
+    LogManager log_manager;
+    OffsetManager offset_manager;
+};
+
+// Commits one offset and completes it, as handleOffsetCommit() does once
+// the flush succeeded; with flushed false, as it does when the flush policy
+// does not wait.
+CommitAppend commitOffset(OffsetManager &offset_manager,
+                          std::string_view group, int32_t partition,
+                          int64_t offset, std::string_view metadata = "",
+                          bool flushed = true) {
+    OffsetCommit commit{"t", partition, offset, -1, metadata};
+    CommitAppend append = offset_manager.commit(group, std::span(&commit, 1));
+    offset_manager.completeCommit(append.base_offset, true);
+    if (flushed) {
+        offset_manager.markFlushed(append.end_offset);
+    }
+    return append;
+}
+
+int64_t committed(const OffsetManager &offset_manager, std::string_view group,
+                  int32_t partition) {
+    auto offset = offset_manager.committedOffset(group, "t", partition);
+    return offset ? offset->offset : -1;
+}
+
+// Records in the log whose key names group.
+int countRecords(const PartitionLog &log, std::string_view group) {
+    int count = 0;
+    int64_t offset = log.logStartOffset();
+    std::vector<std::byte> buffer;
+    while (auto read = log.read(offset, 1024 * 1024)) {
+        buffer.resize(read->records.size);
+        REQUIRE(pread(*read->records.file, buffer.data(), buffer.size(),
+                      static_cast<off_t>(read->records.position)) ==
+                static_cast<ssize_t>(buffer.size()));
+        std::span<const std::byte> chunk(buffer);
+        while (chunk.size() >= RecordBatchView::HEADER_SIZE) {
+            RecordBatchView batch(chunk);
+            if (batch.sizeInBytes() > chunk.size()) {
+                break;
+            }
+            batch.forEachRecord([&](const Record &record) {
+                std::string_view key(
+                    reinterpret_cast<const char *>(record.key->data()),
+                    record.key->size());
+                count += key.find(group) != std::string_view::npos;
+            });
+            offset = batch.lastOffset() + 1;
+            chunk = chunk.subspan(batch.sizeInBytes());
+        }
+    }
+    return count;
+}
+
+std::string readFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    return {std::istreambuf_iterator<char>(file),
+            std::istreambuf_iterator<char>()};
+}
+
+void writeFile(const std::string &path, const std::string &contents) {
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << contents;
+}
+
+std::string offsetsLogDir(const test::TempDir &dir) {
+    return dir.path() + "/" + std::string(OffsetsConfig::TOPIC) + "-0";
+}
+
+// The active segment of the offsets log.
+std::string activeSegment(const test::TempDir &dir) {
+    std::string last;
+    for (const auto &entry :
+         std::filesystem::directory_iterator(offsetsLogDir(dir))) {
+        if (entry.path().extension() == ".log") {
+            last = std::max(last, entry.path().string());
+        }
+    }
+    return last;
+}
+
+} // namespace
+
+TEST(table_grows_and_keeps_every_key) {
+    OffsetTable table;
+    constexpr int KEYS = 5000;
+    for (int i = 0; i < KEYS; ++i) {
+        table.put({{static_cast<uint32_t>(i % 7), static_cast<uint32_t>(i % 3),
+                    i},
+                   -1, 10 * i, 0, i},
+                  std::to_string(i));
+    }
+
+    CHECK_EQ(table.size(), static_cast<size_t>(KEYS));
+    for (int i = 0; i < KEYS; ++i) {
+        const OffsetTable::Slot *slot = table.find(
+            {static_cast<uint32_t>(i % 7), static_cast<uint32_t>(i % 3), i});
+        REQUIRE(slot);
+        CHECK_EQ(slot->offset, 10 * i);
+        CHECK_EQ(table.metadata(*slot), std::to_string(i));
+    }
+    CHECK(!table.find({7, 0, 0}));
+
+    size_t visited = 0;
+    table.forEach([&](const OffsetTable::Slot &) { ++visited; });
+    CHECK_EQ(visited, static_cast<size_t>(KEYS));
+}
+
+TEST(table_put_keeps_the_later_log_offset) {
+    OffsetTable table;
+    OffsetTable::Key key{0, 0, 3};
+    table.put({key, -1, 100, 0, 10}, "ten");
+    // An older commit, e.g. replayed over a snapshot: ignored.
+    table.put({key, -1, 50, 0, 5}, "five");
+    CHECK_EQ(table.find(key)->offset, 100);
+    CHECK_EQ(table.metadata(*table.find(key)), "ten");
+
+    table.put({key, 4, 200, 0, 20}, "twenty");
+    CHECK_EQ(table.find(key)->offset, 200);
+    CHECK_EQ(table.find(key)->leader_epoch, 4);
+    CHECK_EQ(table.metadata(*table.find(key)), "twenty");
+    CHECK_EQ(table.size(), 1u);
+}
+
+TEST(interner_hands_out_dense_ids) {
+    StringInterner names;
+    CHECK_EQ(names.intern("a"), 0u);
+    CHECK_EQ(names.intern("b"), 1u);
+    CHECK_EQ(names.intern("a"), 0u);
+    CHECK_EQ(names.find("b"), 1u);
+    CHECK_EQ(names.find("c"), StringInterner::NOT_FOUND);
+    CHECK_EQ(names.name(1), "b");
+    CHECK_EQ(names.size(), 2u);
+}
+
+TEST(commits_are_served_once_completed) {
+    test::TempDir dir;
+    Broker broker(brokerConfig(dir));
+    OffsetManager &offsets = broker.offset_manager;
+
+    OffsetCommit commit{"t", 0, 42, -1, ""};
+    CommitAppend applied = offsets.commit("g", std::span(&commit, 1));
+    CHECK(offsets.hasPendingCommits());
+    CHECK_EQ(committed(offsets, "g", 0), -1);
+    offsets.completeCommit(applied.base_offset, true);
+    CHECK(!offsets.hasPendingCommits());
+    CHECK_EQ(committed(offsets, "g", 0), 42);
+
+    // A commit whose flush failed is dropped.
+    commit.offset = 43;
+    CommitAppend dropped = offsets.commit("g", std::span(&commit, 1));
+    offsets.completeCommit(dropped.base_offset, false);
+    CHECK(!offsets.hasPendingCommits());
+    CHECK_EQ(committed(offsets, "g", 0), 42);
+}
+
+TEST(snapshot_round_trip_and_checksum) {
+    test::TempDir dir;
+    BrokerConfig config = brokerConfig(dir);
+    {
+        Broker broker(config);
+        commitOffset(broker.offset_manager, "g", 0, 7, "AAAA");
+        commitOffset(broker.offset_manager, "g", 1, 8);
+        commitOffset(broker.offset_manager, "h", 0, 9);
+        broker.shutdown();
+    }
+    std::string snapshot =
+        offsetsLogDir(dir) + "/" + OffsetManager::SNAPSHOT_FILE;
+    REQUIRE(std::filesystem::exists(snapshot));
+
+    // Make the log disagree with the snapshot. The log dir was shut down
+    // cleanly, so loading it does not check record CRCs.
+    std::string segment = activeSegment(dir);
+    std::string contents = readFile(segment);
+    size_t metadata = contents.find("AAAA");
+    REQUIRE(metadata != std::string::npos);
+    contents.replace(metadata, 4, "BBBB");
+    writeFile(segment, contents);
+
+    {
+        Broker broker(config);
+        auto offset = broker.offset_manager.committedOffset("g", "t", 0);
+        REQUIRE(offset);
+        CHECK_EQ(offset->offset, 7);
+        // From the snapshot, not the log.
+        CHECK_EQ(offset->metadata, "AAAA");
+        CHECK_EQ(committed(broker.offset_manager, "g", 1), 8);
+        CHECK_EQ(committed(broker.offset_manager, "h", 0), 9);
+        CHECK_EQ(broker.offset_manager.groupOffsets("g").size(), 2u);
+        broker.shutdown();
+    }
+
+    // A snapshot that fails its CRC is ignored and the log replayed.
+    std::string damaged = readFile(snapshot);
+    damaged[damaged.size() / 2] ^= 0x01;
+    writeFile(snapshot, damaged);
+    Broker broker(config);
+    auto offset = broker.offset_manager.committedOffset("g", "t", 0);
+    REQUIRE(offset);
+    CHECK_EQ(offset->offset, 7);
+    CHECK_EQ(offset->metadata, "BBBB");
+    CHECK_EQ(committed(broker.offset_manager, "h", 0), 9);
+}
+
+TEST(snapshot_ahead_of_the_log_is_dropped) {
+    test::TempDir dir;
+    BrokerConfig config = brokerConfig(dir);
+    {
+        Broker broker(config);
+        commitOffset(broker.offset_manager, "g", 0, 1);
+        commitOffset(broker.offset_manager, "g", 0, 2);
+        commitOffset(broker.offset_manager, "g", 1, 5);
+        broker.shutdown();
+    }
+
+    // A crash that loses the last commit after the snapshot was taken: no
+    // clean shutdown marker, and the log cut short by one batch.
+    std::filesystem::remove(dir.path() + "/" +
+                            LogManager::CLEAN_SHUTDOWN_FILE);
+    std::string segment = activeSegment(dir);
+    std::filesystem::resize_file(segment,
+                                 std::filesystem::file_size(segment) - 1);
+
+    Broker broker(config);
+    CHECK_EQ(broker.offset_manager.log()->logEndOffset(), 2);
+    CHECK_EQ(committed(broker.offset_manager, "g", 0), 2);
+    // Only the snapshot had it.
+    CHECK_EQ(committed(broker.offset_manager, "g", 1), -1);
+}
+
+TEST(compaction_only_drops_commits_replaced_by_flushed_ones) {
+    test::TempDir dir;
+    BrokerConfig config = brokerConfig(dir);
+    Broker broker(config);
+    OffsetManager &offsets = broker.offset_manager;
+    const PartitionLog &log = *offsets.log();
+
+    // Enough commits of one key to fill a few segments.
+    for (int i = 0; i < 40; ++i) {
+        commitOffset(offsets, "flushed", 0, i);
+    }
+    // A later commit of the same key that is served but not on disk yet,
+    // and more of another group's to roll it into a compactable segment.
+    commitOffset(offsets, "flushed", 0, 1000, "", false);
+    for (int i = 0; i < 40; ++i) {
+        commitOffset(offsets, "other", 0, i, "", false);
+    }
+
+    offsets.clean();
+    // None of the key's commits go while a crash could still lose the one
+    // that replaced them.
+    CHECK_EQ(countRecords(log, "flushed"), 41);
+    CHECK_EQ(committed(offsets, "flushed", 0), 1000);
+
+    // Once flushed, it replaces the older one. More commits roll another
+    // segment for the next pass to work on.
+    offsets.markFlushed(log.logEndOffset());
+    for (int i = 0; i < 40; ++i) {
+        commitOffset(offsets, "more", 0, i);
+    }
+    offsets.clean();
+    CHECK_EQ(countRecords(log, "flushed"), 1);
+    CHECK_EQ(countRecords(log, "other"), 1);
+    CHECK_EQ(committed(offsets, "flushed", 0), 1000);
+}
+
+int main() { return test::runTests(); }
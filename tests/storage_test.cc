@@ -0,0 +1,279 @@
+// The on-disk log: segments and their indexes, offset lookups, segment
+// rolling and reopening what was written.
+
+#include "TestHarness.h"
+
+#include "LogSegment.h"
+#include "PartitionLog.h"
+
+#include <unistd.h>
+
+#include <filesystem>
+
+namespace {
+
+// Appends batches of records_per_batch records each, at consecutive
+// offsets from base_offset; batch i is stamped timestamp + i. Returns the
+// offset after the last one.
+int64_t appendBatches(LogSegment &segment, int64_t base_offset, int batches,
+                      int records_per_batch, int64_t timestamp = 1000) {
+    for (int i = 0; i < batches; ++i) {
+        std::string batch = test::recordBatch(records_per_batch, timestamp + i);
+        segment.append(base_offset, base_offset + records_per_batch - 1,
+                       test::bytesOf(batch));
+        base_offset += records_per_batch;
+    }
+    return base_offset;
+}
+
+// The base offset field of the batch at the start of region.
+int64_t baseOffsetAt(const FileRegion &region) {
+    std::byte header[RecordBatchView::HEADER_SIZE];
+    REQUIRE(pread(*region.file, header, sizeof(header),
+                  static_cast<off_t>(region.position)) ==
+            static_cast<ssize_t>(sizeof(header)));
+    return RecordBatchView(header).baseOffset();
+}
+
+size_t countFiles(const std::string &dir, const std::string &extension) {
+    size_t count = 0;
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+        count += entry.path().extension() == extension;
+    }
+    return count;
+}
+
+LogConfig smallIndexConfig() {
+    LogConfig config;
+    config.index_interval_bytes = 256;
+    return config;
+}
+
+} // namespace
+
+TEST(segment_translates_every_offset) {
+    test::TempDir dir;
+    LogSegment segment(dir.path(), 100, smallIndexConfig());
+    int64_t end = appendBatches(segment, 100, 50, 3);
+
+    CHECK_EQ(end, 250);
+    CHECK(segment.offsetIndex().entries() > 0);
+    for (int64_t offset = 100; offset < end; ++offset) {
+        auto batch = segment.translateOffset(offset);
+        REQUIRE(batch);
+        CHECK(batch->base_offset <= offset && offset <= batch->last_offset);
+        CHECK_EQ(batch->base_offset, 100 + (offset - 100) / 3 * 3);
+        auto header = segment.batchAt(batch->position);
+        REQUIRE(header);
+        CHECK_EQ(header->base_offset, batch->base_offset);
+    }
+    CHECK(!segment.translateOffset(end));
+    // Below the first offset: the first batch, which holds the next one.
+    CHECK_EQ(segment.translateOffset(0)->base_offset, 100);
+}
+
+TEST(segment_finds_offsets_by_timestamp) {
+    test::TempDir dir;
+    LogSegment segment(dir.path(), 0, smallIndexConfig());
+    appendBatches(segment, 0, 40, 2, 5000);
+
+    CHECK_EQ(segment.largestTimestamp(), 5039);
+    auto found = segment.findOffsetByTimestamp(5020);
+    REQUIRE(found);
+    CHECK_EQ(found->timestamp, 5020);
+    CHECK_EQ(found->offset, 40);
+    CHECK_EQ(segment.findOffsetByTimestamp(0)->offset, 0);
+    CHECK(!segment.findOffsetByTimestamp(5040));
+}
+
+TEST(offset_index_lookup) {
+    test::TempDir dir;
+    OffsetIndex index(dir.path() + "/0.index", 1000, 1024);
+    index.append(1010, 100);
+    index.append(1020, 200);
+    index.append(1035, 300);
+
+    CHECK_EQ(index.lookup(1005).offset, 1000);
+    CHECK_EQ(index.lookup(1005).position, 0u);
+    CHECK_EQ(index.lookup(1010).position, 100u);
+    CHECK_EQ(index.lookup(1019).position, 100u);
+    CHECK_EQ(index.lookup(1020).position, 200u);
+    CHECK_EQ(index.lookup(5000).position, 300u);
+    CHECK_THROWS(index.append(1035, 400), std::runtime_error);
+
+    index.truncateTo(1020);
+    CHECK_EQ(index.entries(), 1u);
+    CHECK_EQ(index.lastEntry().offset, 1010);
+}
+
+TEST(time_index_lookup) {
+    test::TempDir dir;
+    TimeIndex index(dir.path() + "/0.timeindex", 0, 1024);
+    index.maybeAppend(100, 5);
+    // Not past the last entry: ignored.
+    index.maybeAppend(100, 7);
+    index.maybeAppend(50, 8);
+    index.maybeAppend(200, 10);
+
+    CHECK_EQ(index.entries(), 2u);
+    CHECK_EQ(index.lookup(100).timestamp, -1);
+    CHECK_EQ(index.lookup(101).offset, 5);
+    CHECK_EQ(index.lookup(1000).offset, 10);
+    CHECK_EQ(index.lastEntry().timestamp, 200);
+}
+
+TEST(segment_reopens_from_disk) {
+    test::TempDir dir;
+    LogConfig config = smallIndexConfig();
+    int64_t end;
+    size_t index_entries;
+    {
+        LogSegment segment(dir.path(), 0, config);
+        end = appendBatches(segment, 0, 30, 4);
+        segment.flush();
+        segment.onBecomeInactive();
+        index_entries = segment.offsetIndex().entries();
+    }
+
+    LogSegment segment(dir.path(), 0, config);
+    CHECK_EQ(segment.offsetIndex().entries(), index_entries);
+    CHECK_EQ(segment.largestTimestamp(), 1029);
+    auto tail = segment.checkTail();
+    REQUIRE(tail);
+    CHECK_EQ(*tail, end);
+    for (int64_t offset = 0; offset < end; offset += 7) {
+        auto batch = segment.translateOffset(offset);
+        REQUIRE(batch);
+        CHECK_EQ(batch->base_offset, offset / 4 * 4);
+    }
+    CHECK_EQ(segment.recover(), end);
+    CHECK_EQ(segment.offsetIndex().entries(), index_entries);
+}
+
+TEST(segment_reopens_with_a_zero_timestamp) {
+    test::TempDir dir;
+    LogConfig config = smallIndexConfig();
+    {
+        // One record stamped 0: its time entry, at relative offset 0, is
+        // all zero bytes.
+        LogSegment segment(dir.path(), 0, config);
+        appendBatches(segment, 0, 1, 1, 0);
+        segment.flush();
+        segment.onBecomeInactive();
+        REQUIRE(segment.timeIndex().entries() == 1);
+    }
+
+    LogSegment segment(dir.path(), 0, config);
+    CHECK_EQ(segment.timeIndex().entries(), 1u);
+    CHECK_EQ(segment.timeIndex().lastEntry().timestamp, 0);
+    CHECK_EQ(segment.largestTimestamp(), 0);
+    auto found = segment.findOffsetByTimestamp(0);
+    REQUIRE(found);
+    CHECK_EQ(found->offset, 0);
+
+    // The same in a rolled segment of a log shut down cleanly, which is
+    // trusted as it is.
+    test::TempDir log_dir;
+    config.segment_bytes = 1;
+    {
+        PartitionLog log({"t", 0}, log_dir.path(), config);
+        for (int64_t timestamp : {0, 1}) {
+            std::string batch = test::recordBatch(1, timestamp);
+            log.append(test::bytesOf(batch));
+        }
+        log.close();
+    }
+    PartitionLog log({"t", 0}, log_dir.path(), config, true);
+    CHECK_EQ(log.logEndOffset(), 2);
+    CHECK_EQ(log.offsetForTimestamp(0)->offset, 0);
+    CHECK_EQ(log.offsetForTimestamp(1)->offset, 1);
+}
+
+TEST(log_reads_across_segments) {
+    test::TempDir dir;
+    LogConfig config;
+    config.segment_bytes = 4096;
+    PartitionLog log({"t", 0}, dir.path(), config);
+    for (int i = 0; i < 100; ++i) {
+        std::string batch = test::recordBatch(2, 1000 + i, 100);
+        auto info = log.append(test::bytesOf(batch));
+        CHECK_EQ(info.base_offset, 2 * i);
+        CHECK_EQ(info.last_offset, 2 * i + 1);
+    }
+
+    CHECK_EQ(log.logEndOffset(), 200);
+    CHECK(countFiles(dir.path(), ".log") > 1);
+    for (int64_t offset = 0; offset < 200; ++offset) {
+        auto read = log.read(offset, 1);
+        REQUIRE(read);
+        // The batch holding offset, whole, however small max_bytes is.
+        CHECK_EQ(read->first_offset, offset / 2 * 2);
+        CHECK_EQ(baseOffsetAt(read->records), offset / 2 * 2);
+        CHECK(read->records.size >= RecordBatchView::HEADER_SIZE);
+    }
+    CHECK(!log.read(200, 1024));
+    CHECK_THROWS(log.read(201, 1024), OffsetOutOfRangeError);
+    CHECK_EQ(log.offsetForTimestamp(1050)->offset, 100);
+}
+
+TEST(log_rolls_when_the_index_is_full) {
+    test::TempDir dir;
+    LogConfig config;
+    config.index_interval_bytes = 0;
+    // Four offset entries, three time entries.
+    config.max_index_size = 36;
+    PartitionLog log({"t", 0}, dir.path(), config);
+    for (int i = 0; i < 20; ++i) {
+        std::string batch = test::recordBatch(1, 1000 + i);
+        log.append(test::bytesOf(batch));
+    }
+
+    size_t segments = countFiles(dir.path(), ".log");
+    CHECK(segments > 1);
+    CHECK_EQ(countFiles(dir.path(), ".index"), segments);
+    CHECK_EQ(countFiles(dir.path(), ".timeindex"), segments);
+    for (int64_t offset = 0; offset < 20; ++offset) {
+        auto read = log.read(offset, 1);
+        REQUIRE(read);
+        CHECK_EQ(baseOffsetAt(read->records), offset);
+    }
+}
+
+TEST(log_reopens_from_disk) {
+    test::TempDir dir;
+    LogConfig config;
+    config.segment_bytes = 4096;
+    config.index_interval_bytes = 512;
+    {
+        PartitionLog log({"t", 0}, dir.path(), config);
+        for (int i = 0; i < 60; ++i) {
+            std::string batch = test::recordBatch(3, 1000 + i, 100);
+            log.append(test::bytesOf(batch));
+        }
+        log.close();
+    }
+
+    // After a clean shutdown the segments are trusted, otherwise the
+    // active one is recovered; either way the log is the same, and appends
+    // carry on where it left off.
+    int64_t end = 180;
+    for (bool clean : {true, false}) {
+        PartitionLog log({"t", 0}, dir.path(), config, clean);
+        CHECK_EQ(log.logStartOffset(), 0);
+        CHECK_EQ(log.logEndOffset(), end);
+        CHECK_EQ(log.maxTimestamp(), clean ? 1059 : 2000);
+        for (int64_t offset = 0; offset < 180; offset += 5) {
+            auto read = log.read(offset, 1);
+            REQUIRE(read);
+            CHECK_EQ(baseOffsetAt(read->records), offset / 3 * 3);
+        }
+        CHECK_EQ(log.offsetForTimestamp(1030)->offset, 90);
+
+        std::string batch = test::recordBatch(1, 2000);
+        CHECK_EQ(log.append(test::bytesOf(batch)).base_offset, end);
+        ++end;
+        log.close();
+    }
+}
+
+int main() { return test::runTests(); }
@@ -0,0 +1,220 @@
+// The tail cache: fetches of recently appended batches served from memory,
+// falling through to the segments for the rest, CLOCK eviction of blocks
+// across partitions under the broker-wide budget, and blocks that stay
+// valid for responses still holding them after eviction.
+
+#include "TestHarness.h"
+
+#include "PartitionLog.h"
+#include "TailCache.h"
+#include "WireCodec.h"
+
+#include <unistd.h>
+
+namespace {
+
+// 4 KiB blocks, four of them per partition.
+constexpr uint64_t BLOCK = 4096;
+
+TailCacheConfig cacheConfig(uint64_t max_bytes) {
+    TailCacheConfig config;
+    config.max_bytes = max_bytes;
+    config.partition_max_bytes = 4 * BLOCK;
+    return config;
+}
+
+std::string toString(std::span<const std::byte> bytes) {
+    return {reinterpret_cast<const char *>(bytes.data()), bytes.size()};
+}
+
+std::string readRegion(const FileRegion &region) {
+    std::string contents(region.size, '\0');
+    REQUIRE(pread(*region.file, contents.data(), contents.size(),
+                  static_cast<off_t>(region.position)) ==
+            static_cast<ssize_t>(contents.size()));
+    return contents;
+}
+
+// Appends a batch of one record at offset, with a value of value_size bytes
+// of fill. Returns the batch as the cache holds it.
+std::string appendBatch(PartitionTailCache &cache, int64_t offset,
+                        size_t value_size = 1000, char fill = 'v') {
+    RecordBatchBuilder builder(1000 + offset);
+    std::string value(value_size, fill);
+    builder.append(std::nullopt, test::bytesOf(value));
+    std::string batch = builder.build();
+    cache.append(offset, offset, test::bytesOf(batch));
+    wire::store(batch.data(), offset);
+    return batch;
+}
+
+} // namespace
+
+TEST(log_serves_its_tail_from_the_cache) {
+    test::TempDir dir;
+    TailCache cache(cacheConfig(1024 * 1024));
+    LogConfig config;
+    config.segment_bytes = 8192;
+    PartitionLog log({"t", 0}, dir.path(), config, false, &cache);
+    constexpr int64_t BATCHES = 60;
+    int64_t per_block = 0;
+    for (int64_t i = 0; i < BATCHES; ++i) {
+        std::string batch = test::recordBatch(1, 1000 + i, 500);
+        log.append(test::bytesOf(batch));
+        per_block = BLOCK / batch.size();
+    }
+
+    // The cached offsets are the most recent ones, up to the partition's
+    // bound, and hold the same bytes as the segments.
+    int64_t first_cached = BATCHES;
+    for (int64_t offset = BATCHES - 1; offset >= 0; --offset) {
+        auto cached = log.readFromCache(offset, 1);
+        if (!cached) {
+            break;
+        }
+        first_cached = offset;
+        CHECK_EQ(cached->first_offset, offset);
+        auto read = log.read(offset, 1);
+        REQUIRE(read);
+        CHECK(toString(cached->records.bytes) == readRegion(read->records));
+    }
+    // Three full blocks and the one being filled.
+    CHECK(BATCHES - first_cached > 3 * per_block);
+    CHECK(BATCHES - first_cached <= 4 * per_block);
+    CHECK(cache.bytesUsed() <= 4 * BLOCK);
+
+    // Anything older falls through to the segments.
+    for (int64_t offset = 0; offset < first_cached; ++offset) {
+        CHECK(!log.readFromCache(offset, 1));
+        auto read = log.read(offset, 1);
+        REQUIRE(read);
+        CHECK_EQ(read->first_offset, offset);
+    }
+    CHECK(!log.readFromCache(BATCHES, 1));
+
+    // A larger max_bytes gets the rest of the block.
+    auto rest = log.readFromCache(BATCHES - 2, 1024 * 1024);
+    REQUIRE(rest);
+    auto read = log.read(BATCHES - 2, 1024 * 1024);
+    REQUIRE(read);
+    CHECK(toString(rest->records.bytes) == readRegion(read->records));
+
+    test::TempDir uncached_dir;
+    PartitionLog uncached({"t", 1}, uncached_dir.path(), config);
+    std::string batch = test::recordBatch(1, 1000);
+    uncached.append(test::bytesOf(batch));
+    CHECK(!uncached.readFromCache(0, 1));
+}
+
+TEST(batches_fill_a_block_before_taking_another) {
+    TailCache cache(cacheConfig(1024 * 1024));
+    PartitionTailCache partition(cache);
+
+    std::string first = appendBatch(partition, 0);
+    std::string second = appendBatch(partition, 1);
+    CHECK_EQ(cache.bytesUsed(), BLOCK);
+    auto both = partition.read(0, 1024 * 1024);
+    REQUIRE(both);
+    CHECK(toString(both->records.bytes) == first + second);
+
+    // Over the partition's bound: not cached, and the next batch does not
+    // go into the same block, which would hide the gap.
+    appendBatch(partition, 2, 5 * BLOCK);
+    appendBatch(partition, 3);
+    CHECK(!partition.read(2, 1));
+    CHECK_EQ(cache.bytesUsed(), 2 * BLOCK);
+    CHECK_EQ(partition.read(1, 1024 * 1024)->records.bytes.size(),
+             second.size());
+    CHECK_EQ(partition.read(3, 1)->first_offset, 3);
+
+    // The partition's own oldest block makes room for its new ones.
+    for (int64_t offset = 4; offset < 40; ++offset) {
+        appendBatch(partition, offset);
+    }
+    CHECK(cache.bytesUsed() <= 4 * BLOCK);
+    CHECK(!partition.read(0, 1));
+    CHECK(partition.read(39, 1));
+
+    partition.clear();
+    CHECK_EQ(cache.bytesUsed(), 0u);
+    CHECK(!partition.read(39, 1));
+}
+
+TEST(clock_evicts_across_partitions_under_the_budget) {
+    // Room for three blocks between both partitions.
+    TailCache cache(cacheConfig(3 * BLOCK));
+    PartitionTailCache a(cache);
+    PartitionTailCache b(cache);
+
+    // Full blocks of three batches: a's at offsets 0 and 10 (an uncached
+    // batch in between starts the second), then b's at 0.
+    for (int64_t offset = 0; offset < 3; ++offset) {
+        appendBatch(a, offset);
+    }
+    appendBatch(a, 9, 5 * BLOCK);
+    for (int64_t offset = 10; offset < 13; ++offset) {
+        appendBatch(a, offset);
+    }
+    for (int64_t offset = 0; offset < 3; ++offset) {
+        appendBatch(b, offset);
+    }
+    CHECK_EQ(cache.bytesUsed(), 3 * BLOCK);
+
+    // Every block is new, so the hand clears them all and takes the first.
+    // (Reads mark blocks, so only the evicted one is looked at.)
+    appendBatch(b, 3);
+    CHECK_EQ(cache.bytesUsed(), 3 * BLOCK);
+    CHECK(!a.read(0, 1));
+    CHECK(b.read(3, 1));
+
+    // a's second block was read since, b's first was not: that one goes
+    // next, even though it is b that needs the room.
+    CHECK(a.read(11, 1));
+    appendBatch(b, 4, 5 * BLOCK);
+    appendBatch(b, 5);
+    CHECK_EQ(cache.bytesUsed(), 3 * BLOCK);
+    CHECK(a.read(10, 1));
+    CHECK(!b.read(0, 1));
+    CHECK(b.read(3, 1));
+    CHECK(b.read(5, 1));
+
+    // Appends to a partition whose blocks were evicted start over.
+    appendBatch(a, 13, 5 * BLOCK);
+    appendBatch(a, 20);
+    CHECK(a.read(20, 1));
+    CHECK(cache.bytesUsed() <= 3 * BLOCK);
+}
+
+TEST(evicted_block_stays_valid_while_held) {
+    // Room for one block.
+    TailCache cache(cacheConfig(BLOCK));
+    PartitionTailCache a(cache);
+    PartitionTailCache b(cache);
+
+    std::string batch = appendBatch(a, 7, 1000, 'a');
+    std::optional<CachedReadInfo> held = a.read(7, 1);
+    REQUIRE(held);
+    CHECK(toString(held->records.bytes) == batch);
+
+    // b takes the only block's memory while a response still queues a's.
+    for (int64_t offset = 0; offset < 3; ++offset) {
+        appendBatch(b, offset, 1000, 'b');
+    }
+    CHECK_EQ(cache.bytesUsed(), BLOCK);
+    CHECK(b.read(2, 1));
+    CHECK(toString(held->records.bytes) == batch);
+
+    // Once the response is sent, the block goes.
+    std::weak_ptr<const void> owner = held->records.owner;
+    held.reset();
+    CHECK(owner.expired());
+    CHECK(!a.read(7, 1));
+
+    // a caches again from its next append, at b's expense.
+    appendBatch(a, 8);
+    CHECK(a.read(8, 1));
+    CHECK(!b.read(0, 1));
+    CHECK_EQ(cache.bytesUsed(), BLOCK);
+}
+
+int main() { return test::runTests(); }